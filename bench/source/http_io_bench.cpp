@@ -0,0 +1,343 @@
+#include <fmt/core.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "toyws/buffer_chain.hpp"
+#include "toyws/http_headers_map.hpp"
+#include "toyws/http_response.hpp"
+#include "toyws/request_reader.hpp"
+#include "toyws/response_writer.hpp"
+
+/*
+ * Microbenchmarks of RequestReader & HttpResponse::Write over a corpus of
+ * realistic messages. Reports ns/op and heap allocations/op as JSON, so runs
+ * can be diffed/compared by scripts.
+ */
+
+// ---- Allocation counting ----
+
+namespace {
+std::atomic<std::uint64_t> allocations = 0;
+}  // namespace
+
+auto operator new(std::size_t size) -> void* {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+auto operator delete(void* ptr) noexcept -> void { std::free(ptr); }
+
+auto operator delete(void* ptr, std::size_t /*size*/) noexcept -> void {
+  std::free(ptr);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+inline constexpr auto kMinRunTime = std::chrono::milliseconds{300};
+
+// ---- Corpus ----
+
+// Same as the getRequest fixture in test/source/http_io_test.cpp
+const std::string kBrowserGet =
+    "GET / HTTP/1.1\r\n"
+    "Host: 127.0.0.1:5000\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:120.0) "
+    "Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: "
+    "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/"
+    "webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,sv;q=0.7,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-User: ?1\r\n\r\n";
+
+const std::string kFormPost =
+    "POST /some/form HTTP/1.1\r\n"
+    "Host: 127.0.0.1:5000\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:120.0) "
+    "Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: text/html,application/xhtml+xml\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 25\r\n"
+    "Origin: null\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "fname=Smith&lname=Johnson";
+
+auto MakeLargeHeaderRequest() -> std::string {
+  std::string out =
+      "GET /api/v1/dashboard?range=7d&tz=Europe%2FStockholm HTTP/1.1\r\n"
+      "Host: app.example.com\r\n"
+      "Accept: application/json\r\n"
+      "Authorization: Bearer ";
+  out.append(512, 'a');
+  out += "\r\nCookie: ";
+  for (int i = 0; i < 24; ++i) {
+    out += fmt::format("c{}={}; ", i, std::string(40, 'x'));
+  }
+  out += "\r\n";
+  for (int i = 0; i < 16; ++i) {
+    out += fmt::format("X-Custom-Header-{}: value-{}\r\n", i, i);
+  }
+  out += "\r\n";
+  return out;
+}
+
+// count requests back to back, as a client pipelining them sends them
+auto MakePipelinedBatch(int count) -> std::string {
+  std::string out;
+  for (int i = 0; i < count; ++i) {
+    out.append(fmt::format(
+        "GET /static/asset-{}.js HTTP/1.1\r\n"
+        "Host: 127.0.0.1:5000\r\n"
+        "Accept: */*\r\n"
+        "Connection: keep-alive\r\n\r\n",
+        i));
+  }
+  return out;
+}
+
+auto MakeResponse(std::size_t bodySize) -> toyws::HttpResponse {
+  toyws::HeadersMap headers{{"Server", "ToyWS"},
+                            {"Content-Type", "text/html; charset=utf-8"},
+                            {"Cache-Control", "no-cache"},
+                            {"Connection", "keep-alive"}};
+  return toyws::HttpResponse{toyws::HttpStatus::kOk, std::move(headers),
+                             std::string(bodySize, 'b')};
+}
+
+// ---- Runner ----
+
+struct Result {
+  std::string name;
+  std::size_t bytes;     // Input/output bytes per op
+  std::size_t messages;  // Messages per op
+  std::uint64_t iterations;
+  double nsPerOp;
+  double allocationsPerOp;
+};
+
+/**
+ * @brief Run op repeatedly for at least kMinRunTime, after a short warmup.
+ */
+auto Measure(const std::string& name, std::size_t bytes, std::size_t messages,
+             const std::function<void()>& op) -> Result {
+  for (int i = 0; i < 100; ++i) {
+    op();
+  }
+
+  std::uint64_t iterations = 0;
+  std::uint64_t batch = 64;
+  const auto allocationsBefore = allocations.load();
+  const auto start = Clock::now();
+  auto elapsed = Clock::duration::zero();
+  while (elapsed < kMinRunTime) {
+    for (std::uint64_t i = 0; i < batch; ++i) {
+      op();
+    }
+    iterations += batch;
+    batch *= 2;
+    elapsed = Clock::now() - start;
+  }
+  const auto allocationsAfter = allocations.load();
+
+  const auto ns = static_cast<double>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  return Result{
+      .name = name,
+      .bytes = bytes,
+      .messages = messages,
+      .iterations = iterations,
+      .nsPerOp = ns / static_cast<double>(iterations),
+      .allocationsPerOp =
+          static_cast<double>(allocationsAfter - allocationsBefore) /
+          static_cast<double>(iterations),
+  };
+}
+
+// Read the requests of input one after the other, with a RequestReader each
+// as the server does, from the one buffer they arrived in. Returns how many
+// were read before one was malformed or cut short.
+auto ReadRequests(std::string_view input) -> std::size_t {
+  using States = toyws::RequestReader::States;
+  std::size_t count = 0;
+  while (!input.empty()) {
+    toyws::RequestReader reader;
+    input.remove_prefix(reader.ReadHead(input));
+    if (reader.State() != States::kBody) {
+      return count;
+    }
+    reader.BeginBody(nullptr);
+    if (reader.State() == States::kBody) {
+      // ReadBody() doesn't tell where the body ends, so only the last request
+      // of a corpus may have one
+      reader.ReadBody(input);
+      input = {};
+    }
+    if (reader.State() != States::kComplete) {
+      return count;
+    }
+    ++count;
+  }
+  return count;
+}
+
+auto ParseBench(const std::string& name, const std::string& corpus,
+                std::size_t count = 1) -> Result {
+  if (const auto read = ReadRequests(corpus); read != count) {
+    throw std::runtime_error(fmt::format(
+        "{}: request {} of the corpus is malformed", name, read + 1));
+  }
+  return Measure(name, corpus.size(), count, [&] { ReadRequests(corpus); });
+}
+
+auto WriteBench(const std::string& name, std::size_t bodySize) -> Result {
+  auto response = MakeResponse(bodySize);
+  std::string buffer(bodySize + 1024, '\0');
+  const auto size = response.Write(buffer.data(), buffer.size()).second;
+  return Measure(name, size, 1, [&] {
+    response.Write(buffer.data(), buffer.size());
+  });
+}
+
+// Same as WriteBench, but into a pooled BufferChain (as the server does)
+auto WriteChainBench(const std::string& name, std::size_t bodySize) -> Result {
+  auto response = MakeResponse(bodySize);
+  toyws::SegmentPool pool;
+  toyws::BufferChain chain{&pool};
+  response.Write(chain);
+  const auto size = chain.Size();
+  return Measure(name, size, 1, [&] {
+    chain.Clear();
+    response.Write(chain);
+  });
+}
+
+// Builds the response from scratch every op, as handlers do, then writes it
+auto BuildChainBench(const std::string& name, std::size_t bodySize)
+    -> Result {
+  const std::string body(bodySize, 'b');
+  toyws::SegmentPool pool;
+  toyws::BufferChain chain{&pool};
+  MakeResponse(bodySize).Write(chain);
+  const auto size = chain.Size();
+  return Measure(name, size, 1, [&] {
+    toyws::HeadersMap headers{{"Server", "ToyWS"},
+                              {"Content-Type", "text/html; charset=utf-8"},
+                              {"Cache-Control", "no-cache"},
+                              {"Connection", "keep-alive"}};
+    const toyws::HttpResponse response{toyws::HttpStatus::kOk,
+                                       std::move(headers), body};
+    chain.Clear();
+    response.Write(chain);
+  });
+}
+
+// Same response as BuildChainBench, written straight into the chain
+auto WriterBench(const std::string& name, std::size_t bodySize) -> Result {
+  const std::string body(bodySize, 'b');
+  toyws::SegmentPool pool;
+  toyws::BufferChain chain{&pool};
+  const auto op = [&] {
+    toyws::ResponseWriter writer{chain};
+    writer.Header("Server", "ToyWS");
+    writer.Header("Content-Type", "text/html; charset=utf-8");
+    writer.Header("Cache-Control", "no-cache");
+    writer.Header("Connection", "keep-alive");
+    writer.Write(body);
+    writer.Finish();
+  };
+  op();
+  return Measure(name, chain.Size(), 1, op);
+}
+
+auto PrintJson(const std::vector<Result>& results) -> void {
+  fmt::print("{{\n  \"benchmarks\": [\n");
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto& r = results[i];
+    fmt::print(
+        "    {{\"name\": \"{}\", \"bytes\": {}, \"messages\": {}, "
+        "\"iterations\": {}, \"ns_per_op\": {:.1f}, "
+        "\"ns_per_message\": {:.1f}, \"allocations_per_op\": {:.2f}, "
+        "\"mb_per_s\": {:.1f}}}{}\n",
+        r.name, r.bytes, r.messages, r.iterations, r.nsPerOp,
+        r.nsPerOp / static_cast<double>(r.messages), r.allocationsPerOp,
+        static_cast<double>(r.bytes) / r.nsPerOp * 1e3,
+        i + 1 < results.size() ? "," : "");
+  }
+  fmt::print("  ]\n}}\n");
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  std::string_view filter = argc > 1 ? argv[1] : "";
+
+  const auto largeHeaders = MakeLargeHeaderRequest();
+  const auto pipelined = MakePipelinedBatch(16);
+
+  using Bench = std::pair<std::string, std::function<Result(std::string)>>;
+  std::vector<Bench> benches = {
+      {"parse/browser_get",
+       [&](auto name) { return ParseBench(name, kBrowserGet); }},
+      {"parse/form_post",
+       [&](auto name) { return ParseBench(name, kFormPost); }},
+      {"parse/large_headers",
+       [&](auto name) { return ParseBench(name, largeHeaders); }},
+      {"parse/pipelined_16",
+       [&](auto name) { return ParseBench(name, pipelined, 16); }},
+      {"write/empty_body", [&](auto name) { return WriteBench(name, 0); }},
+      {"write/json_256", [&](auto name) { return WriteBench(name, 256); }},
+      {"write/html_16k",
+       [&](auto name) { return WriteBench(name, 16 * 1024); }},
+      {"write_chain/json_256",
+       [&](auto name) { return WriteChainBench(name, 256); }},
+      {"write_chain/html_16k",
+       [&](auto name) { return WriteChainBench(name, 16 * 1024); }},
+      {"build_chain/json_256",
+       [&](auto name) { return BuildChainBench(name, 256); }},
+      {"build_chain/html_16k",
+       [&](auto name) { return BuildChainBench(name, 16 * 1024); }},
+      {"writer/json_256", [&](auto name) { return WriterBench(name, 256); }},
+      {"writer/html_16k",
+       [&](auto name) { return WriterBench(name, 16 * 1024); }},
+  };
+
+  std::vector<Result> results;
+  bool failed = false;
+  for (auto& [name, run] : benches) {
+    if (filter.empty() || name.find(filter) != std::string::npos) {
+      try {
+        results.push_back(run(name));
+      } catch (const std::runtime_error& err) {
+        fmt::print(stderr, "{}\n", err.what());
+        failed = true;
+      }
+    }
+  }
+
+  PrintJson(results);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
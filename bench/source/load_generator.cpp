@@ -0,0 +1,701 @@
+#include <arpa/inet.h>
+#include <fmt/core.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "toyws/error.hpp"
+#include "toyws/http_request.hpp"
+#include "toyws/test_client.hpp"
+#include "toyws/toyws.hpp"
+
+/*
+ * HTTP load generator.
+ *
+ * Drives many concurrent connections from a few threads, each thread owning
+ * one io_uring. Two modes are supported:
+ *  - Closed loop (--rate=0): every connection keeps --pipeline requests in
+ *    flight (with --keep-alive) and sends a new one as soon as a response
+ *    arrives.
+ *  - Open loop (--rate=N): requests are scheduled at a constant rate and
+ *    latency is measured from the *scheduled* send time, so a stalled server
+ *    is not hidden by the generator backing off (coordinated omission).
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+inline constexpr std::size_t kRecvBufferSize = 16 * 1024;
+
+struct Options {
+  std::string address = "127.0.0.1";
+  std::uint16_t port = 5000;
+  std::string path = "/";
+  int connections = 64;
+  int threads = 2;
+  int pipeline = 1;
+  double rate = 0;  // Requests per second over all threads, 0 = closed loop
+  double duration = 10;  // Seconds
+  // ToyWs closes every connection after one response, so reusing them is
+  // only for other servers
+  bool keepAlive = false;
+  bool server = false;  // Run a ToyWs instance in-process to benchmark against
+  int serverRings = 1;
+};
+
+auto PrintUsage() -> void {
+  fmt::print(
+      "Usage: toyws_bench [options]\n"
+      "  --address=ADDR      Server address (default 127.0.0.1)\n"
+      "  --port=PORT         Server port (default 5000)\n"
+      "  --path=PATH         Request target (default /)\n"
+      "  --connections=N     Concurrent connections (default 64)\n"
+      "  --threads=N         Generator threads / rings (default 2)\n"
+      "  --pipeline=N        Requests in flight per connection (default 1),\n"
+      "                      more than 1 needs --keep-alive\n"
+      "  --rate=N            Open loop at N req/s (default 0 = closed loop)\n"
+      "  --duration=SECONDS  Length of run (default 10)\n"
+      "  --keep-alive        Reuse connections, for servers that support it\n"
+      "                      (ToyWs does not)\n"
+      "  --no-keep-alive     New connection for every request (default)\n"
+      "  --server            Benchmark an in-process loopback ToyWs\n"
+      "  --server-rings=N    Rings of the in-process ToyWs (default 1)\n");
+}
+
+auto ParseOptions(int argc, char** argv) -> std::optional<Options> {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    auto eq = arg.find('=');
+    auto name = arg.substr(0, eq);
+    std::string value{eq == std::string_view::npos ? "" : arg.substr(eq + 1)};
+
+    if (name == "--address") {
+      options.address = value;
+    } else if (name == "--port") {
+      options.port = static_cast<std::uint16_t>(std::stoi(value));
+    } else if (name == "--path") {
+      options.path = value;
+    } else if (name == "--connections") {
+      options.connections = std::stoi(value);
+    } else if (name == "--threads") {
+      options.threads = std::stoi(value);
+    } else if (name == "--pipeline") {
+      options.pipeline = std::stoi(value);
+    } else if (name == "--rate") {
+      options.rate = std::stod(value);
+    } else if (name == "--duration") {
+      options.duration = std::stod(value);
+    } else if (name == "--keep-alive") {
+      options.keepAlive = true;
+    } else if (name == "--no-keep-alive") {
+      options.keepAlive = false;
+    } else if (name == "--server") {
+      options.server = true;
+    } else if (name == "--server-rings") {
+      options.serverRings = std::stoi(value);
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  if (options.connections < 1 || options.threads < 1 || options.pipeline < 1 ||
+      options.threads > options.connections) {
+    return std::nullopt;
+  }
+  // Requests pipelined behind the first would be lost with the connection
+  if (!options.keepAlive && options.pipeline > 1) {
+    return std::nullopt;
+  }
+  return options;
+}
+
+/**
+ * @brief Serialize the request that is sent repeatedly.
+ */
+auto MakeRequest(const Options& options) -> std::string {
+  toyws::HeadersMap headers;
+  headers["Host"] = fmt::format("{}:{}", options.address, options.port);
+  headers["Connection"] = options.keepAlive ? "keep-alive" : "close";
+  toyws::HttpRequest request{toyws::HttpMethod::GET, options.path,
+                             std::move(headers)};
+
+  std::string out;
+  out.resize(4096);
+  auto [finished, length] = request.Write(out.data(), out.size());
+  if (!finished) {
+    throw toyws::Error("Request does not fit in 4096 bytes");
+  }
+  out.resize(length);
+  return out;
+}
+
+/**
+ * @brief Find the end of the first response in data.
+ * @return Length of the response, or nullopt if incomplete. A response without
+ * Content-Length/chunked framing is only complete at EOF (atEof).
+ */
+auto ResponseLength(std::string_view data, bool atEof)
+    -> std::optional<std::size_t> {
+  auto headerEnd = data.find("\r\n\r\n");
+  if (headerEnd == std::string_view::npos) {
+    return std::nullopt;
+  }
+  headerEnd += 4;
+
+  auto head = data.substr(0, headerEnd);
+  std::string lower{head};
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  if (auto pos = lower.find("\r\ncontent-length:"); pos != std::string::npos) {
+    auto length = std::strtoull(lower.c_str() + pos + 17, nullptr, 10);
+    if (data.size() - headerEnd < length) {
+      return std::nullopt;
+    }
+    return headerEnd + length;
+  }
+  if (lower.find("\r\ntransfer-encoding: chunked") != std::string::npos) {
+    auto end = data.find("\r\n0\r\n\r\n", headerEnd - 2);
+    if (end == std::string_view::npos) {
+      return std::nullopt;
+    }
+    return end + 7;
+  }
+  if (atEof) {
+    return data.size();
+  }
+  return std::nullopt;
+}
+
+enum class Op : std::uint8_t { kConnect = 0, kSend, kRecv, kCancel };
+
+struct Connection {
+  int fd = -1;
+  std::uint32_t generation = 0;
+  // Operations in flight, which may still reference the buffers below
+  int pending = 0;
+  bool connected = false;
+  bool closing = false;  // Replaced once nothing is pending anymore
+  bool sending = false;
+  std::string queued;    // Not yet handed to the kernel
+  std::string inFlight;  // Handed to the kernel
+  std::size_t inFlightOffset = 0;
+  std::vector<char> received = std::vector<char>(kRecvBufferSize);
+  std::size_t receivedSize = 0;
+  std::deque<Clock::time_point> sendTimes;  // Scheduled time per request
+};
+
+struct Results {
+  std::vector<std::uint64_t> latenciesNs;
+  std::uint64_t errors = 0;
+  std::uint64_t reconnects = 0;
+};
+
+/**
+ * @brief One generator thread with its own ring and share of connections.
+ */
+class Worker {
+ public:
+  Worker(const Options& benchOptions, int connectionCount, double workerRate,
+         const std::string& requestBytes, sockaddr_in serverAddr)
+      : options{benchOptions},
+        rate{workerRate},
+        request{requestBytes},
+        server{serverAddr},
+        connections(static_cast<std::size_t>(connectionCount)) {
+    unsigned entries = 256;
+    while (entries < static_cast<unsigned>(connectionCount) * 2 &&
+           entries < 32768) {
+      entries *= 2;
+    }
+    if (auto res = io_uring_queue_init(entries, &ring, 0); res < 0) {
+      throw toyws::Error(fmt::format("Error in io_uring_queue_init(): {}",
+                                     std::strerror(-res)));
+    }
+  }
+
+  ~Worker() {
+    for (auto& connection : connections) {
+      if (connection.fd != -1) {
+        close(connection.fd);
+      }
+    }
+    io_uring_queue_exit(&ring);
+  }
+
+  Worker(const Worker&) = delete;
+  auto operator=(const Worker&) -> Worker& = delete;
+
+  auto Run(Clock::time_point start, Clock::time_point end) -> void {
+    std::this_thread::sleep_until(start);
+    for (std::size_t i = 0; i < connections.size(); ++i) {
+      Connect(i);
+    }
+
+    const bool openLoop = rate > 0;
+    const auto interval =
+        openLoop ? std::chrono::duration_cast<Clock::duration>(
+                       std::chrono::duration<double>(1 / rate))
+                 : Clock::duration::zero();
+    auto nextSend = start;
+
+    while (Clock::now() < end) {
+      auto now = Clock::now();
+      auto wait = std::chrono::milliseconds{10};
+      if (openLoop) {
+        for (; nextSend <= now; nextSend += interval) {
+          scheduled.push_back(nextSend);
+        }
+        Dispatch();
+        wait = std::min(wait, std::chrono::ceil<std::chrono::milliseconds>(
+                                  nextSend - now));
+      }
+
+      __kernel_timespec timeout{};
+      timeout.tv_nsec =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count();
+      io_uring_cqe* cqe = nullptr;
+      io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &timeout, nullptr);
+
+      unsigned head = 0;
+      unsigned seen = 0;
+      io_uring_for_each_cqe(&ring, head, cqe) {
+        HandleCqe(cqe);
+        ++seen;
+      }
+      io_uring_cq_advance(&ring, seen);
+    }
+
+    // Requests that were scheduled but never sent count as errors
+    results.errors += scheduled.size();
+    Drain();
+  }
+
+  auto Result() -> Results& { return results; }
+
+ private:
+  const Options& options;
+  double rate;
+  const std::string& request;
+  sockaddr_in server;
+  io_uring ring{};
+  std::vector<Connection> connections;
+  std::deque<Clock::time_point> scheduled;  // Open loop backlog
+  std::size_t dispatchCursor = 0;
+  Results results;
+
+  static auto UserData(std::size_t index, std::uint32_t generation, Op op)
+      -> std::uint64_t {
+    return (static_cast<std::uint64_t>(index) << 32) |
+           (static_cast<std::uint64_t>(generation & 0xFFFFFF) << 8) |
+           static_cast<std::uint64_t>(op);
+  }
+
+  auto GetSqe() -> io_uring_sqe* {
+    auto* sqe = io_uring_get_sqe(&ring);
+    while (sqe == nullptr) {
+      io_uring_submit(&ring);
+      sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+  }
+
+  // Prepare an operation on a connection, counted until it completes
+  auto GetSqe(Connection& connection) -> io_uring_sqe* {
+    ++connection.pending;
+    return GetSqe();
+  }
+
+  auto Connect(std::size_t index) -> void {
+    auto& connection = connections[index];
+    connection.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection.fd == -1) {
+      throw toyws::Error(
+          fmt::format("Error in socket(): {}", std::strerror(errno)));
+    }
+    auto* sqe = GetSqe(connection);
+    io_uring_prep_connect(sqe, connection.fd,
+                          reinterpret_cast<const sockaddr*>(&server),
+                          sizeof(server));
+    io_uring_sqe_set_data64(
+        sqe, UserData(index, connection.generation, Op::kConnect));
+  }
+
+  /**
+   * @brief Replace a connection by a new one, once what is in flight on it
+   * (e.g. the recv after a failed send) is canceled: the kernel may write
+   * into its buffers until then.
+   */
+  auto Reconnect(std::size_t index) -> void {
+    auto& connection = connections[index];
+    results.errors += connection.sendTimes.size();
+    ++results.reconnects;
+
+    connection.connected = false;
+    connection.closing = true;
+    connection.sendTimes.clear();
+    if (connection.pending > 0) {
+      Cancel(connection);
+      return;  // Replaced by HandleCqe()
+    }
+    Replace(index);
+  }
+
+  auto Replace(std::size_t index) -> void {
+    auto& connection = connections[index];
+    close(connection.fd);
+    const auto generation = connection.generation + 1;
+    connection = Connection{};
+    connection.generation = generation;
+    Connect(index);
+  }
+
+  // Cancel all in flight on connection. Not counted as pending itself.
+  auto Cancel(const Connection& connection) -> void {
+    auto* sqe = GetSqe();
+    io_uring_prep_cancel_fd(sqe, connection.fd, IORING_ASYNC_CANCEL_ALL);
+    io_uring_sqe_set_data64(sqe, UserData(0, 0, Op::kCancel));
+  }
+
+  /**
+   * @brief Once the run is over, cancel what is in flight and wait until it
+   * is done, before the buffers are freed.
+   */
+  auto Drain() -> void {
+    std::size_t pending = 0;
+    for (auto& connection : connections) {
+      if (connection.pending > 0) {
+        connection.closing = true;
+        Cancel(connection);
+        pending += static_cast<std::size_t>(connection.pending);
+      }
+    }
+    while (pending > 0) {
+      io_uring_cqe* cqe = nullptr;
+      if (io_uring_submit_and_wait(&ring, 1) < 0 ||
+          io_uring_peek_cqe(&ring, &cqe) != 0) {
+        continue;
+      }
+      if (static_cast<Op>(cqe->user_data & 0xFF) != Op::kCancel) {
+        --connections[static_cast<std::size_t>(cqe->user_data >> 32)].pending;
+        --pending;
+      }
+      io_uring_cqe_seen(&ring, cqe);
+    }
+  }
+
+  auto QueueRequest(Connection& connection, Clock::time_point sendTime)
+      -> void {
+    connection.queued += request;
+    connection.sendTimes.push_back(sendTime);
+  }
+
+  /**
+   * @brief Start sending queued requests, unless a send is already in flight
+   * (its completion calls Flush() again).
+   */
+  auto Flush(std::size_t index) -> void {
+    auto& connection = connections[index];
+    if (connection.sending || connection.queued.empty()) {
+      return;
+    }
+    connection.inFlight = std::move(connection.queued);
+    connection.queued.clear();
+    connection.inFlightOffset = 0;
+    connection.sending = true;
+    Send(index);
+  }
+
+  auto Send(std::size_t index) -> void {
+    auto& connection = connections[index];
+    auto* sqe = GetSqe(connection);
+    io_uring_prep_send(sqe, connection.fd,
+                       connection.inFlight.data() + connection.inFlightOffset,
+                       connection.inFlight.size() - connection.inFlightOffset,
+                       MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe,
+                            UserData(index, connection.generation, Op::kSend));
+  }
+
+  auto Recv(std::size_t index) -> void {
+    auto& connection = connections[index];
+    if (connection.receivedSize == connection.received.size()) {
+      connection.received.resize(connection.received.size() * 2);
+    }
+    auto* sqe = GetSqe(connection);
+    io_uring_prep_recv(sqe, connection.fd,
+                       connection.received.data() + connection.receivedSize,
+                       connection.received.size() - connection.receivedSize,
+                       0);
+    io_uring_sqe_set_data64(sqe,
+                            UserData(index, connection.generation, Op::kRecv));
+  }
+
+  /**
+   * @brief Closed loop: top up a connection to the pipeline depth.
+   */
+  auto Refill(std::size_t index) -> void {
+    auto& connection = connections[index];
+    if (!connection.connected) {
+      return;
+    }
+    const auto now = Clock::now();
+    while (connection.sendTimes.size() <
+           static_cast<std::size_t>(options.pipeline)) {
+      QueueRequest(connection, now);
+    }
+    Flush(index);
+  }
+
+  /**
+   * @brief Open loop: hand scheduled requests to connections with room.
+   */
+  auto Dispatch() -> void {
+    for (std::size_t n = 0; n < connections.size() && !scheduled.empty();
+         ++n) {
+      const auto index = dispatchCursor;
+      dispatchCursor = (dispatchCursor + 1) % connections.size();
+
+      auto& connection = connections[index];
+      if (!connection.connected) {
+        continue;
+      }
+      bool queued = false;
+      while (!scheduled.empty() &&
+             connection.sendTimes.size() <
+                 static_cast<std::size_t>(options.pipeline)) {
+        QueueRequest(connection, scheduled.front());
+        scheduled.pop_front();
+        queued = true;
+      }
+      if (queued) {
+        Flush(index);
+      }
+    }
+  }
+
+  auto OnResponses(std::size_t index, bool atEof) -> void {
+    auto& connection = connections[index];
+    const auto now = Clock::now();
+    std::size_t consumed = 0;
+
+    while (true) {
+      std::string_view data{connection.received.data() + consumed,
+                            connection.receivedSize - consumed};
+      auto length = ResponseLength(data, atEof);
+      if (!length || *length == 0) {
+        break;
+      }
+      consumed += *length;
+
+      if (connection.sendTimes.empty()) {
+        ++results.errors;  // Unsolicited response
+        continue;
+      }
+      results.latenciesNs.push_back(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              now - connection.sendTimes.front())
+              .count()));
+      connection.sendTimes.pop_front();
+    }
+
+    std::memmove(connection.received.data(),
+                 connection.received.data() + consumed,
+                 connection.receivedSize - consumed);
+    connection.receivedSize -= consumed;
+  }
+
+  auto HandleCqe(io_uring_cqe* cqe) -> void {
+    const auto index = static_cast<std::size_t>(cqe->user_data >> 32);
+    [[maybe_unused]] const auto generation =
+        static_cast<std::uint32_t>((cqe->user_data >> 8) & 0xFFFFFF);
+    const auto op = static_cast<Op>(cqe->user_data & 0xFF);
+    if (op == Op::kCancel) {
+      return;  // What it canceled completes on its own
+    }
+    auto& connection = connections[index];
+    // Connections are only replaced with nothing in flight
+    assert(generation == (connection.generation & 0xFFFFFF));
+    --connection.pending;
+    if (connection.closing) {
+      if (connection.pending == 0) {
+        Replace(index);
+      }
+      return;
+    }
+
+    switch (op) {
+      case Op::kConnect:
+        if (cqe->res < 0) {
+          Reconnect(index);
+          return;
+        }
+        connection.connected = true;
+        Recv(index);
+        if (rate <= 0) {
+          Refill(index);
+        }
+        break;
+      case Op::kSend:
+        if (cqe->res < 0) {
+          Reconnect(index);
+          return;
+        }
+        connection.inFlightOffset += static_cast<std::size_t>(cqe->res);
+        if (connection.inFlightOffset < connection.inFlight.size()) {
+          Send(index);  // Short send
+          return;
+        }
+        connection.sending = false;
+        Flush(index);
+        break;
+      case Op::kRecv:
+        if (cqe->res <= 0) {
+          OnResponses(index, true);
+          Reconnect(index);
+          return;
+        }
+        connection.receivedSize += static_cast<std::size_t>(cqe->res);
+        OnResponses(index, false);
+        if (!options.keepAlive && connection.sendTimes.empty()) {
+          Reconnect(index);
+          return;
+        }
+        Recv(index);
+        if (rate <= 0) {
+          Refill(index);
+        }
+        break;
+      case Op::kCancel:
+        break;  // Returned above
+    }
+  }
+};
+
+auto Percentile(const std::vector<std::uint64_t>& sorted, double p)
+    -> double {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<std::size_t>(p / 100 *
+                                       static_cast<double>(sorted.size() - 1));
+  return static_cast<double>(sorted[rank]) / 1000;
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  auto parsed = ParseOptions(argc, argv);
+  if (!parsed) {
+    PrintUsage();
+    return 1;
+  }
+  auto options = *parsed;
+
+  std::unique_ptr<toyws::ToyWs> server;
+  std::thread serverThread;
+  if (options.server) {
+    server = std::make_unique<toyws::ToyWs>(options.address, options.port);
+    toyws::AccessLogOptions logOptions;
+    logOptions.level = toyws::AccessLogLevel::kOff;
+    server->SetAccessLogOptions(logOptions);
+    server->SetRings(static_cast<std::size_t>(options.serverRings));
+    serverThread = std::thread{[&] { server->Run(); }};
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    fmt::print("Server: in-process ToyWs on {}, {} ring(s)\n",
+               toyws::kIoBackendName, options.serverRings);
+  }
+
+  int exitCode = 0;
+  try {
+    // Sanity check that the target answers at all
+    toyws::TestClient probe{options.port, options.address};
+    auto response = probe.Get(options.path);
+    fmt::print("Probe: {} {}\n", static_cast<int>(response.Status()),
+               response.Reason());
+
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.address.c_str(), &serverAddr.sin_addr) !=
+        1) {
+      throw toyws::Error("Invalid network address");
+    }
+
+    const auto request = MakeRequest(options);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < options.threads; ++i) {
+      const int count = options.connections / options.threads +
+                        (i < options.connections % options.threads ? 1 : 0);
+      workers.push_back(std::make_unique<Worker>(
+          options, count, options.rate / options.threads, request,
+          serverAddr));
+    }
+
+    const auto start = Clock::now() + std::chrono::milliseconds{50};
+    const auto end = start + std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double>(
+                                     options.duration));
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+      threads.emplace_back([&worker, start, end] { worker->Run(start, end); });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    Results total;
+    for (auto& worker : workers) {
+      auto& result = worker->Result();
+      total.latenciesNs.insert(total.latenciesNs.end(),
+                               result.latenciesNs.begin(),
+                               result.latenciesNs.end());
+      total.errors += result.errors;
+      total.reconnects += result.reconnects;
+    }
+    std::sort(total.latenciesNs.begin(), total.latenciesNs.end());
+
+    fmt::print(
+        "Mode:        {} ({} connections, {} threads, pipeline {}{})\n"
+        "Requests:    {} completed, {} errors, {} reconnects\n"
+        "Throughput:  {:.0f} req/s\n"
+        "Latency us:  p50 {:.1f}  p99 {:.1f}  p99.9 {:.1f}  max {:.1f}\n",
+        options.rate > 0 ? fmt::format("open loop @ {:.0f} req/s", options.rate)
+                         : std::string{"closed loop"},
+        options.connections, options.threads, options.pipeline,
+        options.keepAlive ? ", keep-alive" : "", total.latenciesNs.size(),
+        total.errors, total.reconnects,
+        static_cast<double>(total.latenciesNs.size()) / options.duration,
+        Percentile(total.latenciesNs, 50), Percentile(total.latenciesNs, 99),
+        Percentile(total.latenciesNs, 99.9),
+        Percentile(total.latenciesNs, 100));
+  } catch (const toyws::Error& e) {
+    fmt::print("Error: {}\n", e.what());
+    exitCode = 1;
+  }
+
+  if (server) {
+    server->Stop();
+    serverThread.join();
+  }
+
+  return exitCode;
+}
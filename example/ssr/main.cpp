@@ -1,12 +1,68 @@
+#include <fcntl.h>
 #include <fmt/core.h>
 
 #include <csignal>
+#include <string>
+#include <string_view>
 
 #include "toyws/error.hpp"
 #include "toyws/toyws.hpp"
 
 toyws::ToyWs instance{"127.0.0.1", 5000};
 
+auto Index(const toyws::HttpRequest& /*request*/,
+           const toyws::HandlerContext& /*context*/,
+           toyws::HttpResponse& response) -> void {
+  response = toyws::HttpResponse{
+      toyws::HttpStatus::kOk,
+      {{"Content-Type", "text/html; charset=utf-8"}},
+      "<!DOCTYPE html><html><body><h1>Hello from ToyWS</h1></body></html>"};
+}
+
+// Streams a large report without materializing it in memory
+auto Report(const toyws::HttpRequest& /*request*/,
+            const toyws::HandlerContext& /*context*/,
+            toyws::HttpResponse& response) -> void {
+  response = toyws::HttpResponse{
+      toyws::HttpStatus::kOk, {{"Content-Type", "text/csv; charset=utf-8"}}};
+  response.SetStream([row = 0](toyws::ChunkSink& sink) mutable {
+    for (; row < 100000; ++row) {
+      const auto line = fmt::format("{},{}\n", row, row * row);
+      if (sink.Remaining() < line.size()) {
+        return true;
+      }
+      sink.Write(line);
+    }
+    return false;
+  });
+}
+
+// Reads a file on the ring, responding once the read completes
+auto License(const toyws::HttpRequest& /*request*/,
+             const toyws::HandlerContext& context,
+             toyws::HttpResponse& /*response*/) -> void {
+  auto* io = context.Io();
+  io->Open("LICENSE", O_RDONLY, [io, respond = context.Defer()](int fd) {
+    if (fd < 0) {
+      respond(toyws::HttpResponse{toyws::HttpStatus::kNotFound});
+      return;
+    }
+    io->Read(fd, 0, 64 * 1024,
+             [io, fd, respond](int result, std::string_view data) {
+               io->CloseFile(fd);
+               if (result < 0) {
+                 respond(toyws::HttpResponse{
+                     toyws::HttpStatus::kInternalServerError});
+                 return;
+               }
+               respond(toyws::HttpResponse{
+                   toyws::HttpStatus::kOk,
+                   {{"Content-Type", "text/plain; charset=utf-8"}},
+                   std::string{data}});
+             });
+  });
+}
+
 auto SigIntHandler(int signal) -> void {
   if (signal == SIGINT) {
     instance.Stop();
@@ -16,6 +72,15 @@ auto SigIntHandler(int signal) -> void {
 auto main() -> int {
   std::signal(SIGINT, SigIntHandler);
 
+  toyws::RouteOptions cached;
+  cached.cache.enabled = true;
+  instance.AddRoute("/", Index, cached);
+  instance.AddRoute("/report", Report);
+  instance.AddRoute("/license", License);
+  // Files of the working directory, e.g. /static/README.md
+  instance.AddStaticRoute("/static", toyws::StaticFilesOptions{.root = "."});
+  instance.SetMetricsRoute("/metrics");
+
   fmt::print("Echo Server! Listening at port 5000...\n");
   try {
     instance.Run();
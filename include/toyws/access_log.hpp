@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "toyws/http_request.hpp"
+#include "toyws/http_response.hpp"
+#include "toyws/spsc_queue.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+enum class AccessLogLevel {
+  kOff = 0,  // Log nothing
+  kErrors,   // Log only responses with status >= 400
+  kAll,      // Log everything (subject to sampling)
+};
+
+struct AccessLogOptions {
+  // File to append to. Empty means stdout.
+  std::string path;
+  AccessLogLevel level = AccessLogLevel::kAll;
+  // Log every N:th non-error request. Errors are never sampled away.
+  std::uint32_t sampleRate = 1;
+  // Formatted output is buffered until this many bytes are pending (or the
+  // writer thread goes idle).
+  std::size_t flushBytes = 64 * 1024;
+  // How long the writer thread sleeps when there is nothing to format.
+  std::chrono::milliseconds idleInterval{10};
+};
+
+/**
+ * @brief Fixed-size binary access log entry. Formatting into text is deferred
+ * to the log writer thread.
+ */
+struct AccessLogRecord {
+  static constexpr std::size_t kResourceCapacity = 94;
+
+  std::int64_t timestampUs;
+  std::uint32_t latencyUs;
+  std::uint32_t bodyBytes;
+  std::uint16_t status;
+  std::uint8_t method;
+  std::uint8_t resourceLength;  // > kResourceCapacity means truncated
+  char resource[kResourceCapacity];
+};
+static_assert(sizeof(AccessLogRecord) == 120);
+
+/**
+ * @brief Per-thread (ring) handle for appending to the AccessLog.
+ *
+ * Must only be used from a single thread; records are handed to the writer
+ * thread through a lock-free SPSC queue. If the queue is full, the record is
+ * dropped and counted rather than blocking the caller.
+ */
+class TOYWS_EXPORT AccessLogProducer {
+ public:
+  static constexpr std::size_t kQueueCapacity = 4096;
+
+  AccessLogProducer(AccessLogLevel logLevel, std::uint32_t logSampleRate)
+      : level{logLevel}, sampleRate{logSampleRate} {}
+
+  auto Record(const HttpRequest& request, const HttpResponse& response,
+              std::chrono::microseconds latency) -> void {
+    Record(request, response.Status(), response.Body().size(), latency);
+  }
+
+  auto Record(const HttpRequest& request, HttpStatus status,
+              std::size_t bodyBytes, std::chrono::microseconds latency)
+      -> void;
+
+  /**
+   * @brief Number of records lost due to the queue being full.
+   */
+  auto Dropped() const -> std::uint64_t {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+  auto Queue() -> SpscQueue<AccessLogRecord, kQueueCapacity>& { return queue; }
+
+ private:
+  AccessLogLevel level;
+  std::uint32_t sampleRate;
+  std::uint32_t sampleCounter = 0;
+  std::atomic<std::uint64_t> dropped = 0;
+  SpscQueue<AccessLogRecord, kQueueCapacity> queue;
+};
+
+/**
+ * @brief Asynchronous access log.
+ *
+ * Each ring gets its own AccessLogProducer. A background thread drains all
+ * producers, formats the records and writes them to the output in large
+ * batches, keeping formatting & I/O off the event loop.
+ */
+class TOYWS_EXPORT AccessLog {
+ public:
+  explicit AccessLog(AccessLogOptions logOptions = {});
+
+  ~AccessLog();
+
+  AccessLog(const AccessLog&) = delete;
+  auto operator=(const AccessLog&) -> AccessLog& = delete;
+
+  /**
+   * @brief Create a producer handle. The returned pointer is owned by, and
+   * valid for as long as, the AccessLog.
+   */
+  auto AddProducer() -> AccessLogProducer*;
+
+  /**
+   * @brief Open the output and start the writer thread.
+   */
+  auto Start() -> void;
+
+  /**
+   * @brief Drain all pending records, flush and stop the writer thread.
+   */
+  auto Stop() -> void;
+
+  auto Options() const -> const AccessLogOptions& { return options; }
+
+ private:
+  AccessLogOptions options;
+  int outputFd = -1;
+  bool ownsOutputFd = false;
+  std::atomic<bool> running = false;
+  std::thread writer;
+  std::string pending;
+
+  std::mutex producersMutex;
+  std::vector<std::unique_ptr<AccessLogProducer>> producers;
+
+  auto WriterLoop() -> void;
+
+  // Returns how many records were formatted.
+  auto Drain() -> std::size_t;
+
+  auto Flush() -> void;
+};
+
+}  // namespace toyws
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+namespace toyws {
+
+/**
+ * @brief Memory for what lives only as long as a request, e.g. the target &
+ * headers of its HttpRequest.
+ *
+ * Allocating is a pointer bump, and deallocating does nothing: everything is
+ * freed at once by Reset(), or along with the Arena. The first kInlineSize
+ * bytes are inside the Arena itself, which is enough for most requests;
+ * beyond that, blocks of growing size come from upstream.
+ */
+class Arena {
+ public:
+  static constexpr std::size_t kInlineSize = 4096;
+
+  explicit Arena(std::pmr::memory_resource* upstream =
+                     std::pmr::get_default_resource())
+      : resource{storage.data(), storage.size(), upstream} {}
+
+  Arena(const Arena&) = delete;
+  auto operator=(const Arena&) -> Arena& = delete;
+
+  auto Resource() -> std::pmr::memory_resource* { return &resource; }
+
+  /**
+   * @brief Free everything allocated so far, and start over at the inline
+   * storage. Nothing allocated from Resource() may be used afterwards.
+   */
+  auto Reset() -> void { resource.release(); }
+
+ private:
+  // Not zeroed, as nothing reads it before it is handed out & written
+  alignas(std::max_align_t) std::array<std::byte, kInlineSize> storage;
+  std::pmr::monotonic_buffer_resource resource;
+};
+
+}  // namespace toyws
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace toyws {
+
+// Alignment of read buffers, enough for O_DIRECT on common block devices
+inline constexpr std::size_t kDiskAlignment = 4096;
+// Mode of the files AsyncFileIo::Open() creates
+inline constexpr mode_t kFileMode = 0600;
+
+// Completions get the result of the operation: a file descriptor or number of
+// bytes read on success, -errno on failure.
+using OpenCallback = std::function<void(int result)>;
+// data is only valid during the call
+using ReadCallback = std::function<void(int result, std::string_view data)>;
+using StatCallback = std::function<void(int result, const struct statx& info)>;
+using WriteCallback = std::function<void(int result)>;
+
+/**
+ * @brief File I/O submitted to the ring of an IoService, rather than blocking
+ * its thread (and every connection on it) on the disk.
+ *
+ * Completions are called on the ring's thread, from IoService::Run(), and may
+ * start further operations. What they throw is caught and dropped, as there is
+ * no one to pass it to: a completion that answers a request must catch what
+ * it throws itself, or the request is never answered.
+ */
+class AsyncFileIo {
+ public:
+  virtual ~AsyncFileIo() = default;
+
+  /**
+   * @brief openat() relative to the working directory. flags may include
+   * O_DIRECT; O_CLOEXEC is always added. Files it creates (O_CREAT,
+   * O_TMPFILE) get kFileMode.
+   */
+  virtual auto Open(std::string path, int flags, OpenCallback done)
+      -> void = 0;
+
+  /**
+   * @brief Open() of path relative to directory dirFd, without resolving it
+   * (e.g. through symlinks) to outside of the directory where the kernel
+   * supports that (openat2() with RESOLVE_BENEATH).
+   */
+  virtual auto OpenBeneath(int dirFd, std::string path, int flags,
+                           OpenCallback done) -> void = 0;
+
+  /**
+   * @brief pread() of up to length bytes at offset. The buffer is aligned to
+   * kDiskAlignment, so with O_DIRECT only offset & length need to be.
+   */
+  virtual auto Read(int fd, std::uint64_t offset, std::size_t length,
+                    ReadCallback done) -> void = 0;
+
+  /**
+   * @brief pwrite() of data at offset, which may write fewer bytes than data
+   * has (e.g. when the disk is full), as pwrite() would.
+   */
+  virtual auto Write(int fd, std::uint64_t offset, std::string data,
+                     WriteCallback done) -> void = 0;
+
+  virtual auto Stat(std::string path, StatCallback done) -> void = 0;
+
+  /**
+   * @brief Stat() of an open file, e.g. one opened with Open().
+   */
+  virtual auto StatFile(int fd, StatCallback done) -> void = 0;
+
+  /**
+   * @brief close() without waiting for the result.
+   */
+  virtual auto CloseFile(int fd) -> void = 0;
+};
+
+}  // namespace toyws
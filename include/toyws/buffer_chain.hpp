@@ -0,0 +1,184 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+inline constexpr std::size_t kSegmentSize = 2048;
+
+struct Segment {
+  char data[kSegmentSize];
+};
+
+/**
+ * @brief Free list of segments, so that buffers can grow and shrink without
+ * going to the allocator. Not thread safe; meant to be owned by a ring.
+ */
+class TOYWS_EXPORT SegmentPool {
+ public:
+  /**
+   * @param maxFreeSegments How many released segments to keep around at most.
+   */
+  explicit SegmentPool(std::size_t maxFreeSegments = 1024)
+      : maxFree{maxFreeSegments} {}
+
+  auto Acquire() -> std::unique_ptr<Segment>;
+
+  auto Release(std::unique_ptr<Segment> segment) -> void;
+
+  auto FreeCount() const -> std::size_t { return free.size(); }
+
+ private:
+  std::size_t maxFree;
+  std::vector<std::unique_ptr<Segment>> free;
+};
+
+/**
+ * @brief Byte buffer made of a chain of fixed-size segments.
+ *
+ * Grows a segment at a time, so there are no large contiguous allocations and
+ * nothing is ever moved. Content and spare capacity are exposed as iovec
+ * arrays for use with readv/writev. Bytes are consumed from the front (e.g.
+ * after a partial write), releasing segments as they are emptied.
+ */
+class TOYWS_EXPORT BufferChain {
+ public:
+  /**
+   * @param segmentPool Where to get segments from. nullptr means allocating
+   * them directly.
+   */
+  explicit BufferChain(SegmentPool* segmentPool = nullptr)
+      : pool{segmentPool} {}
+
+  ~BufferChain() { Clear(); }
+
+  BufferChain(const BufferChain&) = delete;
+  auto operator=(const BufferChain&) -> BufferChain& = delete;
+
+  /**
+   * @brief Change pool. Segments currently held are later released to the new
+   * pool.
+   */
+  auto SetPool(SegmentPool* segmentPool) -> void { pool = segmentPool; }
+
+  auto Size() const -> std::size_t { return size; }
+
+  auto Empty() const -> bool { return size == 0; }
+
+  auto Append(std::string_view data) -> void;
+
+  auto Append(char c) -> void {
+    if (head + size == Capacity()) {
+      AddSegment();
+    }
+    const auto end = head + size;
+    segments[end / kSegmentSize]->data[end % kSegmentSize] = c;
+    ++size;
+  }
+
+  /**
+   * @brief Output iterator appending to a chain, e.g. for fmt::format_to.
+   */
+  class Inserter {
+   public:
+    using iterator_category = std::output_iterator_tag;
+    using value_type = void;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = void;
+
+    explicit Inserter(BufferChain& chain) : target{&chain} {}
+
+    auto operator=(char c) -> Inserter& {
+      target->Append(c);
+      return *this;
+    }
+    auto operator*() -> Inserter& { return *this; }
+    auto operator++() -> Inserter& { return *this; }
+    auto operator++(int) -> Inserter { return *this; }
+
+   private:
+    BufferChain* target;
+  };
+
+  auto Back() -> Inserter { return Inserter{*this}; }
+
+  /**
+   * @brief Replace content from offset on with data, which must not reach
+   * past the end of the content. E.g. to fill in a length once it is known.
+   */
+  auto Overwrite(std::size_t offset, std::string_view data) -> void;
+
+  /**
+   * @brief Ensure there is room for at least bytes more content.
+   */
+  auto Reserve(std::size_t bytes) -> void;
+
+  /**
+   * @brief Spare capacity after the content, for reading into. Valid until
+   * the chain is next modified.
+   */
+  auto Spare() -> std::span<const iovec>;
+
+  /**
+   * @brief Turn n bytes of spare capacity into content (after a read).
+   */
+  auto Commit(std::size_t n) -> void;
+
+  /**
+   * @brief The content from offset on, for writing out. At most IOV_MAX
+   * entries; write again with a larger offset (or after Consume()) if there is
+   * more. Valid until the chain is next modified.
+   */
+  auto Data(std::size_t offset = 0) -> std::span<const iovec>;
+
+  /**
+   * @brief Drop n bytes from the front of the content.
+   */
+  auto Consume(std::size_t n) -> void;
+
+  /**
+   * @brief Number of contiguous pieces the content is made of.
+   */
+  auto PieceCount() const -> std::size_t;
+
+  /**
+   * @brief Contiguous piece i of the content. Tokens may straddle pieces.
+   */
+  auto Piece(std::size_t i) const -> std::string_view;
+
+  auto ToString() const -> std::string;
+
+  /**
+   * @brief Drop all content and release all segments.
+   */
+  auto Clear() -> void;
+
+ private:
+  SegmentPool* pool;
+  std::deque<std::unique_ptr<Segment>> segments;
+  std::size_t head = 0;  // Offset of the content in segments.front()
+  std::size_t size = 0;
+  std::vector<iovec> iovecs;  // Storage for Spare() & Data()
+
+  auto Capacity() const -> std::size_t {
+    return segments.size() * kSegmentSize;
+  }
+
+  auto AddSegment() -> void;
+
+  auto ReleaseFront() -> void;
+};
+
+}  // namespace toyws
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+
+namespace toyws {
+
+/**
+ * @brief Assumed size of a cache line. Used to pad data that is written by
+ * one thread and read by another, so that they do not share a line.
+ *
+ * NOTE: std::hardware_destructive_interference_size is not used since its
+ * value may differ between compilers (or flags), which makes it unsuitable in
+ * a public header.
+ */
+inline constexpr std::size_t kCacheLineSize = 64;
+
+}  // namespace toyws
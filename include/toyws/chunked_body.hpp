@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <utility>
+
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Bounded destination for one chunk of a streamed response body.
+ */
+class ChunkSink {
+ public:
+  ChunkSink(char* buffer, std::size_t bufferCapacity)
+      : data{buffer}, capacity{bufferCapacity} {}
+
+  /**
+   * @brief Append as much of str as fits.
+   * @return How many bytes were consumed from str.
+   */
+  auto Write(std::string_view str) -> std::size_t {
+    const auto n = std::min(str.size(), Remaining());
+    std::memcpy(data + size, str.data(), n);
+    size += n;
+    return n;
+  }
+
+  auto Remaining() const -> std::size_t { return capacity - size; }
+
+  auto Size() const -> std::size_t { return size; }
+
+ private:
+  char* data;
+  std::size_t capacity;
+  std::size_t size = 0;
+};
+
+/**
+ * @brief Produces a response body piece by piece, for use with
+ * Transfer-Encoding: chunked.
+ *
+ * Called every time the previous chunk has been written to the socket, so a
+ * slow client naturally slows down production and at most one chunk per
+ * response is buffered. Should write at least one byte per call until it is
+ * done. Returns false once the body is complete (possibly having written a
+ * last piece in the same call).
+ */
+using BodyProducer = std::function<bool(ChunkSink&)>;
+
+/**
+ * @brief Frame the next chunk from producer into data.
+ *
+ * The chunk size is written with a fixed number of hex digits (leading zeros
+ * are allowed) so the payload can be produced in place. When the producer is
+ * done, the terminating zero-length chunk is appended.
+ *
+ * @return Pair (done, length): whether the body is complete and how many bytes
+ * were put into data.
+ */
+TOYWS_EXPORT auto WriteChunk(const BodyProducer& producer, char* data,
+                             std::size_t capacity)
+    -> std::pair<bool, std::size_t>;
+
+}  // namespace toyws
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "toyws/arena.hpp"
+#include "toyws/buffer_chain.hpp"
+#include "toyws/chunked_body.hpp"
+#include "toyws/open_file.hpp"
+#include "toyws/request_reader.hpp"
 #include "toyws/toyws_export.hpp"
-
-inline constexpr int kBufferSize = 2048;
+#include "toyws/websocket.hpp"
 
 namespace toyws {
 
@@ -14,9 +22,18 @@ namespace toyws {
  */
 class TOYWS_EXPORT Client {
  public:
-  enum class States { kAccept = 0, kRead, kWrite, kFinished };
-
-  Client() { buffer.resize(kBufferSize); }
+  enum class States : std::uint8_t {
+    kAccept = 0,
+    kRead,
+    kWrite,
+    kSendFile,
+    kLinger,
+    kWaitClose,
+    // Between operations, e.g. while its request is answered, until the
+    // handler starts the next one
+    kIdle,
+    kFinished
+  };
 
   auto State() const -> States { return state; }
   auto SetState(States newState) -> void { state = newState; }
@@ -28,26 +45,113 @@ class TOYWS_EXPORT Client {
   auto SetIoServiceSlot(int slot) -> void { ioServiceSlot = slot; }
 
   /**
-   * @brief Buffer for network reading/writing.
+   * @brief Buffer for network reading/writing. Holds the data of the last
+   * read, or the data to write.
+   */
+  auto Buffer() -> BufferChain& { return buffer; }
+
+  /**
+   * @brief Shared, immutable data to write after the content of Buffer(). Kept
+   * alive until the write completes, at which point it is reset.
    */
-  auto Buffer() -> std::vector<char>& { return buffer; }
+  auto Output() const -> const std::shared_ptr<const std::string>& {
+    return output;
+  }
+  auto SetOutput(std::shared_ptr<const std::string> data) -> void {
+    output = std::move(data);
+  }
+
+  /**
+   * @brief Range of an open file to send after Buffer() & Output(), with
+   * splice rather than through user space. Reset once it is sent.
+   */
+  auto File() const -> const FileRange& { return file; }
+  auto SetFile(FileRange range) -> void { file = std::move(range); }
+
+  /**
+   * @brief Request being read on this connection. It, its handler's context &
+   * response are allocated from the connection's Arena, which goes along with
+   * the connection once the response is sent.
+   */
+  auto Reader() -> RequestReader& { return reader; }
+
+  /**
+   * @brief Producer of a chunked response body that is still being streamed,
+   * if any.
+   */
+  auto Stream() const -> const BodyProducer& { return stream; }
+  auto SetStream(BodyProducer producer) -> void {
+    stream = std::move(producer);
+  }
 
   /**
-   * @brief How much content is in the buffer. Bytes in range
-   * Buffer()[0..BufferContentSize] indicates the content that was read/written.
-   * It does not necessarily correspond to the buffer size.
+   * @brief Messages queued for a full-duplex connection, e.g. WebSocket
+   * frames, sent in order by IoService::AsyncSend() while a read may be in
+   * progress. Shared, so that one sent to many connections exists once. The
+   * front one stays until it is sent in full. A vector rather than a deque,
+   * which allocates even while empty, as most connections never use it.
    */
-  auto BufferContentSize() const -> std::size_t { return bufferContentSize; }
-  auto SetBufferContentSize(std::size_t newSize) -> void {
-    bufferContentSize = newSize;
+  auto Outbox() -> std::vector<std::shared_ptr<const std::string>>& {
+    return outbox;
   }
 
+  /**
+   * @brief Bytes of the front message of Outbox() sent already.
+   */
+  auto OutboxSent() const -> std::size_t { return outboxSent; }
+
+  /**
+   * @brief Drop n bytes that were sent from the front of Outbox().
+   */
+  auto ConsumeOutbox(std::size_t n) -> void {
+    auto sent = outbox.begin();
+    while (n > 0) {
+      const auto left = (*sent)->size() - outboxSent;
+      if (n < left) {
+        outboxSent += n;
+        break;
+      }
+      n -= left;
+      ++sent;
+      outboxSent = 0;
+    }
+    outbox.erase(outbox.begin(), sent);
+  }
+
+  auto ClearOutbox() -> void {
+    outbox.clear();
+    outboxSent = 0;
+  }
+
+  /**
+   * @brief The WebSocket the connection was upgraded to, if any.
+   */
+  auto WebSocket() const -> toyws::WebSocket* { return webSocket.get(); }
+  auto SetWebSocket(std::unique_ptr<toyws::WebSocket> socket) -> void {
+    webSocket = std::move(socket);
+  }
+
+  /**
+   * @brief Whether the connection is subscribed to the event stream of its
+   * request's route, see EventHub.
+   */
+  auto Subscribed() const -> bool { return subscribed; }
+  auto SetSubscribed(bool value) -> void { subscribed = value; }
+
  private:
   States state = States::kAccept;
   int clientFd = 0;
   int ioServiceSlot = -1;
-  std::vector<char> buffer;
-  std::size_t bufferContentSize = 0;
+  BufferChain buffer;
+  std::shared_ptr<const std::string> output;
+  FileRange file;
+  Arena arena;  // Outlives reader, which allocates from it
+  RequestReader reader{arena.Resource()};
+  BodyProducer stream;
+  std::vector<std::shared_ptr<const std::string>> outbox;
+  std::size_t outboxSent = 0;
+  std::unique_ptr<toyws::WebSocket> webSocket;
+  bool subscribed = false;
 };
 
 }  // namespace toyws
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "toyws/toyws_export.hpp"
+
+struct z_stream_s;
+
+namespace toyws {
+
+enum class ContentEncoding { kIdentity = 0, kGzip, kDeflate };
+
+inline auto ContentEncodingName(ContentEncoding encoding) -> const char* {
+  switch (encoding) {
+    case ContentEncoding::kIdentity:
+      return "identity";
+    case ContentEncoding::kGzip:
+      return "gzip";
+    case ContentEncoding::kDeflate:
+      return "deflate";
+  }
+  return "identity";
+}
+
+struct CompressionOptions {
+  bool enabled = true;
+  // Bodies smaller than this are sent uncompressed
+  std::size_t minSize = 1024;
+  // zlib compression level, 1 (fastest) - 9 (smallest)
+  int level = 6;
+  // Upper bound on the size of cached compressed variants
+  std::size_t variantCacheBytes = 8 * 1024 * 1024;
+};
+
+/**
+ * @brief Pick the best encoding we support from an Accept-Encoding value.
+ * gzip is preferred over deflate when both are equally acceptable.
+ */
+TOYWS_EXPORT auto NegotiateEncoding(std::string_view acceptEncoding)
+    -> ContentEncoding;
+
+/**
+ * @brief Whether a Content-Type is worth compressing (text, JSON, XML, ...).
+ */
+TOYWS_EXPORT auto IsCompressibleType(std::string_view contentType) -> bool;
+
+/**
+ * @brief Streaming gzip/deflate compressor.
+ *
+ * Keeps one zlib context per encoding alive and resets it between bodies,
+ * instead of allocating zlib's (large) state for every response. Not thread
+ * safe; meant to be owned by a ring.
+ */
+class TOYWS_EXPORT Compressor {
+ public:
+  explicit Compressor(int compressionLevel = 6);
+
+  ~Compressor();
+
+  Compressor(const Compressor&) = delete;
+  auto operator=(const Compressor&) -> Compressor& = delete;
+
+  /**
+   * @brief Change compression level. Releases the current contexts.
+   */
+  auto SetLevel(int compressionLevel) -> void;
+
+  /**
+   * @brief Compress input in one go. encoding must not be kIdentity.
+   */
+  auto Compress(std::string_view input, ContentEncoding encoding)
+      -> std::string;
+
+ private:
+  struct StreamDeleter {
+    auto operator()(z_stream_s* stream) const -> void;
+  };
+
+  int level;
+  std::unique_ptr<z_stream_s, StreamDeleter> gzip;
+  std::unique_ptr<z_stream_s, StreamDeleter> deflate;
+
+  auto Stream(ContentEncoding encoding) -> z_stream_s*;
+};
+
+/**
+ * @brief LRU cache of compressed bodies, keyed on a representation identifier
+ * (e.g. an ETag) and encoding. Makes sure that a body which is served many
+ * times is only compressed once.
+ */
+class TOYWS_EXPORT CompressedVariantCache {
+ public:
+  using Bytes = std::shared_ptr<const std::string>;
+
+  explicit CompressedVariantCache(std::size_t maxCacheBytes)
+      : maxBytes{maxCacheBytes} {}
+
+  auto Find(std::string_view identity, ContentEncoding encoding) -> Bytes;
+
+  auto Insert(std::string_view identity, ContentEncoding encoding, Bytes data)
+      -> void;
+
+  auto SizeBytes() const -> std::size_t { return bytes; }
+
+ private:
+  struct Entry {
+    std::string key;
+    Bytes data;
+  };
+
+  std::size_t maxBytes;
+  std::size_t bytes = 0;
+  std::list<Entry> lru;  // Most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+  static auto MakeKey(std::string_view identity, ContentEncoding encoding)
+      -> std::string;
+};
+
+}  // namespace toyws
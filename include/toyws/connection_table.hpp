@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "toyws/client.hpp"
+#include "toyws/io_service_common.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief What an operation submitted by an IoService is for, carried in the
+ * top byte of its user_data (see OpTag).
+ */
+enum class OpKind : std::uint8_t {
+  // Closes, shutdowns & link timeouts, whose completions need no handling
+  kUntracked = 0,
+  kAccept,
+  // Wait before accepting again, see kAcceptBackoff
+  kAcceptRetry,
+  kRead,
+  kWrite,
+  // Send of a full-duplex connection's outbox, see Client::Outbox()
+  kSend,
+  // The halves of a splice pair: from the file into the pipe, and from the
+  // pipe into the socket
+  kSpliceIn,
+  kSpliceOut,
+  // Read draining a lingering connection
+  kDrain,
+  // Read discarding what the peer sends until it closes, see AsyncWaitClose()
+  kWaitClose,
+  // File I/O (see AsyncFileIo), with its index as payload
+  kDiskOp,
+  // Poll of the Mailbox's eventfd
+  kMailbox,
+  // Connection handed over between rings. On the target, with the Client's
+  // address as payload; on the ring handing it over, with a sequence number.
+  kHandoff,
+};
+
+/**
+ * @brief user_data of an operation: its OpKind, and either a payload or, for
+ * operations on a connection, its slot & the generation of the slot (see
+ * ConnectionTable). Completions are dispatched, and told from those of an
+ * earlier connection in the same slot, by their user_data alone.
+ */
+class OpTag {
+ public:
+  static constexpr int kKindShift = 56;
+  static constexpr int kGenerationShift = 32;
+  static constexpr std::uint64_t kPayloadMask =
+      (std::uint64_t{1} << kKindShift) - 1;
+  // Generations wrap around at this, which takes long enough for whatever was
+  // in flight on a slot to have completed
+  static constexpr std::uint32_t kGenerationMask = (1U << 24) - 1;
+
+  constexpr explicit OpTag(std::uint64_t userData) : value{userData} {}
+
+  constexpr OpTag(OpKind kind, std::uint64_t payload)
+      : value{(static_cast<std::uint64_t>(kind) << kKindShift) |
+              (payload & kPayloadMask)} {}
+
+  constexpr OpTag(OpKind kind, std::uint32_t slot, std::uint32_t generation)
+      : OpTag{kind,
+              (static_cast<std::uint64_t>(generation & kGenerationMask)
+               << kGenerationShift) |
+                  slot} {}
+
+  constexpr auto Value() const -> std::uint64_t { return value; }
+
+  constexpr auto Kind() const -> OpKind {
+    return static_cast<OpKind>(value >> kKindShift);
+  }
+
+  constexpr auto Payload() const -> std::uint64_t {
+    return value & kPayloadMask;
+  }
+
+  constexpr auto Slot() const -> std::uint32_t {
+    return static_cast<std::uint32_t>(value);
+  }
+
+  constexpr auto Generation() const -> std::uint32_t {
+    return static_cast<std::uint32_t>(value >> kGenerationShift) &
+           kGenerationMask;
+  }
+
+ private:
+  std::uint64_t value;
+};
+
+/**
+ * @brief What handling any completion on a connection looks at. Kept inline
+ * in the ConnectionTable, four to a cache line; the rest is in the Client.
+ */
+struct alignas(16) ConnectionSlot {
+  std::uint32_t generation = 0;
+  // Socket of the connection, or the listening socket while accepting
+  int fd = -1;
+  // Operation last started on the connection. kFinished while the slot is
+  // free.
+  Client::States state = Client::States::kFinished;
+  bool used = false;
+};
+
+/**
+ * @brief Slots of an IoService's connections (and accepts waiting for one).
+ *
+ * Each slot has a generation, which changes when the slot is released. Tags
+ * of operations carry it, so that a completion arriving after its connection
+ * is gone, e.g. the rest of a canceled chain, is not taken for one of the
+ * connection now in the slot.
+ */
+class TOYWS_EXPORT ConnectionTable {
+ public:
+  explicit ConnectionTable(std::size_t capacity = kClientSlots);
+
+  /**
+   * @brief Slot for a new connection, growing the table if all are in use.
+   * The most recently released slot is reused first, while it is still in
+   * cache.
+   */
+  auto Acquire() -> std::uint32_t;
+
+  /**
+   * @brief Free slot. Completions of what is still in flight on it are stale
+   * from now on.
+   */
+  auto Release(std::uint32_t slot) -> void;
+
+  auto operator[](std::size_t slot) -> ConnectionSlot& { return slots[slot]; }
+  auto operator[](std::size_t slot) const -> const ConnectionSlot& {
+    return slots[slot];
+  }
+
+  /**
+   * @brief Tag of an operation of kind on the connection in slot.
+   */
+  auto Tag(OpKind kind, std::uint32_t slot) const -> OpTag {
+    return OpTag{kind, slot, slots[slot].generation};
+  }
+
+  /**
+   * @brief Whether tag refers to the connection now in its slot.
+   */
+  auto IsCurrent(OpTag tag) const -> bool {
+    if (tag.Slot() >= slots.size()) {
+      return false;
+    }
+    const auto& slot = slots[tag.Slot()];
+    return slot.used &&
+           (slot.generation & OpTag::kGenerationMask) == tag.Generation();
+  }
+
+  /**
+   * @brief Number of slots, used or not.
+   */
+  auto Size() const -> std::size_t { return slots.size(); }
+
+  auto Used() const -> std::size_t { return slots.size() - free.size(); }
+
+ private:
+  std::vector<ConnectionSlot> slots;
+  std::vector<std::uint32_t> free;  // Most recently released last
+};
+
+}  // namespace toyws
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "toyws/http_request.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+class Route;
+
+/**
+ * @brief An encoded event, framed as a chunk (see EncodeEventChunk), shared by
+ * the connections it is sent to.
+ */
+using EventStreamFrame = std::shared_ptr<const std::string>;
+
+/**
+ * @brief Event in the text/event-stream format: an optional event type & id,
+ * and a data line for each line of data. Throws Error if event or id contain a
+ * line break.
+ */
+TOYWS_EXPORT auto EncodeEvent(std::string_view data,
+                              std::string_view event = {},
+                              std::string_view id = {}) -> std::string;
+
+/**
+ * @brief payload framed as a chunk of a Transfer-Encoding: chunked body, which
+ * event streams are sent with. Empty payloads yield nothing, as an empty chunk
+ * would end the body.
+ */
+TOYWS_EXPORT auto EncodeChunk(std::string_view payload) -> std::string;
+
+/**
+ * @brief EncodeEvent() as a chunk, to share with every subscriber.
+ */
+TOYWS_EXPORT auto EncodeEventChunk(std::string_view data,
+                                   std::string_view event = {},
+                                   std::string_view id = {})
+    -> EventStreamFrame;
+
+/**
+ * @brief A comment as a chunk, sent to idle subscribers so that proxies (and
+ * the peer) don't time the connection out.
+ */
+TOYWS_EXPORT auto HeartbeatChunk() -> EventStreamFrame;
+
+/**
+ * @brief What an event stream route calls. Each may be nullptr.
+ */
+struct EventStreamHandlers {
+  // When a client subscribes, before it is sent any published event. Returns
+  // encoded events (see EncodeEvent) to send it first, e.g. those it missed
+  // since its Last-Event-ID. Throwing HttpStatusError refuses the
+  // subscription with that status.
+  std::string (*onSubscribe)(const HttpRequest& request) = nullptr;
+};
+
+struct EventStreamOptions {
+  // A subscriber with more events than this waiting to be sent (i.e. one too
+  // slow for what is published) is dropped
+  std::size_t maxQueuedEvents = 256;
+};
+
+/**
+ * @brief Subscribers of the event streams of a ring, by route.
+ *
+ * Meant to be owned by a single ring (not thread safe). Subscribers are client
+ * slots, so publishing to a topic is a walk over a vector of ints.
+ */
+class TOYWS_EXPORT EventHub {
+ public:
+  auto Subscribe(const Route* topic, int slot) -> void;
+
+  /**
+   * @return Whether slot was subscribed to topic.
+   */
+  auto Unsubscribe(const Route* topic, int slot) -> bool;
+
+  /**
+   * @brief Call deliver(slot) for each subscriber of topic. Those it returns
+   * false for are unsubscribed.
+   * @return How many subscribers remain.
+   */
+  template <typename Deliver>
+  auto Publish(const Route* topic, Deliver&& deliver) -> std::size_t {
+    const auto found = topics.find(topic);
+    if (found == topics.end()) {
+      return 0;
+    }
+    const auto remaining = Walk(found->second, deliver);
+    if (found->second.empty()) {
+      topics.erase(found);
+    }
+    return remaining;
+  }
+
+  /**
+   * @brief Publish() to all topics.
+   */
+  template <typename Deliver>
+  auto PublishAll(Deliver&& deliver) -> std::size_t {
+    std::size_t remaining = 0;
+    for (auto it = topics.begin(); it != topics.end();) {
+      remaining += Walk(it->second, deliver);
+      it = it->second.empty() ? topics.erase(it) : std::next(it);
+    }
+    return remaining;
+  }
+
+  auto Subscribers() const -> std::size_t { return subscribers; }
+
+  auto Subscribers(const Route* topic) const -> std::size_t;
+
+ private:
+  std::unordered_map<const Route*, std::vector<int>> topics;
+  std::size_t subscribers = 0;
+
+  // Backwards, so that removing (by swapping in the last) skips nobody
+  template <typename Deliver>
+  auto Walk(std::vector<int>& slots, Deliver& deliver) -> std::size_t {
+    for (auto i = slots.size(); i-- > 0;) {
+      if (!deliver(slots[i])) {
+        slots[i] = slots.back();
+        slots.pop_back();
+        --subscribers;
+      }
+    }
+    return slots.size();
+  }
+};
+
+}  // namespace toyws
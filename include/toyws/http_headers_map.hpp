@@ -1,10 +1,63 @@
 #pragma once
 
+#include <cstddef>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 namespace toyws {
 
-using HeadersMap = std::unordered_map<std::string, std::string>;
-
+/**
+ * @brief ASCII lower case of c. Header names are tokens, so nothing else needs
+ * folding (and the locale has no say).
+ */
+constexpr auto FoldHeaderNameChar(char c) -> char {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
 }
+
+/**
+ * @brief Hash & equality of header names, which are case-insensitive
+ * (RFC 9110 section 5.1). They accept any string type, so that a HeadersMap
+ * can be searched without first copying the name into its allocator.
+ */
+struct HeaderNameHash {
+  using is_transparent = void;
+
+  auto operator()(std::string_view name) const noexcept -> std::size_t {
+    // FNV-1a
+    std::size_t hash = 14695981039346656037ULL;
+    for (const char c : name) {
+      hash ^= static_cast<unsigned char>(FoldHeaderNameChar(c));
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+};
+
+struct HeaderNameEqual {
+  using is_transparent = void;
+
+  auto operator()(std::string_view lhs, std::string_view rhs) const noexcept
+      -> bool {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+      if (FoldHeaderNameChar(lhs[i]) != FoldHeaderNameChar(rhs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief Header fields by name. Allocates from the memory resource it is
+ * constructed with, e.g. the Arena of a connection.
+ */
+using HeadersMap =
+    std::pmr::unordered_map<std::pmr::string, std::pmr::string,
+                            HeaderNameHash, HeaderNameEqual>;
+
+}  // namespace toyws
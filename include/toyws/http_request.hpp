@@ -2,17 +2,21 @@
 
 #include <cassert>
 #include <cstddef>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 
-#include "toyws/error.hpp"
 #include "toyws/http_headers_map.hpp"
 
 struct HttpRequestEditor;
 
 namespace toyws {
 
+enum class HttpStatus;
+
 enum class HttpMethod {
   // NOTE: This violates enum naming conventions of the project. But matches the
   // universal naming convention of HTTP methods.
@@ -32,35 +36,49 @@ enum class HttpMethod {
  *
  * Structured data of a HTTP request. Used to parse a string containing a HTTP
  * request and then access the information in a structured manner.
+ *
+ * The target & headers are allocated with the allocator it is constructed
+ * with, e.g. from the Arena of the connection it arrived on. The body is not,
+ * as it is handed over whole (see RequestReader).
  */
 class HttpRequest {
  public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
   HttpRequest() = default;
-  HttpRequest(HttpMethod httpMethod, std::string targetResource)
-      : method{httpMethod}, resource{std::move(targetResource)} {}
-  HttpRequest(HttpMethod httpMethod, std::string targetResource,
+  explicit HttpRequest(const allocator_type& alloc)
+      : resource{alloc}, headers{alloc} {}
+  HttpRequest(HttpMethod httpMethod, std::string_view targetResource)
+      : method{httpMethod}, resource{targetResource} {}
+  HttpRequest(HttpMethod httpMethod, std::string_view targetResource,
               HeadersMap httpHeaders)
       : method{httpMethod},
-        resource{std::move(targetResource)},
+        resource{targetResource, httpHeaders.get_allocator()},
         headers{std::move(httpHeaders)} {}
-  HttpRequest(HttpMethod httpMethod, std::string targetResource,
+  HttpRequest(HttpMethod httpMethod, std::string_view targetResource,
               HeadersMap httpHeaders, std::string requestBody)
       : method{httpMethod},
-        resource{std::move(targetResource)},
+        resource{targetResource, httpHeaders.get_allocator()},
         headers{std::move(httpHeaders)},
         body{std::move(requestBody)} {}
-  HttpRequest(HttpMethod httpMethod, std::string targetResource,
+  HttpRequest(HttpMethod httpMethod, std::string_view targetResource,
               std::string requestBody)
       : method{httpMethod},
-        resource{std::move(targetResource)},
+        resource{targetResource},
         body{std::move(requestBody)} {}
 
+  /**
+   * @brief Parse a complete request head (up to & including the empty line),
+   * followed by any body data. Does not throw on malformed input.
+   * @return kOk, or the status to reject the request with: kBadRequest,
+   * kRequestHeaderFieldsTooLarge or kHttpVersionNotSupported.
+   */
+  auto Parse(std::string_view head) -> HttpStatus;
+
   /**
    * @brief Parse HTTP data from given buffer.
    * @return A truth value if the HTTP read has read a full request. A false
-   * value if data is missing. If data is missing, another Read
-   * request can be issued to "fill in" the missing pieces, without
-   * resupplying the same data.
+   * value if data is missing or malformed (see Parse).
    */
   auto Read(const char* data, std::size_t length) -> bool;
 
@@ -73,22 +91,36 @@ class HttpRequest {
 
   auto Method() const -> HttpMethod { return method; }
 
-  auto Resource() const -> const std::string& { return resource; }
+  auto Resource() const -> const std::pmr::string& { return resource; }
 
   auto Headers() const -> const HeadersMap& { return headers; }
 
   auto Body() const -> const std::string& { return body; }
 
+  auto SetBody(std::string content) -> void { body = std::move(content); }
+
+  /**
+   * @brief File descriptor of an (unlinked) temporary file holding the body,
+   * if it was too large to keep in memory. Otherwise -1. Owned by the server
+   * and only valid while the request is being handled.
+   */
+  auto BodyFile() const -> int { return bodyFile; }
+  auto SetBodyFile(int fd) -> void { bodyFile = fd; }
+
  private:
   HttpMethod method;
-  std::string resource;
+  std::pmr::string resource;
   HeadersMap headers;
   std::string body;
+  int bodyFile = -1;
 
   friend struct ::HttpRequestEditor;
 };
 
-inline auto ParseHttpMethod(const std::string& str) -> HttpMethod {
+/**
+ * @brief Method named str, or std::nullopt if there is none.
+ */
+inline auto ParseHttpMethod(std::string_view str) -> std::optional<HttpMethod> {
   if (str == "GET") {
     return HttpMethod::GET;
   } else if (str == "POST") {
@@ -107,9 +139,8 @@ inline auto ParseHttpMethod(const std::string& str) -> HttpMethod {
     return HttpMethod::TRACE;
   } else if (str == "CONNECT") {
     return HttpMethod::CONNECT;
-  } else {
-    throw Error(std::string("Invalid HttpMethod: ") + str);
   }
+  return std::nullopt;
 }
 
 inline auto HttpMethodName(HttpMethod method) -> const char* {
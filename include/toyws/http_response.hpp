@@ -1,12 +1,21 @@
 #pragma once
 
+#include <charconv>
 #include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <unordered_map>
 #include <utility>
 
+#include "toyws/buffer_chain.hpp"
+#include "toyws/chunked_body.hpp"
 #include "toyws/error.hpp"
 #include "toyws/http_headers_map.hpp"
+#include "toyws/open_file.hpp"
 
 struct HttpResponseEditor;
 
@@ -14,16 +23,25 @@ namespace toyws {
 
 enum class HttpStatus {
   // TODO: Add more status codes
+  kSwitchingProtocols = 101,
   kOk = 200,
+  kPartialContent = 206,
   kFound = 302,
   kSeeOther = 303,
+  kNotModified = 304,
   kBadRequest = 400,
   kUnauthorized = 401,
   kForbidden = 403,
   kNotFound = 404,
+  kMethodNotAllowed = 405,
+  kPayloadTooLarge = 413,
+  kRangeNotSatisfiable = 416,
   kUnprocessableContent = 422,
+  kUpgradeRequired = 426,
   kTooManyRequests = 429,
+  kRequestHeaderFieldsTooLarge = 431,
   kInternalServerError = 500,
+  kNotImplemented = 501,
   kHttpVersionNotSupported = 505,
 };
 
@@ -40,19 +58,51 @@ class HttpStatusError : public Error {
   HttpStatus status;
 };
 
+/**
+ * @brief Reason phrase sent along with status.
+ */
+inline auto HttpStatusReason(HttpStatus status) -> const char* {
+  switch (status) {
+    case HttpStatus::kSwitchingProtocols:
+      return "Switching Protocols";
+    case HttpStatus::kOk:
+      return "OK";
+    case HttpStatus::kPartialContent:
+      return "Partial Content";
+    case HttpStatus::kNotModified:
+      return "Not Modified";
+    case HttpStatus::kRangeNotSatisfiable:
+      return "Range Not Satisfiable";
+    case HttpStatus::kUpgradeRequired:
+      return "Upgrade Required";
+    default:
+      return "ERR";
+  }
+}
+
 /**
  * @brief Structured HTTP response.
  *
  * Structured data of a HTTP response. Used to fill in HTTP response data, and
  * then write it back to the client.
+ *
+ * The headers are allocated with the allocator of the HeadersMap it is
+ * constructed with. Handlers are passed one allocated from the Arena of the
+ * connection (see HandlerContext::Allocator()).
  */
 class HttpResponse {
  public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
   /* Constructors */
   HttpResponse() = default;
   explicit HttpResponse(HttpStatus statusCode) : status{statusCode} {
     FillReason();
   }
+  HttpResponse(HttpStatus statusCode, const allocator_type& alloc)
+      : status{statusCode}, headers{alloc} {
+    FillReason();
+  }
   HttpResponse(HttpStatus statusCode, std::string reasonField)
       : status{statusCode}, reason{std::move(reasonField)} {}
   HttpResponse(HttpStatus statusCode, std::string reasonField,
@@ -78,6 +128,23 @@ class HttpResponse {
     FillReason();
   }
 
+  HttpResponse(const HttpResponse&) = default;
+  HttpResponse(HttpResponse&&) noexcept = default;
+  auto operator=(const HttpResponse&) -> HttpResponse& = default;
+
+  /**
+   * @brief Take over other along with its allocator. The usual
+   * `response = HttpResponse{...}` in a handler thus moves the headers, rather
+   * than copying them into the memory of the response it replaces.
+   */
+  auto operator=(HttpResponse&& other) noexcept -> HttpResponse& {
+    if (this != &other) {
+      std::destroy_at(this);
+      std::construct_at(this, std::move(other));
+    }
+    return *this;
+  }
+
   /**
    * @brief Write HTTP data.
    * @return Pair (finished, length) indicating if write was partial
@@ -85,6 +152,17 @@ class HttpResponse {
    */
   auto Write(char* data, std::size_t capacity) -> std::pair<bool, std::size_t>;
 
+  /**
+   * @brief Append HTTP data to out, which grows as needed.
+   */
+  auto Write(BufferChain& out) const -> void;
+
+  /**
+   * @brief Append only the status line & headers (including Content-Length
+   * for Body()) to out. For sending the body separately.
+   */
+  auto WriteHead(BufferChain& out) const -> void;
+
   /**
    * @brief Parse HTTP data from given buffer.
    * @return A truth value if the HTTP read has read a full request. A false
@@ -100,34 +178,80 @@ class HttpResponse {
 
   auto Headers() const -> const HeadersMap& { return headers; }
 
+  auto Headers() -> HeadersMap& { return headers; }
+
   auto Body() const -> const std::string& { return body; }
 
+  auto SetBody(std::string content) -> void { body = std::move(content); }
+
+  auto TakeBody() -> std::string { return std::move(body); }
+
+  /**
+   * @brief Stream the body with Transfer-Encoding: chunked instead of sending
+   * Body(), which is then ignored. Write() only writes the head; the chunks
+   * are produced as the connection drains (see BodyProducer). If the
+   * producer throws, the connection is closed with the body cut short.
+   */
+  auto SetStream(BodyProducer producer) -> void {
+    stream = std::move(producer);
+  }
+
+  auto Stream() const -> const BodyProducer& { return stream; }
+
+  auto IsStreaming() const -> bool { return static_cast<bool>(stream); }
+
+  /**
+   * @brief Send (part of) an open file as the body instead of Body(), which is
+   * then ignored. Write() only writes the head; the file is sent straight from
+   * the page cache (see Client::File()).
+   */
+  auto SetFile(FileRange range) -> void { file = std::move(range); }
+
+  auto File() const -> const FileRange& { return file; }
+
+  auto TakeFile() -> FileRange { return std::move(file); }
+
+  auto HasFile() const -> bool { return static_cast<bool>(file); }
+
  private:
   HttpStatus status;
   std::string reason;
   HeadersMap headers;
   std::string body;
+  BodyProducer stream;
+  FileRange file;
 
-  auto FillReason() -> void {
-    if (status == HttpStatus::kOk) {
-      reason = "OK";
-    } else {
-      reason = "ERR";
-    }
-  }
+  auto FillReason() -> void { reason = HttpStatusReason(status); }
 
   friend struct ::HttpResponseEditor;
 };
 
-inline auto ParseHttpStatus(const std::string& str) -> HttpStatus {
-  auto status = static_cast<HttpStatus>(std::stoi(str));
+/**
+ * @brief Status with the code in str, or std::nullopt if there is none.
+ */
+inline auto ParseHttpStatus(std::string_view str)
+    -> std::optional<HttpStatus> {
+  int code = 0;
+  const auto* last = str.data() + str.size();
+  auto [ptr, ec] = std::from_chars(str.data(), last, code);
+  if (str.empty() || ec != std::errc{} || ptr != last) {
+    return std::nullopt;
+  }
+
+  auto status = static_cast<HttpStatus>(code);
   switch (status) {
+    case HttpStatus::kSwitchingProtocols:
+      return status;
     case HttpStatus::kOk:
       return status;
+    case HttpStatus::kPartialContent:
+      return status;
     case HttpStatus::kFound:
       return status;
     case HttpStatus::kSeeOther:
       return status;
+    case HttpStatus::kNotModified:
+      return status;
     case HttpStatus::kBadRequest:
       return status;
     case HttpStatus::kUnauthorized:
@@ -136,17 +260,29 @@ inline auto ParseHttpStatus(const std::string& str) -> HttpStatus {
       return status;
     case HttpStatus::kNotFound:
       return status;
+    case HttpStatus::kMethodNotAllowed:
+      return status;
+    case HttpStatus::kPayloadTooLarge:
+      return status;
+    case HttpStatus::kRangeNotSatisfiable:
+      return status;
     case HttpStatus::kUnprocessableContent:
       return status;
+    case HttpStatus::kUpgradeRequired:
+      return status;
     case HttpStatus::kTooManyRequests:
       return status;
+    case HttpStatus::kRequestHeaderFieldsTooLarge:
+      return status;
     case HttpStatus::kInternalServerError:
       return status;
+    case HttpStatus::kNotImplemented:
+      return status;
     case HttpStatus::kHttpVersionNotSupported:
       return status;
   }
 
-  throw Error(str + " is not a valid HttpStatus");
+  return std::nullopt;
 }
 
 }  // namespace toyws
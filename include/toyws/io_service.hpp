@@ -1,23 +1,50 @@
 #pragma once
 
+#include "io_service_epoll.hpp"
 #include "io_service_uring.hpp"
 
+namespace toyws {
+
+// IoService is UringIoService, unless TOYWS_IO_EPOLL is defined (see the
+// toyws_IO_BACKEND CMake option). Both remain available by their names,
+// e.g. to compare them.
+#if defined(TOYWS_IO_EPOLL)
+template <typename Handler>
+using IoService = EpollIoService<Handler>;
+inline constexpr const char* kIoBackendName = "epoll";
+#else
+template <typename Handler>
+using IoService = UringIoService<Handler>;
+inline constexpr const char* kIoBackendName = "io_uring";
+#endif
+
+}  // namespace toyws
+
 /*
 \**
  * @brief Asynchronous Input / Output handler
  *
  * Provides Input / Output handling. Templated on "Handler" by
- * "IoServiceHandler" (see below). Directly include "io_service.cpp" into T
- * implementation instead of this file.
+ * "IoServiceHandler" (see below). Include "io_service_impl.hpp" into the
+ * translation unit that instantiates it instead of this file.
+ *
+ * Implemented by UringIoService & EpollIoService. Handler is called from
+ * Run(), never from within the call that started an operation.
  *\
 template <typename Handler>
 class IoService {
  public:
   auto Run() -> void;
 
+  // May be called from another thread. If called before Run(), that returns
+  // right away.
   auto Stop() -> void;
 
-  auto MakeListeningSocket(std::string address, uint16_t port) -> Socket;
+  // Call task from Run(). May be called from any thread.
+  auto Post(Mailbox::Task task) -> void;
+
+  auto MakeListeningSocket(const std::string& address, uint16_t port,
+                           const ListenerOptions& options = {}) -> Socket;
 
   auto AsyncAccept(Socket listeningFd) -> void;
 
@@ -27,7 +54,25 @@ class IoService {
 
   // Precondition: Client must exist in IoService already.
   //               Either via AsyncAccept() or GiveClient().
-  auto AsyncWrite(int clientSlot) -> void;
+  auto AsyncWrite(int clientSlot, AfterWrite after = AfterWrite::kOnWrite)
+      -> void;
+
+  // Send the client's Outbox(), alongside a read that may be in progress.
+  // Calls Handler::OnSent once it is empty (or dropped, if sending failed).
+  auto AsyncSend(int clientSlot) -> void;
+
+  // Shut the connection down; a read in progress completes empty
+  auto Shutdown(int clientSlot) -> void;
+
+  // Discard what the peer sends until it closes, then call Handler::OnRead
+  // with an empty Buffer(). Holds no buffer of the client's meanwhile.
+  auto AsyncWaitClose(int clientSlot) -> void;
+
+  // Client in slot, or nullptr if the slot is empty.
+  auto GetClient(int clientSlot) -> Client*;
+
+  // Slots there are, for GetClient()
+  auto SlotCount() const -> std::size_t;
 
   auto TakeClient(int clientSlot) -> std::unique_ptr<Client>;
 
@@ -36,6 +81,13 @@ class IoService {
   // Shorthand for: TakeClient() and then client.Socket().close()
   auto Close(Client* client) -> void;
 
+  // Hand a client over to a service running on another thread, which calls
+  // Handler::OnHandoff for it from its Run()
+  auto Handoff(IoService& target, std::unique_ptr<Client> client) -> void;
+
+  // Connections served. May be called from any thread.
+  auto Load() const -> std::size_t;
+
   auto SetInstance(ToyWs* parent) -> void;
   auto Instance() const -> ToyWs*;
 };
@@ -49,4 +101,8 @@ class IoService {
   static auto OnRead(IoService* service, Client* client) -> void;
 
   static auto OnWrite(IoService* service, Client* client) -> void;
+
+  static auto OnHandoff(IoService* service, Client* client) -> void;
+
+  static auto OnSent(IoService* service, Client* client) -> void;
 };*/
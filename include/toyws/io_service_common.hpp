@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+#include "toyws/buffer_chain.hpp"
+
+namespace toyws {
+
+// Slots for clients, i.e. connections and accepts waiting for one. The
+// io_uring backend starts with this many, and grows as needed.
+inline constexpr std::size_t kClientSlots = 80;
+// How much to read at most per read operation
+inline constexpr std::size_t kReadSize = 2 * kSegmentSize;
+// What AsyncWaitClose() reads at most at once, to discard
+inline constexpr std::size_t kDiscardSize = 512;
+// Writes at least this large are sent with zero-copy send by default
+inline constexpr std::size_t kZeroCopyThreshold = 64 * 1024;
+// A lingering connection is closed once the peer sends nothing for this long,
+// or after this long in total.
+inline constexpr std::chrono::seconds kLingerTimeout{5};
+inline constexpr std::chrono::seconds kLingerTime{30};
+// An accept that failed for want of descriptors (or memory) is tried again
+// after this long, rather than at once, when it would fail again
+inline constexpr std::chrono::milliseconds kAcceptBackoff{100};
+
+/**
+ * @brief What AsyncWrite() does once all is written.
+ */
+enum class AfterWrite {
+  // Call Handler::OnWrite
+  kOnWrite = 0,
+  // Close the connection. If the write fits into a single send, the close is
+  // linked to it, and needs no extra round through Run().
+  kClose,
+  // Shut down the sending side, then read (and discard) whatever the peer
+  // still sends before closing, e.g. the rest of a rejected request body.
+  // Closing with unread data would reset the connection, and the peer might
+  // lose the response.
+  kLinger,
+};
+
+}  // namespace toyws
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "toyws/async_io.hpp"
+#include "toyws/buffer_chain.hpp"
+#include "toyws/client_pool.hpp"
+#include "toyws/connection_table.hpp"
+#include "toyws/io_service_common.hpp"
+#include "toyws/listener.hpp"
+#include "toyws/mailbox.hpp"
+#include "toyws/metrics.hpp"
+#include "toyws/socket.hpp"
+
+namespace toyws {
+
+class Client;
+class ToyWs;
+
+// Events taken per epoll_wait()
+inline constexpr int kEpollEvents = 64;
+// Set in the epoll data (& ready keys) of listening sockets, along with their
+// index. Those of connections hold the slot, and the socket in the upper half.
+inline constexpr std::uint64_t kListenerFlag = std::uint64_t{1} << 63;
+// The epoll data of the Mailbox's eventfd
+inline constexpr std::uint64_t kMailboxKey = std::uint64_t{1} << 62;
+
+/**
+ * @brief IoService on edge-triggered epoll, for hosts where io_uring is not
+ * available (e.g. disabled by seccomp or sysctl).
+ *
+ * Implements the same Handler contract as UringIoService. Sockets are made
+ * nonblocking and registered once, for both directions. An operation is
+ * attempted right away if its direction is known to be ready, and otherwise
+ * once epoll reports it; either way, the Handler is called from Run(). Files
+ * are sent with sendfile(). File I/O for handlers (AsyncFileIo) blocks, as
+ * regular files are always ready, but its completions are called from Run()
+ * as well.
+ */
+template <typename Handler>
+class EpollIoService : public AsyncFileIo {
+ public:
+  explicit EpollIoService();
+
+  ~EpollIoService() override;
+
+  EpollIoService(const EpollIoService&) = delete;
+  auto operator=(const EpollIoService&) -> EpollIoService& = delete;
+
+  auto Run() -> void;
+
+  // Also wakes up Run(), so it may be called from another thread
+  auto Stop() -> void;
+
+  // Call task from Run(), on the ring's thread. May be called from any
+  // thread.
+  auto Post(Mailbox::Task task) -> void { mailbox.Post(std::move(task)); }
+
+  auto MakeListeningSocket(const std::string& address, uint16_t port,
+                           const ListenerOptions& options = {}) -> Socket;
+
+  // The listening socket is made nonblocking
+  auto AsyncAccept(Socket listeningFd) -> void;
+
+  // Precondition: Client must exist in IoService already.
+  //               Either via AsyncAccept() or GiveClient().
+  auto AsyncRead(int clientSlot) -> void;
+
+  // Precondition: Client must exist in IoService already.
+  //               Either via AsyncAccept() or GiveClient().
+  // Writes the client's Buffer() followed by its Output() & File(), if any.
+  // None may be modified until OnWrite. With AfterWrite::kClose or kLinger,
+  // OnWrite is not called and the client is gone once the write is done.
+  auto AsyncWrite(int clientSlot, AfterWrite after = AfterWrite::kOnWrite)
+      -> void;
+
+  // Send the client's Outbox() alongside a read, see UringIoService
+  auto AsyncSend(int clientSlot) -> void;
+
+  // Shut the connection down in both directions; a read completes empty
+  auto Shutdown(int clientSlot) -> void;
+
+  // Wait for the peer to close without a read buffer, see UringIoService
+  auto AsyncWaitClose(int clientSlot) -> void;
+
+  // There is no zero-copy send on this backend, but handlers still hand
+  // bodies of this size over as Output() rather than copying them.
+  auto ZeroCopyThreshold() const -> std::size_t { return zeroCopyThreshold; }
+  auto SetZeroCopyThreshold(std::size_t bytes) -> void {
+    zeroCopyThreshold = bytes;
+  }
+
+  // AsyncFileIo; completions are called from Run()
+  auto Open(std::string path, int flags, OpenCallback done) -> void override;
+
+  auto OpenBeneath(int dirFd, std::string path, int flags, OpenCallback done)
+      -> void override;
+
+  auto Read(int fd, std::uint64_t offset, std::size_t length,
+            ReadCallback done) -> void override;
+
+  auto Write(int fd, std::uint64_t offset, std::string data,
+             WriteCallback done) -> void override;
+
+  auto Stat(std::string path, StatCallback done) -> void override;
+
+  auto StatFile(int fd, StatCallback done) -> void override;
+
+  auto CloseFile(int fd) -> void override;
+
+  auto GetClient(int clientSlot) -> Client* {
+    return clients[static_cast<std::size_t>(clientSlot)].get();
+  }
+
+  // Tag of the client now in clientSlot, to find it by later even if it may
+  // be gone meanwhile
+  auto ClientTag(int clientSlot) const -> OpTag {
+    return table.Tag(OpKind::kUntracked,
+                     static_cast<std::uint32_t>(clientSlot));
+  }
+
+  // Client tagged with tag (see ClientTag()), or nullptr if it is gone, even
+  // if its slot holds another client now
+  auto GetClient(OpTag tag) -> Client* {
+    return table.IsCurrent(tag) ? clients[tag.Slot()].get() : nullptr;
+  }
+
+  // Slots there are, so that all clients can be visited with GetClient()
+  auto SlotCount() const -> std::size_t { return clients.size(); }
+
+  auto TakeClient(int clientSlot) -> std::unique_ptr<Client>;
+
+  // The client's socket is made nonblocking
+  auto GiveClient(std::unique_ptr<Client> client) -> void;
+
+  // Shorthand for: TakeClient() and then client.Socket().close()
+  auto Close(Client* client) -> void;
+
+  // Hand client (see TakeClient()) over to target, a service running on
+  // another thread, through target's mailbox. client must have no operation
+  // in progress. target adopts it from its Run(), and calls
+  // Handler::OnHandoff.
+  auto Handoff(EpollIoService& target, std::unique_ptr<Client> client)
+      -> void;
+
+  // Connections served, including those handed over to this service that have
+  // yet to arrive. May be called from any thread.
+  auto Load() const -> std::size_t {
+    return connections.load(std::memory_order_relaxed) +
+           incoming.load(std::memory_order_relaxed);
+  }
+
+  auto SetInstance(ToyWs* parent) -> void { parentInst = parent; }
+  auto Instance() const -> ToyWs* { return parentInst; }
+
+  // cqes & cqeBatches count events & the epoll_wait() calls returning them
+  auto Metrics() -> RingMetrics& { return metrics; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  int epollFd = -1;
+  // Set by Stop(), possibly before Run() or on another thread, and cleared
+  // once Run() returns
+  std::atomic<bool> stopping = false;
+  auto Stopping() const -> bool {
+    return stopping.load(std::memory_order_relaxed);
+  }
+
+  ClientPool clientPool;
+  SegmentPool segmentPool;
+  // Which slots are free; clients & slots grow along with it. Only its free
+  // list is used, as events are told from those of an earlier connection in
+  // the slot by their socket.
+  ConnectionTable table;
+  std::vector<std::unique_ptr<Client>> clients;
+
+  // State of the connection in a slot, besides its Client
+  struct SlotState {
+    // Whether the socket is known to be ready. Set by epoll, and cleared
+    // once an attempt finds that it is not.
+    bool readable = false;
+    bool writable = false;
+    bool peerClosed = false;  // Reads return 0 from now on
+    bool queued = false;      // In ready
+    bool sending = false;     // Of the outbox, see AsyncSend()
+    std::vector<iovec> sendIovecs;
+    // Write in progress
+    std::size_t sent = 0;
+    std::size_t total = 0;
+    std::uint64_t fileSent = 0;
+    AfterWrite after = AfterWrite::kOnWrite;
+    std::vector<iovec> iovecs;
+    Clock::time_point lingerStart;
+    Clock::time_point lingerLast;  // When the peer last sent anything
+  };
+  std::vector<SlotState> slots;
+
+  // A listening socket, and the slots waiting for a connection from it
+  struct Acceptor {
+    Socket fd = -1;
+    bool readable = true;
+    bool queued = false;
+    std::deque<std::size_t> waiting;
+  };
+  std::vector<Acceptor> acceptors;
+
+  // Keys (see kListenerFlag) of what to attempt on the next round
+  std::deque<std::uint64_t> ready;
+  // Completions of file I/O, & tasks posted to the mailbox, to call on the
+  // next round
+  std::deque<std::function<void()>> completions;
+  Mailbox mailbox;
+
+  // Written by the service's thread, except incoming by those handing over
+  std::atomic<std::size_t> connections = 0;
+  std::atomic<std::size_t> incoming = 0;
+
+  std::size_t lingering = 0;
+  Clock::time_point lingerDeadline = Clock::time_point::max();
+  std::size_t zeroCopyThreshold = kZeroCopyThreshold;
+
+  ToyWs* parentInst = nullptr;
+  RingMetrics metrics;
+
+  // Attempt what was ready at the start of the round, so that a busy
+  // connection can't hold up the others. Then call file I/O completions.
+  auto RunReady() -> void;
+
+  // Milliseconds for epoll_wait() to wait, up to the next linger deadline
+  auto WaitTimeout() -> int;
+
+  auto HandleEvent(const epoll_event& event) -> void;
+
+  auto Queue(std::uint64_t key) -> void;
+
+  // Register a connection's (nonblocking) socket, for both directions
+  auto Register(std::size_t slot, Socket sock) -> bool;
+
+  // Index of the Acceptor of listeningFd, registering it on first use
+  auto FindAcceptor(Socket listeningFd) -> std::size_t;
+
+  // Accept one connection, if both it and a waiting slot are there
+  auto TryAccept(std::size_t index) -> void;
+
+  // Attempt the operation the client in slot is in (see Client::States)
+  auto TryOperation(std::size_t slot) -> void;
+
+  auto TryRead(std::size_t slot) -> void;
+
+  // Write until done, or the socket is full
+  auto TryWrite(std::size_t slot) -> void;
+
+  // Send the outbox until it is empty, or the socket is full
+  auto TrySend(std::size_t slot) -> void;
+
+  auto TrySendFile(std::size_t slot) -> void;
+
+  // Once all is written: call OnWrite, close or linger
+  auto FinishWrite(std::size_t slot) -> void;
+
+  // Read & discard what a lingering peer sends
+  auto TryDrain(std::size_t slot) -> void;
+
+  // Read & discard what the peer sends, until it closes
+  auto TryWaitClose(std::size_t slot) -> void;
+
+  // Close lingering connections past their deadline, & find the next one
+  auto ExpireLinger() -> void;
+
+  // Free slot for a client, with its state reset
+  auto AcquireSlot() -> std::size_t;
+
+  // Forget the state of slot, once its client is gone, and free it
+  auto Release(std::size_t slot) -> void;
+
+  // Take in a connection handed over by another service
+  auto Adopt(std::unique_ptr<Client> client) -> void;
+};
+
+}  // namespace toyws
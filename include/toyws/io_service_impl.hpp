@@ -1,3 +1,4 @@
 #pragma once
 
+#include "io_service_epoll.cpp"  // NOLINT(bugprone-suspicious-include)
 #include "io_service_uring.cpp"  // NOLINT(bugprone-suspicious-include)
@@ -1,14 +1,32 @@
 #pragma once
 
 #include <liburing.h>
-#include <netinet/in.h>
+#include <linux/openat2.h>
 #include <sys/uio.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "toyws/async_io.hpp"
+#include "toyws/buffer_chain.hpp"
 #include "toyws/client_pool.hpp"
+#include "toyws/connection_table.hpp"
+#include "toyws/io_service_common.hpp"
+#include "toyws/listener.hpp"
+#include "toyws/mailbox.hpp"
+#include "toyws/metrics.hpp"
 #include "toyws/socket.hpp"
 
 namespace toyws {
@@ -16,24 +34,48 @@ namespace toyws {
 class Client;
 class ToyWs;
 
-inline constexpr int kAcceptQueue = 5;
 inline constexpr int kSqSize = 16;
 inline constexpr int kCqSize = 64;
-
+// Default of IoService::SubmitLatency()
+inline constexpr std::chrono::microseconds kSubmitLatency{50};
+// Completions handled between checks against SubmitThreshold(), which reads
+// the clock
+inline constexpr unsigned kSubmitCheckInterval = 8;
+// Weight of the latest batch in the moving average of batch sizes, as 1/this
+inline constexpr unsigned kBatchAverageWeight = 8;
+// Capacity requested for the pipes that files are spliced through
+inline constexpr int kSplicePipeSize = 1024 * 1024;
+// Buffers registered with the ring for file reads up to their size
+inline constexpr std::size_t kFixedBufferSize = 64 * 1024;
+inline constexpr unsigned kFixedBufferCount = 8;
+/**
+ * @brief IoService on io_uring. Operations are submitted to the ring in
+ * batches, and complete with a call to the Handler from Run().
+ *
+ * The user_data of every SQE is an OpTag, by which its completion is
+ * dispatched, and checked against the ConnectionTable before anything else
+ * of the connection is touched.
+ */
 template <typename Handler>
-class IoService {
+class UringIoService : public AsyncFileIo {
  public:
-  explicit IoService();
+  explicit UringIoService();
 
-  ~IoService();
+  ~UringIoService() override;
 
   // TODO: prevent copying, etc
 
   auto Run() -> void;
 
+  // Also wakes up Run(), so it may be called from another thread
   auto Stop() -> void;
 
-  auto MakeListeningSocket(std::string address, uint16_t port) -> Socket;
+  // Call task from Run(), on the ring's thread. May be called from any
+  // thread.
+  auto Post(Mailbox::Task task) -> void { mailbox.Post(std::move(task)); }
+
+  auto MakeListeningSocket(const std::string& address, uint16_t port,
+                           const ListenerOptions& options = {}) -> Socket;
 
   auto AsyncAccept(Socket listeningFd) -> void;
 
@@ -43,49 +85,356 @@ class IoService {
 
   // Precondition: Client must exist in IoService already.
   //               Either via AsyncAccept() or GiveClient().
-  auto AsyncWrite(int clientSlot) -> void;
+  // Writes the client's Buffer() followed by its Output() & File(), if any.
+  // None may be modified until OnWrite. With AfterWrite::kClose or kLinger,
+  // OnWrite is not called and the client is gone once the write is done.
+  auto AsyncWrite(int clientSlot, AfterWrite after = AfterWrite::kOnWrite)
+      -> void;
+
+  // Send the client's Outbox() in order, alongside a read that may be in
+  // progress; Buffer() is not touched. What is queued meanwhile is sent as
+  // well, until the outbox is empty, which calls Handler::OnSent. If sending
+  // fails, the outbox is dropped, the connection is shut down (so that a read
+  // in progress ends) and OnSent is called all the same. Does nothing while a
+  // send is in progress.
+  auto AsyncSend(int clientSlot) -> void;
+
+  // Shut the connection down in both directions, so that what is in progress
+  // on it ends: a read completes empty, as if the peer closed.
+  auto Shutdown(int clientSlot) -> void;
+
+  // Wait for the peer to close, discarding what it sends, then call
+  // Handler::OnRead with an empty Buffer(). For long-lived responses the peer
+  // sends nothing on (e.g. event streams), alongside AsyncSend(): the buffer
+  // is released rather than held by a read, and what is discarded is read
+  // into a buffer all such connections share.
+  auto AsyncWaitClose(int clientSlot) -> void;
+
+  // How long SQEs prepared while handling a batch of completions may wait to
+  // be submitted, before the batch is done, on a fully loaded ring. Zero
+  // submits at every check that finds any prepared.
+  auto SubmitLatency() const -> std::chrono::microseconds {
+    return submitLatency;
+  }
+  auto SetSubmitLatency(std::chrono::microseconds latency) -> void {
+    submitLatency = latency;
+  }
+
+  // The wait in effect: SubmitLatency() scaled by the load, as a moving
+  // average of the completions per batch against kCqSize. A lightly loaded
+  // ring submits what a burst prepares almost right away, for latency; a busy
+  // one lets it wait longer, for fewer & larger submits. Checked every
+  // kSubmitCheckInterval completions, so it may be exceeded by the time those
+  // take.
+  auto SubmitThreshold() const -> std::chrono::nanoseconds {
+    return std::chrono::nanoseconds{submitLatency} *
+           std::min<unsigned>(batchAverage, kCqSize * kBatchAverageScale) /
+           (kCqSize * kBatchAverageScale);
+  }
+
+  // Writes of at least this many bytes use zero-copy send (if supported by
+  // the kernel & socket). SIZE_MAX disables zero-copy send.
+  auto ZeroCopyThreshold() const -> std::size_t { return zeroCopyThreshold; }
+  auto SetZeroCopyThreshold(std::size_t bytes) -> void {
+    zeroCopyThreshold = bytes;
+  }
+
+  // AsyncFileIo; completions are called from Run()
+  auto Open(std::string path, int flags, OpenCallback done) -> void override;
+
+  auto OpenBeneath(int dirFd, std::string path, int flags, OpenCallback done)
+      -> void override;
+
+  auto Read(int fd, std::uint64_t offset, std::size_t length,
+            ReadCallback done) -> void override;
+
+  auto Write(int fd, std::uint64_t offset, std::string data,
+             WriteCallback done) -> void override;
+
+  auto Stat(std::string path, StatCallback done) -> void override;
+
+  auto StatFile(int fd, StatCallback done) -> void override;
+
+  auto CloseFile(int fd) -> void override;
+
+  auto GetClient(int clientSlot) -> Client* {
+    return clients[static_cast<std::size_t>(clientSlot)].get();
+  }
+
+  // Tag of the client now in clientSlot, to find it by later even if it may
+  // be gone meanwhile
+  auto ClientTag(int clientSlot) const -> OpTag {
+    return table.Tag(OpKind::kUntracked,
+                     static_cast<std::uint32_t>(clientSlot));
+  }
+
+  // Client tagged with tag (see ClientTag()), or nullptr if it is gone, even
+  // if its slot holds another client now
+  auto GetClient(OpTag tag) -> Client* {
+    return table.IsCurrent(tag) ? clients[tag.Slot()].get() : nullptr;
+  }
+
+  // Slots there are, so that all clients can be visited with GetClient()
+  auto SlotCount() const -> std::size_t { return clients.size(); }
 
   auto TakeClient(int clientSlot) -> std::unique_ptr<Client>;
 
   auto GiveClient(std::unique_ptr<Client> client) -> void;
 
-  // Shorthand for: TakeClient() and then client.Socket().close()
+  // Shorthand for: TakeClient() and then client.Socket().close(), except that
+  // the socket is closed asynchronously on the ring. Not while a read is in
+  // progress. A send in progress is cut short, and the client stays in its
+  // slot until the kernel is done with it.
   auto Close(Client* client) -> void;
 
+  // Hand client (see TakeClient()) over to target, a service running on
+  // another thread, with a message from this ring to its ring. client must
+  // have no operation in progress. target adopts it from its Run(), and calls
+  // Handler::OnHandoff.
+  auto Handoff(UringIoService& target, std::unique_ptr<Client> client)
+      -> void;
+
+  // Connections served, including those handed over to this service that have
+  // yet to arrive. May be called from any thread.
+  auto Load() const -> std::size_t {
+    return connections.load(std::memory_order_relaxed) +
+           incoming.load(std::memory_order_relaxed);
+  }
+
   auto SetInstance(ToyWs* parent) -> void { parentInst = parent; }
   auto Instance() const -> ToyWs* { return parentInst; }
 
+  auto Metrics() -> RingMetrics& { return metrics; }
+
  private:
   io_uring ring = {};
-  sockaddr_in clientName = {};
-  unsigned int clientNameLen = sizeof(sockaddr_in);
+  using Clock = std::chrono::steady_clock;
+
   int submissions = 0;
-  bool submitAlways = true;
-  bool running = false;
+  Clock::time_point pendingSince;  // When the oldest unsubmitted SQE was
+  std::chrono::microseconds submitLatency = kSubmitLatency;
+  // Completions per batch, averaged, in 1/kBatchAverageScale
+  static constexpr unsigned kBatchAverageScale = 16;
+  unsigned batchAverage = 0;
+  // Set by Stop(), possibly before Run() or on another thread, and cleared
+  // once Run() returns
+  std::atomic<bool> stopping = false;
+  auto Stopping() const -> bool {
+    return stopping.load(std::memory_order_relaxed);
+  }
 
   ClientPool clientPool;
-  std::size_t nextClientSlot = 0;
+  SegmentPool segmentPool;
+  // Connections by slot: what every completion looks at in table, the rest
+  // in clients & writes, which grow along with it
+  ConnectionTable table;
   std::vector<std::unique_ptr<Client>> clients;
-  std::vector<iovec> bufferDescriptors;
+
+  // State of the write in progress on a slot
+  struct WriteState {
+    std::size_t sent = 0;
+    std::size_t total = 0;
+    // Zero-copy sends complete twice: once when sent, and again (with
+    // IORING_CQE_F_NOTIF) when the kernel no longer references the data.
+    bool zeroCopy = false;
+    bool sendDone = false;
+    int notifications = 0;
+    std::vector<iovec> iovecs;
+    msghdr message = {};
+    // Client::File() is sent in rounds of a linked pair of splices: from the
+    // file into a pipe, and from the pipe into the socket.
+    std::uint64_t fileRead = 0;  // Spliced into the pipe
+    std::size_t piped = 0;       // In the pipe, not yet sent
+    int splices = 0;             // Splices of this round in flight
+    int spliceIn = 0;            // Results of this round
+    int spliceOut = 0;
+    int pipeFds[2] = {-1, -1};
+    std::size_t pipeCapacity = 0;
+    AfterWrite after = AfterWrite::kOnWrite;
+    // What comes after is linked to the write's single send
+    bool linked = false;
+    // The connection is closed once the kernel is done with the data
+    bool failed = false;
+    std::chrono::steady_clock::time_point lingerStart;
+  };
+  // A deque, so that the messages SQEs point to stay put when the table grows
+  std::deque<WriteState> writes;
+
+  // State of the send of the outbox on a slot, see AsyncSend()
+  struct SendState {
+    bool active = false;
+    bool closing = false;  // Close() once it completes
+    std::vector<iovec> iovecs;
+    msghdr message = {};
+  };
+  std::deque<SendState> sends;
+  std::size_t zeroCopyThreshold = kZeroCopyThreshold;
+  bool zeroCopySupported = true;
+
+  struct FreeDeleter {
+    auto operator()(char* ptr) const -> void { std::free(ptr); }
+  };
+  using AlignedBuffer = std::unique_ptr<char[], FreeDeleter>;
+
+  // File I/O in flight, indexed by the user_data of its SQE
+  struct DiskOp {
+    std::function<void(int, DiskOp&)> complete;
+    std::string path;
+    open_how how = {};  // Read by the kernel once submitted
+    struct statx info = {};
+    char* data = nullptr;
+    std::string written;  // What a write writes
+    AlignedBuffer buffer;  // When no registered buffer is free
+    int fixedBuffer = -1;
+  };
+  std::vector<std::unique_ptr<DiskOp>> diskOps;
+  std::vector<std::size_t> freeDiskOps;
+  AlignedBuffer fixedBuffers;
+  std::vector<int> freeFixedBuffers;
+
+  // Where AsyncWaitClose() reads to, overwritten by every such read
+  std::array<char, kDiscardSize> discard;
+  // Shared by all link timeouts, read when submitted
+  __kernel_timespec lingerTimeout = {.tv_sec = kLingerTimeout.count(),
+                                     .tv_nsec = 0};
+  __kernel_timespec acceptBackoff = {
+      .tv_sec = 0,
+      .tv_nsec =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(kAcceptBackoff)
+              .count()};
+
+  // SQEs prepared while the SQ was full, in order
+  std::deque<io_uring_sqe> overflow;
+
+  Mailbox mailbox;
+
+  // Written by the ring's thread, except incoming by those handing over
+  std::atomic<std::size_t> connections = 0;
+  std::atomic<std::size_t> incoming = 0;
+  // Handoffs whose message has not completed, by the sequence number their
+  // completion carries. Not by the Client's address, which may be reused once
+  // the target is done with the Client, before that completion arrives.
+  struct SentHandoff {
+    Client* client;
+    UringIoService* target;
+  };
+  std::unordered_map<std::uint64_t, SentHandoff> handoffs;
+  std::uint64_t handoffSequence = 0;
+  bool msgRingSupported = true;
 
   ToyWs* parentInst;
+  RingMetrics metrics;
 
   auto CreateIoRing() -> void;
 
-  auto ShouldSubmit() const -> bool {
-    return submitAlways || submissions >= kSqSize;
-  }
-
+  // Count a prepared SQE. SQEs are submitted in batches by Run(), or by
+  // GetSqe() once the SQ has no room for more.
   auto Submit() -> void {
-    ++submissions;
-    if (ShouldSubmit()) {
-      ForceSubmit();
+    if (submissions++ == 0) {
+      pendingSince = Clock::now();
     }
   }
 
+  // Submit what is prepared, then what of the overflow queue fits
   auto ForceSubmit() -> void;
 
+  // SQE to prepare, ahead of count - 1 more that are linked to it. If the SQ
+  // has no room for them even after submitting, they are parked in the
+  // overflow queue until it does. Never null.
+  auto GetSqe(unsigned count = 1) -> io_uring_sqe*;
+
+  auto DrainOverflow() -> void;
+
+  // SQEs that PrepareAfterWrite() prepares
+  static constexpr auto ChainLength(AfterWrite after) -> unsigned {
+    return after == AfterWrite::kLinger ? 3 : 1;
+  }
+
+  // Slot for a client, in which it is tagged with a new generation
+  auto AcquireSlot() -> std::uint32_t;
+
+  // Forget the client in slot. Completions still in flight on it are stale.
+  auto ReleaseSlot(std::size_t slot) -> void;
+
+  auto Tag(OpKind kind, std::size_t slot) const -> std::uint64_t {
+    return table.Tag(kind, static_cast<std::uint32_t>(slot)).Value();
+  }
+
+  // Prepare write of what remains of the client's buffer & output, & submit
+  auto PrepareWrite(std::size_t slot) -> void;
+
   auto HandleCqe(io_uring_cqe* cqe) -> void;
+
+  // Prepare the poll that completes once something is posted to the mailbox
+  auto ArmMailbox() -> void;
+
+  // Call what was posted, & poll again
+  auto HandleMailboxCqe() -> void;
+
+  // Handle a connection arriving from another ring, or the completion of one
+  // sent there
+  auto HandleHandoffCqe(io_uring_cqe* cqe) -> void;
+
+  // Hand client over through target's mailbox, rather than with a message
+  // between the rings
+  auto PostHandoff(UringIoService& target, std::unique_ptr<Client> client)
+      -> void;
+
+  // Take in a connection handed over by another ring
+  auto Adopt(std::unique_ptr<Client> client) -> void;
+
+  // Prepare send of what remains of the client's outbox, & submit
+  auto PrepareSend(std::size_t slot) -> void;
+
+  // Handle completion of (part of) a send. Calls OnSent once the outbox is
+  // empty.
+  auto HandleSendCqe(io_uring_cqe* cqe, std::size_t slot) -> void;
+
+  // Read into discard, to learn when the peer closes
+  auto PrepareWaitClose(std::size_t slot) -> void;
+
+  // Handle completion of (part of) a write. Calls OnWrite once all is written
+  // and no longer referenced by the kernel.
+  auto HandleWriteCqe(io_uring_cqe* cqe, std::size_t slot) -> void;
+
+  // Prepare what follows the write per WriteState::after, linked to the
+  // SQE before. Returns the number of SQEs prepared.
+  auto PrepareAfterWrite(std::size_t slot) -> int;
+
+  // Prepare shutdown of the sending side, then a drain read. Returns the
+  // number of SQEs prepared.
+  auto PrepareLinger(std::size_t slot) -> int;
+
+  // Prepare a read of a lingering connection, bounded by kLingerTimeout.
+  // Returns the number of SQEs prepared.
+  auto PrepareDrain(std::size_t slot) -> int;
+
+  // Once all is written (and spliced): call OnWrite, close or linger
+  auto FinishWrite(std::size_t slot) -> void;
+
+  auto HandleLingerCqe(io_uring_cqe* cqe, std::size_t slot) -> void;
+
+  // Prepare & submit the next round of splices of the client's file
+  auto PrepareSplice(std::size_t slot) -> void;
+
+  // Handle completion of a splice. Calls OnWrite once the file is sent.
+  auto HandleSpliceCqe(io_uring_cqe* cqe, OpKind kind, std::size_t slot)
+      -> void;
+
+  static auto ClosePipe(WriteState& write) -> void;
+
+  auto RegisterFixedBuffers() -> void;
+
+  // Open() relative to dirFd
+  auto OpenAt(int dirFd, std::string path, int flags, OpenCallback done)
+      -> void;
+
+  // Index of an unused DiskOp
+  auto AcquireDiskOp() -> std::size_t;
+
+  auto SubmitDiskOp(io_uring_sqe* sqe, std::size_t index) -> void;
+
+  auto HandleDiskCqe(io_uring_cqe* cqe, std::size_t index) -> void;
 };
 
 }  // namespace toyws
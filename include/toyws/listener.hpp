@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "toyws/socket.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+// Prefix of addresses naming a UNIX domain socket, e.g. "unix:/run/toyws.sock"
+inline constexpr std::string_view kUnixAddressPrefix = "unix:";
+
+struct ListenerOptions {
+  // Length of the accept queue. Capped by net.core.somaxconn.
+  int backlog = SOMAXCONN;
+  // Disable Nagle's algorithm. Set on the listening socket, from which
+  // accepted sockets inherit it.
+  bool noDelay = true;
+  // Don't complete accepts until data arrives, for up to this long
+  // (TCP_DEFER_ACCEPT). Zero disables.
+  std::chrono::seconds deferAccept{0};
+  // Length of the queue of pending TCP Fast Open requests. Zero disables.
+  int fastOpenQueue = 0;
+  // SO_SNDBUF & SO_RCVBUF of accepted sockets. Zero keeps the kernel's
+  // default (and autotuning).
+  int sendBufferSize = 0;
+  int receiveBufferSize = 0;
+  // Accept IPv4 connections on IPv6 addresses as well, e.g. on "::"
+  bool dualStack = true;
+  // Allow more sockets to listen on the same address & port (SO_REUSEPORT),
+  // e.g. one per ring. The kernel spreads connections over them by hash.
+  bool reusePort = false;
+  // Permissions of a UNIX domain socket file. Zero keeps those of the umask.
+  unsigned unixMode = 0;
+};
+
+/**
+ * @brief Create a socket listening on address & port.
+ *
+ * address is an IPv4 address ("127.0.0.1"), an IPv6 address ("::1") or a
+ * path prefixed with kUnixAddressPrefix, in which case port is ignored. A
+ * stale socket file at the path is replaced. Port 0 binds an ephemeral port.
+ *
+ * Throws Error on failure.
+ */
+TOYWS_EXPORT auto MakeListeningSocket(const std::string& address,
+                                      std::uint16_t port,
+                                      const ListenerOptions& options = {})
+    -> Socket;
+
+/**
+ * @brief Port a TCP socket is bound to, e.g. after binding port 0.
+ */
+TOYWS_EXPORT auto LocalPort(Socket sock) -> std::uint16_t;
+
+}  // namespace toyws
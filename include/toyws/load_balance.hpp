@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <span>
+
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief When a ring hands a connection it accepted over to another ring (see
+ * ToyWs::SetRings). Loads are the connections each ring serves.
+ */
+struct LoadBalanceOptions {
+  bool enabled = true;
+  // Hand over to the least loaded ring once this ring has this many more
+  // connections than it. Handing over costs a message between the rings, so
+  // small differences are not worth it.
+  std::size_t minImbalance = 4;
+};
+
+/**
+ * @brief Ring (index into loads) that ring self should hand its latest
+ * connection over to, if any. loads[self] includes that connection.
+ */
+TOYWS_EXPORT auto PickHandoffTarget(std::span<const std::size_t> loads,
+                                    std::size_t self,
+                                    const LoadBalanceOptions& options)
+    -> std::optional<std::size_t>;
+
+}  // namespace toyws
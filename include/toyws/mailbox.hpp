@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Tasks posted to an IoService from other threads, e.g. responses of
+ * handlers run on a WorkerPool.
+ *
+ * The IoService waits for Fd() (an eventfd) to be readable along with its
+ * sockets, and then calls TakeAll().
+ */
+class TOYWS_EXPORT Mailbox {
+ public:
+  using Task = std::function<void()>;
+
+  Mailbox();
+
+  ~Mailbox();
+
+  Mailbox(const Mailbox&) = delete;
+  auto operator=(const Mailbox&) -> Mailbox& = delete;
+
+  /**
+   * @brief Nonblocking eventfd, readable once something is posted.
+   */
+  auto Fd() const -> int { return eventFd; }
+
+  /**
+   * @brief Thread-safe. Only the first post since the last TakeAll() writes
+   * to the eventfd.
+   */
+  auto Post(Task task) -> void;
+
+  /**
+   * @brief Make Fd() readable without posting anything, e.g. to have the
+   * IoService notice Stop(). Async-signal-safe.
+   */
+  auto Wake() -> void;
+
+  /**
+   * @brief Everything posted so far, oldest first. Makes Fd() unreadable,
+   * until the next post (or Wake()).
+   */
+  auto TakeAll() -> std::vector<Task>;
+
+ private:
+  int eventFd = -1;
+  std::mutex mutex;  // Guards tasks
+  std::vector<Task> tasks;
+};
+
+}  // namespace toyws
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "toyws/cache_line.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Monotonic counter with a single writer.
+ *
+ * Only the owning thread may call Add(), which therefore avoids a locked
+ * read-modify-write. Any thread may call Value().
+ */
+class Counter {
+ public:
+  auto Add(std::uint64_t n = 1) -> void {
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  auto Value() const -> std::uint64_t {
+    return value.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<std::uint64_t> value = 0;
+};
+
+/**
+ * @brief Log-bucketed histogram (HDR style) with a single writer.
+ *
+ * Each power of two is split into kSubBuckets linear sub-buckets, so the
+ * relative error of any recorded value is at most 1 / kSubBuckets. Values at
+ * or above 2^kMaxBits are clamped into the last bucket.
+ */
+class LogHistogram {
+ public:
+  static constexpr int kSubBucketBits = 2;
+  static constexpr std::uint64_t kSubBuckets = 1U << kSubBucketBits;
+  static constexpr int kMaxBits = 36;
+  static constexpr std::size_t kBucketCount =
+      (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+  auto Record(std::uint64_t value) -> void {
+    buckets[BucketIndex(value)].Add();
+    sum.Add(value);
+  }
+
+  auto BucketValue(std::size_t bucket) const -> std::uint64_t {
+    return buckets[bucket].Value();
+  }
+
+  auto Sum() const -> std::uint64_t { return sum.Value(); }
+
+  static constexpr auto BucketIndex(std::uint64_t value) -> std::size_t {
+    if (value < kSubBuckets) {
+      return static_cast<std::size_t>(value);
+    }
+    const int msb = static_cast<int>(std::bit_width(value)) - 1;
+    if (msb >= kMaxBits) {
+      return kBucketCount - 1;
+    }
+    const auto shift = msb - kSubBucketBits;
+    const auto sub = (value >> shift) & (kSubBuckets - 1);
+    return static_cast<std::size_t>(static_cast<std::uint64_t>(shift + 1) *
+                                        kSubBuckets +
+                                    sub);
+  }
+
+  /**
+   * @brief Largest value that is recorded into given bucket.
+   */
+  static constexpr auto BucketUpperBound(std::size_t bucket)
+      -> std::uint64_t {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    const auto shift = bucket / kSubBuckets - 1;
+    const auto sub = bucket % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+  }
+
+ private:
+  std::array<Counter, kBucketCount> buckets;
+  Counter sum;
+};
+
+/**
+ * @brief Metrics of a single ring (IoService, or its epoll counterpart) and
+ * the requests it served.
+ *
+ * Padded to a cache line so that rings never write to the same line. Only the
+ * ring's own thread writes; MetricsRegistry reads without locking.
+ */
+struct alignas(kCacheLineSize) RingMetrics {
+  // IoService
+  Counter accepts;
+  Counter reads;
+  Counter bytesRead;
+  Counter writes;
+  Counter bytesWritten;
+  Counter cqes;
+  Counter cqeBatches;
+  Counter batchSubmits;  // Submits in the middle of a batch of completions
+  Counter sqFull;
+  Counter sqOverflows;  // SQEs parked until the SQ had room
+  Counter cqeErrors;
+  Counter staleCqes;       // Completions for connections gone meanwhile
+  Counter zeroCopyWrites;
+  Counter zeroCopyCopied;  // Zero-copy sends where the kernel copied anyway
+  Counter bytesSpliced;    // File bytes sent without copying to user space
+  Counter diskOps;         // File I/O for handlers, see AsyncFileIo
+  Counter closes;          // Connections closed
+  Counter linkedCloses;    // Of which linked to the final send of a response
+  Counter handoffs;        // Connections handed over to other rings
+
+  // RequestHandler
+  Counter requests;
+  Counter offloads;    // Handlers run on the WorkerPool
+  Counter cacheWaits;  // Requests waiting for a response being generated
+  Counter webSocketUpgrades;
+  Counter webSocketMessages;  // Received
+  Counter webSocketFrames;    // Queued to be sent, once per connection
+  Counter eventStreamSubscriptions;
+  Counter eventStreamEvents;  // Queued to be sent, once per subscriber
+  Counter eventStreamDrops;   // Subscribers dropped for falling behind
+  LogHistogram requestLatencyUs;
+};
+
+/**
+ * @brief Sum of the metrics of all registered rings.
+ */
+struct MetricsSnapshot {
+  std::uint64_t accepts = 0;
+  std::uint64_t reads = 0;
+  std::uint64_t bytesRead = 0;
+  std::uint64_t writes = 0;
+  std::uint64_t bytesWritten = 0;
+  std::uint64_t cqes = 0;
+  std::uint64_t cqeBatches = 0;
+  std::uint64_t batchSubmits = 0;
+  std::uint64_t sqFull = 0;
+  std::uint64_t sqOverflows = 0;
+  std::uint64_t cqeErrors = 0;
+  std::uint64_t staleCqes = 0;
+  std::uint64_t zeroCopyWrites = 0;
+  std::uint64_t zeroCopyCopied = 0;
+  std::uint64_t bytesSpliced = 0;
+  std::uint64_t diskOps = 0;
+  std::uint64_t closes = 0;
+  std::uint64_t linkedCloses = 0;
+  std::uint64_t handoffs = 0;
+  std::uint64_t requests = 0;
+  std::uint64_t offloads = 0;
+  std::uint64_t cacheWaits = 0;
+  std::uint64_t webSocketUpgrades = 0;
+  std::uint64_t webSocketMessages = 0;
+  std::uint64_t webSocketFrames = 0;
+  std::uint64_t eventStreamSubscriptions = 0;
+  std::uint64_t eventStreamEvents = 0;
+  std::uint64_t eventStreamDrops = 0;
+  std::uint64_t requestLatencySumUs = 0;
+  std::array<std::uint64_t, LogHistogram::kBucketCount> requestLatencyUs{};
+};
+
+/**
+ * @brief Collects RingMetrics and aggregates them on demand.
+ */
+class TOYWS_EXPORT MetricsRegistry {
+ public:
+  /**
+   * @brief Register metrics of a ring. The metrics must outlive the registry
+   * (or be unregistered).
+   */
+  auto Register(const RingMetrics* metrics) -> void;
+
+  auto Unregister(const RingMetrics* metrics) -> void;
+
+  auto Snapshot() const -> MetricsSnapshot;
+
+  /**
+   * @brief Render snapshot in the Prometheus text exposition format.
+   *
+   * The request latency histogram is exported with a fixed set of "le"
+   * boundaries. A log bucket is counted towards a boundary if its whole range
+   * lies at or below it, so exported counts are accurate to the log bucket
+   * width.
+   */
+  auto RenderPrometheus() const -> std::string;
+
+ private:
+  mutable std::mutex mutex;  // Guards registration only
+  std::vector<const RingMetrics*> rings;
+};
+
+}  // namespace toyws
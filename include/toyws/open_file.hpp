@@ -0,0 +1,47 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace toyws {
+
+/**
+ * @brief A file kept open for serving, along with the metadata its responses
+ * need. The file is closed once the last reference to it is gone, so it stays
+ * valid for sends in flight even if it is evicted from FileCache meanwhile.
+ */
+struct OpenFile {
+  explicit OpenFile(int fileFd) : fd{fileFd} {}
+
+  ~OpenFile() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  OpenFile(const OpenFile&) = delete;
+  auto operator=(const OpenFile&) -> OpenFile& = delete;
+
+  int fd;
+  std::uint64_t size = 0;
+  std::int64_t modified = 0;  // Seconds since the epoch
+  std::string etag;           // Strong validator, including the quotes
+  std::string lastModified;   // IMF-fixdate of modified
+  std::string contentType;
+};
+
+/**
+ * @brief Byte range of an open file that makes up a response body.
+ */
+struct FileRange {
+  std::shared_ptr<const OpenFile> file;
+  std::uint64_t offset = 0;
+  std::uint64_t length = 0;
+
+  explicit operator bool() const { return file != nullptr; }
+};
+
+}  // namespace toyws
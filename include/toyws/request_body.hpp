@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "toyws/async_io.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Incremental decoder of a chunked (Transfer-Encoding) message body.
+ *
+ * Chunk extensions and trailer fields are skipped. Malformed input puts the
+ * decoder into a failed state (to be answered with 400 Bad Request), in which
+ * it consumes nothing further.
+ */
+class TOYWS_EXPORT ChunkedDecoder {
+ public:
+  /**
+   * @brief Consume framing from the front of input and return the next piece
+   * of body data (a view into input, which is advanced past it).
+   * @return Empty view if input is exhausted, the body is done or the input
+   * is malformed.
+   */
+  auto Next(std::string_view& input) -> std::string_view;
+
+  auto Done() const -> bool { return state == State::kDone; }
+
+  auto Failed() const -> bool { return state == State::kError; }
+
+ private:
+  enum class State {
+    kSize,       // Hex digits of chunk size
+    kExtension,  // Chunk extension, up to CRLF
+    kData,       // Chunk data
+    kDataCrlf,   // CRLF after chunk data
+    kTrailer,    // Trailer fields, up to an empty line
+    kDone,
+    kError,     // Malformed input
+  };
+
+  State state = State::kSize;
+  std::uint64_t remaining = 0;
+  std::size_t digits = 0;
+  std::size_t lineLength = 0;
+};
+
+/**
+ * @brief Collects a request body, in memory up to a threshold and in an
+ * unlinked temporary file beyond it.
+ *
+ * With an AsyncFileIo, the file is created & written on it rather than
+ * blocking the thread, so writes may still be in flight once all of the body
+ * is appended (see Flush()).
+ */
+class TOYWS_EXPORT BodyBuffer {
+ public:
+  /**
+   * @param directory Where to create the temporary file. Empty means the
+   * system temp directory.
+   * @param fileIo Where to create & write the file, or nullptr to block on
+   * plain write()s instead.
+   */
+  BodyBuffer(std::size_t spillAfter, std::string directory,
+             AsyncFileIo* fileIo = nullptr)
+      : spillThreshold{spillAfter},
+        spillDirectory{std::move(directory)},
+        io{fileIo} {}
+
+  ~BodyBuffer();
+
+  BodyBuffer(const BodyBuffer&) = delete;
+  auto operator=(const BodyBuffer&) -> BodyBuffer& = delete;
+
+  /**
+   * @brief Append data. Throws Error if spilling to disk fails, which with an
+   * AsyncFileIo is found out by the appends after the failed write.
+   */
+  auto Append(std::string_view data) -> void;
+
+  /**
+   * @brief Call done once all that was appended is on disk, or writing it
+   * failed (see Failed()). Not called if the buffer is destroyed first.
+   */
+  auto Flush(std::function<void()> done) -> void;
+
+  /**
+   * @brief Whether no writes are in flight, so that the file (if any) is
+   * complete or Failed().
+   */
+  auto Flushed() const -> bool {
+    return file == nullptr || (!file->opening && file->writes == 0);
+  }
+
+  auto Failed() const -> bool { return file != nullptr && file->failed; }
+
+  auto Size() const -> std::size_t { return size; }
+
+  auto Spilled() const -> bool { return file != nullptr; }
+
+  /**
+   * @brief The temporary file, or -1 if not Spilled() (or not yet created).
+   */
+  auto File() const -> int { return file != nullptr ? file->fd : -1; }
+
+  /**
+   * @brief Take the body if it is kept in memory.
+   */
+  auto TakeMemory() -> std::string { return std::move(memory); }
+
+ private:
+  // The temporary file, shared with the file I/O in flight, which may
+  // complete after the buffer is gone
+  struct SpillFile {
+    SpillFile() = default;
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+    auto operator=(const SpillFile&) -> SpillFile& = delete;
+
+    int fd = -1;
+    bool opening = false;  // Appended data waits in pending meanwhile
+    bool failed = false;
+    std::uint64_t end = 0;   // Of the data written or being written
+    std::size_t writes = 0;  // In flight
+    std::string pending;
+    std::function<void()> flushed;  // See Flush()
+  };
+
+  std::size_t spillThreshold;
+  std::string spillDirectory;
+  AsyncFileIo* io;
+  std::string memory;
+  std::size_t size = 0;
+  std::shared_ptr<SpillFile> file;
+
+  auto Spill() -> void;
+
+  auto WriteFile(std::string_view data) -> void;
+
+  static auto WriteAsync(AsyncFileIo& io,
+                         const std::shared_ptr<SpillFile>& file,
+                         std::string data) -> void;
+
+  // Call flushed if nothing is in flight anymore
+  static auto Settle(SpillFile& file) -> void;
+};
+
+}  // namespace toyws
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "toyws/event_stream.hpp"
 #include "toyws/io_service.hpp"
+#include "toyws/router.hpp"
+#include "toyws/websocket.hpp"
 
 namespace toyws {
 
@@ -17,11 +20,34 @@ class RequestHandler {
   static auto OnAccept(IoService<RequestHandler>* service, Socket listenSock,
                        Client* client) -> void;
 
+  // A connection accepted by another ring, see ToyWs::HandoffTarget()
+  static auto OnHandoff(IoService<RequestHandler>* service, Client* client)
+      -> void;
+
   static auto OnRead(IoService<RequestHandler>* service, Client* client)
       -> void;
 
   static auto OnWrite(IoService<RequestHandler>* service, Client* client)
       -> void;
+
+  // Once the outbox of a WebSocket connection is sent
+  static auto OnSent(IoService<RequestHandler>* service, Client* client)
+      -> void;
+
+  // Queue frame for the open WebSockets of service on route, see
+  // ToyWs::Broadcast()
+  static auto Broadcast(IoService<RequestHandler>* service, const Route* route,
+                        const WebSocketFrame& frame) -> void;
+
+  // Queue frame for the subscribers of service to route, see
+  // ToyWs::Publish()
+  static auto Publish(IoService<RequestHandler>* service, const Route* route,
+                      const EventStreamFrame& frame) -> void;
+
+  // Queue frame for the subscribers of service that have nothing queued, see
+  // ToyWs::SetEventStreamKeepAlive()
+  static auto Heartbeat(IoService<RequestHandler>* service,
+                        const EventStreamFrame& frame) -> void;
 };
 
 }  // namespace toyws
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "toyws/async_io.hpp"
+#include "toyws/http_request.hpp"
+#include "toyws/request_body.hpp"
+#include "toyws/router.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Assembles a request from the data of successive reads on a
+ * connection: the head is accumulated until complete, and the body is decoded
+ * (Content-Length or chunked) according to the BodyOptions of its route.
+ *
+ * Malformed or oversized requests move it to kError, with ErrorStatus() to
+ * respond with; nothing is thrown for what peers can send.
+ *
+ * The head, and the Request() & Context() made of it, are allocated with the
+ * allocator it is constructed with, e.g. from the Arena of the connection.
+ */
+class TOYWS_EXPORT RequestReader {
+ public:
+  // kFlushing: all of the body is read, but not yet written to disk (see
+  // Flush())
+  enum class States { kHead = 0, kBody, kFlushing, kComplete, kError };
+
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  static constexpr std::size_t kMaxHeadSize = 16 * 1024;
+
+  RequestReader() = default;
+  explicit RequestReader(const allocator_type& alloc)
+      : head{alloc}, request{alloc}, context{alloc} {}
+
+  /**
+   * @brief Feed data while in kHead. Moves to kBody once the head is complete.
+   * @return How many bytes of data belonged to the head; the rest is body.
+   */
+  auto ReadHead(std::string_view data) -> std::size_t;
+
+  /**
+   * @brief Determine the framing of the body, once the route for Request() has
+   * been looked up (route may be nullptr). Moves to kComplete if there is no
+   * body.
+   * @param io Where a body spilled to disk is written (see BodyBuffer), or
+   * nullptr to block on the writes.
+   */
+  auto BeginBody(const Route* requestRoute, AsyncFileIo* io = nullptr)
+      -> void;
+
+  /**
+   * @brief Feed data while in kBody. Moves to kComplete at the end of the
+   * body, or to kFlushing if writes of it to disk are still in flight; any
+   * data beyond that is ignored.
+   */
+  auto ReadBody(std::string_view data) -> void;
+
+  /**
+   * @brief In kFlushing, call done once the body is on disk, having moved to
+   * kComplete (or to kError if writing it failed). Not called if the reader
+   * is destroyed first.
+   */
+  auto Flush(std::function<void()> done) -> void;
+
+  auto State() const -> States { return state; }
+
+  /**
+   * @brief Status to respond with in kError.
+   */
+  auto ErrorStatus() const -> HttpStatus { return errorStatus; }
+
+  auto Request() -> HttpRequest& { return request; }
+
+  auto Context() -> HandlerContext& { return context; }
+
+  auto Route() const -> const toyws::Route* { return route; }
+
+ private:
+  States state = States::kHead;
+  HttpStatus errorStatus = HttpStatus::kOk;
+  std::pmr::string head;
+  HttpRequest request;
+  HandlerContext context;
+  const toyws::Route* route = nullptr;
+  BodyOptions options;
+  bool chunked = false;
+  std::uint64_t remaining = 0;  // For Content-Length
+  std::uint64_t received = 0;
+  ChunkedDecoder decoder;
+  std::optional<BodyBuffer> buffer;
+
+  auto Deliver(std::string_view piece) -> void;
+
+  auto Complete() -> void;
+
+  auto Fail(HttpStatus status) -> void;
+};
+
+}  // namespace toyws
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "toyws/http_request.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+struct ResponseCacheOptions {
+  // Upper bound on the sum of cached response sizes
+  std::size_t maxBytes = 16 * 1024 * 1024;
+  std::size_t maxEntries = 4096;
+  // A miss not completed within this is given up on: the next lookup of the
+  // key is a miss again, and fills the entry instead
+  std::chrono::steady_clock::duration fillTimeout = std::chrono::seconds{30};
+};
+
+/**
+ * @brief Cache of fully serialized HTTP responses.
+ *
+ * Meant to be owned by a single ring (not thread safe). Entries expire after
+ * their TTL and are evicted with the CLOCK algorithm when a bound is hit.
+ *
+ * Misses are coalesced: the first Lookup() of a key that is not cached returns
+ * kMiss and makes the caller responsible for calling Complete(). Lookups of the
+ * same key until then return kPending and register the caller as a waiter,
+ * whom Complete() hands back so that they can be served the same response.
+ * Should the caller not complete within the fill timeout, the next Lookup()
+ * takes over, along with the waiters so far.
+ */
+class TOYWS_EXPORT ResponseCache {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Bytes = std::shared_ptr<const std::string>;
+
+  enum class LookupStatus { kHit, kMiss, kPending };
+
+  struct LookupResult {
+    LookupStatus status;
+    Bytes bytes;  // Set on kHit
+  };
+
+  struct Waiter {
+    std::uint64_t id;
+    Clock::time_point since;  // Of its Lookup()
+  };
+
+  explicit ResponseCache(ResponseCacheOptions cacheOptions = {})
+      : options{cacheOptions} {}
+
+  /**
+   * @brief Cache key for request: method, normalized target and the values of
+   * the vary headers.
+   */
+  static auto MakeKey(const HttpRequest& request,
+                      const std::vector<std::string>& vary) -> std::string;
+
+  /**
+   * @brief Normalize a request target: collapse repeated '/' in the path and
+   * sort the query parameters.
+   */
+  static auto NormalizeTarget(std::string_view target) -> std::string;
+
+  /**
+   * @param waiter Identifies the caller (e.g. the OpTag of its connection,
+   * which is told from a later one in the same slot). Only used if the result
+   * is kPending.
+   */
+  auto Lookup(const std::string& key, std::uint64_t waiter,
+              Clock::time_point now) -> LookupResult;
+
+  /**
+   * @brief Finish a miss. If expires is set, bytes is stored until then.
+   * @return Waiters that were coalesced onto this miss.
+   */
+  auto Complete(const std::string& key, Bytes bytes,
+                std::optional<Clock::time_point> expires)
+      -> std::vector<Waiter>;
+
+  auto Entries() const -> std::size_t { return index.size(); }
+
+  auto SizeBytes() const -> std::size_t { return bytes; }
+
+ private:
+  struct Entry {
+    std::string key;
+    Bytes response;
+    Clock::time_point expires;  // While filling, when the fill is given up on
+    bool referenced = false;
+    bool filling = false;
+    std::vector<Waiter> waiters;
+  };
+
+  ResponseCacheOptions options;
+  std::unordered_map<std::string, std::size_t> index;
+  std::vector<Entry> entries;
+  std::vector<std::size_t> freeSlots;
+  std::size_t clockHand = 0;
+  std::size_t bytes = 0;
+
+  auto Allocate() -> std::size_t;
+
+  auto Remove(std::size_t slot) -> void;
+
+  // Evict entries until size fits within bounds. Returns false if impossible.
+  auto MakeRoom(std::size_t size) -> bool;
+};
+
+}  // namespace toyws
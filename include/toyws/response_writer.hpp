@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+#include "toyws/buffer_chain.hpp"
+#include "toyws/http_response.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Writes a response straight into the output buffer of a connection,
+ * instead of building an HttpResponse to be serialized afterwards.
+ *
+ * The status line goes out with the first header (or the body), and the head
+ * ends with the first write to the body. Content-Length is added by the
+ * writer: a placeholder of fixed width is filled in by Finish(), once the
+ * length of the body is known. Format into the body with Out(), e.g.
+ *
+ *   writer.Header("Content-Type", "text/plain");
+ *   fmt::format_to(writer.Out(), "Hello, {}!", name);
+ *
+ * Without a buffer to write into, it writes into one of its own, which
+ * ToResponse() parses into an HttpResponse (e.g. for tests).
+ */
+class TOYWS_EXPORT ResponseWriter {
+ public:
+  // Decimal digits of the Content-Length placeholder
+  static constexpr std::size_t kLengthDigits = 10;
+
+  ResponseWriter();
+
+  /**
+   * @param buffer Where to write the response. Cleared first.
+   */
+  explicit ResponseWriter(BufferChain& buffer);
+
+  ResponseWriter(const ResponseWriter&) = delete;
+  auto operator=(const ResponseWriter&) -> ResponseWriter& = delete;
+
+  /**
+   * @brief Status of the response, kOk unless set. Throws Error once the
+   * status line is written.
+   */
+  auto SetStatus(HttpStatus status) -> void;
+
+  auto Status() const -> HttpStatus { return status; }
+
+  /**
+   * @brief Add a header field. Throws Error once the body is started.
+   */
+  auto Header(std::string_view name, std::string_view value) -> void;
+
+  /**
+   * @brief Output iterator appending to the body.
+   */
+  auto Out() -> BufferChain::Inserter;
+
+  /**
+   * @brief Append data to the body.
+   */
+  auto Write(std::string_view data) -> void;
+
+  /**
+   * @brief Complete the response: end the head if the body is empty, or fill
+   * in its Content-Length. Nothing can be written afterwards. Called by the
+   * server once the handler returns.
+   */
+  auto Finish() -> void;
+
+  /**
+   * @brief Drop everything written so far, e.g. to respond with an error
+   * instead. The status is reset to kOk.
+   */
+  auto Discard() -> void;
+
+  auto BodySize() const -> std::size_t;
+
+  /**
+   * @brief Finish() and parse what was written.
+   */
+  auto ToResponse() -> HttpResponse;
+
+ private:
+  enum class Stages { kStatus = 0, kHeaders, kBody, kFinished };
+
+  std::unique_ptr<BufferChain> owned;  // Without a buffer passed in
+  BufferChain* out;
+  HttpStatus status = HttpStatus::kOk;
+  Stages stage = Stages::kStatus;
+  std::size_t lengthOffset = 0;  // Of the Content-Length placeholder
+  std::size_t bodyOffset = 0;
+
+  // Write the head up to the start of stage
+  auto Advance(Stages to) -> void;
+};
+
+}  // namespace toyws
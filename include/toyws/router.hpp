@@ -1,19 +1,170 @@
 #pragma once
 
+#include <any>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "toyws/async_io.hpp"
+#include "toyws/error.hpp"
+#include "toyws/event_stream.hpp"
 #include "toyws/http_request.hpp"
 #include "toyws/http_response.hpp"
+#include "toyws/websocket.hpp"
 
 namespace toyws {
 
-class HandlerContext {};
+/**
+ * @brief Sends the response to a request whose handler deferred it (see
+ * HandlerContext::Defer).
+ */
+using Responder = std::function<void(HttpResponse)>;
+
+/**
+ * @brief Per-request state passed to handlers.
+ */
+class HandlerContext {
+ public:
+  using allocator_type = std::pmr::polymorphic_allocator<>;
+
+  HandlerContext() = default;
+  explicit HandlerContext(const allocator_type& alloc) : allocator{alloc} {}
+
+  /**
+   * @brief Arbitrary state for the handlers of a request. E.g. a
+   * BodyChunkHandler can keep a hash of the upload here, for the final handler
+   * to look at.
+   */
+  auto UserData() -> std::any& { return userData; }
+  auto UserData() const -> const std::any& { return userData; }
+
+  /**
+   * @brief Allocator for the handler's own temporaries, e.g.
+   * `std::pmr::vector<Row> rows{context.Allocator()}`. Within IoService, it
+   * allocates from the Arena of the connection, which is freed wholesale with
+   * it, so nothing allocated with it may outlive the response.
+   */
+  auto Allocator() const -> allocator_type { return allocator; }
+
+  /**
+   * @brief File I/O on the ring of the connection, to use instead of blocking
+   * calls. nullptr if not handled by an IoService (e.g. when calling
+   * ToyWs::HandleRequest directly).
+   */
+  auto Io() const -> AsyncFileIo* { return io; }
+  auto SetIo(AsyncFileIo* fileIo) -> void { io = fileIo; }
+
+  /**
+   * @brief Respond later, e.g. once AsyncFileIo completes, rather than with
+   * the handler's HttpResponse (which is then ignored). The returned
+   * Responder must be called exactly once, on the ring's thread; the
+   * connection waits until then.
+   */
+  auto Defer() const -> Responder {
+    if (!responder) {
+      throw Error("HandlerContext: Only IoService can defer responses");
+    }
+    deferred = true;
+    return responder;
+  }
+
+  auto IsDeferred() const -> bool { return deferred; }
+
+  auto SetResponder(Responder respond) -> void {
+    responder = std::move(respond);
+  }
+
+ private:
+  std::any userData;
+  allocator_type allocator;
+  AsyncFileIo* io = nullptr;
+  Responder responder;
+  mutable bool deferred = false;
+};
 
 using SyncHandler = void (*)(const HttpRequest&, const HandlerContext&,
                              HttpResponse&);
 
+class ResponseWriter;
+
+/**
+ * @brief Handler writing its response straight into the connection's buffer
+ * (see ResponseWriter), skipping the HttpResponse. The response is sent as
+ * written, so it is not compressed (whether offloaded or not), and can't be
+ * deferred.
+ */
+using WriterHandler = void (*)(const HttpRequest&, const HandlerContext&,
+                               ResponseWriter&);
+
+/**
+ * @brief Receives a piece of the request body as it arrives (see
+ * BodyMode::kStream). Called zero or more times before the route's handler.
+ * Throwing HttpStatusError rejects the request with its status (anything else
+ * with 500 Internal Server Error), and the handler is not called.
+ */
+using BodyChunkHandler = void (*)(const HttpRequest&, HandlerContext&,
+                                  std::string_view chunk);
+
+enum class BodyMode {
+  // Collect the whole body before calling the handler. Bodies larger than
+  // spillThreshold are kept in a temporary file, see HttpRequest::BodyFile().
+  kBuffer = 0,
+  // Pass the body to onChunk as it arrives, then call the handler (with an
+  // empty HttpRequest::Body()).
+  kStream,
+};
+
+/**
+ * @brief How a route receives request bodies (Content-Length or chunked).
+ * Bodies larger than maxBytes are rejected with 413 Payload Too Large.
+ */
+struct BodyOptions {
+  BodyMode mode = BodyMode::kBuffer;
+  std::size_t maxBytes = 1024 * 1024;
+  // Larger bodies are spilled to disk, written with the file I/O of the ring
+  // reading them (see AsyncFileIo). The handler is called once all of it is
+  // written.
+  std::size_t spillThreshold = 64 * 1024;
+  // Where spilled bodies are stored. Empty means the system temp directory.
+  std::string spillDirectory;
+  // Required for BodyMode::kStream
+  BodyChunkHandler onChunk = nullptr;
+};
+
+/**
+ * @brief Opt-in caching of a route's fully serialized responses.
+ *
+ * Only GET & HEAD requests answered with 200 OK are cached. Requests are keyed
+ * on method, normalized target and the values of the headers listed in vary.
+ */
+struct CachePolicy {
+  bool enabled = false;
+  std::chrono::milliseconds ttl{1000};
+  std::vector<std::string> vary;
+};
+
+struct RouteOptions {
+  CachePolicy cache;
+  BodyOptions body;
+  // Allow compressing responses (see ToyWs::SetCompressionOptions)
+  bool compress = true;
+  // Run the handler on a WorkerPool rather than on the ring's thread, for
+  // CPU-heavy handlers (e.g. templating) that would hold up every other
+  // connection. Handlers then run concurrently, so must be thread-safe, and
+  // can neither Defer() nor use Io().
+  bool offload = false;
+  // Of WebSocket routes only
+  WebSocketOptions webSocket;
+  // Of event stream routes only
+  EventStreamOptions eventStream;
+};
+
 /**
  * @brief A route used by Router. Can be partial (contains other Routes) or
  * final (endpoint), or both.
@@ -47,7 +198,52 @@ class Route {
    * @brief Check if string starts with this Route's idenitifer.
    */
   auto AppliesTo(const std::string& uri) -> bool {
-    return uri.starts_with(idenitifer);
+    return uri.starts_with(identifier);
+  }
+
+  auto FullPath() const -> const std::string& { return fullPath; }
+
+  auto Identifier() const -> const std::string& { return identifier; }
+
+  auto SubRoutes() -> std::vector<Route>& { return subRoutes; }
+
+  auto Handler() const -> SyncHandler { return syncHandler; }
+  auto SetHandler(SyncHandler handler) -> void { syncHandler = handler; }
+
+  auto Writer() const -> WriterHandler { return writerHandler; }
+  auto SetWriter(WriterHandler handler) -> void { writerHandler = handler; }
+
+  /**
+   * @brief Handlers of a WebSocket endpoint, or nullptr if it is not one.
+   */
+  auto SocketHandlers() const -> const WebSocketHandlers* {
+    return socketHandlers ? &*socketHandlers : nullptr;
+  }
+  auto SetSocketHandlers(std::optional<WebSocketHandlers> handlers) -> void {
+    socketHandlers = handlers;
+  }
+
+  /**
+   * @brief Handlers of an event stream endpoint, or nullptr if it is not one.
+   */
+  auto StreamHandlers() const -> const EventStreamHandlers* {
+    return streamHandlers ? &*streamHandlers : nullptr;
+  }
+  auto SetStreamHandlers(std::optional<EventStreamHandlers> handlers) -> void {
+    streamHandlers = handlers;
+  }
+
+  /**
+   * @brief Whether it is an endpoint, with any kind of handler.
+   */
+  auto HasHandler() const -> bool {
+    return syncHandler != nullptr || writerHandler != nullptr ||
+           socketHandlers.has_value() || streamHandlers.has_value();
+  }
+
+  auto Options() const -> const RouteOptions& { return options; }
+  auto SetOptions(RouteOptions routeOptions) -> void {
+    options = std::move(routeOptions);
   }
 
  private:
@@ -55,6 +251,10 @@ class Route {
   std::string identifier;
   std::vector<Route> subRoutes;
   SyncHandler syncHandler = nullptr;
+  WriterHandler writerHandler = nullptr;
+  std::optional<WebSocketHandlers> socketHandlers;
+  std::optional<EventStreamHandlers> streamHandlers;
+  RouteOptions options;
 };
 
 /**
@@ -75,7 +275,29 @@ class Router {
    * the route "/users/me" will never match because the route before it is
    * applicable.
    */
-  auto AddRoute(const std::string& uri, SyncHandler handler) -> void;
+  auto AddRoute(const std::string& uri, SyncHandler handler,
+                RouteOptions options = {}) -> void;
+
+  /**
+   * @brief Add route with a handler that writes its response directly, see
+   * ResponseWriter. Otherwise the same as the above.
+   */
+  auto AddRoute(const std::string& uri, WriterHandler handler,
+                RouteOptions options = {}) -> void;
+
+  /**
+   * @brief Add route accepting WebSocket connections (see WebSocketHandlers).
+   * Other requests to it are answered with 426 Upgrade Required.
+   */
+  auto AddRoute(const std::string& uri, WebSocketHandlers handlers,
+                RouteOptions options = {}) -> void;
+
+  /**
+   * @brief Add route streaming events (text/event-stream) to the GET requests
+   * subscribing to it, as they are published (see ToyWs::Publish).
+   */
+  auto AddRoute(const std::string& uri, EventStreamHandlers handlers,
+                RouteOptions options = {}) -> void;
 
   /**
    * @brief Add route with asynchronous handler
@@ -106,10 +328,16 @@ class Router {
    */
   auto FindPartialMatchingRoute(const std::string& uri) -> Route*;
 
+  /**
+   * @brief Split uri at '/' (left-inclusive), e.g. "/a/b" -> {"/a", "/b"}.
+   */
+  static auto SplitUri(const std::string& uri) -> std::vector<std::string>;
+
  private:
   std::vector<Route> routes;
 
-  auto SplitUri(const std::string& uri) -> std::vector<std::string>;
+  // Route for uri, created (along with its parents) if missing
+  auto Emplace(const std::string& uri) -> Route&;
 };
 
 }  // namespace toyws
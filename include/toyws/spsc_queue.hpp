@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+#include "toyws/cache_line.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Bounded lock-free single-producer single-consumer queue.
+ *
+ * Exactly one thread may call TryPush() and exactly one (other) thread may
+ * call TryPop(). Each side keeps a cached copy of the other side's index, so
+ * the shared indices are only read when the queue looks full/empty.
+ */
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+  static_assert(std::has_single_bit(Capacity),
+                "SpscQueue capacity must be a power of two");
+
+ public:
+  /**
+   * @brief Push a copy of value. Returns false (and does nothing) if the queue
+   * is full.
+   */
+  auto TryPush(const T& value) -> bool {
+    const auto tail = tailIndex.load(std::memory_order_relaxed);
+    if (tail - cachedHead == Capacity) {
+      cachedHead = headIndex.load(std::memory_order_acquire);
+      if (tail - cachedHead == Capacity) {
+        return false;
+      }
+    }
+
+    slots[tail & kMask] = value;
+    tailIndex.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Pop the oldest element into out. Returns false if the queue is
+   * empty.
+   */
+  auto TryPop(T& out) -> bool {
+    const auto head = headIndex.load(std::memory_order_relaxed);
+    if (head == cachedTail) {
+      cachedTail = tailIndex.load(std::memory_order_acquire);
+      if (head == cachedTail) {
+        return false;
+      }
+    }
+
+    out = slots[head & kMask];
+    headIndex.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Approximate number of elements. Exact if called while neither side
+   * is active.
+   */
+  auto Size() const -> std::size_t {
+    return tailIndex.load(std::memory_order_acquire) -
+           headIndex.load(std::memory_order_acquire);
+  }
+
+  static constexpr auto MaxSize() -> std::size_t { return Capacity; }
+
+ private:
+  static constexpr std::size_t kMask = Capacity - 1;
+
+  // Consumer side
+  alignas(kCacheLineSize) std::atomic<std::size_t> headIndex = 0;
+  std::size_t cachedTail = 0;
+
+  // Producer side
+  alignas(kCacheLineSize) std::atomic<std::size_t> tailIndex = 0;
+  std::size_t cachedHead = 0;
+
+  alignas(kCacheLineSize) std::array<T, Capacity> slots{};
+};
+
+}  // namespace toyws
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "toyws/async_io.hpp"
+#include "toyws/http_request.hpp"
+#include "toyws/http_response.hpp"
+#include "toyws/open_file.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+struct StaticFilesOptions {
+  // Directory to serve
+  std::string root;
+  // Served for paths ending in '/'. Empty disables index files.
+  std::string indexFile = "index.html";
+  // Hidden files & directories (starting with '.') are not served by default
+  bool serveHidden = false;
+  // Bound of the open-file cache, which each ring serving the files has
+  std::size_t maxOpenFiles = 1024;
+  // How often pending invalidations are picked up; a changed file may be
+  // served from the cache for this long. Zero checks on every lookup.
+  std::chrono::milliseconds invalidationInterval{100};
+  // Cache-Control: max-age for responses. Zero omits the header.
+  std::chrono::seconds maxAge{0};
+  // Compressible files up to this size are read into memory when the client
+  // accepts a compressed encoding (see ToyWs::SetCompressionOptions). Other
+  // files are sent straight from the page cache.
+  std::size_t compressMaxBytes = 1024 * 1024;
+};
+
+/**
+ * @brief Cache of open files (and their metadata) below a root directory.
+ *
+ * Entries are invalidated through inotify watches on the directories of
+ * cached files, rather than by stat()ing files on every lookup. Without
+ * inotify (e.g. out of watches) files are simply not cached.
+ */
+class TOYWS_EXPORT FileCache {
+ public:
+  // The file, or nullptr along with -errno: -EISDIR for a directory, -ENOENT
+  // for what is not a regular file
+  using OpenedCallback =
+      std::function<void(std::shared_ptr<const OpenFile> file, int error)>;
+
+  FileCache(const std::string& root, std::size_t maxOpenFiles,
+            std::chrono::milliseconds invalidationInterval);
+
+  ~FileCache();
+
+  FileCache(const FileCache&) = delete;
+  auto operator=(const FileCache&) -> FileCache& = delete;
+
+  /**
+   * @brief Open regular file at path, relative to the root & normalized (e.g.
+   * "css/site.css").
+   * @return nullptr if there is no such regular file. Throws HttpStatusError
+   * with 403 Forbidden if the file may not be opened.
+   */
+  auto Open(const std::string& path) -> std::shared_ptr<const OpenFile>;
+
+  /**
+   * @brief Open() on io rather than blocking, for a file that Find() did not
+   * find. done is called from a completion on io, which the cache must
+   * outlive.
+   */
+  auto Open(AsyncFileIo& io, const std::string& path, OpenedCallback done)
+      -> void;
+
+  /**
+   * @brief The cached file at path, or nullptr if it is not cached.
+   */
+  auto Find(const std::string& path) -> std::shared_ptr<const OpenFile>;
+
+  auto IsDirectory(const std::string& path) const -> bool;
+
+  /**
+   * @brief Apply pending invalidations now, regardless of the interval.
+   */
+  auto ProcessEvents() -> void;
+
+  auto Size() const -> std::size_t { return entries.size(); }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::shared_ptr<const OpenFile> file;
+    std::list<std::string>::iterator lru;
+  };
+
+  int rootFd = -1;
+  std::string rootPath;
+  int inotifyFd = -1;
+  std::size_t capacity;
+  std::chrono::milliseconds interval;
+  Clock::time_point lastCheck;
+  std::unordered_map<std::string, Entry> entries;
+  std::list<std::string> lru;  // Most recently used first
+  std::unordered_map<int, std::string> watches;  // Descriptor -> directory
+  // Events processed so far. A file opened while any were is not cached, as
+  // it may have been changed since.
+  std::uint64_t events = 0;
+
+  auto OpenUncached(const std::string& path) -> std::shared_ptr<OpenFile>;
+
+  // Watch the directory of path, before opening it so that a change in
+  // between is not missed. Returns whether the file may be cached.
+  auto WatchDirectoryOf(const std::string& path) -> bool;
+
+  auto Watch(const std::string& directory) -> bool;
+
+  auto Insert(const std::string& path, std::shared_ptr<const OpenFile> file)
+      -> void;
+
+  auto Invalidate(const std::string& path) -> void;
+
+  auto InvalidateDirectory(const std::string& directory) -> void;
+};
+
+/**
+ * @brief Single byte range of a representation.
+ */
+struct ByteRange {
+  std::uint64_t offset = 0;
+  std::uint64_t length = 0;
+};
+
+/**
+ * @brief Parse a Range header for a representation of given size.
+ *
+ * Only single byte ranges are supported; other units, multiple ranges and
+ * malformed values are ignored (the full representation is served instead).
+ *
+ * @return The range clamped to size, with a length of 0 if it can not be
+ * satisfied, or std::nullopt if the header is to be ignored.
+ */
+TOYWS_EXPORT auto ParseRange(std::string_view header, std::uint64_t size)
+    -> std::optional<ByteRange>;
+
+/**
+ * @brief Match an If-None-Match header against etag, using weak comparison.
+ * Tags of compressed variants (see ToyWs::Compress) match as well.
+ * @return The matching tag of header, or std::nullopt if none matches.
+ */
+TOYWS_EXPORT auto MatchEtag(std::string_view header, std::string_view etag)
+    -> std::optional<std::string_view>;
+
+/**
+ * @brief Format seconds since the epoch as IMF-fixdate, e.g.
+ * "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+TOYWS_EXPORT auto FormatHttpDate(std::int64_t seconds) -> std::string;
+
+/**
+ * @brief Parse an IMF-fixdate into seconds since the epoch.
+ */
+TOYWS_EXPORT auto ParseHttpDate(std::string_view date)
+    -> std::optional<std::int64_t>;
+
+/**
+ * @brief Content-Type for a file name, by its extension.
+ */
+TOYWS_EXPORT auto ContentTypeFor(std::string_view path) -> std::string_view;
+
+/**
+ * @brief Read range of a file into memory.
+ */
+TOYWS_EXPORT auto ReadFileRange(const FileRange& range) -> std::string;
+
+// 0 & the data, or -errno (-EIO if the file was truncated)
+using ReadRangeCallback = std::function<void(int result, std::string data)>;
+
+/**
+ * @brief ReadFileRange() on io rather than blocking. done is called from a
+ * completion on io.
+ */
+TOYWS_EXPORT auto ReadFileRange(AsyncFileIo& io, FileRange range,
+                                ReadRangeCallback done) -> void;
+
+/**
+ * @brief Serves the files of a directory (see ToyWs::AddStaticRoute).
+ *
+ * Responses carry ETag & Last-Modified, conditional requests are answered
+ * with 304 Not Modified and single Range requests with 206 Partial Content.
+ * Bodies are not read into memory but set as HttpResponse::File().
+ */
+class TOYWS_EXPORT StaticFiles {
+ public:
+  using ServeCallback = std::function<void(HttpResponse response)>;
+
+  explicit StaticFiles(StaticFilesOptions staticOptions);
+
+  /**
+   * @brief Answer request for path, relative to the served directory (e.g.
+   * "/css/site.css"). Throws HttpStatusError if there is no such file.
+   */
+  auto Serve(const HttpRequest& request, std::string_view path,
+             HttpResponse& response) -> void;
+
+  /**
+   * @brief Serve(), opening files that are not cached on io rather than
+   * blocking.
+   * @return Whether response is answered. Otherwise done is called with the
+   * response instead, from a completion on io, and request must stay put
+   * until then. Errors of the pending open are answered rather than thrown.
+   */
+  auto Serve(const HttpRequest& request, std::string_view path,
+             HttpResponse& response, AsyncFileIo& io, ServeCallback done)
+      -> bool;
+
+  auto Options() const -> const StaticFilesOptions& { return options; }
+
+  auto Files() -> FileCache& { return cache; }
+
+ private:
+  StaticFilesOptions options;
+  FileCache cache;
+
+  // Path of the file to serve for request, relative to the root. std::nullopt
+  // if response is answered without one.
+  auto Resolve(const HttpRequest& request, std::string_view path,
+               HttpResponse& response) const -> std::optional<std::string>;
+
+  // Answer request with file, or with why there is none (see
+  // FileCache::OpenedCallback). directory is whether a directory's index was
+  // requested.
+  auto Respond(const HttpRequest& request, bool directory,
+               std::shared_ptr<const OpenFile> file, int error,
+               HttpResponse& response) const -> void;
+
+  // Suppress MSVC warning about containing data types that are not exported.
+  // This is okay if non-exported types are private members & not part of API.
+  // TOYWS_SUPPRESS_C4251
+};
+
+}  // namespace toyws
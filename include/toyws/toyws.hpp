@@ -1,13 +1,33 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
+#include "toyws/access_log.hpp"
+#include "toyws/compression.hpp"
+#include "toyws/event_stream.hpp"
 #include "toyws/http_request.hpp"
 #include "toyws/http_response.hpp"
 #include "toyws/io_service.hpp"
+#include "toyws/listener.hpp"
+#include "toyws/load_balance.hpp"
+#include "toyws/metrics.hpp"
 #include "toyws/request_handler.hpp"
+#include "toyws/response_cache.hpp"
+#include "toyws/response_writer.hpp"
+#include "toyws/router.hpp"
+#include "toyws/static_files.hpp"
 #include "toyws/toyws_export.hpp"
+#include "toyws/websocket.hpp"
+#include "toyws/worker_pool.hpp"
 
 namespace toyws {
 
@@ -16,18 +36,357 @@ namespace toyws {
  */
 class TOYWS_EXPORT ToyWs {
  public:
+  /**
+   * @brief Server listening on address & port, see MakeListeningSocket() for
+   * the forms of address (including UNIX domain sockets).
+   */
   ToyWs(std::string address, uint16_t port);
 
+  /**
+   * @brief Serve connections on this many rings, each with a thread of its
+   * own (Run() serves the first). TCP rings each listen on a socket of their
+   * own, with SO_REUSEPORT. Must be called before Run().
+   */
+  auto SetRings(std::size_t count) -> void;
+
+  /**
+   * @brief Configure handing over accepted connections between rings. Must be
+   * called before Run().
+   */
+  auto SetLoadBalanceOptions(LoadBalanceOptions options) -> void {
+    loadBalanceOptions = options;
+  }
+
+  /**
+   * @brief Service of the ring that from should hand the connection it just
+   * accepted over to, or nullptr to keep it.
+   */
+  auto HandoffTarget(const IoService<RequestHandler>& from)
+      -> IoService<RequestHandler>*;
+
+  /**
+   * @brief Configure the listening socket. Must be called before Run().
+   */
+  auto SetListenerOptions(ListenerOptions options) -> void {
+    listenerOptions = options;
+  }
+
+  /**
+   * @brief Configure the access log. Must be called before Run().
+   */
+  auto SetAccessLogOptions(AccessLogOptions options) -> void;
+
+  /**
+   * @brief Expose metrics in Prometheus text format on given route. An empty
+   * route (the default) disables the endpoint.
+   */
+  auto SetMetricsRoute(std::string route) -> void {
+    metricsRoute = std::move(route);
+  }
+
+  auto Metrics() -> MetricsRegistry& { return metrics; }
+
+  /**
+   * @brief Add route with synchronous handler. See Router::AddRoute().
+   */
+  auto AddRoute(const std::string& uri, SyncHandler handler,
+                RouteOptions options = {}) -> void {
+    router.AddRoute(uri, handler, std::move(options));
+  }
+
+  /**
+   * @brief Add route with a handler writing its response directly. See
+   * Router::AddRoute().
+   */
+  auto AddRoute(const std::string& uri, WriterHandler handler,
+                RouteOptions options = {}) -> void {
+    router.AddRoute(uri, handler, std::move(options));
+  }
+
+  /**
+   * @brief Add route accepting WebSocket connections. See Router::AddRoute().
+   */
+  auto AddRoute(const std::string& uri, WebSocketHandlers handlers,
+                RouteOptions options = {}) -> void {
+    router.AddRoute(uri, handlers, std::move(options));
+  }
+
+  /**
+   * @brief Send a message to every open WebSocket on the route added for uri.
+   * The frame is encoded once, and shared by all the connections it is queued
+   * for. Each ring sends it from its own thread, so it may be called from any
+   * thread, and it is sent once the rings get to it. Throws Error if uri is
+   * not a WebSocket route.
+   */
+  auto Broadcast(const std::string& uri, WebSocketOpcode opcode,
+                 std::string_view payload) -> void;
+
+  /**
+   * @brief Add route streaming events to its subscribers. See
+   * Router::AddRoute().
+   */
+  auto AddRoute(const std::string& uri, EventStreamHandlers handlers,
+                RouteOptions options = {}) -> void {
+    router.AddRoute(uri, handlers, std::move(options));
+    hasEventStreams = true;
+  }
+
+  /**
+   * @brief Send an event to every subscriber of the event stream route added
+   * for uri. It is encoded (& framed as a chunk) once, and shared by all the
+   * subscribers it is queued for. Like Broadcast(), it may be called from any
+   * thread. Throws Error if uri is not an event stream route, or if event or
+   * id contain a line break.
+   */
+  auto Publish(const std::string& uri, std::string_view data,
+               std::string_view event = {}, std::string_view id = {}) -> void;
+
+  /**
+   * @brief How often subscribers of event streams that were sent nothing else
+   * are sent a comment, so that the connection isn't timed out as idle. Zero
+   * disables it. Must be called before Run().
+   */
+  auto SetEventStreamKeepAlive(std::chrono::milliseconds interval) -> void {
+    eventStreamKeepAlive = interval;
+  }
+
+  /**
+   * @brief Subscribers of the event streams of the ring whose thread calls.
+   * Only to be called on a ring's thread, e.g. from a handler running on it;
+   * throws Error on others.
+   */
+  auto Events() -> EventHub& { return CurrentRing().eventHub; }
+
+  /**
+   * @brief Serve the files of options.root below prefix, e.g. "/static" maps
+   * "/static/css/site.css" to "<root>/css/site.css". Routes added with
+   * AddRoute() take precedence. The response cache is not used for these
+   * routes; files are kept open in a FileCache of each ring instead.
+   */
+  auto AddStaticRoute(const std::string& prefix, StaticFilesOptions options,
+                      RouteOptions routeOptions = {}) -> void;
+
+  /**
+   * @brief Configure bounds of the response cache used by routes with a
+   * CachePolicy. Each ring has a cache of its own. Must be called before
+   * Run().
+   */
+  auto SetResponseCacheOptions(ResponseCacheOptions options) -> void {
+    responseCacheOptions = options;
+  }
+
+  /**
+   * @brief Response cache of the ring whose thread calls. Only to be called on
+   * a ring's thread, e.g. from a handler running on it; throws Error on
+   * others.
+   */
+  auto Cache() -> ResponseCache& { return CurrentRing().responseCache; }
+
+  /**
+   * @brief Configure compression of response bodies. Each ring caches
+   * compressed variants of its own. Must be called before Run().
+   */
+  auto SetCompressionOptions(CompressionOptions options) -> void {
+    compressionOptions = options;
+  }
+
+  /**
+   * @brief Encoding that a response to request on route would be compressed
+   * with, if its body turns out to be compressible. Always identity for
+   * routes with a WriterHandler.
+   */
+  auto NegotiateEncoding(const HttpRequest& request, const Route* route) const
+      -> ContentEncoding;
+
+  /**
+   * @brief Threads of the WorkerPool that routes with RouteOptions::offload
+   * are handled on. 0 (the default) means one per hardware thread. Must be
+   * called before Run().
+   */
+  auto SetWorkerThreads(std::size_t threads) -> void {
+    workerThreads = threads;
+  }
+
+  /**
+   * @brief The WorkerPool, started on first use.
+   */
+  auto Workers() -> WorkerPool&;
+
   auto Run() -> void;
 
   auto Stop() -> void;
 
+  /**
+   * @brief Route with handler matching the request's path, or nullptr.
+   */
+  auto FindRoute(const HttpRequest& request) -> const Route*;
+
   auto HandleRequest(const HttpRequest& request) -> HttpResponse;
 
+  /**
+   * @brief Handle request with an already looked up route (see FindRoute).
+   * If the handler deferred its response (see HandlerContext::Defer), the
+   * returned response is meaningless. May be called on any thread; off the
+   * rings' threads, the response is neither logged nor are compressed
+   * variants of it cached.
+   */
+  auto HandleRequest(const HttpRequest& request, const Route* route,
+                     const HandlerContext& context = {}) -> HttpResponse;
+
+  /**
+   * @brief Just call route's handler (or serve its files), turning an
+   * HttpStatusError into the response, and anything else thrown into 500
+   * Internal Server Error, whether on a ring or a worker (see
+   * RouteOptions::offload). The response is neither compressed nor
+   * logged, see FinishResponse(). What a WriterHandler writes is parsed into
+   * the response.
+   */
+  auto CallHandler(const HttpRequest& request, const Route* route,
+                   const HandlerContext& context) -> HttpResponse;
+
+  /**
+   * @brief Call onSubscribe of an event stream route, turning an
+   * HttpStatusError into the response (and anything else into 500 Internal
+   * Server Error). A subscription that is accepted gets 200 OK with the head
+   * of the stream, and the events to send first as its body. Throws Error if
+   * route is not an event stream route.
+   */
+  auto CallSubscribe(const HttpRequest& request, const Route* route)
+      -> HttpResponse;
+
+  /**
+   * @brief Call route's WriterHandler with writer and Finish() it. An
+   * HttpStatusError replaces whatever was written with an empty response of
+   * its status, anything else thrown with 500 Internal Server Error. Not
+   * logged.
+   */
+  auto CallWriter(const HttpRequest& request, const Route* route,
+                  const HandlerContext& context, ResponseWriter& writer)
+      -> void;
+
+  /**
+   * @brief Do for a deferred response what HandleRequest does once the
+   * handler returns: compress & log it.
+   */
+  auto FinishResponse(const HttpRequest& request, const Route* route,
+                      HttpResponse& response,
+                      std::chrono::steady_clock::time_point start) -> void;
+
+  /**
+   * @brief Compress response body in place, if negotiated & worthwhile. Sets
+   * Content-Encoding and Vary headers accordingly.
+   */
+  auto Compress(const HttpRequest& request, const Route* route,
+                HttpResponse& response) -> void;
+
+  /**
+   * @brief Answer request on a route added with AddStaticRoute(). On a ring,
+   * files are opened & read on its AsyncFileIo where not cached, deferring the
+   * response (see HandlerContext::Defer).
+   */
+  auto ServeStatic(const HttpRequest& request, const Route* route,
+                   const HandlerContext& context, HttpResponse& response)
+      -> void;
+
+  auto LogAccess(const HttpRequest& request, HttpStatus status,
+                 std::size_t bodyBytes, std::chrono::microseconds latency)
+      -> void {
+    // Each ring's producer has a single thread writing to it
+    auto* ring = LocalRing();
+    if (ring != nullptr && ring->accessLog != nullptr) {
+      ring->accessLog->Record(request, status, bodyBytes, latency);
+    }
+  }
+
+  auto LogAccess(const HttpRequest& request, const HttpResponse& response,
+                 std::chrono::steady_clock::time_point start) -> void {
+    LogAccess(request, response.Status(),
+              response.HasFile() ? response.File().length
+                                 : response.Body().size(),
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - start));
+  }
+
  private:
   std::string listeningAddress;
   uint16_t listeningPort;
-  IoService<RequestHandler> ioService;
+  ListenerOptions listenerOptions;
+  LoadBalanceOptions loadBalanceOptions;
+  AccessLogOptions accessLogOptions;
+  std::unique_ptr<AccessLog> accessLog;
+  MetricsRegistry metrics;
+  std::string metricsRoute;
+  Router router;
+  ResponseCacheOptions responseCacheOptions;
+  CompressionOptions compressionOptions;
+
+  // A ring serving connections on a thread of its own. What is written while
+  // serving is kept per ring, so that rings never contend for it.
+  struct Ring {
+    IoService<RequestHandler> service;
+    std::thread thread;  // Unless the first, which runs on that of Run()
+    Socket listeningSocket = -1;
+    AccessLogProducer* accessLog = nullptr;
+    ResponseCache responseCache;
+    Compressor compressor;
+    CompressedVariantCache compressedVariants{
+        CompressionOptions{}.variantCacheBytes};
+    std::vector<std::size_t> loads;  // Scratch for HandoffTarget()
+    EventHub eventHub;
+    // Files of staticRoutes, by index. Kept across Run()s, as completions
+    // of file I/O in flight at Stop() refer to them.
+    std::vector<std::unique_ptr<StaticFiles>> staticFiles;
+  };
+  std::vector<std::unique_ptr<Ring>> rings;
+  // The ring whose thread this is, if any
+  static thread_local Ring* localRing;
+
+  std::size_t workerThreads = 0;
+  std::mutex workersMutex;  // Guards starting workers
+  // After rings, so that workers are joined before the connections are gone
+  std::unique_ptr<WorkerPool> workers;
+
+  struct StaticRoute {
+    StaticRoute(std::string path, StaticFilesOptions options)
+        : prefix{std::move(path)},
+          route{prefix.empty() ? "/" : prefix},
+          files{std::move(options)} {}
+
+    std::string prefix;  // Without trailing '/'
+    Route route;
+    // Guards files, which threads other than the rings' serve from (e.g.
+    // those calling HandleRequest() directly). Rings have files of their own.
+    std::mutex mutex;
+    StaticFiles files;
+  };
+  std::vector<std::unique_ptr<StaticRoute>> staticRoutes;
+
+  bool hasEventStreams = false;
+  std::chrono::milliseconds eventStreamKeepAlive{15000};
+  // Posts heartbeats to the rings while they run, if there are event streams
+  std::thread heartbeat;
+  std::mutex heartbeatMutex;
+  std::condition_variable heartbeatWake;
+  bool heartbeatStop = false;  // Guarded by heartbeatMutex
+
+  // The ring whose thread calls, or nullptr on other threads (e.g. workers,
+  // or those calling HandleRequest() directly). What is kept per ring must
+  // not be touched from those.
+  auto LocalRing() -> Ring* {
+    return localRing != nullptr && localRing->service.Instance() == this
+               ? localRing
+               : nullptr;
+  }
+
+  // LocalRing(), for what only rings' threads may call. Throws Error on
+  // other threads.
+  auto CurrentRing() -> Ring&;
+
+  // Serve connections on ring until stopped
+  auto RunRing(Ring& ring) -> void;
+
+  // Body of the heartbeat thread, until Stop()
+  auto SendHeartbeats() -> void;
 
   // Suppress MSVC warning about containing data types that are not exported.
   // This is okay if non-exported types are private members & not part of API.
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <any>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "toyws/http_request.hpp"
+#include "toyws/http_response.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+enum class WebSocketOpcode : std::uint8_t {
+  kContinuation = 0x0,
+  kText = 0x1,
+  kBinary = 0x2,
+  kClose = 0x8,
+  kPing = 0x9,
+  kPong = 0xa,
+};
+
+/**
+ * @brief Status codes of a Close frame (RFC 6455, section 7.4).
+ */
+enum class WebSocketCloseCode : std::uint16_t {
+  kNormal = 1000,
+  kGoingAway = 1001,
+  kProtocolError = 1002,
+  kUnsupportedData = 1003,
+  // Never sent: a Close frame without a code
+  kNoStatus = 1005,
+  // Never sent: the connection was lost without a Close frame
+  kAbnormal = 1006,
+  kInvalidPayload = 1007,
+  kPolicyViolation = 1008,
+  kMessageTooBig = 1009,
+  kInternalError = 1011,
+};
+
+/**
+ * @brief Masking key of a frame sent by a client.
+ */
+using WebSocketMask = std::array<unsigned char, 4>;
+
+/**
+ * @brief An encoded frame (see EncodeFrame), shared by the connections it is
+ * sent to.
+ */
+using WebSocketFrame = std::shared_ptr<const std::string>;
+
+// Largest head of a frame: 2 bytes, 8 of extended length & 4 of masking key
+inline constexpr std::size_t kMaxFrameHeadSize = 14;
+// Largest payload of a control frame
+inline constexpr std::size_t kMaxControlPayload = 125;
+
+/**
+ * @brief Value of Sec-WebSocket-Accept for a Sec-WebSocket-Key.
+ */
+TOYWS_EXPORT auto WebSocketAcceptKey(std::string_view key) -> std::string;
+
+/**
+ * @brief Whether request asks to upgrade to WebSocket (a GET with Upgrade:
+ * websocket), regardless of whether it is a valid opening handshake.
+ */
+TOYWS_EXPORT auto IsWebSocketUpgrade(const HttpRequest& request) -> bool;
+
+/**
+ * @brief Answer to an opening handshake: 101 Switching Protocols if request is
+ * a valid one, 426 Upgrade Required (with the version supported) if it is not
+ * a WebSocket request of version 13, or else 400 Bad Request.
+ */
+TOYWS_EXPORT auto AcceptWebSocket(const HttpRequest& request) -> HttpResponse;
+
+/**
+ * @brief XOR size bytes of a masked payload from in into out (which may be the
+ * same), offset bytes into the payload. 16 bytes at a time with SSE2 or
+ * NEON, if available.
+ */
+TOYWS_EXPORT auto UnmaskPayload(char* out, const char* in, std::size_t size,
+                                WebSocketMask mask, std::size_t offset = 0)
+    -> void;
+
+/**
+ * @brief Frame as sent by a server, i.e. unmasked. A message can be sent in
+ * fragments: the first with its opcode, the rest with kContinuation, and all
+ * but the last without fin.
+ */
+TOYWS_EXPORT auto EncodeFrame(WebSocketOpcode opcode, std::string_view payload,
+                              bool fin = true) -> std::string;
+
+/**
+ * @brief Frame as sent by a client, masked with mask.
+ */
+TOYWS_EXPORT auto EncodeMaskedFrame(WebSocketOpcode opcode,
+                                    std::string_view payload,
+                                    WebSocketMask mask, bool fin = true)
+    -> std::string;
+
+/**
+ * @brief Code in the payload of a Close frame, or kNoStatus if it has none.
+ */
+TOYWS_EXPORT auto CloseCodeOf(std::string_view payload) -> WebSocketCloseCode;
+
+/**
+ * @brief Close frame with code & reason, which is cut to fit into a control
+ * frame. kNoStatus makes one without either.
+ */
+TOYWS_EXPORT auto EncodeCloseFrame(WebSocketCloseCode code,
+                                   std::string_view reason = {})
+    -> std::string;
+
+/**
+ * @brief Incremental decoder of the frames a client sends.
+ *
+ * Reassembles fragmented messages, and passes control frames (which may come
+ * between fragments) on as they arrive. Unmasks payloads as it copies them
+ * out of the input. Text must be valid UTF-8.
+ *
+ * Protocol violations put the reader into a failed state, with ErrorCode() to
+ * close the connection with, in which it consumes nothing further.
+ */
+class TOYWS_EXPORT WebSocketReader {
+ public:
+  struct Message {
+    // kText or kBinary for a (reassembled) message, or that of a control
+    // frame
+    WebSocketOpcode opcode;
+    // Unmasked. Valid until the next call of Next().
+    std::string_view payload;
+  };
+
+  explicit WebSocketReader(std::size_t maxMessageBytes = 1024 * 1024)
+      : maxMessageSize{maxMessageBytes} {}
+
+  /**
+   * @brief Consume frames from the front of input (which is advanced past
+   * them) up to the end of the next message or control frame.
+   * @return The message, or nothing if input is exhausted first or the reader
+   * failed.
+   */
+  auto Next(std::string_view& input) -> std::optional<Message>;
+
+  auto Failed() const -> bool { return state == State::kError; }
+
+  /**
+   * @brief Code to close with once Failed().
+   */
+  auto ErrorCode() const -> WebSocketCloseCode { return errorCode; }
+
+ private:
+  enum class State { kHead, kPayload, kError };
+
+  State state = State::kHead;
+  WebSocketCloseCode errorCode = WebSocketCloseCode::kNormal;
+  std::size_t maxMessageSize;
+
+  // Frame being read
+  std::array<unsigned char, kMaxFrameHeadSize> head{};
+  std::size_t headSize = 0;
+  WebSocketOpcode opcode = WebSocketOpcode::kContinuation;
+  bool fin = false;
+  WebSocketMask mask{};
+  std::uint64_t remaining = 0;
+  std::size_t payloadRead = 0;
+
+  // Message being reassembled from its fragments
+  bool inMessage = false;
+  WebSocketOpcode messageOpcode = WebSocketOpcode::kText;
+  std::string message;
+  std::string control;
+  // What the last Message returned points into, cleared by the next call
+  std::string* delivered = nullptr;
+
+  // Consume head bytes from input; false until the head is complete & valid
+  auto ReadHead(std::string_view& input) -> bool;
+
+  // Once the payload of the current frame is all read
+  auto CompleteFrame() -> std::optional<Message>;
+
+  auto Fail(WebSocketCloseCode code) -> std::optional<Message>;
+};
+
+/**
+ * @brief A WebSocket connection, as passed to WebSocketHandlers. Only to be
+ * used on the ring's thread, and not after onClose returns.
+ */
+class TOYWS_EXPORT WebSocket {
+ public:
+  WebSocket() = default;
+  virtual ~WebSocket() = default;
+
+  WebSocket(const WebSocket&) = delete;
+  auto operator=(const WebSocket&) -> WebSocket& = delete;
+
+  /**
+   * @brief Queue an encoded frame, e.g. one shared with other connections.
+   * Ignored unless the connection is open.
+   */
+  virtual auto Send(WebSocketFrame frame) -> void = 0;
+
+  auto Send(WebSocketOpcode opcode, std::string_view payload) -> void {
+    Send(std::make_shared<const std::string>(EncodeFrame(opcode, payload)));
+  }
+
+  auto SendText(std::string_view text) -> void {
+    Send(WebSocketOpcode::kText, text);
+  }
+
+  /**
+   * @brief Start the closing handshake. Messages still arriving are delivered
+   * until the peer answers, then onClose is called.
+   */
+  virtual auto Close(WebSocketCloseCode code = WebSocketCloseCode::kNormal,
+                     std::string_view reason = {}) -> void = 0;
+
+  /**
+   * @brief The request that opened the connection.
+   */
+  virtual auto Request() const -> const HttpRequest& = 0;
+
+  /**
+   * @brief Arbitrary state of the connection's handlers.
+   */
+  auto UserData() -> std::any& { return userData; }
+
+ private:
+  std::any userData;
+};
+
+/**
+ * @brief What a WebSocket route calls. Each may be nullptr.
+ *
+ * If onOpen or onMessage throws, the connection is closed with
+ * kInternalError (and onClose called with it). What onClose throws is
+ * ignored.
+ */
+struct WebSocketHandlers {
+  // Once the handshake is done, before any message
+  void (*onOpen)(WebSocket& socket) = nullptr;
+  // With a complete text or binary message, valid during the call only
+  void (*onMessage)(WebSocket& socket, WebSocketOpcode opcode,
+                    std::string_view payload) = nullptr;
+  // Once closed, with the peer's code, the one it was failed with (see
+  // WebSocketReader::ErrorCode()), or kAbnormal if the connection was lost.
+  // Nothing can be sent anymore.
+  void (*onClose)(WebSocket& socket, WebSocketCloseCode code) = nullptr;
+};
+
+struct WebSocketOptions {
+  // Larger messages close the connection with kMessageTooBig
+  std::size_t maxMessageBytes = 1024 * 1024;
+  // A connection with more frames than this waiting to be sent (e.g. a client
+  // too slow for what is broadcast to it) is dropped
+  std::size_t maxQueuedFrames = 1024;
+};
+
+}  // namespace toyws
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "toyws/cache_line.hpp"
+#include "toyws/toyws_export.hpp"
+
+namespace toyws {
+
+/**
+ * @brief Threads to run CPU-heavy work on, off the event loop (see
+ * RouteOptions::offload).
+ *
+ * Each worker has its own queue. Tasks submitted from outside the pool are
+ * spread over the queues in turn, and tasks submitted by a worker go to its
+ * own. A worker whose queue is empty steals from the others before going to
+ * sleep, so one slow task only holds up the tasks behind it until another
+ * worker is idle.
+ */
+class TOYWS_EXPORT WorkerPool {
+ public:
+  using Task = std::function<void()>;
+
+  /**
+   * @param threads Number of workers; 0 means one per hardware thread.
+   */
+  explicit WorkerPool(std::size_t threads = 0);
+
+  /**
+   * @brief Runs what was already submitted, then joins the workers.
+   */
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  auto operator=(const WorkerPool&) -> WorkerPool& = delete;
+
+  /**
+   * @brief Run task on some worker. Any thread may submit. task must not
+   * throw.
+   */
+  auto Submit(Task task) -> void;
+
+  auto Size() const -> std::size_t { return workers.size(); }
+
+ private:
+  struct alignas(kCacheLineSize) Worker {
+    std::mutex mutex;  // Guards tasks
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<std::size_t> nextWorker = 0;
+
+  // Submitted tasks that no worker has taken yet. Incremented under
+  // sleepMutex, so that a worker about to sleep can't miss it.
+  std::atomic<std::size_t> pending = 0;
+  std::mutex sleepMutex;
+  std::condition_variable wakeup;
+  bool stopping = false;  // Guarded by sleepMutex
+
+  auto WorkerLoop(std::size_t index) -> void;
+
+  // Take the oldest task of worker index, or else of another worker
+  auto TakeTask(std::size_t index, Task& task) -> bool;
+};
+
+}  // namespace toyws
@@ -0,0 +1,172 @@
+#include "toyws/access_log.hpp"
+
+#include <fcntl.h>
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+
+#include "toyws/error.hpp"
+
+auto toyws::AccessLogProducer::Record(const HttpRequest& request,
+                                      HttpStatus httpStatus,
+                                      std::size_t bodyBytes,
+                                      std::chrono::microseconds latency)
+    -> void {
+  const auto status = static_cast<int>(httpStatus);
+  const bool isError = status >= 400;
+  if (level == AccessLogLevel::kOff ||
+      (level == AccessLogLevel::kErrors && !isError)) {
+    return;
+  }
+  if (!isError && sampleRate > 1) {
+    if (++sampleCounter < sampleRate) {
+      return;
+    }
+    sampleCounter = 0;
+  }
+
+  AccessLogRecord record;
+  record.timestampUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  record.latencyUs = static_cast<std::uint32_t>(
+      std::min<std::int64_t>(latency.count(), UINT32_MAX));
+  record.bodyBytes = static_cast<std::uint32_t>(
+      std::min<std::size_t>(bodyBytes, UINT32_MAX));
+  record.status = static_cast<std::uint16_t>(status);
+  record.method = static_cast<std::uint8_t>(request.Method());
+
+  const auto& resource = request.Resource();
+  const auto copied =
+      std::min(resource.size(), AccessLogRecord::kResourceCapacity);
+  std::memcpy(record.resource, resource.data(), copied);
+  record.resourceLength =
+      static_cast<std::uint8_t>(std::min<std::size_t>(resource.size(), 255));
+
+  if (!queue.TryPush(record)) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+toyws::AccessLog::AccessLog(AccessLogOptions logOptions)
+    : options{std::move(logOptions)} {
+  pending.reserve(options.flushBytes * 2);
+}
+
+toyws::AccessLog::~AccessLog() {
+  Stop();
+  if (ownsOutputFd && outputFd != -1) {
+    close(outputFd);
+  }
+}
+
+auto toyws::AccessLog::AddProducer() -> AccessLogProducer* {
+  std::lock_guard lock{producersMutex};
+  producers.push_back(
+      std::make_unique<AccessLogProducer>(options.level, options.sampleRate));
+  return producers.back().get();
+}
+
+auto toyws::AccessLog::Start() -> void {
+  if (running || options.level == AccessLogLevel::kOff) {
+    return;
+  }
+
+  if (outputFd == -1) {
+    if (options.path.empty()) {
+      outputFd = STDOUT_FILENO;
+    } else {
+      outputFd = open(options.path.c_str(),
+                      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (outputFd == -1) {
+        throw Error(fmt::format("Error opening access log {}: {}",
+                                options.path, std::strerror(errno)));
+      }
+      ownsOutputFd = true;
+    }
+  }
+
+  running = true;
+  writer = std::thread{[this] { WriterLoop(); }};
+}
+
+auto toyws::AccessLog::Stop() -> void {
+  running = false;
+  if (writer.joinable()) {
+    writer.join();
+  }
+}
+
+auto toyws::AccessLog::WriterLoop() -> void {
+  while (running.load(std::memory_order_relaxed)) {
+    if (Drain() == 0) {
+      Flush();
+      std::this_thread::sleep_for(options.idleInterval);
+    }
+  }
+
+  // Producers may still have queued records when Stop() is called
+  while (Drain() != 0) {
+  }
+  Flush();
+}
+
+auto toyws::AccessLog::Drain() -> std::size_t {
+  std::size_t formatted = 0;
+  AccessLogRecord record;
+
+  std::lock_guard lock{producersMutex};
+  for (auto& producer : producers) {
+    while (producer->Queue().TryPop(record)) {
+      const auto seconds =
+          static_cast<std::time_t>(record.timestampUs / 1'000'000);
+      const auto micros = record.timestampUs % 1'000'000;
+      std::tm utc{};
+      gmtime_r(&seconds, &utc);
+
+      const auto resourceLength = std::min<std::size_t>(
+          record.resourceLength, AccessLogRecord::kResourceCapacity);
+      const bool truncated =
+          record.resourceLength > AccessLogRecord::kResourceCapacity;
+
+      fmt::format_to(
+          std::back_inserter(pending),
+          "[{:%Y-%m-%dT%H:%M:%S}.{:06}Z] {} {}{} {} {}B {}us\n", utc, micros,
+          HttpMethodName(static_cast<HttpMethod>(record.method)),
+          std::string_view{record.resource, resourceLength},
+          truncated ? "..." : "", record.status, record.bodyBytes,
+          record.latencyUs);
+      ++formatted;
+
+      if (pending.size() >= options.flushBytes) {
+        Flush();
+      }
+    }
+  }
+
+  return formatted;
+}
+
+auto toyws::AccessLog::Flush() -> void {
+  std::size_t offset = 0;
+  while (offset < pending.size()) {
+    auto res =
+        write(outputFd, pending.data() + offset, pending.size() - offset);
+    if (res == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Nowhere sensible to report this from the writer thread; drop the batch
+      break;
+    }
+    offset += static_cast<std::size_t>(res);
+  }
+  pending.clear();
+}
@@ -0,0 +1,141 @@
+#include "toyws/buffer_chain.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+
+// SegmentPool:
+
+auto toyws::SegmentPool::Acquire() -> std::unique_ptr<Segment> {
+  if (free.empty()) {
+    // NOTE: Deliberately not value-initialized, the contents are overwritten
+    return std::unique_ptr<Segment>(new Segment);
+  }
+  auto segment = std::move(free.back());
+  free.pop_back();
+  return segment;
+}
+
+auto toyws::SegmentPool::Release(std::unique_ptr<Segment> segment) -> void {
+  if (free.size() < maxFree) {
+    free.push_back(std::move(segment));
+  }
+}
+
+// BufferChain:
+
+auto toyws::BufferChain::Append(std::string_view data) -> void {
+  while (!data.empty()) {
+    if (head + size == Capacity()) {
+      AddSegment();
+    }
+    const auto end = head + size;
+    const auto offset = end % kSegmentSize;
+    const auto n = std::min(data.size(), kSegmentSize - offset);
+    std::memcpy(segments[end / kSegmentSize]->data + offset, data.data(), n);
+    size += n;
+    data.remove_prefix(n);
+  }
+}
+
+auto toyws::BufferChain::Overwrite(std::size_t offset, std::string_view data)
+    -> void {
+  assert(offset + data.size() <= size);
+  for (auto pos = head + offset; !data.empty();) {
+    const auto inSegment = pos % kSegmentSize;
+    const auto n = std::min(data.size(), kSegmentSize - inSegment);
+    std::memcpy(segments[pos / kSegmentSize]->data + inSegment, data.data(),
+                n);
+    pos += n;
+    data.remove_prefix(n);
+  }
+}
+
+auto toyws::BufferChain::Reserve(std::size_t bytes) -> void {
+  while (Capacity() - head - size < bytes) {
+    AddSegment();
+  }
+}
+
+auto toyws::BufferChain::Spare() -> std::span<const iovec> {
+  iovecs.clear();
+  for (auto offset = head + size; offset < Capacity();) {
+    const auto inSegment = offset % kSegmentSize;
+    iovecs.push_back(iovec{segments[offset / kSegmentSize]->data + inSegment,
+                           kSegmentSize - inSegment});
+    offset += kSegmentSize - inSegment;
+  }
+  return iovecs;
+}
+
+auto toyws::BufferChain::Commit(std::size_t n) -> void {
+  size += std::min(n, Capacity() - head - size);
+}
+
+auto toyws::BufferChain::Data(std::size_t offset) -> std::span<const iovec> {
+  iovecs.clear();
+  const auto end = head + size;
+  for (auto pos = head + std::min(offset, size);
+       pos < end && iovecs.size() < IOV_MAX;) {
+    const auto inSegment = pos % kSegmentSize;
+    const auto n = std::min(kSegmentSize - inSegment, end - pos);
+    iovecs.push_back(iovec{segments[pos / kSegmentSize]->data + inSegment, n});
+    pos += n;
+  }
+  return iovecs;
+}
+
+auto toyws::BufferChain::Consume(std::size_t n) -> void {
+  n = std::min(n, size);
+  head += n;
+  size -= n;
+  while (head >= kSegmentSize ||
+         (size == 0 && !segments.empty() && head > 0)) {
+    head -= std::min(head, kSegmentSize);
+    ReleaseFront();
+  }
+}
+
+auto toyws::BufferChain::PieceCount() const -> std::size_t {
+  if (size == 0) {
+    return 0;
+  }
+  return (head + size - 1) / kSegmentSize + 1;
+}
+
+auto toyws::BufferChain::Piece(std::size_t i) const -> std::string_view {
+  const auto begin = i == 0 ? head : i * kSegmentSize;
+  const auto end = std::min(head + size, (i + 1) * kSegmentSize);
+  return {segments[i]->data + begin % kSegmentSize, end - begin};
+}
+
+auto toyws::BufferChain::ToString() const -> std::string {
+  std::string out;
+  out.reserve(size);
+  for (std::size_t i = 0; i < PieceCount(); ++i) {
+    out += Piece(i);
+  }
+  return out;
+}
+
+auto toyws::BufferChain::Clear() -> void {
+  while (!segments.empty()) {
+    ReleaseFront();
+  }
+  head = 0;
+  size = 0;
+}
+
+auto toyws::BufferChain::AddSegment() -> void {
+  segments.push_back(pool != nullptr ? pool->Acquire()
+                                     : std::unique_ptr<Segment>(new Segment));
+}
+
+auto toyws::BufferChain::ReleaseFront() -> void {
+  auto segment = std::move(segments.front());
+  segments.pop_front();
+  if (pool != nullptr) {
+    pool->Release(std::move(segment));
+  }
+}
@@ -0,0 +1,38 @@
+#include "toyws/chunked_body.hpp"
+
+#include <fmt/core.h>
+
+#include "toyws/error.hpp"
+
+inline constexpr std::size_t kSizeDigits = 8;
+inline constexpr std::string_view kCrlf = "\r\n";
+inline constexpr std::string_view kLastChunk = "0\r\n\r\n";
+inline constexpr std::size_t kChunkOverhead =
+    kSizeDigits + 2 * kCrlf.size() + kLastChunk.size();
+
+auto toyws::WriteChunk(const BodyProducer& producer, char* data,
+                       std::size_t capacity) -> std::pair<bool, std::size_t> {
+  if (capacity <= kChunkOverhead) {
+    throw Error("WriteChunk: buffer too small");
+  }
+
+  const std::size_t payloadOffset = kSizeDigits + kCrlf.size();
+  ChunkSink sink{data + payloadOffset, capacity - kChunkOverhead};
+  const bool more = producer(sink);
+
+  std::size_t i = 0;
+  if (sink.Size() > 0) {
+    fmt::format_to(data, "{:0{}x}", sink.Size(), kSizeDigits);
+    std::memcpy(data + kSizeDigits, kCrlf.data(), kCrlf.size());
+    i = payloadOffset + sink.Size();
+    std::memcpy(data + i, kCrlf.data(), kCrlf.size());
+    i += kCrlf.size();
+  }
+
+  if (!more) {
+    std::memcpy(data + i, kLastChunk.data(), kLastChunk.size());
+    i += kLastChunk.size();
+  }
+
+  return std::make_pair(!more, i);
+}
@@ -4,5 +4,6 @@
 
 auto toyws::ClientPool::Acquire() -> std::unique_ptr<Client> {
   // TODO: pool implementation :-)
-  return std::make_unique<Client>();
+  // Without zeroing the inline storage of its Arena
+  return std::make_unique_for_overwrite<Client>();
 }
@@ -0,0 +1,207 @@
+#include "toyws/compression.hpp"
+
+#include <fmt/core.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#include "toyws/error.hpp"
+
+inline constexpr std::size_t kOutputChunk = 16 * 1024;
+
+static auto Trim(std::string_view str) -> std::string_view {
+  while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+    str.remove_prefix(1);
+  }
+  while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+    str.remove_suffix(1);
+  }
+  return str;
+}
+
+static auto EqualsIgnoreCase(std::string_view a, std::string_view b) -> bool {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+auto toyws::NegotiateEncoding(std::string_view acceptEncoding)
+    -> ContentEncoding {
+  double gzipQ = -1;
+  double deflateQ = -1;
+  double anyQ = -1;
+
+  while (!acceptEncoding.empty()) {
+    const auto comma = acceptEncoding.find(',');
+    auto item = acceptEncoding.substr(0, comma);
+    acceptEncoding = comma == std::string_view::npos
+                         ? std::string_view{}
+                         : acceptEncoding.substr(comma + 1);
+
+    double q = 1;
+    const auto semicolon = item.find(';');
+    if (semicolon != std::string_view::npos) {
+      auto param = Trim(item.substr(semicolon + 1));
+      if (param.starts_with("q=") || param.starts_with("Q=")) {
+        q = std::strtod(std::string{param.substr(2)}.c_str(), nullptr);
+      }
+    }
+    auto coding = Trim(item.substr(0, semicolon));
+
+    if (EqualsIgnoreCase(coding, "gzip") ||
+        EqualsIgnoreCase(coding, "x-gzip")) {
+      gzipQ = q;
+    } else if (EqualsIgnoreCase(coding, "deflate")) {
+      deflateQ = q;
+    } else if (coding == "*") {
+      anyQ = q;
+    }
+  }
+
+  if (gzipQ < 0) {
+    gzipQ = anyQ;
+  }
+  if (deflateQ < 0) {
+    deflateQ = anyQ;
+  }
+
+  if (gzipQ > 0 && gzipQ >= deflateQ) {
+    return ContentEncoding::kGzip;
+  }
+  if (deflateQ > 0) {
+    return ContentEncoding::kDeflate;
+  }
+  return ContentEncoding::kIdentity;
+}
+
+auto toyws::IsCompressibleType(std::string_view contentType) -> bool {
+  contentType = Trim(contentType.substr(0, contentType.find(';')));
+  return contentType.starts_with("text/") ||
+         contentType == "application/json" ||
+         contentType == "application/javascript" ||
+         contentType == "application/xml" ||
+         contentType == "image/svg+xml" || contentType.ends_with("+json") ||
+         contentType.ends_with("+xml");
+}
+
+// Compressor:
+
+toyws::Compressor::Compressor(int compressionLevel)
+    : level{compressionLevel} {}
+
+toyws::Compressor::~Compressor() = default;
+
+auto toyws::Compressor::SetLevel(int compressionLevel) -> void {
+  level = compressionLevel;
+  gzip.reset();
+  deflate.reset();
+}
+
+auto toyws::Compressor::StreamDeleter::operator()(z_stream_s* stream) const
+    -> void {
+  deflateEnd(stream);
+  delete stream;  // NOLINT(cppcoreguidelines-owning-memory)
+}
+
+auto toyws::Compressor::Stream(ContentEncoding encoding) -> z_stream_s* {
+  auto& stream = encoding == ContentEncoding::kGzip ? gzip : deflate;
+  if (stream) {
+    deflateReset(stream.get());
+    return stream.get();
+  }
+
+  // Window bits 15 gives a zlib stream ("deflate" in HTTP), +16 a gzip stream
+  const int windowBits = encoding == ContentEncoding::kGzip ? 15 + 16 : 15;
+  auto created = std::unique_ptr<z_stream_s, StreamDeleter>(new z_stream{});
+  if (deflateInit2(created.get(), level, Z_DEFLATED, windowBits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    // Don't run deflateEnd() on a stream that failed to initialize
+    delete created.release();  // NOLINT(cppcoreguidelines-owning-memory)
+    throw Error("Compressor: deflateInit2() failed");
+  }
+  stream = std::move(created);
+  return stream.get();
+}
+
+auto toyws::Compressor::Compress(std::string_view input,
+                                 ContentEncoding encoding) -> std::string {
+  auto* stream = Stream(encoding);
+
+  std::string out;
+  out.resize(std::min<std::size_t>(deflateBound(stream, input.size()),
+                                   kOutputChunk));
+
+  // NOTE: zlib's API is not const correct, but does not write to next_in
+  stream->next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream->avail_in = static_cast<uInt>(input.size());
+
+  std::size_t produced = 0;
+  int res = Z_OK;
+  while (res != Z_STREAM_END) {
+    if (produced == out.size()) {
+      out.resize(out.size() + kOutputChunk);
+    }
+    stream->next_out = reinterpret_cast<Bytef*>(out.data() + produced);
+    stream->avail_out = static_cast<uInt>(out.size() - produced);
+
+    res = ::deflate(stream, Z_FINISH);
+    if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR) {
+      throw Error(fmt::format("Compressor: deflate() failed with {}", res));
+    }
+    produced = out.size() - stream->avail_out;
+  }
+
+  out.resize(produced);
+  return out;
+}
+
+// CompressedVariantCache:
+
+auto toyws::CompressedVariantCache::MakeKey(std::string_view identity,
+                                            ContentEncoding encoding)
+    -> std::string {
+  std::string key{ContentEncodingName(encoding)};
+  key += ' ';
+  key += identity;
+  return key;
+}
+
+auto toyws::CompressedVariantCache::Find(std::string_view identity,
+                                         ContentEncoding encoding) -> Bytes {
+  auto it = index.find(MakeKey(identity, encoding));
+  if (it == index.end()) {
+    return nullptr;
+  }
+  lru.splice(lru.begin(), lru, it->second);
+  return it->second->data;
+}
+
+auto toyws::CompressedVariantCache::Insert(std::string_view identity,
+                                           ContentEncoding encoding,
+                                           Bytes data) -> void {
+  if (data->size() > maxBytes) {
+    return;
+  }
+
+  auto key = MakeKey(identity, encoding);
+  if (auto it = index.find(key); it != index.end()) {
+    bytes -= it->second->data->size();
+    lru.erase(it->second);
+    index.erase(it);
+  }
+
+  while (bytes + data->size() > maxBytes && !lru.empty()) {
+    bytes -= lru.back().data->size();
+    index.erase(lru.back().key);
+    lru.pop_back();
+  }
+
+  bytes += data->size();
+  lru.push_front(Entry{key, std::move(data)});
+  index.emplace(std::move(key), lru.begin());
+}
@@ -0,0 +1,32 @@
+#include "toyws/connection_table.hpp"
+
+#include <cassert>
+
+toyws::ConnectionTable::ConnectionTable(std::size_t capacity) {
+  slots.resize(capacity);
+  // Lowest slots first
+  for (std::size_t i = capacity; i > 0; --i) {
+    free.push_back(static_cast<std::uint32_t>(i - 1));
+  }
+}
+
+auto toyws::ConnectionTable::Acquire() -> std::uint32_t {
+  if (free.empty()) {
+    free.push_back(static_cast<std::uint32_t>(slots.size()));
+    slots.emplace_back();
+  }
+  const auto slot = free.back();
+  free.pop_back();
+  slots[slot].used = true;
+  return slot;
+}
+
+auto toyws::ConnectionTable::Release(std::uint32_t slot) -> void {
+  auto& entry = slots[slot];
+  assert(entry.used);
+  ++entry.generation;
+  entry.fd = -1;
+  entry.state = Client::States::kFinished;
+  entry.used = false;
+  free.push_back(slot);
+}
@@ -0,0 +1,108 @@
+#include "toyws/event_stream.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include "toyws/error.hpp"
+
+namespace {
+
+// A comment line & the blank line ending it, ignored by EventSource
+constexpr std::string_view kHeartbeat = ":\n\n";
+
+auto AppendField(std::string& out, std::string_view name,
+                 std::string_view value) -> void {
+  if (value.find_first_of("\r\n") != std::string_view::npos) {
+    throw toyws::Error(
+        fmt::format("EncodeEvent: Line break in the {} field", name));
+  }
+  out += name;
+  out += ": ";
+  out += value;
+  out += '\n';
+}
+
+}  // namespace
+
+auto toyws::EncodeEvent(std::string_view data, std::string_view event,
+                        std::string_view id) -> std::string {
+  std::string out;
+  out.reserve(data.size() + event.size() + id.size() + 32);
+  if (!event.empty()) {
+    AppendField(out, "event", event);
+  }
+  if (!id.empty()) {
+    AppendField(out, "id", id);
+  }
+
+  // A data line per line, which may end with CRLF, LF or CR
+  while (true) {
+    const auto end = data.find_first_of("\r\n");
+    out += "data: ";
+    out += data.substr(0, end);
+    out += '\n';
+    if (end == std::string_view::npos) {
+      break;
+    }
+    const auto next = data.substr(end, 2) == "\r\n" ? end + 2 : end + 1;
+    data.remove_prefix(next);
+  }
+  out += '\n';
+  return out;
+}
+
+auto toyws::EncodeChunk(std::string_view payload) -> std::string {
+  if (payload.empty()) {
+    return {};
+  }
+  std::string out = fmt::format("{:x}\r\n", payload.size());
+  out.reserve(out.size() + payload.size() + 2);
+  out += payload;
+  out += "\r\n";
+  return out;
+}
+
+auto toyws::EncodeEventChunk(std::string_view data, std::string_view event,
+                             std::string_view id) -> EventStreamFrame {
+  return std::make_shared<const std::string>(
+      EncodeChunk(EncodeEvent(data, event, id)));
+}
+
+auto toyws::HeartbeatChunk() -> EventStreamFrame {
+  // Immutable, so one serves every ring
+  static const EventStreamFrame kFrame =
+      std::make_shared<const std::string>(EncodeChunk(kHeartbeat));
+  return kFrame;
+}
+
+auto toyws::EventHub::Subscribe(const Route* topic, int slot) -> void {
+  topics[topic].push_back(slot);
+  ++subscribers;
+}
+
+auto toyws::EventHub::Unsubscribe(const Route* topic, int slot) -> bool {
+  const auto found = topics.find(topic);
+  if (found == topics.end()) {
+    return false;
+  }
+  auto& slots = found->second;
+  const auto it = std::find(slots.begin(), slots.end(), slot);
+  if (it == slots.end()) {
+    return false;
+  }
+  *it = slots.back();
+  slots.pop_back();
+  --subscribers;
+  if (slots.empty()) {
+    topics.erase(found);
+  }
+  return true;
+}
+
+auto toyws::EventHub::Subscribers(const Route* topic) const -> std::size_t {
+  const auto found = topics.find(topic);
+  return found != topics.end() ? found->second.size() : 0;
+}
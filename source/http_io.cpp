@@ -1,12 +1,15 @@
-#include <fmt/core.h>
-
+#include <cctype>
+#include <memory_resource>
+#include <string>
+#include <string_view>
 #include <type_traits>
 
-#include "toyws/error.hpp"
 #include "toyws/http_request.hpp"
 #include "toyws/http_response.hpp"
 
 inline constexpr int kBufSize = 256;
+// More header fields than this are answered with 431
+inline constexpr std::size_t kMaxHeaderFields = 100;
 
 struct HttpRequestEditor {
   static auto SetMethod(toyws::HttpRequest* request, toyws::HttpMethod method)
@@ -14,9 +17,9 @@ struct HttpRequestEditor {
     request->method = method;
   }
 
-  static auto SetResource(toyws::HttpRequest* request, std::string resource)
-      -> void {
-    request->resource = std::move(resource);
+  static auto SetResource(toyws::HttpRequest* request,
+                          std::string_view resource) -> void {
+    request->resource = resource;
   }
 };
 
@@ -26,27 +29,30 @@ struct HttpResponseEditor {
     response->status = status;
   }
 
-  static auto SetReason(toyws::HttpResponse* response, std::string reason)
-      -> void {
-    response->reason = std::move(reason);
+  static auto SetReason(toyws::HttpResponse* response,
+                        std::string_view reason) -> void {
+    response->reason = reason;
   }
 };
 
 // Fwd Declares:
-static auto ReadUntilDelim(const char* data, std::size_t i, std::size_t length,
-                           char delim, std::string& buf) -> std::size_t;
-static auto ConsumeNewline(const char* data, std::size_t i, std::size_t length)
-    -> std::size_t;
-static auto ParseRequestLine(const char* data, std::size_t i,
-                             std::size_t length, std::string& buf,
-                             toyws::HttpRequest* target) -> std::size_t;
-static auto ParseStatusLine(const char* data, std::size_t i, std::size_t length,
-                            std::string& buf, toyws::HttpResponse* target)
-    -> std::size_t;
-
-static auto ParseHeaderField(const char* data, std::size_t i,
-                             std::size_t length, std::string& buf,
-                             toyws::HeadersMap* headers) -> std::size_t;
+// Parsing advances i past what it consumed. Malformed input is reported by the
+// return value rather than thrown, as it is common (& cheap to produce) junk.
+static auto ReadUntilDelim(const char* data, std::size_t& i,
+                           std::size_t length, char delim,
+                           std::pmr::string& buf) -> bool;
+static auto ConsumeNewline(const char* data, std::size_t& i,
+                           std::size_t length) -> bool;
+static auto ParseRequestLine(const char* data, std::size_t& i,
+                             std::size_t length, std::pmr::string& buf,
+                             toyws::HttpRequest* target) -> toyws::HttpStatus;
+static auto ParseStatusLine(const char* data, std::size_t& i,
+                            std::size_t length, std::pmr::string& buf,
+                            toyws::HttpResponse* target) -> bool;
+
+static auto ParseHeaders(const char* data, std::size_t& i, std::size_t length,
+                         std::pmr::string& buf, toyws::HeadersMap* headers)
+    -> toyws::HttpStatus;
 
 static auto ReadBody(const char* data, std::size_t i, std::size_t length,
                      std::string* body) -> void;
@@ -54,32 +60,37 @@ static auto WriteRaw(char* data, std::size_t offset, std::size_t capacity,
                      const char* output, std::size_t length, bool& success)
     -> std::size_t;
 static auto WriteRaw(char* data, std::size_t offset, std::size_t capacity,
-                     const std::string& output, bool& success) -> std::size_t;
+                     std::string_view output, bool& success) -> std::size_t;
 static auto WriteStr(char* data, std::size_t offset, std::size_t capacity,
                      const char* output, bool& success) -> std::size_t;
 
 // HttpRequest:
-auto toyws::HttpRequest::Read(const char* data, const std::size_t length)
-    -> bool {
-  std::string buf;
+auto toyws::HttpRequest::Parse(std::string_view head) -> HttpStatus {
+  const auto* data = head.data();
+  const auto length = head.size();
+  // Scratch space for one token at a time, along with the headers
+  std::pmr::string buf{headers.get_allocator()};
   buf.reserve(kBufSize);
   std::size_t offset = 0;
 
-  offset = ParseRequestLine(data, offset, length, buf, this);
-
-  std::size_t prev;
-  do {
-    prev = offset;
-    offset = ParseHeaderField(data, offset, length, buf, &headers);
-  } while (offset != prev);
-
-  offset = ConsumeNewline(data, offset, length);
+  if (auto status = ParseRequestLine(data, offset, length, buf, this);
+      status != HttpStatus::kOk) {
+    return status;
+  }
+  if (auto status = ParseHeaders(data, offset, length, buf, &headers);
+      status != HttpStatus::kOk) {
+    return status;
+  }
 
   ReadBody(data, offset, length, &body);
+  return HttpStatus::kOk;
+}
 
+auto toyws::HttpRequest::Read(const char* data, const std::size_t length)
+    -> bool {
   // TODO: Implement partial reading, i.e., when buffer has missing request
   // data
-  return true;
+  return Parse({data, length}) == HttpStatus::kOk;
 }
 
 auto toyws::HttpRequest::Write(char* data, std::size_t capacity)
@@ -133,32 +144,73 @@ auto toyws::HttpResponse::Write(char* data, const std::size_t capacity)
     i = WriteRaw(data, i, capacity, header.second, success);
     i = WriteStr(data, i, capacity, "\r\n", success);
   }
+  if (stream) {
+    i = WriteStr(data, i, capacity, "Transfer-Encoding: chunked\r\n", success);
+  } else if (file && !headers.contains("Content-Length")) {
+    i = WriteStr(data, i, capacity, "Content-Length: ", success);
+    i = WriteRaw(data, i, capacity, std::to_string(file.length), success);
+    i = WriteStr(data, i, capacity, "\r\n", success);
+  } else if (!body.empty() && !headers.contains("Content-Length")) {
+    i = WriteStr(data, i, capacity, "Content-Length: ", success);
+    i = WriteRaw(data, i, capacity, std::to_string(body.size()), success);
+    i = WriteStr(data, i, capacity, "\r\n", success);
+  }
 
   // CRLF to seperate header & body
   i = WriteStr(data, i, capacity, "\r\n", success);
 
-  // TODO: Write body + content length
+  if (!stream && !file) {
+    i = WriteRaw(data, i, capacity, body, success);
+  }
 
-  return std::make_pair(true, i);  // TODO
+  return std::make_pair(success, i);
+}
+
+auto toyws::HttpResponse::Write(BufferChain& out) const -> void {
+  WriteHead(out);
+  if (!stream && !file) {
+    out.Append(body);
+  }
+}
+
+auto toyws::HttpResponse::WriteHead(BufferChain& out) const -> void {
+  out.Append("HTTP/1.1 ");
+  out.Append(std::to_string(static_cast<int>(status)));
+  out.Append(" ");
+  out.Append(reason);
+  out.Append("\r\n");
+
+  for (const auto& header : headers) {
+    out.Append(header.first);
+    out.Append(": ");
+    out.Append(header.second);
+    out.Append("\r\n");
+  }
+  if (stream) {
+    out.Append("Transfer-Encoding: chunked\r\n");
+  } else if (file && !headers.contains("Content-Length")) {
+    out.Append("Content-Length: ");
+    out.Append(std::to_string(file.length));
+    out.Append("\r\n");
+  } else if (!body.empty() && !headers.contains("Content-Length")) {
+    out.Append("Content-Length: ");
+    out.Append(std::to_string(body.size()));
+    out.Append("\r\n");
+  }
+
+  out.Append("\r\n");
 }
 
 auto toyws::HttpResponse::Read(const char* data, const std::size_t length)
     -> bool {
-  std::string buf;
+  std::pmr::string buf{headers.get_allocator()};
   buf.reserve(kBufSize);
   std::size_t offset = 0;
 
-  offset = ParseStatusLine(data, offset, length, buf, this);
-
-  // TODO: From here on HttpRequest & HttpResponse can be unified
-
-  std::size_t prev;
-  do {
-    prev = offset;
-    offset = ParseHeaderField(data, offset, length, buf, &headers);
-  } while (offset != prev);
-
-  offset = ConsumeNewline(data, offset, length);
+  if (!ParseStatusLine(data, offset, length, buf, this) ||
+      ParseHeaders(data, offset, length, buf, &headers) != HttpStatus::kOk) {
+    return false;
+  }
 
   ReadBody(data, offset, length, &body);
 
@@ -167,107 +219,155 @@ auto toyws::HttpResponse::Read(const char* data, const std::size_t length)
 
 // Shared Implementation:
 
-auto ReadUntilDelim(const char* data, std::size_t i, const std::size_t length,
-                    const char delim, std::string& buf) -> std::size_t {
+auto ReadUntilDelim(const char* data, std::size_t& i, const std::size_t length,
+                    const char delim, std::pmr::string& buf) -> bool {
   for (; i < length; ++i) {
     char c = data[i];
     if (c == delim) {
-      break;
-    } else if (c == '\r' || c == '\n') {
-      throw toyws::Error(fmt::format(
-          "HttpIo::ReadUntilDelim: Newline before expected delimiter {}",
-          delim));
-    } else {
-      buf += c;
+      return true;
     }
+    if (c == '\r' || c == '\n') {
+      // Newline before expected delimiter
+      return false;
+    }
+    buf += c;
   }
 
-  return i;
+  return false;
 }
 
-auto ConsumeNewline(const char* data, std::size_t i, std::size_t length)
-    -> std::size_t {
-  if (i < length + 1 && data[i] == '\r' && data[i + 1] == '\n') {
-    return i + 2;
+auto ConsumeNewline(const char* data, std::size_t& i, std::size_t length)
+    -> bool {
+  if (i + 1 < length && data[i] == '\r' && data[i + 1] == '\n') {
+    i += 2;
+    return true;
   }
-  throw toyws::Error("HttpIo: Expected newline");
+  return false;
 }
 
-auto ParseRequestLine(const char* data, std::size_t i, const std::size_t length,
-                      std::string& buf, toyws::HttpRequest* target)
-    -> std::size_t {
-  i = ReadUntilDelim(data, i, length, ' ', buf) + 1;
-  HttpRequestEditor::SetMethod(target, toyws::ParseHttpMethod(buf));
+// Whether version has the form "HTTP/x.y", i.e. is some version of HTTP
+static auto IsHttpVersion(std::string_view version) -> bool {
+  return version.size() == 8 && version.starts_with("HTTP/") &&
+         std::isdigit(static_cast<unsigned char>(version[5])) != 0 &&
+         version[6] == '.' &&
+         std::isdigit(static_cast<unsigned char>(version[7])) != 0;
+}
+
+auto ParseRequestLine(const char* data, std::size_t& i,
+                      const std::size_t length, std::pmr::string& buf,
+                      toyws::HttpRequest* target) -> toyws::HttpStatus {
+  using toyws::HttpStatus;
+
+  if (!ReadUntilDelim(data, i, length, ' ', buf)) {
+    return HttpStatus::kBadRequest;
+  }
+  ++i;
+  const auto method = toyws::ParseHttpMethod(buf);
+  if (!method) {
+    return HttpStatus::kBadRequest;
+  }
+  HttpRequestEditor::SetMethod(target, *method);
   buf.clear();
 
-  i = ReadUntilDelim(data, i, length, ' ', buf) + 1;
+  if (!ReadUntilDelim(data, i, length, ' ', buf) || buf.empty()) {
+    return HttpStatus::kBadRequest;
+  }
+  ++i;
   HttpRequestEditor::SetResource(target, buf);
   buf.clear();
 
-  i = ReadUntilDelim(data, i, length, '\r', buf);
+  if (!ReadUntilDelim(data, i, length, '\r', buf)) {
+    return HttpStatus::kBadRequest;
+  }
   if (buf != "HTTP/1.1") {
-    throw toyws::Error(fmt::format("Expected version HTTP/1.1, given {}", buf));
+    return IsHttpVersion(buf) ? HttpStatus::kHttpVersionNotSupported
+                              : HttpStatus::kBadRequest;
   }
   buf.clear();
 
-  i = ConsumeNewline(data, i, length);
-
-  return i;
+  return ConsumeNewline(data, i, length) ? HttpStatus::kOk
+                                         : HttpStatus::kBadRequest;
 }
 
-auto ParseStatusLine(const char* data, std::size_t i, std::size_t length,
-                     std::string& buf, toyws::HttpResponse* target)
-    -> std::size_t {
-  i = ReadUntilDelim(data, i, length, ' ', buf) + 1;
-  if (buf != "HTTP/1.1") {
-    throw toyws::Error(fmt::format("Expected version HTTP/1.1, given {}", buf));
+auto ParseStatusLine(const char* data, std::size_t& i, std::size_t length,
+                     std::pmr::string& buf, toyws::HttpResponse* target)
+    -> bool {
+  if (!ReadUntilDelim(data, i, length, ' ', buf) || buf != "HTTP/1.1") {
+    return false;
   }
+  ++i;
   buf.clear();
 
-  i = ReadUntilDelim(data, i, length, ' ', buf) + 1;
-  HttpResponseEditor::SetStatus(target, toyws::ParseHttpStatus(buf));
+  if (!ReadUntilDelim(data, i, length, ' ', buf)) {
+    return false;
+  }
+  ++i;
+  const auto status = toyws::ParseHttpStatus(buf);
+  if (!status) {
+    return false;
+  }
+  HttpResponseEditor::SetStatus(target, *status);
   buf.clear();
 
-  i = ReadUntilDelim(data, i, length, '\r', buf);
+  if (!ReadUntilDelim(data, i, length, '\r', buf)) {
+    return false;
+  }
   HttpResponseEditor::SetReason(target, buf);
   buf.clear();
 
-  i = ConsumeNewline(data, i, length);
-
-  return i;
+  return ConsumeNewline(data, i, length);
 }
 
-auto ParseHeaderField(const char* data, std::size_t i, const std::size_t length,
-                      std::string& buf, toyws::HeadersMap* headers)
-    -> std::size_t {
-  if (data[i] == '\r') {
-    return i;
-  }
-
+static auto ParseHeaderField(const char* data, std::size_t& i,
+                             const std::size_t length, std::pmr::string& buf,
+                             toyws::HeadersMap* headers) -> bool {
   // Read "Key:"
-  i = ReadUntilDelim(data, i, length, ':', buf) + 1;
-  std::string key{buf};
+  if (!ReadUntilDelim(data, i, length, ':', buf) || buf.empty()) {
+    return false;
+  }
+  ++i;
+  std::pmr::string key{buf, buf.get_allocator()};
   buf.clear();
   if (headers->contains(key)) {
-    throw toyws::Error(
-        fmt::format("Header {} stated twice in HTTP request", key));
+    // Stated twice
+    return false;
   }
 
   // Skip whitespace
-  if (data[i] == ' ') {
+  if (i < length && data[i] == ' ') {
     ++i;
   }
 
   // Read rest as header value
-  i = ReadUntilDelim(data, i, length, '\r', buf);
-  (*headers)[key] = buf;
+  if (!ReadUntilDelim(data, i, length, '\r', buf)) {
+    return false;
+  }
+  headers->emplace(std::move(key), buf);
   buf.clear();
 
   // TODO: Skip optional whitespace at end of value?
 
-  i = ConsumeNewline(data, i, length);
+  return ConsumeNewline(data, i, length);
+}
+
+auto ParseHeaders(const char* data, std::size_t& i, const std::size_t length,
+                  std::pmr::string& buf, toyws::HeadersMap* headers)
+    -> toyws::HttpStatus {
+  using toyws::HttpStatus;
+
+  std::size_t count = 0;
+  while (i < length && data[i] != '\r') {
+    if (++count > kMaxHeaderFields) {
+      return HttpStatus::kRequestHeaderFieldsTooLarge;
+    }
+    if (!ParseHeaderField(data, i, length, buf, headers)) {
+      return HttpStatus::kBadRequest;
+    }
+  }
 
-  return i;
+  // CRLF separating the headers from the body
+  return ConsumeNewline(data, i, length) ? HttpStatus::kOk
+                                         : HttpStatus::kBadRequest;
 }
 
 auto ReadBody(const char* data, const std::size_t i, const std::size_t length,
@@ -289,8 +389,8 @@ auto WriteRaw(char* data, std::size_t offset, std::size_t capacity,
 }
 
 auto WriteRaw(char* data, std::size_t offset, const std::size_t capacity,
-              const std::string& output, bool& success) -> std::size_t {
-  return WriteRaw(data, offset, capacity, output.c_str(), output.size(),
+              std::string_view output, bool& success) -> std::size_t {
+  return WriteRaw(data, offset, capacity, output.data(), output.size(),
                   success);
 }
 
@@ -0,0 +1,919 @@
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <utility>
+
+#include "toyws/client.hpp"
+#include "toyws/error.hpp"
+#include "toyws/io_service_epoll.hpp"
+#include "toyws/toyws.hpp"
+
+static auto IsAgain(int err) -> bool {
+  return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+static auto SetNonBlocking(toyws::Socket sock) -> bool {
+  const int flags = fcntl(sock, F_GETFL);
+  return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// openat() path below dirFd, resolving it beneath dirFd where the kernel
+// supports that
+static auto OpenAt2(int dirFd, const char* path, int flags) -> int {
+#if defined(RESOLVE_BENEATH) && defined(SYS_openat2)
+  open_how how{};
+  how.flags = static_cast<unsigned>(flags);
+  how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+  const auto fd =
+      static_cast<int>(syscall(SYS_openat2, dirFd, path, &how, sizeof(how)));
+  if (fd >= 0 || errno != ENOSYS) {
+    return fd;
+  }
+#endif
+  return openat(dirFd, path, flags);
+}
+
+// Call a file I/O completion. What it throws is dropped, see AsyncFileIo.
+template <typename Callback, typename... Args>
+static auto Complete(const Callback& done, const Args&... args) -> void {
+  try {
+    done(args...);
+  } catch (...) {
+    // No one to pass it to
+  }
+}
+
+template <typename Handler>
+toyws::EpollIoService<Handler>::EpollIoService() {
+  clients.resize(table.Size());
+  slots.resize(table.Size());
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1) {
+    throw Error(
+        std::format("Error in epoll_create1(): {}", std::strerror(errno)));
+  }
+
+  // Level-triggered, as it is only read once the event is handled
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = kMailboxKey;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, mailbox.Fd(), &event) == -1) {
+    const int err = errno;
+    close(epollFd);
+    throw Error(std::format("Error in epoll_ctl(): {}", std::strerror(err)));
+  }
+}
+
+template <typename Handler>
+toyws::EpollIoService<Handler>::~EpollIoService() {
+  close(epollFd);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Run() -> void {
+  std::array<epoll_event, kEpollEvents> events{};
+  while (!Stopping()) {
+    RunReady();
+    if (Stopping()) {
+      break;
+    }
+
+    const int count = epoll_wait(epollFd, events.data(), kEpollEvents,
+                                 ready.empty() && completions.empty()
+                                     ? WaitTimeout()
+                                     : 0);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;  // E.g. Stop() from a signal handler
+      }
+      throw Error(
+          std::format("Error in epoll_wait(): {}", std::strerror(errno)));
+    }
+    metrics.cqeBatches.Add();
+    for (int i = 0; i < count; ++i) {
+      HandleEvent(events[static_cast<std::size_t>(i)]);
+    }
+    if (lingering > 0) {
+      ExpireLinger();
+    }
+  }
+  stopping.store(false, std::memory_order_relaxed);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Stop() -> void {
+  stopping.store(true, std::memory_order_relaxed);
+  mailbox.Wake();
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::MakeListeningSocket(
+    const std::string& address, uint16_t port, const ListenerOptions& options)
+    -> Socket {
+  return toyws::MakeListeningSocket(address, port, options);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::RunReady() -> void {
+  for (auto count = ready.size(); count > 0 && !Stopping(); --count) {
+    const auto key = ready.front();
+    ready.pop_front();
+    if ((key & kListenerFlag) != 0) {
+      const auto index = static_cast<std::size_t>(key & ~kListenerFlag);
+      acceptors[index].queued = false;
+      TryAccept(index);
+    } else {
+      const auto slot = static_cast<std::size_t>(key);
+      slots[slot].queued = false;
+      TryOperation(slot);
+    }
+  }
+
+  for (auto count = completions.size(); count > 0 && !Stopping(); --count) {
+    auto complete = std::move(completions.front());
+    completions.pop_front();
+    complete();
+  }
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::WaitTimeout() -> int {
+  if (lingering == 0) {
+    return -1;
+  }
+  const auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+      lingerDeadline - Clock::now());
+  return static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(
+      wait.count(), 0, INT_MAX));
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::HandleEvent(const epoll_event& event)
+    -> void {
+  metrics.cqes.Add();
+
+  if (event.data.u64 == kMailboxKey) {
+    for (auto& task : mailbox.TakeAll()) {
+      completions.push_back(std::move(task));
+    }
+    return;
+  }
+  if ((event.data.u64 & kListenerFlag) != 0) {
+    const auto index =
+        static_cast<std::size_t>(event.data.u64 & ~kListenerFlag);
+    acceptors[index].readable = true;
+    Queue(event.data.u64);
+    return;
+  }
+
+  const auto slot = static_cast<std::size_t>(event.data.u64 & 0xffffffff);
+  const auto sock = static_cast<Socket>(event.data.u64 >> 32);
+  auto& client = clients[slot];
+  if (client == nullptr || client->Socket() != sock) {
+    return;  // The connection was closed meanwhile
+  }
+
+  // Errors & hangups are found out by the next attempt
+  auto& state = slots[slot];
+  if ((event.events & (EPOLLRDHUP | EPOLLHUP)) != 0) {
+    state.peerClosed = true;
+  }
+  if ((event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+    state.readable = true;
+  }
+  if ((event.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0) {
+    state.writable = true;
+  }
+  Queue(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Queue(std::uint64_t key) -> void {
+  bool& queued =
+      (key & kListenerFlag) != 0
+          ? acceptors[static_cast<std::size_t>(key & ~kListenerFlag)].queued
+          : slots[static_cast<std::size_t>(key)].queued;
+  if (!queued) {
+    queued = true;
+    ready.push_back(key);
+  }
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Register(std::size_t slot, Socket sock)
+    -> bool {
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.u64 = (static_cast<std::uint64_t>(sock) << 32) | slot;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &event) == -1) {
+    return false;
+  }
+
+  // A new connection has room to write, and (with TCP_DEFER_ACCEPT) likely
+  // the request to read already. Finding out costs less than waiting for
+  // epoll to tell.
+  auto& state = slots[slot];
+  state.readable = true;
+  state.writable = true;
+  state.peerClosed = false;
+  return true;
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::FindAcceptor(Socket listeningFd)
+    -> std::size_t {
+  for (std::size_t i = 0; i < acceptors.size(); ++i) {
+    if (acceptors[i].fd == listeningFd) {
+      return i;
+    }
+  }
+
+  const auto index = acceptors.size();
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.u64 = kListenerFlag | index;
+  if (!SetNonBlocking(listeningFd) ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, listeningFd, &event) == -1) {
+    throw Error(std::format("Error registering listening socket: {}",
+                            std::strerror(errno)));
+  }
+  acceptors.emplace_back().fd = listeningFd;
+  return index;
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::AsyncAccept(Socket listeningFd) -> void {
+  const auto index = FindAcceptor(listeningFd);
+
+  auto client = clientPool.Acquire();
+  const auto slot = AcquireSlot();
+  client->SetSocket(listeningFd);
+  client->SetIoServiceSlot(static_cast<int>(slot));
+  client->Buffer().SetPool(&segmentPool);
+  clients[slot] = std::move(client);
+
+  acceptors[index].waiting.push_back(slot);
+  Queue(kListenerFlag | index);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TryAccept(std::size_t index) -> void {
+  auto& acceptor = acceptors[index];
+  // Taken meanwhile, and the slot perhaps reused
+  while (!acceptor.waiting.empty() &&
+         (clients[acceptor.waiting.front()] == nullptr ||
+          clients[acceptor.waiting.front()]->Socket() != acceptor.fd)) {
+    acceptor.waiting.pop_front();
+  }
+  if (!acceptor.readable || acceptor.waiting.empty()) {
+    return;
+  }
+
+  const Socket listeningFd = acceptor.fd;
+  const Socket sock =
+      accept4(listeningFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (sock == -1) {
+    if (errno == EINTR || errno == ECONNABORTED) {
+      Queue(kListenerFlag | index);
+      return;
+    }
+    if (!IsAgain(errno)) {
+      // E.g. out of file descriptors. The connection stays queued, and is
+      // tried again once the next one arrives.
+      metrics.cqeErrors.Add();
+    }
+    acceptor.readable = false;
+    return;
+  }
+
+  const auto slot = acceptor.waiting.front();
+  acceptor.waiting.pop_front();
+  // There may be more; take them one per round, like reads
+  Queue(kListenerFlag | index);
+
+  auto& client = clients[slot];
+  if (!Register(slot, sock)) {
+    metrics.cqeErrors.Add();
+    close(sock);
+    acceptors[index].waiting.push_front(slot);
+    return;
+  }
+  metrics.accepts.Add();
+  connections.fetch_add(1, std::memory_order_relaxed);
+  client->SetSocket(sock);
+  Handler::OnAccept(this, listeningFd, client.get());
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::AsyncRead(int clientSlot) -> void {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  auto& client = clients[slot];
+  auto& buffer = client->Buffer();
+  buffer.Clear();
+  buffer.Reserve(kReadSize);
+  client->SetState(Client::States::kRead);
+  Queue(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::AsyncWrite(int clientSlot,
+                                                AfterWrite after) -> void {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+  state.sent = 0;
+  state.total = client->Buffer().Size() +
+                (client->Output() ? client->Output()->size() : 0);
+  state.fileSent = 0;
+  state.after = after;
+  client->SetState(Client::States::kWrite);
+  Queue(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::AsyncSend(int clientSlot) -> void {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  auto& state = slots[slot];
+  if (state.sending || clients[slot]->Outbox().empty()) {
+    return;
+  }
+  state.sending = true;
+  Queue(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::AsyncWaitClose(int clientSlot) -> void {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  clients[slot]->Buffer().Clear();
+  clients[slot]->SetState(Client::States::kWaitClose);
+  Queue(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Shutdown(int clientSlot) -> void {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  shutdown(clients[slot]->Socket(), SHUT_RDWR);
+  // Without waiting for epoll to report it
+  auto& state = slots[slot];
+  state.readable = true;
+  state.peerClosed = true;
+  Queue(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TryOperation(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  if (client == nullptr) {
+    return;  // Closed after it was queued
+  }
+
+  auto& state = slots[slot];
+  if (state.sending && state.writable) {
+    // Alongside the operation the client is in
+    TrySend(slot);
+    if (client == nullptr) {
+      return;  // Closed by OnSent
+    }
+  }
+  switch (client->State()) {
+    case Client::States::kRead:
+      if (state.readable) {
+        TryRead(slot);
+      }
+      break;
+    case Client::States::kWrite:
+      if (state.writable) {
+        TryWrite(slot);
+      }
+      break;
+    case Client::States::kSendFile:
+      if (state.writable) {
+        TrySendFile(slot);
+      }
+      break;
+    case Client::States::kLinger:
+      if (state.readable) {
+        TryDrain(slot);
+      }
+      break;
+    case Client::States::kWaitClose:
+      if (state.readable) {
+        TryWaitClose(slot);
+      }
+      break;
+    default:
+      // Waiting for its acceptor, or for the handler to start something
+      break;
+  }
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TryRead(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+  auto& buffer = client->Buffer();
+
+  const auto spare = buffer.Spare();
+  const auto res = readv(client->Socket(), spare.data(),
+                         static_cast<int>(spare.size()));
+  if (res < 0) {
+    if (errno == EINTR) {
+      Queue(slot);
+    } else if (IsAgain(errno)) {
+      state.readable = false;
+    } else {
+      // Left to the handler like an empty read, as a send may be in progress
+      metrics.cqeErrors.Add();
+      state.readable = false;
+      client->SetState(Client::States::kIdle);
+      Handler::OnRead(this, client.get());
+    }
+    return;
+  }
+
+  const auto read = static_cast<std::size_t>(res);
+  std::size_t requested = 0;
+  for (const auto& iov : spare) {
+    requested += iov.iov_len;
+  }
+  if (read < requested && !state.peerClosed) {
+    // All there was. More data arrives with an event, which spares trying
+    // until EAGAIN. Not so the end of the stream once reported.
+    state.readable = false;
+  }
+
+  // An empty read (peer closed) is left to the handler. One read per
+  // AsyncRead(), as with io_uring: what arrives meanwhile (e.g. a pipelined
+  // request, or the peer half-closing) waits until the handler reads again.
+  metrics.reads.Add();
+  metrics.bytesRead.Add(read);
+  buffer.Commit(read);
+  client->SetState(Client::States::kIdle);
+  Handler::OnRead(this, client.get());
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TryWrite(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+  auto& buffer = client->Buffer();
+  const auto& output = client->Output();
+
+  while (state.sent < state.total) {
+    // Skip what has been sent already
+    const auto data = buffer.Data(std::min(state.sent, buffer.Size()));
+    state.iovecs.assign(data.begin(), data.end());
+    if (output && state.iovecs.size() < IOV_MAX) {
+      const auto skip = state.sent - std::min(state.sent, buffer.Size());
+      if (skip < output->size()) {
+        // Safe to cast away const, sendmsg only reads from the buffer
+        state.iovecs.push_back(iovec{const_cast<char*>(output->data()) + skip,
+                                     output->size() - skip});
+      }
+    }
+
+    msghdr message{};
+    message.msg_iov = state.iovecs.data();
+    message.msg_iovlen = state.iovecs.size();
+    const auto res = sendmsg(client->Socket(), &message, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (IsAgain(errno)) {
+        // Continued once epoll reports room. This is what paces streamed
+        // responses to the speed of the client.
+        state.writable = false;
+        return;
+      }
+      metrics.cqeErrors.Add();
+      Close(client.get());
+      return;
+    }
+    metrics.writes.Add();
+    metrics.bytesWritten.Add(static_cast<std::uint64_t>(res));
+    state.sent += static_cast<std::size_t>(res);
+  }
+
+  buffer.Clear();
+  client->SetOutput(nullptr);
+  if (client->File()) {
+    client->SetState(Client::States::kSendFile);
+    TrySendFile(slot);
+    return;
+  }
+  FinishWrite(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TrySend(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+
+  while (!client->Outbox().empty()) {
+    state.sendIovecs.clear();
+    auto skip = client->OutboxSent();
+    for (const auto& message : client->Outbox()) {
+      if (state.sendIovecs.size() == IOV_MAX) {
+        break;
+      }
+      // Safe to cast away const, sendmsg only reads from the buffer
+      state.sendIovecs.push_back(
+          iovec{const_cast<char*>(message->data()) + skip,
+                message->size() - skip});
+      skip = 0;
+    }
+
+    msghdr message{};
+    message.msg_iov = state.sendIovecs.data();
+    message.msg_iovlen = state.sendIovecs.size();
+    const auto res = sendmsg(client->Socket(), &message, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (IsAgain(errno)) {
+        state.writable = false;
+        return;
+      }
+      metrics.cqeErrors.Add();
+      client->ClearOutbox();
+      Shutdown(static_cast<int>(slot));
+      break;
+    }
+    metrics.writes.Add();
+    metrics.bytesWritten.Add(static_cast<std::uint64_t>(res));
+    client->ConsumeOutbox(static_cast<std::size_t>(res));
+  }
+
+  state.sending = false;
+  Handler::OnSent(this, client.get());
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TrySendFile(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+  const auto& file = client->File();
+
+  while (state.fileSent < file.length) {
+    auto offset = static_cast<off_t>(file.offset + state.fileSent);
+    const auto res =
+        sendfile(client->Socket(), file.file->fd, &offset,
+                 static_cast<std::size_t>(
+                     std::min<std::uint64_t>(file.length - state.fileSent,
+                                             INT_MAX)));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (IsAgain(errno)) {
+        state.writable = false;
+        return;
+      }
+      metrics.cqeErrors.Add();
+      Close(client.get());
+      return;
+    }
+    if (res == 0) {
+      // The file was truncated after it was opened. The response is cut
+      // short.
+      break;
+    }
+    metrics.writes.Add();
+    metrics.bytesWritten.Add(static_cast<std::uint64_t>(res));
+    metrics.bytesSpliced.Add(static_cast<std::uint64_t>(res));
+    state.fileSent += static_cast<std::uint64_t>(res);
+  }
+
+  client->SetFile({});
+  FinishWrite(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::FinishWrite(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+
+  switch (state.after) {
+    case AfterWrite::kOnWrite:
+      Handler::OnWrite(this, client.get());
+      break;
+    case AfterWrite::kClose:
+      Close(client.get());
+      break;
+    case AfterWrite::kLinger:
+      shutdown(client->Socket(), SHUT_WR);
+      state.lingerStart = Clock::now();
+      state.lingerLast = state.lingerStart;
+      lingerDeadline =
+          std::min(lingerDeadline, state.lingerLast + kLingerTimeout);
+      ++lingering;
+      client->SetState(Client::States::kLinger);
+      Queue(slot);
+      break;
+  }
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TryDrain(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+  auto& buffer = client->Buffer();
+  buffer.Clear();
+  buffer.Reserve(kReadSize);
+
+  const auto spare = buffer.Spare();
+  const auto res = readv(client->Socket(), spare.data(),
+                         static_cast<int>(spare.size()));
+  if (res < 0 && errno == EINTR) {
+    Queue(slot);
+    return;
+  }
+  if (res < 0 && IsAgain(errno)) {
+    state.readable = false;
+    return;
+  }
+  // Keep draining while the peer sends, but not forever
+  const auto now = Clock::now();
+  if (res > 0 && now - state.lingerStart < kLingerTime) {
+    state.lingerLast = now;
+    Queue(slot);
+    return;
+  }
+  // Peer closed too, or failed
+  Close(client.get());
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TryWaitClose(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& state = slots[slot];
+
+  // Shared by all connections, as what is read is thrown away
+  static thread_local std::array<char, kDiscardSize> discard;
+  const auto res = recv(client->Socket(), discard.data(), discard.size(), 0);
+  if (res < 0 && errno == EINTR) {
+    Queue(slot);
+    return;
+  }
+  if (res < 0 && IsAgain(errno)) {
+    state.readable = false;
+    return;
+  }
+  if (res > 0) {
+    metrics.reads.Add();
+    metrics.bytesRead.Add(static_cast<std::uint64_t>(res));
+    Queue(slot);
+    return;
+  }
+  // Peer closed, or failed
+  if (res < 0) {
+    metrics.cqeErrors.Add();
+  }
+  Handler::OnRead(this, client.get());
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::ExpireLinger() -> void {
+  const auto now = Clock::now();
+  if (now < lingerDeadline) {
+    return;
+  }
+
+  lingerDeadline = Clock::time_point::max();
+  for (std::size_t slot = 0; slot < clients.size(); ++slot) {
+    auto& client = clients[slot];
+    if (client == nullptr || client->State() != Client::States::kLinger) {
+      continue;
+    }
+    const auto& state = slots[slot];
+    const auto deadline = std::min(state.lingerLast + kLingerTimeout,
+                                   state.lingerStart + kLingerTime);
+    if (now >= deadline) {
+      Close(client.get());
+    } else {
+      lingerDeadline = std::min(lingerDeadline, deadline);
+    }
+  }
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Open(std::string path, int flags,
+                                          OpenCallback done) -> void {
+  metrics.diskOps.Add();
+  const int fd = open(path.c_str(), flags | O_CLOEXEC, kFileMode);
+  const int res = fd == -1 ? -errno : fd;
+  completions.push_back(
+      [done = std::move(done), res] { Complete(done, res); });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::OpenBeneath(int dirFd, std::string path,
+                                                 int flags, OpenCallback done)
+    -> void {
+  metrics.diskOps.Add();
+  const int fd = OpenAt2(dirFd, path.c_str(), flags | O_CLOEXEC);
+  const int res = fd == -1 ? -errno : fd;
+  completions.push_back(
+      [done = std::move(done), res] { Complete(done, res); });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Read(int fd, std::uint64_t offset,
+                                          std::size_t length,
+                                          ReadCallback done) -> void {
+  // The result has to fit into an int
+  length = std::min(length,
+                    static_cast<std::size_t>(INT_MAX) & ~(kDiskAlignment - 1));
+
+  metrics.diskOps.Add();
+  const auto size =
+      (length + kDiskAlignment - 1) / kDiskAlignment * kDiskAlignment;
+  std::shared_ptr<char> buffer{
+      static_cast<char*>(
+          std::aligned_alloc(kDiskAlignment, std::max(size, kDiskAlignment))),
+      [](char* ptr) { std::free(ptr); }};
+  const auto read =
+      pread(fd, buffer.get(), length, static_cast<off_t>(offset));
+  const int res = read == -1 ? -errno : static_cast<int>(read);
+  completions.push_back([done = std::move(done), buffer, res] {
+    Complete(done, res,
+             res > 0 ? std::string_view{buffer.get(),
+                                        static_cast<std::size_t>(res)}
+                     : std::string_view{});
+  });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Write(int fd, std::uint64_t offset,
+                                           std::string data,
+                                           WriteCallback done) -> void {
+  metrics.diskOps.Add();
+  const auto length = std::min(data.size(), static_cast<std::size_t>(INT_MAX));
+  const auto written =
+      pwrite(fd, data.data(), length, static_cast<off_t>(offset));
+  const int res = written == -1 ? -errno : static_cast<int>(written);
+  completions.push_back(
+      [done = std::move(done), res] { Complete(done, res); });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Stat(std::string path, StatCallback done)
+    -> void {
+  metrics.diskOps.Add();
+  struct statx info = {};
+  const int res =
+      statx(AT_FDCWD, path.c_str(), 0, STATX_BASIC_STATS, &info) == -1
+          ? -errno
+          : 0;
+  completions.push_back(
+      [done = std::move(done), info, res] { Complete(done, res, info); });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::StatFile(int fd, StatCallback done)
+    -> void {
+  metrics.diskOps.Add();
+  struct statx info = {};
+  const int res =
+      statx(fd, "", AT_EMPTY_PATH, STATX_BASIC_STATS, &info) == -1 ? -errno
+                                                                     : 0;
+  completions.push_back(
+      [done = std::move(done), info, res] { Complete(done, res, info); });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::CloseFile(int fd) -> void {
+  metrics.diskOps.Add();
+  close(fd);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::TakeClient(int clientSlot)
+    -> std::unique_ptr<Client> {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  auto ptr = std::move(clients[slot]);
+  clients[slot] = nullptr;
+  // Unless still waiting for a connection, with the listening socket. A
+  // client that was just accepted is in kAccept as well.
+  const bool waiting = std::any_of(
+      acceptors.begin(), acceptors.end(),
+      [&](const Acceptor& acceptor) { return acceptor.fd == ptr->Socket(); });
+  if (!waiting) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, ptr->Socket(), nullptr);
+    connections.fetch_sub(1, std::memory_order_relaxed);
+  }
+  if (ptr->State() == Client::States::kLinger) {
+    --lingering;
+  }
+  Release(slot);
+  ptr->SetIoServiceSlot(-1);
+
+  return ptr;
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::GiveClient(std::unique_ptr<Client> client)
+    -> void {
+  const auto slot = AcquireSlot();
+  if (!SetNonBlocking(client->Socket()) || !Register(slot, client->Socket())) {
+    Release(slot);
+    throw Error(std::format("Error registering client socket: {}",
+                            std::strerror(errno)));
+  }
+  client->SetIoServiceSlot(static_cast<int>(slot));
+  client->Buffer().SetPool(&segmentPool);
+  clients[slot] = std::move(client);
+  connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Close(Client* client) -> void {
+  auto slot = static_cast<std::size_t>(client->IoServiceSlot());
+  assert(clients[slot].get() == client);
+
+  if (client->State() == Client::States::kLinger) {
+    --lingering;
+  }
+  // Which also removes it from the epoll set
+  close(client->Socket());
+  metrics.closes.Add();
+  connections.fetch_sub(1, std::memory_order_relaxed);
+  clients[slot] = nullptr;
+  Release(slot);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Handoff(EpollIoService& target,
+                                             std::unique_ptr<Client> client)
+    -> void {
+  // Segments of this service's pool must not go along
+  client->Buffer().Clear();
+  client->Buffer().SetPool(nullptr);
+  target.incoming.fetch_add(1, std::memory_order_relaxed);
+  metrics.handoffs.Add();
+
+  // Owned by the task, in case it never runs
+  auto owned = std::make_shared<std::unique_ptr<Client>>(std::move(client));
+  target.Post([&target, owned] { target.Adopt(std::move(*owned)); });
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Adopt(std::unique_ptr<Client> client)
+    -> void {
+  incoming.fetch_sub(1, std::memory_order_relaxed);
+  auto* ptr = client.get();
+  GiveClient(std::move(client));
+  Handler::OnHandoff(this, ptr);
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::AcquireSlot() -> std::size_t {
+  const std::size_t slot = table.Acquire();
+  if (slot >= clients.size()) {
+    clients.resize(table.Size());
+    slots.resize(table.Size());
+  }
+  return slot;
+}
+
+template <typename Handler>
+auto toyws::EpollIoService<Handler>::Release(std::size_t slot) -> void {
+  // Stays queued if it is, but then finds the slot empty (or reused)
+  const bool queued = slots[slot].queued;
+  slots[slot] = SlotState{};
+  slots[slot].queued = queued;
+  table.Release(static_cast<std::uint32_t>(slot));
+}
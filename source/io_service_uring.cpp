@@ -1,102 +1,121 @@
-#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <cstring>
 #include <format>
+#include <memory>
 
 #include "toyws/client.hpp"
 #include "toyws/error.hpp"
-#include "toyws/io_service.hpp"
+#include "toyws/io_service_uring.hpp"
 #include "toyws/toyws.hpp"
 
 template <typename Handler>
-toyws::IoService<Handler>::IoService() {
-  clients.resize(kSqSize + kCqSize);
-  bufferDescriptors.resize(kSqSize + kCqSize);
+toyws::UringIoService<Handler>::UringIoService() {
+  clients.resize(table.Size());
+  writes.resize(table.Size());
+  sends.resize(table.Size());
 
   CreateIoRing();
+  ArmMailbox();
 }
 
 template <typename Handler>
-toyws::IoService<Handler>::~IoService() {
+toyws::UringIoService<Handler>::~UringIoService() {
+  // Connections handed over to this ring after it stopped, & those that
+  // failed to leave it, are not served by anyone
+  io_uring_cqe* cqe = nullptr;
+  while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+    const OpTag tag{cqe->user_data};
+    if (tag.Kind() == OpKind::kHandoff && cqe->res > 0) {
+      std::unique_ptr<Client> client{reinterpret_cast<Client*>(
+          static_cast<std::uintptr_t>(tag.Payload()))};
+      close(client->Socket());
+    } else if (tag.Kind() == OpKind::kHandoff && cqe->res < 0) {
+      const auto sent = handoffs.find(tag.Payload());
+      if (sent != handoffs.end()) {
+        std::unique_ptr<Client> client{sent->second.client};
+        close(client->Socket());
+      }
+    }
+    io_uring_cqe_seen(&ring, cqe);
+  }
   io_uring_queue_exit(&ring);
+  for (auto& write : writes) {
+    ClosePipe(write);
+  }
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::Run() -> void {
-  // TODO: Add dummy fd as an event based wakeup, to notice running = false
-  running = true;
-  while (running) {
-    io_uring_cqe* cqe;
-    if (int res = io_uring_wait_cqe(&ring, &cqe); res != 0) {
-      throw Error(
-          std::format("Error in io_uring_wait_cqe(): {}", std::strerror(-res)));
+auto toyws::UringIoService<Handler>::Run() -> void {
+  std::array<io_uring_cqe*, kCqSize> cqes{};
+  while (!Stopping()) {
+    // Submit what the last batch prepared and wait, in a single call
+    if (int res = io_uring_submit_and_wait(&ring, 1); res < 0) {
+      if (res == -EINTR) {
+        continue;  // E.g. Stop() from a signal handler
+      }
+      throw Error(std::format("Error in io_uring_submit_and_wait(): {}",
+                              std::strerror(-res)));
+    }
+    submissions = 0;
+    if (!overflow.empty()) {
+      DrainOverflow();
     }
 
-    submitAlways = false;
-
-    while (true) {
-      HandleCqe(cqe);
+    // Reap all that is ready, and hand the CQ slots back at once
+    const auto count = io_uring_peek_batch_cqe(&ring, cqes.data(),
+                                               static_cast<unsigned>(kCqSize));
+    metrics.cqeBatches.Add();
+    batchAverage = batchAverage - batchAverage / kBatchAverageWeight +
+                   count * kBatchAverageScale / kBatchAverageWeight;
+    const auto threshold = SubmitThreshold();
+    for (unsigned i = 0; i < count; ++i) {
+      HandleCqe(cqes[i]);
 
-      io_uring_cqe_seen(&ring, cqe);
-      if (io_uring_peek_cqe(&ring, &cqe) == -EAGAIN) {
-        break;
+      // A large batch takes a while to handle. Rather than holding back all
+      // it prepares until the end, submit once the oldest SQE has waited for
+      // the threshold, looking at the clock only every few completions. Small
+      // batches end sooner, and submit along with the next wait.
+      if ((i + 1) % kSubmitCheckInterval == 0 && submissions > 0 &&
+          i + 1 < count && Clock::now() - pendingSince >= threshold) {
+        metrics.batchSubmits.Add();
+        ForceSubmit();
       }
     }
+    io_uring_cq_advance(&ring, count);
+  }
 
-    if (submissions > 0) {
-      ForceSubmit();
-    }
-
-    submitAlways = true;
+  // Don't leave e.g. closes behind
+  if (submissions > 0 || !overflow.empty()) {
+    ForceSubmit();
   }
+  stopping.store(false, std::memory_order_relaxed);
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::Stop() -> void {
-  running = false;
+auto toyws::UringIoService<Handler>::Stop() -> void {
+  stopping.store(true, std::memory_order_relaxed);
+  mailbox.Wake();
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::MakeListeningSocket(std::string address,
-                                                    uint16_t port) -> Socket {
-  // Create socket file descriptor
-  int listeningFd = socket(PF_INET, SOCK_STREAM, 0);
-  if (listeningFd == -1) {
-    throw Error(std::format("Error in socket(): {}", std::strerror(errno)));
-  }
-
-  // Allow address reuse (for quick server restarts)
-  const int on = 1;
-  if (setsockopt(listeningFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ==
-      -1) {
-    throw Error(std::format("Error in setsockopt(): {}", std::strerror(errno)));
-  }
-
-  // Assign name to socket
-  sockaddr_in name{};
-  name.sin_family = AF_INET;
-  name.sin_port = htons(port);
-  if (inet_pton(AF_INET, address.c_str(), &name.sin_addr) != 1) {
-    throw Error("Invalid network address");
-  }
-  if (bind(listeningFd, reinterpret_cast<const sockaddr*>(&name),
-           sizeof(name)) == -1) {
-    throw Error(std::format("Error in bind(): {}", std::strerror(errno)));
-  }
-
-  // Listen
-  if (listen(listeningFd, kAcceptQueue) == -1) {
-    throw Error(std::format("Error in listen(): {}", std::strerror(errno)));
-  }
-
-  return listeningFd;
+auto toyws::UringIoService<Handler>::MakeListeningSocket(
+    const std::string& address, uint16_t port, const ListenerOptions& options)
+    -> Socket {
+  return toyws::MakeListeningSocket(address, port, options);
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::CreateIoRing() -> void {
+auto toyws::UringIoService<Handler>::CreateIoRing() -> void {
   // TODO: Look into IORING_SETUP_SQPOLL
   io_uring_params params{};
   params.cq_entries = kCqSize;
@@ -105,136 +124,1040 @@ auto toyws::IoService<Handler>::CreateIoRing() -> void {
     throw Error(std::format("Error in io_uring_queue_init_params(): {}",
                             std::strerror(-res)));
   }
+
+  RegisterFixedBuffers();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::RegisterFixedBuffers() -> void {
+  fixedBuffers.reset(static_cast<char*>(std::aligned_alloc(
+      kDiskAlignment, kFixedBufferSize * kFixedBufferCount)));
+  if (!fixedBuffers) {
+    return;
+  }
+
+  std::vector<iovec> iovecs;
+  for (unsigned i = 0; i < kFixedBufferCount; ++i) {
+    iovecs.push_back(iovec{fixedBuffers.get() + i * kFixedBufferSize,
+                           kFixedBufferSize});
+  }
+  // May fail, e.g. over RLIMIT_MEMLOCK on older kernels. Reads then go into
+  // buffers allocated per read.
+  if (io_uring_register_buffers(&ring, iovecs.data(), kFixedBufferCount) != 0) {
+    fixedBuffers.reset();
+    return;
+  }
+  for (unsigned i = 0; i < kFixedBufferCount; ++i) {
+    freeFixedBuffers.push_back(static_cast<int>(i));
+  }
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::AsyncAccept(Socket listeningFd) -> void {
-  auto* sqe = io_uring_get_sqe(&ring);
-  assert(sqe != nullptr);  // null if SQ is full
+auto toyws::UringIoService<Handler>::AsyncAccept(Socket listeningFd) -> void {
+  auto* sqe = GetSqe();
 
-  io_uring_prep_accept(sqe, listeningFd,
-                       reinterpret_cast<sockaddr*>(&clientName), &clientNameLen,
-                       0);
+  // The peer's address is not used, so don't have it copied out
+  io_uring_prep_accept(sqe, listeningFd, nullptr, nullptr, SOCK_CLOEXEC);
 
   auto client = clientPool.Acquire();
-  // FIXME: Ensure we get an empty slot
-  const std::size_t slot = nextClientSlot;
-  nextClientSlot = (nextClientSlot + 1) % clients.size();
+  const auto slot = AcquireSlot();
   client->SetSocket(listeningFd);
   client->SetIoServiceSlot(static_cast<int>(slot));
+  client->Buffer().SetPool(&segmentPool);
   clients[slot] = std::move(client);
-  io_uring_sqe_set_data64(sqe, slot);
+  table[slot].fd = listeningFd;
+  table[slot].state = Client::States::kAccept;
+  io_uring_sqe_set_data64(sqe, Tag(OpKind::kAccept, slot));
 
   Submit();
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::AsyncRead(int clientSlot) -> void {
+auto toyws::UringIoService<Handler>::AsyncRead(int clientSlot) -> void {
   assert(clientSlot >= 0);
 
-  auto* sqe = io_uring_get_sqe(&ring);
-  assert(sqe != nullptr);  // null if SQ is full
+  auto* sqe = GetSqe();
 
   auto slot = static_cast<std::size_t>(clientSlot);
-  auto& client = clients[slot];
-  bufferDescriptors[slot].iov_base = client->Buffer().data();
-  bufferDescriptors[slot].iov_len = client->Buffer().size();
-  io_uring_prep_readv(sqe, client->Socket(), &bufferDescriptors[slot], 1, 0);
-  io_uring_sqe_set_data64(sqe, slot);
-  client->SetState(Client::States::kRead);
+  auto& buffer = clients[slot]->Buffer();
+  buffer.Clear();
+  buffer.Reserve(kReadSize);
+  const auto spare = buffer.Spare();
+  io_uring_prep_readv(sqe, table[slot].fd, spare.data(),
+                      static_cast<unsigned>(spare.size()), 0);
+  io_uring_sqe_set_data64(sqe, Tag(OpKind::kRead, slot));
+  table[slot].state = Client::States::kRead;
 
   Submit();
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::AsyncWrite(int clientSlot) -> void {
+auto toyws::UringIoService<Handler>::AsyncWrite(int clientSlot,
+                                                AfterWrite after) -> void {
   assert(clientSlot >= 0);
 
-  auto* sqe = io_uring_get_sqe(&ring);
-  assert(sqe != nullptr);  // null if SQ is full
+  auto slot = static_cast<std::size_t>(clientSlot);
+  auto& client = clients[slot];
+  auto& write = writes[slot];
+  write.sent = 0;
+  write.total = client->Buffer().Size() +
+                (client->Output() ? client->Output()->size() : 0);
+  write.zeroCopy = write.total >= zeroCopyThreshold;
+  write.sendDone = false;
+  write.notifications = 0;
+  write.fileRead = 0;
+  write.after = after;
+  write.linked = false;
+  write.failed = false;
+  PrepareWrite(slot);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareWrite(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& write = writes[slot];
+
+  // Skip what has been sent already; the buffers are left untouched until the
+  // whole write is done, as zero-copy send may still be reading from them.
+  auto& buffer = client->Buffer();
+  const auto data = buffer.Data(std::min(write.sent, buffer.Size()));
+  write.iovecs.assign(data.begin(), data.end());
+  const auto& output = client->Output();
+  if (output && write.iovecs.size() < IOV_MAX) {
+    const auto skip = write.sent - std::min(write.sent, buffer.Size());
+    if (skip < output->size()) {
+      // Safe to cast away const, writev only reads from the buffer
+      write.iovecs.push_back(iovec{const_cast<char*>(output->data()) + skip,
+                                   output->size() - skip});
+    }
+  }
+
+  std::size_t covered = 0;
+  for (const auto& iov : write.iovecs) {
+    covered += iov.iov_len;
+  }
+
+  // Everything goes out with this send, so the close (or shutdown) can
+  // follow in the same submission
+  const bool link = !(write.zeroCopy && zeroCopySupported) &&
+                    write.after != AfterWrite::kOnWrite && write.sent == 0 &&
+                    covered == write.total && !client->File();
+  int prepared = 1;
+  const auto fd = table[slot].fd;
+  auto* sqe = GetSqe(link ? 1 + ChainLength(write.after) : 1);
+  write.message = {};
+  write.message.msg_iov = write.iovecs.data();
+  write.message.msg_iovlen = write.iovecs.size();
+  if (write.zeroCopy && zeroCopySupported) {
+    io_uring_prep_sendmsg_zc(sqe, fd, &write.message, MSG_NOSIGNAL);
+    // Have the notification report whether the kernel had to copy after all
+    sqe->ioprio |= IORING_SEND_ZC_REPORT_USAGE;
+  } else if (link) {
+    // MSG_WAITALL has a short send fail the link, rather than the close
+    // cutting the response short
+    io_uring_prep_sendmsg(sqe, fd, &write.message,
+                          MSG_NOSIGNAL | MSG_WAITALL);
+    sqe->flags |= IOSQE_IO_LINK;
+    write.linked = true;
+  } else {
+    io_uring_prep_writev(sqe, fd, write.iovecs.data(),
+                         static_cast<unsigned>(write.iovecs.size()), 0);
+  }
+  io_uring_sqe_set_data64(sqe, Tag(OpKind::kWrite, slot));
+  table[slot].state = Client::States::kWrite;
+  if (write.linked) {
+    prepared += PrepareAfterWrite(slot);
+  }
+
+  // A link does not extend over separate submissions, so prepare all first
+  for (int i = 0; i < prepared; ++i) {
+    Submit();
+  }
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::AsyncSend(int clientSlot) -> void {
+  assert(clientSlot >= 0);
 
   auto slot = static_cast<std::size_t>(clientSlot);
+  if (sends[slot].active || clients[slot]->Outbox().empty()) {
+    return;
+  }
+  sends[slot].active = true;
+  PrepareSend(slot);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareSend(std::size_t slot) -> void {
   auto& client = clients[slot];
-  bufferDescriptors[slot].iov_base = client->Buffer().data();
-  bufferDescriptors[slot].iov_len = client->BufferContentSize();
-  io_uring_prep_writev(sqe, client->Socket(), &bufferDescriptors[slot], 1, 0);
-  io_uring_sqe_set_data64(sqe, slot);
-  client->SetState(Client::States::kWrite);
+  auto& send = sends[slot];
+
+  // Messages stay put while queued, and new ones are only ever appended
+  send.iovecs.clear();
+  auto skip = client->OutboxSent();
+  for (const auto& message : client->Outbox()) {
+    if (send.iovecs.size() == IOV_MAX) {
+      break;
+    }
+    // Safe to cast away const, sendmsg only reads from the buffer
+    send.iovecs.push_back(iovec{const_cast<char*>(message->data()) + skip,
+                                message->size() - skip});
+    skip = 0;
+  }
 
+  auto* sqe = GetSqe();
+  send.message = {};
+  send.message.msg_iov = send.iovecs.data();
+  send.message.msg_iovlen = send.iovecs.size();
+  io_uring_prep_sendmsg(sqe, table[slot].fd, &send.message, MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, Tag(OpKind::kSend, slot));
   Submit();
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::TakeClient(int clientSlot)
+auto toyws::UringIoService<Handler>::AsyncWaitClose(int clientSlot) -> void {
+  assert(clientSlot >= 0);
+
+  auto slot = static_cast<std::size_t>(clientSlot);
+  clients[slot]->Buffer().Clear();
+  table[slot].state = Client::States::kWaitClose;
+  PrepareWaitClose(slot);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareWaitClose(std::size_t slot)
+    -> void {
+  auto* sqe = GetSqe();
+  io_uring_prep_recv(sqe, table[slot].fd, discard.data(), discard.size(), 0);
+  io_uring_sqe_set_data64(sqe, Tag(OpKind::kWaitClose, slot));
+  Submit();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Shutdown(int clientSlot) -> void {
+  assert(clientSlot >= 0);
+
+  auto* sqe = GetSqe();
+  io_uring_prep_shutdown(sqe, table[static_cast<std::size_t>(clientSlot)].fd,
+                         SHUT_RDWR);
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kUntracked, 0}.Value());
+  Submit();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareAfterWrite(std::size_t slot)
+    -> int {
+  if (writes[slot].after == AfterWrite::kLinger) {
+    return PrepareLinger(slot);
+  }
+
+  auto* sqe = GetSqe();
+  io_uring_prep_close(sqe, table[slot].fd);
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kUntracked, 0}.Value());
+  return 1;
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareLinger(std::size_t slot) -> int {
+  auto* sqe = GetSqe(ChainLength(AfterWrite::kLinger));
+  io_uring_prep_shutdown(sqe, table[slot].fd,
+                         SHUT_WR);
+  sqe->flags |= IOSQE_IO_LINK;
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kUntracked, 0}.Value());
+  return 1 + PrepareDrain(slot);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareDrain(std::size_t slot) -> int {
+  auto& buffer = clients[slot]->Buffer();
+  buffer.Clear();
+  buffer.Reserve(kReadSize);
+  const auto spare = buffer.Spare();
+
+  auto* read = GetSqe(2);
+  io_uring_prep_readv(read, table[slot].fd,
+                      spare.data(), static_cast<unsigned>(spare.size()), 0);
+  read->flags |= IOSQE_IO_LINK;
+  io_uring_sqe_set_data64(read, Tag(OpKind::kDrain, slot));
+
+  auto* timeout = GetSqe();
+  io_uring_prep_link_timeout(timeout, &lingerTimeout, 0);
+  io_uring_sqe_set_data64(timeout, OpTag{OpKind::kUntracked, 0}.Value());
+  return 2;
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::FinishWrite(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& write = writes[slot];
+
+  switch (write.after) {
+    case AfterWrite::kOnWrite:
+      Handler::OnWrite(this, client.get());
+      break;
+    case AfterWrite::kClose:
+      if (write.linked) {
+        // Closed by the kernel right after the send
+        metrics.closes.Add();
+        metrics.linkedCloses.Add();
+        connections.fetch_sub(1, std::memory_order_relaxed);
+        ReleaseSlot(slot);
+      } else {
+        Close(client.get());
+      }
+      break;
+    case AfterWrite::kLinger: {
+      if (!write.linked) {
+        const int prepared = PrepareLinger(slot);
+        for (int i = 0; i < prepared; ++i) {
+          Submit();
+        }
+      }
+      write.lingerStart = std::chrono::steady_clock::now();
+      table[slot].state = Client::States::kLinger;
+      break;
+    }
+  }
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleLingerCqe(io_uring_cqe* cqe,
+                                                     std::size_t slot) -> void {
+  if (table[slot].state != Client::States::kLinger) {
+    // Canceled along with the rest of a chain after a short send
+    return;
+  }
+
+  // Keep draining while the peer sends, but not forever
+  if (cqe->res > 0 && std::chrono::steady_clock::now() -
+                              writes[slot].lingerStart <
+                          kLingerTime) {
+    const int prepared = PrepareDrain(slot);
+    for (int i = 0; i < prepared; ++i) {
+      Submit();
+    }
+    return;
+  }
+  // Peer closed too, timed out (canceled) or failed
+  Close(clients[slot].get());
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Open(std::string path, int flags,
+                                          OpenCallback done) -> void {
+  OpenAt(AT_FDCWD, std::move(path), flags, std::move(done));
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::OpenBeneath(int dirFd, std::string path,
+                                                 int flags, OpenCallback done)
+    -> void {
+  const auto index = AcquireDiskOp();
+  auto& op = *diskOps[index];
+  op.path = std::move(path);
+  op.how.flags = static_cast<unsigned>(flags | O_CLOEXEC);
+  op.how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+  op.complete = [this, dirFd, flags, done = std::move(done)](
+                    int res, DiskOp& completed) mutable {
+    if (res == -EINVAL || res == -ENOSYS) {
+      // A kernel without openat2, which io_uring fails as an unknown opcode
+      OpenAt(dirFd, std::move(completed.path), flags, std::move(done));
+      return;
+    }
+    done(res);
+  };
+
+  auto* sqe = GetSqe();
+  io_uring_prep_openat2(sqe, dirFd, op.path.c_str(), &op.how);
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Read(int fd, std::uint64_t offset,
+                                          std::size_t length, ReadCallback done)
+    -> void {
+  // The result has to fit into an int
+  length = std::min(length,
+                    static_cast<std::size_t>(INT_MAX) & ~(kDiskAlignment - 1));
+
+  const auto index = AcquireDiskOp();
+  auto& op = *diskOps[index];
+  op.complete = [done = std::move(done)](int res, DiskOp& completed) {
+    done(res, res > 0 ? std::string_view{completed.data,
+                                         static_cast<std::size_t>(res)}
+                      : std::string_view{});
+  };
+
+  auto* sqe = GetSqe();
+  if (length <= kFixedBufferSize && !freeFixedBuffers.empty()) {
+    // Registered buffers spare the kernel mapping the pages on every read
+    op.fixedBuffer = freeFixedBuffers.back();
+    freeFixedBuffers.pop_back();
+    op.data = fixedBuffers.get() +
+              static_cast<std::size_t>(op.fixedBuffer) * kFixedBufferSize;
+    io_uring_prep_read_fixed(sqe, fd, op.data, static_cast<unsigned>(length),
+                             offset, op.fixedBuffer);
+  } else {
+    const auto size =
+        (length + kDiskAlignment - 1) / kDiskAlignment * kDiskAlignment;
+    op.buffer.reset(static_cast<char*>(
+        std::aligned_alloc(kDiskAlignment, std::max(size, kDiskAlignment))));
+    op.data = op.buffer.get();
+    io_uring_prep_read(sqe, fd, op.data, static_cast<unsigned>(length),
+                       offset);
+  }
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Write(int fd, std::uint64_t offset,
+                                           std::string data,
+                                           WriteCallback done) -> void {
+  const auto index = AcquireDiskOp();
+  auto& op = *diskOps[index];
+  op.written = std::move(data);
+  op.complete = [done = std::move(done)](int res, DiskOp& /*op*/) {
+    done(res);
+  };
+
+  // Anything beyond what fits into the result is left for another write
+  const auto length = std::min(op.written.size(),
+                               static_cast<std::size_t>(INT_MAX));
+  auto* sqe = GetSqe();
+  io_uring_prep_write(sqe, fd, op.written.data(),
+                      static_cast<unsigned>(length), offset);
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Stat(std::string path, StatCallback done)
+    -> void {
+  const auto index = AcquireDiskOp();
+  auto& op = *diskOps[index];
+  op.path = std::move(path);
+  op.complete = [done = std::move(done)](int res, DiskOp& completed) {
+    done(res, completed.info);
+  };
+
+  auto* sqe = GetSqe();
+  io_uring_prep_statx(sqe, AT_FDCWD, op.path.c_str(), 0, STATX_BASIC_STATS,
+                      &op.info);
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::StatFile(int fd, StatCallback done)
+    -> void {
+  const auto index = AcquireDiskOp();
+  auto& op = *diskOps[index];
+  op.complete = [done = std::move(done)](int res, DiskOp& completed) {
+    done(res, completed.info);
+  };
+
+  auto* sqe = GetSqe();
+  io_uring_prep_statx(sqe, fd, "", AT_EMPTY_PATH, STATX_BASIC_STATS, &op.info);
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::CloseFile(int fd) -> void {
+  const auto index = AcquireDiskOp();
+  diskOps[index]->complete = [](int /*res*/, DiskOp& /*op*/) {};
+
+  auto* sqe = GetSqe();
+  io_uring_prep_close(sqe, fd);
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::TakeClient(int clientSlot)
     -> std::unique_ptr<Client> {
   assert(clientSlot >= 0);
 
   auto slot = static_cast<std::size_t>(clientSlot);
   auto ptr = std::move(clients[slot]);
-  clients[slot] = nullptr;
+  ReleaseSlot(slot);
   ptr->SetIoServiceSlot(-1);
+  connections.fetch_sub(1, std::memory_order_relaxed);
 
   return ptr;
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::GiveClient(std::unique_ptr<Client> client)
-    -> void {
-  // FIXME: Ensure we get an empty slot
-  const std::size_t slot = nextClientSlot;
-  nextClientSlot = (nextClientSlot + 1) % clients.size();
+auto toyws::UringIoService<Handler>::GiveClient(
+    std::unique_ptr<Client> client) -> void {
+  const auto slot = AcquireSlot();
   client->SetIoServiceSlot(static_cast<int>(slot));
+  client->Buffer().SetPool(&segmentPool);
+  table[slot].fd = client->Socket();
   clients[slot] = std::move(client);
+  connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::AcquireSlot() -> std::uint32_t {
+  const auto slot = table.Acquire();
+  if (slot >= clients.size()) {
+    clients.resize(table.Size());
+    writes.resize(table.Size());
+    sends.resize(table.Size());
+  }
+  return slot;
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::ReleaseSlot(std::size_t slot) -> void {
+  clients[slot] = nullptr;
+  table.Release(static_cast<std::uint32_t>(slot));
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::Close(Client* client) -> void {
+auto toyws::UringIoService<Handler>::Close(Client* client) -> void {
   auto slot = static_cast<std::size_t>(client->IoServiceSlot());
   assert(clients[slot].get() == client);
 
-  close(client->Socket());
-  clients[slot] = nullptr;
+  if (sends[slot].active) {
+    // The kernel may still read from the outbox. The shutdown fails the send
+    // if it waits for room, so that closing is not held up by the peer.
+    sends[slot].closing = true;
+    Shutdown(static_cast<int>(slot));
+    return;
+  }
+
+  auto* sqe = GetSqe();
+  io_uring_prep_close(sqe, client->Socket());
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kUntracked, 0}.Value());
+  metrics.closes.Add();
+  connections.fetch_sub(1, std::memory_order_relaxed);
+  ReleaseSlot(slot);
+
+  Submit();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Handoff(UringIoService& target,
+                                             std::unique_ptr<Client> client)
+    -> void {
+  // Segments of this ring's pool must not go along
+  client->Buffer().Clear();
+  client->Buffer().SetPool(nullptr);
+  target.incoming.fetch_add(1, std::memory_order_relaxed);
+  metrics.handoffs.Add();
+
+  if (!msgRingSupported) {
+    PostHandoff(target, std::move(client));
+    return;
+  }
+
+  // The message is the Client's address. It arrives on target with res 1,
+  // while its completion here has res 0 (or -errno), and the sequence number.
+  const auto address = reinterpret_cast<std::uintptr_t>(client.get());
+  assert((address & ~OpTag::kPayloadMask) == 0);
+  const auto sequence = handoffSequence++ & OpTag::kPayloadMask;
+  auto* sqe = GetSqe();
+  io_uring_prep_msg_ring(sqe, target.ring.ring_fd, 1,
+                         OpTag{OpKind::kHandoff, address}.Value(), 0);
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kHandoff, sequence}.Value());
+  handoffs.emplace(sequence, SentHandoff{client.release(), &target});
+  Submit();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PostHandoff(
+    UringIoService& target, std::unique_ptr<Client> client) -> void {
+  // Owned by the task, in case it never runs
+  auto owned = std::make_shared<std::unique_ptr<Client>>(std::move(client));
+  target.Post([&target, owned] { target.Adopt(std::move(*owned)); });
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::Adopt(std::unique_ptr<Client> client)
+    -> void {
+  incoming.fetch_sub(1, std::memory_order_relaxed);
+  auto* ptr = client.get();
+  GiveClient(std::move(client));
+  Handler::OnHandoff(this, ptr);
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::ForceSubmit() -> void {
+auto toyws::UringIoService<Handler>::ForceSubmit() -> void {
   io_uring_submit(&ring);
   submissions = 0;
+  if (!overflow.empty()) {
+    DrainOverflow();
+  }
 }
 
 template <typename Handler>
-auto toyws::IoService<Handler>::HandleCqe(io_uring_cqe* cqe) -> void {
-  // TODO: Should not automatically throw on error
-  if (cqe->res < 0) {
-    throw Error(
-        std::format("Error in async step: {}", std::strerror(-cqe->res)));
+auto toyws::UringIoService<Handler>::GetSqe(unsigned count) -> io_uring_sqe* {
+  if (overflow.empty() && io_uring_sq_space_left(&ring) < count) {
+    // Make room by submitting what is prepared so far
+    metrics.sqFull.Add();
+    ForceSubmit();
+  }
+  // Once anything is parked, the rest follows so as to keep the order
+  if (overflow.empty() && io_uring_sq_space_left(&ring) >= count) {
+    return io_uring_get_sqe(&ring);
   }
+  metrics.sqOverflows.Add();
+  return &overflow.emplace_back();
+}
 
-  const auto slot = static_cast<std::size_t>(cqe->user_data);
-  auto& client = clients[slot];
-  assert(static_cast<int>(slot) == client->IoServiceSlot());
-  switch (client->State()) {
-    case Client::States::kAccept: {
-      Socket listeningFd = client->Socket();
+template <typename Handler>
+auto toyws::UringIoService<Handler>::DrainOverflow() -> void {
+  bool moved = false;
+  while (!overflow.empty()) {
+    // A chain goes in whole, as links don't extend over submissions
+    unsigned length = 1;
+    for (auto it = overflow.begin();
+         it != overflow.end() && (it->flags & IOSQE_IO_LINK) != 0; ++it) {
+      ++length;
+    }
+    if (io_uring_sq_space_left(&ring) < length) {
+      break;
+    }
+    for (unsigned i = 0; i < length && !overflow.empty(); ++i) {
+      *io_uring_get_sqe(&ring) = overflow.front();
+      overflow.pop_front();
+    }
+    moved = true;
+  }
+  if (moved) {
+    io_uring_submit(&ring);
+  }
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleCqe(io_uring_cqe* cqe) -> void {
+  metrics.cqes.Add();
+
+  const OpTag tag{cqe->user_data};
+  switch (tag.Kind()) {
+    case OpKind::kUntracked:
+      // Closes & shutdowns of connections that are gone; nothing to do on
+      // error
+      return;
+    case OpKind::kDiskOp:
+      // Errors are the caller's to handle
+      HandleDiskCqe(cqe, static_cast<std::size_t>(tag.Payload()));
+      return;
+    case OpKind::kMailbox:
+      HandleMailboxCqe();
+      return;
+    case OpKind::kHandoff:
+      HandleHandoffCqe(cqe);
+      return;
+    default:
+      break;
+  }
+
+  if (!table.IsCurrent(tag)) {
+    // The connection was closed meanwhile, and its slot may be taken by
+    // another one already
+    metrics.staleCqes.Add();
+    return;
+  }
+  const std::size_t slot = tag.Slot();
+
+  switch (tag.Kind()) {
+    case OpKind::kAccept: {
+      const auto listeningFd = table[slot].fd;
+      if (cqe->res < 0) {
+        metrics.cqeErrors.Add();
+        if (cqe->res == -EMFILE || cqe->res == -ENFILE ||
+            cqe->res == -ENOBUFS || cqe->res == -ENOMEM) {
+          // Accepting again at once would fail at once, and spin until a
+          // descriptor frees up. The slot waits out the backoff instead.
+          auto* sqe = GetSqe();
+          io_uring_prep_timeout(sqe, &acceptBackoff, 0, 0);
+          io_uring_sqe_set_data64(sqe, Tag(OpKind::kAcceptRetry, slot));
+          Submit();
+          return;
+        }
+        // Nothing to close, but keep accepting (e.g. after ECONNABORTED)
+        ReleaseSlot(slot);
+        AsyncAccept(listeningFd);
+        return;
+      }
+      metrics.accepts.Add();
+      connections.fetch_add(1, std::memory_order_relaxed);
+      table[slot].fd = cqe->res;
+      auto* client = clients[slot].get();
       client->SetSocket(cqe->res);
-      Handler::OnAccept(this, listeningFd, client.get());
+      Handler::OnAccept(this, listeningFd, client);
+      break;
+    }
+    case OpKind::kAcceptRetry: {
+      // Completes with -ETIME once the backoff is over
+      const auto listeningFd = table[slot].fd;
+      ReleaseSlot(slot);
+      AsyncAccept(listeningFd);
       break;
     }
-    case Client::States::kRead:
-      // TODO: Keep reading if there's still stuff to be read
-      if (cqe->res == 0) {
-        // TODO: Handle error
+    case OpKind::kRead: {
+      auto* client = clients[slot].get();
+      if (cqe->res < 0) {
+        // Only ever affects this connection, e.g. reset by the peer. Left to
+        // the handler like an empty read, as a send may be in progress.
+        metrics.cqeErrors.Add();
+        Handler::OnRead(this, client);
+        return;
       }
-      assert(cqe->res >= 0);
-      client->SetBufferContentSize(static_cast<std::size_t>(cqe->res));
-      Handler::OnRead(this, client.get());
+      // An empty read (peer closed) is left to the handler
+      metrics.reads.Add();
+      metrics.bytesRead.Add(static_cast<std::uint64_t>(cqe->res));
+      client->Buffer().Commit(static_cast<std::size_t>(cqe->res));
+      Handler::OnRead(this, client);
       break;
-    case Client::States::kWrite:
-      // TODO: Verify all was wr itten?
-      Handler::OnWrite(this, client.get());
+    }
+    case OpKind::kWrite:
+      // Zero-copy notifications carry flags in res, and errors may be
+      // recoverable
+      HandleWriteCqe(cqe, slot);
+      break;
+    case OpKind::kSend:
+      HandleSendCqe(cqe, slot);
+      break;
+    case OpKind::kSpliceIn:
+    case OpKind::kSpliceOut:
+      // A short splice cancels the one linked to it, which is no error
+      HandleSpliceCqe(cqe, tag.Kind(), slot);
+      break;
+    case OpKind::kDrain:
+      // Ends with a timeout (canceled read) or error as well
+      HandleLingerCqe(cqe, slot);
+      break;
+    case OpKind::kWaitClose:
+      if (cqe->res > 0) {
+        metrics.reads.Add();
+        metrics.bytesRead.Add(static_cast<std::uint64_t>(cqe->res));
+        PrepareWaitClose(slot);
+        break;
+      }
+      if (cqe->res < 0) {
+        metrics.cqeErrors.Add();
+      }
+      Handler::OnRead(this, clients[slot].get());
       break;
     default:
-      assert(false && "Unhandled Request::State in HandleCqe");
+      assert(false && "Unhandled OpKind in HandleCqe");
       break;
   }
 }
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::ArmMailbox() -> void {
+  auto* sqe = GetSqe();
+  io_uring_prep_poll_add(sqe, mailbox.Fd(), POLLIN);
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kMailbox, 0}.Value());
+  Submit();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleMailboxCqe() -> void {
+  auto tasks = mailbox.TakeAll();
+  ArmMailbox();
+  for (auto& task : tasks) {
+    task();
+  }
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleHandoffCqe(io_uring_cqe* cqe)
+    -> void {
+  const auto payload = OpTag{cqe->user_data}.Payload();
+  if (cqe->res > 0) {
+    Adopt(std::unique_ptr<Client>{
+        reinterpret_cast<Client*>(static_cast<std::uintptr_t>(payload))});
+    return;
+  }
+
+  const auto sent = handoffs.find(payload);
+  assert(sent != handoffs.end());
+  auto [client, target] = sent->second;
+  handoffs.erase(sent);
+  if (cqe->res == 0) {
+    return;
+  }
+
+  // E.g. EINVAL from a kernel without MSG_RING (before 5.18), in which case
+  // the mailbox is used from now on
+  metrics.cqeErrors.Add();
+  if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+    msgRingSupported = false;
+  }
+  PostHandoff(*target, std::unique_ptr<Client>{client});
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleSendCqe(io_uring_cqe* cqe,
+                                                   std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& send = sends[slot];
+
+  if (cqe->res > 0) {
+    metrics.writes.Add();
+    metrics.bytesWritten.Add(static_cast<std::uint64_t>(cqe->res));
+    client->ConsumeOutbox(static_cast<std::size_t>(cqe->res));
+    if (!client->Outbox().empty() && !send.closing) {
+      // Short send (socket buffer full), more than IOV_MAX messages, or what
+      // was queued meanwhile
+      PrepareSend(slot);
+      return;
+    }
+  } else {
+    // E.g. reset by the peer, or the shutdown by Close()
+    metrics.cqeErrors.Add();
+    client->ClearOutbox();
+    if (!send.closing) {
+      Shutdown(static_cast<int>(slot));
+    }
+  }
+
+  send.active = false;
+  if (send.closing) {
+    send.closing = false;
+    Close(client.get());
+    return;
+  }
+  Handler::OnSent(this, client.get());
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleWriteCqe(io_uring_cqe* cqe,
+                                                    std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& write = writes[slot];
+
+  if ((cqe->flags & IORING_CQE_F_NOTIF) != 0) {
+    --write.notifications;
+    if ((static_cast<unsigned>(cqe->res) & IORING_NOTIF_USAGE_ZC_COPIED) !=
+        0) {
+      metrics.zeroCopyCopied.Add();
+    }
+  } else {
+    if ((cqe->flags & IORING_CQE_F_MORE) != 0) {
+      ++write.notifications;
+    }
+
+    if (write.zeroCopy && (cqe->res == -EOPNOTSUPP || cqe->res == -EINVAL)) {
+      // Not supported by the kernel or socket type: fall back to writev
+      zeroCopySupported = false;
+      PrepareWrite(slot);
+      return;
+    }
+    if (cqe->res < 0) {
+      // Close once the kernel no longer references what was sent before
+      metrics.cqeErrors.Add();
+      write.failed = true;
+      write.linked = false;
+      write.sendDone = true;
+    } else {
+      metrics.writes.Add();
+      metrics.bytesWritten.Add(static_cast<std::uint64_t>(cqe->res));
+      if (write.zeroCopy && zeroCopySupported) {
+        metrics.zeroCopyWrites.Add();
+      }
+
+      const auto written = static_cast<std::size_t>(cqe->res);
+      write.sent += written;
+      if (write.sent < write.total) {
+        // The linked close (or shutdown) was canceled
+        write.linked = false;
+      }
+      if (written > 0 && write.sent < write.total) {
+        // Short write (socket buffer full) or more than IOV_MAX segments:
+        // continue where it stopped. This is what paces streamed responses
+        // to the speed of the client.
+        PrepareWrite(slot);
+        return;
+      }
+      write.sendDone = true;
+    }
+  }
+
+  if (!write.sendDone || write.notifications > 0) {
+    return;  // The kernel may still reference the data
+  }
+
+  write.zeroCopy = false;
+  client->Buffer().Clear();
+  client->SetOutput(nullptr);
+  if (write.failed) {
+    Close(client.get());
+    return;
+  }
+  if (client->File()) {
+    PrepareSplice(slot);
+    return;
+  }
+  FinishWrite(slot);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::PrepareSplice(std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& write = writes[slot];
+  const auto& file = client->File();
+
+  if (write.pipeFds[0] < 0) {
+    if (pipe2(write.pipeFds, O_CLOEXEC) != 0) {
+      // E.g. out of file descriptors; the response can't be completed
+      Close(client.get());
+      return;
+    }
+    // Fewer rounds with a larger pipe, but keep the default if not permitted
+    fcntl(write.pipeFds[1], F_SETPIPE_SZ, kSplicePipeSize);
+    write.pipeCapacity =
+        static_cast<std::size_t>(fcntl(write.pipeFds[1], F_GETPIPE_SZ));
+  }
+
+  // Refill the pipe from the file, unless data from the last round did not
+  // fit into the socket. Both SQEs are prepared before submitting, as a link
+  // does not extend over separate submissions (see GetSqe).
+  io_uring_sqe* in = nullptr;
+  std::size_t length = write.piped;
+  if (length == 0) {
+    length = static_cast<std::size_t>(std::min<std::uint64_t>(
+        file.length - write.fileRead, write.pipeCapacity));
+    in = GetSqe(2);
+    const auto offset =
+        static_cast<std::int64_t>(file.offset + write.fileRead);
+    io_uring_prep_splice(in, file.file->fd, offset, write.pipeFds[1], -1,
+                         static_cast<unsigned>(length), SPLICE_F_MOVE);
+    // A short splice (e.g. file truncated meanwhile) cancels the next one
+    in->flags |= IOSQE_IO_LINK;
+    io_uring_sqe_set_data64(in, Tag(OpKind::kSpliceIn, slot));
+  }
+  auto* out = GetSqe();
+  io_uring_prep_splice(out, write.pipeFds[0], -1,
+                       table[slot].fd, -1,
+                       static_cast<unsigned>(length), SPLICE_F_MOVE);
+  io_uring_sqe_set_data64(out, Tag(OpKind::kSpliceOut, slot));
+
+  write.splices = in != nullptr ? 2 : 1;
+  write.spliceIn = 0;
+  write.spliceOut = 0;
+  table[slot].state = Client::States::kSendFile;
+  for (int i = 0; i < write.splices; ++i) {
+    Submit();
+  }
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleSpliceCqe(io_uring_cqe* cqe,
+                                                     OpKind kind,
+                                                     std::size_t slot) -> void {
+  auto& client = clients[slot];
+  auto& write = writes[slot];
+
+  if (kind == OpKind::kSpliceIn) {
+    write.spliceIn = cqe->res;
+  } else {
+    write.spliceOut = cqe->res;
+  }
+  if (--write.splices > 0) {
+    return;
+  }
+
+  const int error = write.spliceIn < 0 ? write.spliceIn : write.spliceOut;
+  if (error < 0 && error != -ECANCELED) {
+    // Whatever is left in the pipe must not go out with the next file
+    ClosePipe(write);
+    metrics.cqeErrors.Add();
+    Close(client.get());
+    return;
+  }
+
+  const auto in = static_cast<std::size_t>(std::max(write.spliceIn, 0));
+  const auto out = static_cast<std::size_t>(std::max(write.spliceOut, 0));
+  write.fileRead += in;
+  write.piped = write.piped + in - out;
+  if (out > 0) {
+    metrics.writes.Add();
+    metrics.bytesWritten.Add(out);
+    metrics.bytesSpliced.Add(out);
+  }
+
+  // Stop without progress as well, which happens if the file was truncated
+  // after it was opened. The response is then cut short.
+  const auto& file = client->File();
+  if ((write.fileRead < file.length || write.piped > 0) && in + out > 0) {
+    PrepareSplice(slot);
+    return;
+  }
+  if (write.piped > 0) {
+    ClosePipe(write);
+  }
+
+  client->SetFile({});
+  FinishWrite(slot);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::ClosePipe(WriteState& write) -> void {
+  for (auto& fd : write.pipeFds) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  write.piped = 0;
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::OpenAt(int dirFd, std::string path,
+                                            int flags, OpenCallback done)
+    -> void {
+  const auto index = AcquireDiskOp();
+  auto& op = *diskOps[index];
+  op.path = std::move(path);
+  op.complete = [done = std::move(done)](int res, DiskOp& /*op*/) {
+    done(res);
+  };
+
+  auto* sqe = GetSqe();
+  io_uring_prep_openat(sqe, dirFd, op.path.c_str(), flags | O_CLOEXEC,
+                       kFileMode);
+  SubmitDiskOp(sqe, index);
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::AcquireDiskOp() -> std::size_t {
+  if (freeDiskOps.empty()) {
+    diskOps.push_back(std::make_unique<DiskOp>());
+    return diskOps.size() - 1;
+  }
+  const auto index = freeDiskOps.back();
+  freeDiskOps.pop_back();
+  return index;
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::SubmitDiskOp(io_uring_sqe* sqe,
+                                                  std::size_t index) -> void {
+  io_uring_sqe_set_data64(sqe, OpTag{OpKind::kDiskOp, index}.Value());
+  metrics.diskOps.Add();
+  Submit();
+}
+
+template <typename Handler>
+auto toyws::UringIoService<Handler>::HandleDiskCqe(io_uring_cqe* cqe,
+                                                   std::size_t index) -> void {
+  // Stays put if the completion starts further operations
+  auto* op = diskOps[index].get();
+
+  auto complete = std::move(op->complete);
+  try {
+    complete(cqe->res, *op);
+  } catch (...) {
+    // Dropped, see AsyncFileIo; the op is released all the same
+  }
+
+  // Released only now, as the completion reads from the buffer
+  if (op->fixedBuffer >= 0) {
+    freeFixedBuffers.push_back(op->fixedBuffer);
+  }
+  *op = DiskOp{};
+  freeDiskOps.push_back(index);
+}
@@ -0,0 +1,159 @@
+#include "toyws/listener.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+
+#include "toyws/error.hpp"
+
+// Throw Error for failed call, closing sock first
+[[noreturn]] static auto Fail(toyws::Socket sock, std::string_view call)
+    -> void {
+  const int err = errno;
+  close(sock);
+  throw toyws::Error(
+      std::format("Error in {}(): {}", call, std::strerror(err)));
+}
+
+static auto SetOption(toyws::Socket sock, int level, int name, int value,
+                      std::string_view what) -> void {
+  if (setsockopt(sock, level, name, &value, sizeof(value)) == -1) {
+    Fail(sock, std::format("setsockopt({})", what));
+  }
+}
+
+static auto MakeUnixSocket(const std::string& path,
+                           const toyws::ListenerOptions& options)
+    -> toyws::Socket {
+  sockaddr_un name{};
+  name.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(name.sun_path)) {
+    throw toyws::Error(std::format("Invalid UNIX socket path: {}", path));
+  }
+  std::memcpy(name.sun_path, path.data(), path.size());
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    throw toyws::Error(
+        std::format("Error in socket(): {}", std::strerror(errno)));
+  }
+
+  // Replace the socket file left behind by a previous run, but nothing else
+  struct stat info {};
+  if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  if (bind(sock, reinterpret_cast<const sockaddr*>(&name), sizeof(name)) ==
+      -1) {
+    Fail(sock, "bind");
+  }
+  if (options.unixMode != 0 &&
+      chmod(path.c_str(), static_cast<mode_t>(options.unixMode)) == -1) {
+    Fail(sock, "chmod");
+  }
+  return sock;
+}
+
+static auto MakeTcpSocket(const std::string& address, std::uint16_t port,
+                          const toyws::ListenerOptions& options)
+    -> toyws::Socket {
+  sockaddr_in name4{};
+  sockaddr_in6 name6{};
+  const sockaddr* name = nullptr;
+  socklen_t nameLen = 0;
+  if (inet_pton(AF_INET, address.c_str(), &name4.sin_addr) == 1) {
+    name4.sin_family = AF_INET;
+    name4.sin_port = htons(port);
+    name = reinterpret_cast<const sockaddr*>(&name4);
+    nameLen = sizeof(name4);
+  } else if (inet_pton(AF_INET6, address.c_str(), &name6.sin6_addr) == 1) {
+    name6.sin6_family = AF_INET6;
+    name6.sin6_port = htons(port);
+    name = reinterpret_cast<const sockaddr*>(&name6);
+    nameLen = sizeof(name6);
+  } else {
+    throw toyws::Error("Invalid network address");
+  }
+
+  int sock = socket(name->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    throw toyws::Error(
+        std::format("Error in socket(): {}", std::strerror(errno)));
+  }
+
+  // Allow address reuse (for quick server restarts)
+  SetOption(sock, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+  if (options.reusePort) {
+    SetOption(sock, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+  }
+  if (name->sa_family == AF_INET6) {
+    SetOption(sock, IPPROTO_IPV6, IPV6_V6ONLY, options.dualStack ? 0 : 1,
+              "IPV6_V6ONLY");
+  }
+  // Accepted sockets inherit these, so that accepting costs no extra calls.
+  // Buffer sizes must be set before listen() to affect the window scale.
+  if (options.noDelay) {
+    SetOption(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+  if (options.sendBufferSize > 0) {
+    SetOption(sock, SOL_SOCKET, SO_SNDBUF, options.sendBufferSize,
+              "SO_SNDBUF");
+  }
+  if (options.receiveBufferSize > 0) {
+    SetOption(sock, SOL_SOCKET, SO_RCVBUF, options.receiveBufferSize,
+              "SO_RCVBUF");
+  }
+  if (options.deferAccept.count() > 0) {
+    SetOption(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+              static_cast<int>(options.deferAccept.count()),
+              "TCP_DEFER_ACCEPT");
+  }
+  if (options.fastOpenQueue > 0) {
+    SetOption(sock, IPPROTO_TCP, TCP_FASTOPEN, options.fastOpenQueue,
+              "TCP_FASTOPEN");
+  }
+
+  if (bind(sock, name, nameLen) == -1) {
+    Fail(sock, "bind");
+  }
+  return sock;
+}
+
+auto toyws::MakeListeningSocket(const std::string& address,
+                                std::uint16_t port,
+                                const ListenerOptions& options) -> Socket {
+  const auto sock =
+      address.starts_with(kUnixAddressPrefix)
+          ? MakeUnixSocket(address.substr(kUnixAddressPrefix.size()), options)
+          : MakeTcpSocket(address, port, options);
+
+  if (listen(sock, options.backlog) == -1) {
+    Fail(sock, "listen");
+  }
+  return sock;
+}
+
+auto toyws::LocalPort(Socket sock) -> std::uint16_t {
+  sockaddr_storage name{};
+  socklen_t nameLen = sizeof(name);
+  if (getsockname(sock, reinterpret_cast<sockaddr*>(&name), &nameLen) == -1) {
+    throw Error(
+        std::format("Error in getsockname(): {}", std::strerror(errno)));
+  }
+  switch (name.ss_family) {
+    case AF_INET:
+      return ntohs(reinterpret_cast<const sockaddr_in*>(&name)->sin_port);
+    case AF_INET6:
+      return ntohs(reinterpret_cast<const sockaddr_in6*>(&name)->sin6_port);
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,22 @@
+#include "toyws/load_balance.hpp"
+
+auto toyws::PickHandoffTarget(std::span<const std::size_t> loads,
+                              std::size_t self,
+                              const LoadBalanceOptions& options)
+    -> std::optional<std::size_t> {
+  if (!options.enabled || self >= loads.size()) {
+    return std::nullopt;
+  }
+
+  // The first of the least loaded, so that ties go to the same ring
+  std::size_t least = self;
+  for (std::size_t i = 0; i < loads.size(); ++i) {
+    if (loads[i] < loads[least]) {
+      least = i;
+    }
+  }
+  if (least == self || loads[self] - loads[least] < options.minImbalance) {
+    return std::nullopt;
+  }
+  return least;
+}
@@ -0,0 +1,50 @@
+#include "toyws/mailbox.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <utility>
+
+#include "toyws/error.hpp"
+
+toyws::Mailbox::Mailbox() {
+  eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd == -1) {
+    throw Error(std::format("Error in eventfd(): {}", std::strerror(errno)));
+  }
+}
+
+toyws::Mailbox::~Mailbox() { close(eventFd); }
+
+auto toyws::Mailbox::Post(Task task) -> void {
+  bool wasEmpty = false;
+  {
+    std::lock_guard lock{mutex};
+    wasEmpty = tasks.empty();
+    tasks.push_back(std::move(task));
+  }
+  if (wasEmpty) {
+    Wake();
+  }
+}
+
+auto toyws::Mailbox::Wake() -> void {
+  // Only fails if the counter would overflow, in which case the eventfd is
+  // readable already
+  const std::uint64_t one = 1;
+  [[maybe_unused]] auto written = write(eventFd, &one, sizeof(one));
+}
+
+auto toyws::Mailbox::TakeAll() -> std::vector<Task> {
+  // Reset the counter before looking at tasks, so that a post in between is
+  // not missed: it either makes it into this batch, or wakes up again.
+  std::uint64_t count = 0;
+  [[maybe_unused]] auto read = ::read(eventFd, &count, sizeof(count));
+
+  std::lock_guard lock{mutex};
+  return std::exchange(tasks, {});
+}
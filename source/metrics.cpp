@@ -0,0 +1,125 @@
+#include "toyws/metrics.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <iterator>
+
+// "le" boundaries (in microseconds) of the exported request latency histogram
+inline constexpr std::array<std::uint64_t, 13> kLatencyBoundsUs = {
+    100,   250,    500,    1000,   2500,   5000,   10000,
+    25000, 50000, 100000, 250000, 500000, 1000000};
+
+auto toyws::MetricsRegistry::Register(const RingMetrics* metrics) -> void {
+  std::lock_guard lock{mutex};
+  rings.push_back(metrics);
+}
+
+auto toyws::MetricsRegistry::Unregister(const RingMetrics* metrics) -> void {
+  std::lock_guard lock{mutex};
+  std::erase(rings, metrics);
+}
+
+auto toyws::MetricsRegistry::Snapshot() const -> MetricsSnapshot {
+  MetricsSnapshot out;
+
+  std::lock_guard lock{mutex};
+  for (const auto* ring : rings) {
+    out.accepts += ring->accepts.Value();
+    out.reads += ring->reads.Value();
+    out.bytesRead += ring->bytesRead.Value();
+    out.writes += ring->writes.Value();
+    out.bytesWritten += ring->bytesWritten.Value();
+    out.cqes += ring->cqes.Value();
+    out.cqeBatches += ring->cqeBatches.Value();
+    out.batchSubmits += ring->batchSubmits.Value();
+    out.sqFull += ring->sqFull.Value();
+    out.sqOverflows += ring->sqOverflows.Value();
+    out.cqeErrors += ring->cqeErrors.Value();
+    out.staleCqes += ring->staleCqes.Value();
+    out.zeroCopyWrites += ring->zeroCopyWrites.Value();
+    out.zeroCopyCopied += ring->zeroCopyCopied.Value();
+    out.bytesSpliced += ring->bytesSpliced.Value();
+    out.diskOps += ring->diskOps.Value();
+    out.closes += ring->closes.Value();
+    out.linkedCloses += ring->linkedCloses.Value();
+    out.handoffs += ring->handoffs.Value();
+    out.requests += ring->requests.Value();
+    out.offloads += ring->offloads.Value();
+    out.cacheWaits += ring->cacheWaits.Value();
+    out.webSocketUpgrades += ring->webSocketUpgrades.Value();
+    out.webSocketMessages += ring->webSocketMessages.Value();
+    out.webSocketFrames += ring->webSocketFrames.Value();
+    out.eventStreamSubscriptions += ring->eventStreamSubscriptions.Value();
+    out.eventStreamEvents += ring->eventStreamEvents.Value();
+    out.eventStreamDrops += ring->eventStreamDrops.Value();
+    out.requestLatencySumUs += ring->requestLatencyUs.Sum();
+    for (std::size_t i = 0; i < LogHistogram::kBucketCount; ++i) {
+      out.requestLatencyUs[i] += ring->requestLatencyUs.BucketValue(i);
+    }
+  }
+
+  return out;
+}
+
+auto toyws::MetricsRegistry::RenderPrometheus() const -> std::string {
+  const auto snapshot = Snapshot();
+  std::string out;
+  auto it = std::back_inserter(out);
+
+  auto counter = [&](const char* name, std::uint64_t value) {
+    fmt::format_to(it, "# TYPE toyws_{0} counter\ntoyws_{0} {1}\n", name,
+                   value);
+  };
+  counter("accepts_total", snapshot.accepts);
+  counter("reads_total", snapshot.reads);
+  counter("read_bytes_total", snapshot.bytesRead);
+  counter("writes_total", snapshot.writes);
+  counter("written_bytes_total", snapshot.bytesWritten);
+  counter("cqes_total", snapshot.cqes);
+  counter("cqe_batches_total", snapshot.cqeBatches);
+  counter("batch_submits_total", snapshot.batchSubmits);
+  counter("cqe_errors_total", snapshot.cqeErrors);
+  counter("stale_cqes_total", snapshot.staleCqes);
+  counter("sq_full_total", snapshot.sqFull);
+  counter("sq_overflows_total", snapshot.sqOverflows);
+  counter("zero_copy_writes_total", snapshot.zeroCopyWrites);
+  counter("zero_copy_copied_total", snapshot.zeroCopyCopied);
+  counter("spliced_bytes_total", snapshot.bytesSpliced);
+  counter("disk_ops_total", snapshot.diskOps);
+  counter("closes_total", snapshot.closes);
+  counter("linked_closes_total", snapshot.linkedCloses);
+  counter("handoffs_total", snapshot.handoffs);
+  counter("offloads_total", snapshot.offloads);
+  counter("cache_waits_total", snapshot.cacheWaits);
+  counter("websocket_upgrades_total", snapshot.webSocketUpgrades);
+  counter("websocket_messages_total", snapshot.webSocketMessages);
+  counter("websocket_frames_total", snapshot.webSocketFrames);
+  counter("event_stream_subscriptions_total",
+          snapshot.eventStreamSubscriptions);
+  counter("event_stream_events_total", snapshot.eventStreamEvents);
+  counter("event_stream_drops_total", snapshot.eventStreamDrops);
+
+  fmt::format_to(it, "# TYPE toyws_request_duration_seconds histogram\n");
+  std::uint64_t cumulative = 0;
+  std::size_t bucket = 0;
+  for (auto bound : kLatencyBoundsUs) {
+    for (; bucket < LogHistogram::kBucketCount &&
+           LogHistogram::BucketUpperBound(bucket) <= bound;
+         ++bucket) {
+      cumulative += snapshot.requestLatencyUs[bucket];
+    }
+    fmt::format_to(it,
+                   "toyws_request_duration_seconds_bucket{{le=\"{}\"}} {}\n",
+                   static_cast<double>(bound) / 1e6, cumulative);
+  }
+  fmt::format_to(it,
+                 "toyws_request_duration_seconds_bucket{{le=\"+Inf\"}} {}\n"
+                 "toyws_request_duration_seconds_sum {}\n"
+                 "toyws_request_duration_seconds_count {}\n",
+                 snapshot.requests,
+                 static_cast<double>(snapshot.requestLatencySumUs) / 1e6,
+                 snapshot.requests);
+
+  return out;
+}
@@ -0,0 +1,252 @@
+#include "toyws/request_body.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+
+#include "toyws/error.hpp"
+
+// Longest size/extension/trailer line accepted in a chunked body
+inline constexpr std::size_t kMaxLineLength = 4096;
+// More hex digits than this could overflow the chunk size
+inline constexpr std::size_t kMaxSizeDigits = 15;
+
+static auto HexValue(char c) -> int {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// ChunkedDecoder:
+
+auto toyws::ChunkedDecoder::Next(std::string_view& input) -> std::string_view {
+  while (!input.empty() && state != State::kDone && state != State::kError) {
+    if (state == State::kData) {
+      const auto n = static_cast<std::size_t>(
+          std::min<std::uint64_t>(remaining, input.size()));
+      const auto piece = input.substr(0, n);
+      input.remove_prefix(n);
+      remaining -= n;
+      if (remaining == 0) {
+        state = State::kDataCrlf;
+        lineLength = 0;
+      }
+      return piece;
+    }
+
+    const char c = input.front();
+    input.remove_prefix(1);
+    if (++lineLength > kMaxLineLength) {
+      state = State::kError;
+      break;
+    }
+
+    switch (state) {
+      case State::kSize:
+        if (const int value = HexValue(c); value >= 0) {
+          if (++digits > kMaxSizeDigits) {
+            // Could overflow
+            state = State::kError;
+            break;
+          }
+          remaining = remaining * 16 + static_cast<std::uint64_t>(value);
+          break;
+        }
+        if (digits == 0) {
+          // Expected chunk size
+          state = State::kError;
+          break;
+        }
+        state = State::kExtension;
+        [[fallthrough]];
+      case State::kExtension:
+        if (c == '\n') {
+          state = remaining == 0 ? State::kTrailer : State::kData;
+          digits = 0;
+          lineLength = 0;
+        }
+        break;
+      case State::kDataCrlf:
+        if (lineLength == 1 && c == '\r') {
+          break;
+        }
+        if (lineLength == 2 && c == '\n') {
+          state = State::kSize;
+          lineLength = 0;
+          break;
+        }
+        // Expected CRLF after chunk data
+        state = State::kError;
+        break;
+      case State::kTrailer:
+        if (c == '\n') {
+          // An empty line ends the trailer (and the body)
+          state = lineLength <= 2 ? State::kDone : State::kTrailer;
+          lineLength = 0;
+        }
+        break;
+      case State::kData:
+      case State::kDone:
+      case State::kError:
+        break;
+    }
+  }
+
+  return {};
+}
+
+// Create an unlinked file in directory, or return -1 with errno set
+static auto CreateTemporaryFile(const std::string& directory) -> int {
+  auto path = directory + "/toyws-body-XXXXXX";
+  const int fd = mkostemp(path.data(), O_CLOEXEC);
+  if (fd >= 0) {
+    unlink(path.c_str());
+  }
+  return fd;
+}
+
+// BodyBuffer:
+
+toyws::BodyBuffer::SpillFile::~SpillFile() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+toyws::BodyBuffer::~BodyBuffer() {
+  if (file != nullptr) {
+    // Writes in flight complete regardless, with no one left to tell
+    file->flushed = nullptr;
+  }
+}
+
+auto toyws::BodyBuffer::Append(std::string_view data) -> void {
+  size += data.size();
+  if (file == nullptr && memory.size() + data.size() > spillThreshold) {
+    Spill();
+  }
+
+  if (file != nullptr) {
+    WriteFile(data);
+  } else {
+    memory.append(data);
+  }
+}
+
+auto toyws::BodyBuffer::Flush(std::function<void()> done) -> void {
+  if (file == nullptr) {
+    done();
+    return;
+  }
+  file->flushed = std::move(done);
+  Settle(*file);
+}
+
+auto toyws::BodyBuffer::Spill() -> void {
+  const auto directory = spillDirectory.empty()
+                             ? std::filesystem::temp_directory_path().string()
+                             : spillDirectory;
+  file = std::make_shared<SpillFile>();
+
+  if (io != nullptr) {
+    file->opening = true;
+    file->pending = std::move(memory);
+    io->Open(directory, O_TMPFILE | O_RDWR,
+             [fileIo = io, spilled = file, directory](int fd) {
+               spilled->opening = false;
+               // Where O_TMPFILE is not supported by the file system, at the
+               // cost of blocking once
+               spilled->fd = fd >= 0 ? fd : CreateTemporaryFile(directory);
+               if (spilled->fd < 0) {
+                 spilled->failed = true;
+               } else if (!spilled->pending.empty()) {
+                 WriteAsync(*fileIo, spilled, std::move(spilled->pending));
+               }
+               Settle(*spilled);
+             });
+    memory = std::string{};
+    return;
+  }
+
+  // Prefer a file that never has a name; fall back where O_TMPFILE is not
+  // supported by the file system.
+  file->fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (file->fd < 0) {
+    file->fd = CreateTemporaryFile(directory);
+  }
+  if (file->fd < 0) {
+    const auto err = errno;
+    file.reset();
+    throw Error(std::format("BodyBuffer: Could not create file in {}: {}",
+                            directory, std::strerror(err)));
+  }
+
+  WriteFile(memory);
+  memory.clear();
+  memory.shrink_to_fit();
+}
+
+auto toyws::BodyBuffer::WriteFile(std::string_view data) -> void {
+  if (io != nullptr) {
+    if (file->failed) {
+      throw Error("BodyBuffer: Could not write file");
+    }
+    if (file->opening) {
+      file->pending.append(data);
+    } else {
+      WriteAsync(*io, file, std::string{data});
+    }
+    return;
+  }
+
+  while (!data.empty()) {
+    const auto res = write(file->fd, data.data(), data.size());
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw Error(std::format("BodyBuffer: Error in write(): {}",
+                              std::strerror(errno)));
+    }
+    data.remove_prefix(static_cast<std::size_t>(res));
+  }
+}
+
+auto toyws::BodyBuffer::WriteAsync(AsyncFileIo& io,
+                                   const std::shared_ptr<SpillFile>& file,
+                                   std::string data) -> void {
+  const auto length = data.size();
+  const auto offset = file->end;
+  file->end += length;
+  ++file->writes;
+  io.Write(file->fd, offset, std::move(data), [file, length](int res) {
+    --file->writes;
+    // Short only if the disk is full
+    if (res < 0 || static_cast<std::size_t>(res) != length) {
+      file->failed = true;
+    }
+    Settle(*file);
+  });
+}
+
+auto toyws::BodyBuffer::Settle(SpillFile& file) -> void {
+  if (file.opening || file.writes > 0 || !file.flushed) {
+    return;
+  }
+  auto done = std::move(file.flushed);
+  file.flushed = nullptr;
+  done();
+}
@@ -1,36 +1,739 @@
 #include "toyws/request_handler.hpp"
 
+#include <cassert>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "toyws/buffer_chain.hpp"
+#include "toyws/chunked_body.hpp"
+#include "toyws/connection_table.hpp"
+#include "toyws/event_stream.hpp"
 #include "toyws/http_request.hpp"
 #include "toyws/io_service_impl.hpp"
+#include "toyws/request_reader.hpp"
+#include "toyws/response_cache.hpp"
+#include "toyws/response_writer.hpp"
+#include "toyws/static_files.hpp"
+#include "toyws/websocket.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+using Service = toyws::IoService<toyws::RequestHandler>;
+
+/**
+ * @brief WebSocket of a connection upgraded on a route, owned by its Client.
+ *
+ * Frames are queued in the client's outbox, and sent by AsyncSend() while
+ * the next read is in progress. Once both sides sent a Close frame (or the
+ * peer broke the protocol), the connection is closed as soon as the outbox is
+ * sent.
+ */
+class Session final : public toyws::WebSocket {
+ public:
+  enum class States {
+    kConnecting = 0,  // Until the 101 response is written
+    kOpen,
+    kClosing,  // We sent a Close frame, and wait for the peer's
+    kClosed,   // Nothing is sent after what is queued
+  };
+
+  Session(Service* ioService, toyws::Client* connection,
+          const toyws::Route* socketRoute)
+      : service{ioService},
+        client{connection},
+        route{socketRoute},
+        handlers{socketRoute->SocketHandlers()},
+        reader{route->Options().webSocket.maxMessageBytes} {
+    assert(handlers != nullptr);
+  }
+
+  using toyws::WebSocket::Send;
+
+  auto Send(toyws::WebSocketFrame frame) -> void override {
+    if (state == States::kOpen) {
+      Queue(std::move(frame));
+    }
+  }
+
+  auto Close(toyws::WebSocketCloseCode code, std::string_view reason)
+      -> void override {
+    if (state != States::kOpen) {
+      return;
+    }
+    Queue(std::make_shared<const std::string>(
+        toyws::EncodeCloseFrame(code, reason)));
+    state = States::kClosing;
+  }
+
+  auto Request() const -> const toyws::HttpRequest& override {
+    return client->Reader().Request();
+  }
+
+  auto State() const -> States { return state; }
+
+  auto Route() const -> const toyws::Route* { return route; }
+
+  // Once the handshake is written
+  auto Open() -> void {
+    state = States::kOpen;
+    if (const auto onOpen = handlers->onOpen) {
+      try {
+        onOpen(*this);
+      } catch (...) {
+        Fault();
+      }
+    }
+  }
+
+  // Feed what was read through the reader, & act on what it yields
+  auto Read(toyws::BufferChain& buffer) -> void {
+    for (std::size_t i = 0; i < buffer.PieceCount(); ++i) {
+      auto input = buffer.Piece(i);
+      while (state != States::kClosed) {
+        const auto message = reader.Next(input);
+        if (!message) {
+          break;
+        }
+        Receive(*message);
+      }
+      if (state == States::kClosed) {
+        return;
+      }
+      if (reader.Failed()) {
+        if (state == States::kOpen) {
+          Queue(std::make_shared<const std::string>(
+              toyws::EncodeCloseFrame(reader.ErrorCode())));
+        }
+        Finish(reader.ErrorCode());
+        return;
+      }
+    }
+  }
+
+  // The connection ended (or failed) without a closing handshake
+  auto Lost() -> void { Finish(toyws::WebSocketCloseCode::kAbnormal); }
+
+ private:
+  Service* service;
+  toyws::Client* client;
+  const toyws::Route* route;
+  const toyws::WebSocketHandlers* handlers;  // Of route, never nullptr
+  toyws::WebSocketReader reader;
+  States state = States::kConnecting;
+  bool dropped = false;
+
+  auto Receive(const toyws::WebSocketReader::Message& message) -> void {
+    using toyws::WebSocketOpcode;
+    switch (message.opcode) {
+      case WebSocketOpcode::kText:
+      case WebSocketOpcode::kBinary:
+        service->Metrics().webSocketMessages.Add();
+        if (const auto onMessage = handlers->onMessage) {
+          try {
+            onMessage(*this, message.opcode, message.payload);
+          } catch (...) {
+            Fault();
+          }
+        }
+        break;
+      case WebSocketOpcode::kPing:
+        Send(WebSocketOpcode::kPong, message.payload);
+        break;
+      case WebSocketOpcode::kClose: {
+        const auto code = toyws::CloseCodeOf(message.payload);
+        if (state == States::kOpen) {
+          // Echo the code, which ends the handshake on our side
+          Queue(std::make_shared<const std::string>(
+              toyws::EncodeCloseFrame(code)));
+        }
+        Finish(code);
+        break;
+      }
+      default:
+        // Pongs, to pings we never send
+        break;
+    }
+  }
+
+  auto Queue(toyws::WebSocketFrame frame) -> void {
+    auto& outbox = client->Outbox();
+    if (outbox.size() >= route->Options().webSocket.maxQueuedFrames) {
+      // The peer doesn't keep up. Dropped rather than buffered without bound:
+      // the read in progress completes empty, which closes it.
+      if (!dropped) {
+        dropped = true;
+        service->Shutdown(client->IoServiceSlot());
+      }
+      return;
+    }
+    outbox.push_back(std::move(frame));
+    service->Metrics().webSocketFrames.Add();
+    service->AsyncSend(client->IoServiceSlot());
+  }
+
+  auto Finish(toyws::WebSocketCloseCode code) -> void {
+    if (state == States::kClosed) {
+      return;
+    }
+    const bool opened = state != States::kConnecting;
+    state = States::kClosed;
+    const auto onClose = handlers->onClose;
+    if (opened && onClose != nullptr) {
+      try {
+        onClose(*this, code);
+      } catch (...) {
+        // The connection closes regardless
+      }
+    }
+  }
+
+  // A handler threw, on the ring's thread: close the connection as an
+  // internal error rather than let that end the ring
+  auto Fault() -> void {
+    if (state == States::kOpen) {
+      Queue(std::make_shared<const std::string>(
+          toyws::EncodeCloseFrame(toyws::WebSocketCloseCode::kInternalError)));
+    }
+    Finish(toyws::WebSocketCloseCode::kInternalError);
+  }
+};
+}  // namespace
+
+static auto IsCacheable(const toyws::HttpRequest& request,
+                        const toyws::Route* route) -> bool {
+  return route != nullptr && route->Options().cache.enabled &&
+         (request.Method() == toyws::HttpMethod::GET ||
+          request.Method() == toyws::HttpMethod::HEAD);
+}
+
+static auto RecordRequest(toyws::IoService<toyws::RequestHandler>* service,
+                          Clock::time_point start) -> void {
+  auto& metrics = service->Metrics();
+  metrics.requests.Add();
+  metrics.requestLatencyUs.Record(static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                            start)
+          .count()));
+}
+
+// Feed one contiguous piece of read data to reader
+static auto Feed(Service* service, toyws::RequestReader& reader,
+                 std::string_view input) -> void {
+  using States = toyws::RequestReader::States;
+  if (reader.State() == States::kHead) {
+    input.remove_prefix(reader.ReadHead(input));
+    if (reader.State() != States::kBody) {
+      return;
+    }
+    // A body spilled to disk is written on the ring
+    reader.BeginBody(service->Instance()->FindRoute(reader.Request()),
+                     service);
+  }
+  if (reader.State() == States::kBody) {
+    reader.ReadBody(input);
+  }
+}
+
+static auto Dispatch(Service* service, toyws::Client* client,
+                     const toyws::Route* route, const std::string& cacheKey,
+                     Clock::time_point start) -> void;
+
+// Have waiter, which waited for a response it can't be served, call the
+// handler for a response of its own
+static auto Redispatch(Service* service, const toyws::Route* route,
+                       const toyws::ResponseCache::Waiter& waiter) -> void {
+  service->Post(
+      [service, tag = toyws::OpTag{waiter.id}, route, since = waiter.since] {
+        if (auto* other = service->GetClient(tag); other != nullptr) {
+          Dispatch(service, other, route, {}, since);
+        }
+      });
+}
+
+// Write the response in client's buffer to client, and to those waiting for
+// the same cache key
+static auto Send(toyws::IoService<toyws::RequestHandler>* service,
+                 toyws::Client* client, const toyws::Route* route,
+                 const std::string& cacheKey, Clock::time_point start,
+                 toyws::HttpStatus status) -> void {
+  if (!cacheKey.empty()) {
+    auto* server = service->Instance();
+    // The buffer of a streamed response holds just its head, which is neither
+    // cached nor shared
+    const bool streamed = static_cast<bool>(client->Stream());
+    std::shared_ptr<const std::string> bytes;
+    std::optional<Clock::time_point> expires;
+    if (!streamed) {
+      bytes = std::make_shared<const std::string>(client->Buffer().ToString());
+      if (status == toyws::HttpStatus::kOk) {
+        expires = start + route->Options().cache.ttl;
+      }
+    }
+    for (const auto& waiter :
+         server->Cache().Complete(cacheKey, bytes, expires)) {
+      if (streamed) {
+        // Once this one is on its way
+        Redispatch(service, route, waiter);
+        continue;
+      }
+      // Gone if its ring handed it over, or is stopping
+      if (auto* other = service->GetClient(toyws::OpTag{waiter.id});
+          other != nullptr) {
+        server->LogAccess(
+            other->Reader().Request(), status, bytes->size(),
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - waiter.since));
+        other->Buffer().Clear();
+        other->SetOutput(bytes);
+        RecordRequest(service, waiter.since);
+        service->AsyncWrite(other->IoServiceSlot(), toyws::AfterWrite::kClose);
+      }
+    }
+  }
+
+  RecordRequest(service, start);
+  service->AsyncWrite(client->IoServiceSlot(),
+                      client->Stream() ? toyws::AfterWrite::kOnWrite
+                                       : toyws::AfterWrite::kClose);
+}
+
+// Serialize response into client's buffer and Send() it
+static auto Respond(toyws::IoService<toyws::RequestHandler>* service,
+                    toyws::Client* client, const toyws::Route* route,
+                    const std::string& cacheKey, Clock::time_point start,
+                    toyws::HttpResponse response) -> void {
+  auto& buffer = client->Buffer();
+
+  if (response.HasFile() && !cacheKey.empty()) {
+    // Cached responses are kept serialized in full
+    try {
+      response.SetBody(toyws::ReadFileRange(response.TakeFile()));
+    } catch (toyws::HttpStatusError& err) {
+      response = toyws::HttpResponse{err.Status()};
+    }
+  }
+
+  buffer.Clear();
+  if (response.HasFile()) {
+    // The body follows the head straight from the page cache
+    response.WriteHead(buffer);
+    client->SetFile(response.TakeFile());
+  } else if (cacheKey.empty() && !response.IsStreaming() &&
+             response.Body().size() >= service->ZeroCopyThreshold()) {
+    // Hand a large body over as is, rather than copying it into the buffer,
+    // so that it can be sent with zero-copy send.
+    response.WriteHead(buffer);
+    client->SetOutput(
+        std::make_shared<const std::string>(response.TakeBody()));
+  } else {
+    response.Write(buffer);
+  }
+
+  // The head goes out first; the body of a streamed response follows chunk by
+  // chunk from OnWrite. Chunked is safe to send, as requests other than
+  // HTTP/1.1 are refused with 505 by the parser.
+  client->SetStream(response.Stream());
+
+  Send(service, client, route, cacheKey, start, response.Status());
+}
+
+// Call the handler of route for client's request & respond, or leave that to
+// a worker or to the handler, if it defers its response
+static auto Dispatch(Service* service, toyws::Client* client,
+                     const toyws::Route* route, const std::string& cacheKey,
+                     Clock::time_point start) -> void {
+  auto* server = service->Instance();
+  auto& reader = client->Reader();
+  const auto& request = reader.Request();
+  auto& context = reader.Context();
+  if (route != nullptr && route->Writer() != nullptr &&
+      !route->Options().offload) {
+    // Straight into the buffer, without an HttpResponse in between
+    context.SetIo(nullptr);
+    context.SetResponder(nullptr);
+    toyws::ResponseWriter writer{client->Buffer()};
+    server->CallWriter(request, route, context, writer);
+    server->LogAccess(
+        request, writer.Status(), writer.BodySize(),
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                              start));
+    Send(service, client, route, cacheKey, start, writer.Status());
+    return;
+  }
+
+  // A handler may defer its response, e.g. until file I/O on the ring is done
+  // By the connection's tag, as its slot may hold another one by then
+  toyws::Responder respond = [service, server,
+                              tag = service->ClientTag(client->IoServiceSlot()),
+                              route, cacheKey,
+                              start](toyws::HttpResponse deferred) {
+    auto* connection = service->GetClient(tag);
+    if (connection == nullptr) {
+      // Gone meanwhile, e.g. as the ring stops. Those waiting for the
+      // response are left to call the handler themselves.
+      if (!cacheKey.empty()) {
+        for (const auto& waiter :
+             server->Cache().Complete(cacheKey, nullptr, std::nullopt)) {
+          Redispatch(service, route, waiter);
+        }
+      }
+      return;
+    }
+    server->FinishResponse(connection->Reader().Request(), route, deferred,
+                           start);
+    Respond(service, connection, route, cacheKey, start, std::move(deferred));
+  };
+
+  if (route != nullptr && route->HasHandler() && route->Options().offload) {
+    // Both belong to the ring's thread
+    context.SetIo(nullptr);
+    context.SetResponder(nullptr);
+    service->Metrics().offloads.Add();
+    // request & context stay put, as the connection waits for the response
+    server->Workers().Submit([service, server, &request, route, &context,
+                              respond = std::move(respond)] {
+      // Which answers what the handler throws, as on the ring's thread
+      auto response = server->CallHandler(request, route, context);
+      service->Post([respond, response = std::move(response)]() mutable {
+        respond(std::move(response));
+      });
+    });
+    return;
+  }
+
+  context.SetIo(service);
+  context.SetResponder(std::move(respond));
+  auto response = server->HandleRequest(request, route, context);
+  if (context.IsDeferred()) {
+    return;
+  }
+  Respond(service, client, route, cacheKey, start, std::move(response));
+}
+
+// Answer the opening handshake on a WebSocket route, and switch the
+// connection over once the 101 response is written (see OnWrite)
+static auto Upgrade(Service* service, toyws::Client* client,
+                    const toyws::Route* route, Clock::time_point start)
+    -> void {
+  const auto& request = client->Reader().Request();
+  auto response = toyws::AcceptWebSocket(request);
+  service->Instance()->LogAccess(request, response, start);
+  auto& buffer = client->Buffer();
+  buffer.Clear();
+  response.Write(buffer);
+  RecordRequest(service, start);
+
+  if (response.Status() != toyws::HttpStatus::kSwitchingProtocols) {
+    service->AsyncWrite(client->IoServiceSlot(), toyws::AfterWrite::kClose);
+    return;
+  }
+  client->SetWebSocket(std::make_unique<Session>(service, client, route));
+  service->Metrics().webSocketUpgrades.Add();
+  service->AsyncWrite(client->IoServiceSlot());
+}
+
+// Answer a request on an event stream route with the head of a chunked
+// response that doesn't end, and subscribe the connection to the route once
+// that is written (see OnWrite)
+static auto Subscribe(Service* service, toyws::Client* client,
+                      const toyws::Route* route, Clock::time_point start)
+    -> void {
+  auto* server = service->Instance();
+  const auto& request = client->Reader().Request();
+  auto response = server->CallSubscribe(request, route);
+  server->LogAccess(request, response, start);
+  auto& buffer = client->Buffer();
+  buffer.Clear();
+  RecordRequest(service, start);
+
+  if (response.Status() != toyws::HttpStatus::kOk) {
+    response.Write(buffer);
+    service->AsyncWrite(client->IoServiceSlot(), toyws::AfterWrite::kClose);
+    return;
+  }
+  // The events to send first go along with the head, as the first chunk
+  const auto initial = toyws::EncodeChunk(response.Body());
+  response.SetBody({});
+  response.Headers().emplace("Transfer-Encoding", "chunked");
+  response.WriteHead(buffer);
+  buffer.Append(initial);
+  client->SetSubscribed(true);
+  service->Metrics().eventStreamSubscriptions.Add();
+  service->AsyncWrite(client->IoServiceSlot());
+}
+
+// Queue frame for a subscriber, unless it fell too far behind already
+static auto Deliver(Service* service, toyws::Client* client,
+                    const toyws::EventStreamFrame& frame) -> bool {
+  auto& outbox = client->Outbox();
+  const auto* route = client->Reader().Route();
+  if (outbox.size() >= route->Options().eventStream.maxQueuedEvents) {
+    // Dropped rather than buffered without bound: the wait for the peer to
+    // close completes, which closes it (see OnRead).
+    service->Shutdown(client->IoServiceSlot());
+    service->Metrics().eventStreamDrops.Add();
+    return false;
+  }
+  outbox.push_back(frame);
+  service->Metrics().eventStreamEvents.Add();
+  service->AsyncSend(client->IoServiceSlot());
+  return true;
+}
+
+// Read on an upgraded connection. Frames a client sends before the handshake
+// is answered, in the same read as the request, are dropped.
+static auto ReadWebSocket(Service* service, toyws::Client* client,
+                          Session& session) -> void {
+  if (client->Buffer().Empty()) {
+    // Peer closed (or we shut it down, see Session::Queue), or the read
+    // failed
+    session.Lost();
+    service->Close(client);
+    return;
+  }
+
+  session.Read(client->Buffer());
+  if (session.State() != Session::States::kClosed) {
+    service->AsyncRead(client->IoServiceSlot());
+  } else if (client->Outbox().empty()) {
+    service->Close(client);
+  }
+  // Otherwise closed by OnSent
+}
+
+// Answer the request client has read in full, or its error
+static auto Answer(Service* service, toyws::Client* client,
+                   Clock::time_point start) -> void {
+  using toyws::AfterWrite;
+  using toyws::HttpResponse;
+  using toyws::HttpStatus;
+  using toyws::ResponseCache;
+  using States = toyws::RequestReader::States;
+  auto* server = service->Instance();
+  auto& reader = client->Reader();
+  auto& buffer = client->Buffer();
+
+  if (reader.State() == States::kError) {
+    buffer.Clear();
+    HttpResponse{reader.ErrorStatus()}.Write(buffer);
+    // The peer may still be sending the rest of the request
+    service->AsyncWrite(client->IoServiceSlot(), AfterWrite::kLinger);
+    return;
+  }
+
+  const auto& request = reader.Request();
+  const auto* route = reader.Route();
+
+  if (route != nullptr && route->SocketHandlers() != nullptr) {
+    Upgrade(service, client, route, start);
+    return;
+  }
+  if (route != nullptr && route->StreamHandlers() != nullptr) {
+    Subscribe(service, client, route, start);
+    return;
+  }
+
+  // Serve from the response cache if possible, without calling the handler
+  std::string cacheKey;
+  if (IsCacheable(request, route)) {
+    auto& cache = server->Cache();
+    cacheKey = ResponseCache::MakeKey(request, route->Options().cache.vary);
+    // Keyed on the negotiated encoding rather than raw Accept-Encoding, which
+    // comes in far more variations than we have encodings.
+    cacheKey += "\nContent-Encoding:";
+    cacheKey += ContentEncodingName(server->NegotiateEncoding(request, route));
+    auto result = cache.Lookup(
+        cacheKey, service->ClientTag(client->IoServiceSlot()).Value(), start);
+    if (result.status == ResponseCache::LookupStatus::kHit) {
+      server->LogAccess(
+          request, HttpStatus::kOk, result.bytes->size(),
+          std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                                start));
+      buffer.Clear();
+      client->SetOutput(std::move(result.bytes));
+      RecordRequest(service, start);
+      service->AsyncWrite(client->IoServiceSlot(), AfterWrite::kClose);
+      return;
+    }
+    if (result.status == ResponseCache::LookupStatus::kPending) {
+      // Another request is generating this response; Send() (for that
+      // request) writes it to this client as well.
+      service->Metrics().cacheWaits.Add();
+      return;
+    }
+  }
+
+  Dispatch(service, client, route, cacheKey, start);
+}
+
 
 auto toyws::RequestHandler::OnAccept(IoService<RequestHandler>* service,
                                      Socket listenSock, Client* client)
     -> void {
   service->AsyncAccept(listenSock);
+  if (auto* target = service->Instance()->HandoffTarget(*service)) {
+    service->Handoff(*target, service->TakeClient(client->IoServiceSlot()));
+    return;
+  }
+  service->AsyncRead(client->IoServiceSlot());
+}
+
+auto toyws::RequestHandler::OnHandoff(IoService<RequestHandler>* service,
+                                      Client* client) -> void {
   service->AsyncRead(client->IoServiceSlot());
 }
 
 auto toyws::RequestHandler::OnRead(IoService<RequestHandler>* service,
                                    Client* client) -> void {
-  // TODO: Handle HttpRequest::Read returning false -> Read more!
-  HttpRequest request;
-  request.Read(client->Buffer().data(), client->BufferContentSize());
-  auto response = service->Instance()->HandleRequest(request);
+  const auto start = Clock::now();
+  auto* server = service->Instance();
+  auto& reader = client->Reader();
+  auto& buffer = client->Buffer();
 
-  // TODO: Handle HttpRequest::Write returning false -> Write multiple times!
-  auto written =
-      response.Write(client->Buffer().data(), client->Buffer().size());
-  client->SetBufferContentSize(written.second);
+  if (auto* socket = client->WebSocket(); socket != nullptr) {
+    ReadWebSocket(service, client, static_cast<Session&>(*socket));
+    return;
+  }
 
-  service->AsyncWrite(client->IoServiceSlot());
+  if (client->Subscribed()) {
+    // Peer closed (or we dropped it, see Deliver()), see AsyncWaitClose()
+    server->Events().Unsubscribe(reader.Route(), client->IoServiceSlot());
+    service->Close(client);
+    return;
+  }
+
+  if (buffer.Empty()) {
+    // Peer closed the connection before sending a full request
+    service->Close(client);
+    return;
+  }
+
+  // Accumulate head & body over as many reads (and segments) as it takes
+  using States = RequestReader::States;
+  for (std::size_t i = 0; i < buffer.PieceCount() &&
+                          (reader.State() == States::kHead ||
+                           reader.State() == States::kBody);
+       ++i) {
+    Feed(service, reader, buffer.Piece(i));
+  }
+  if (reader.State() == States::kHead || reader.State() == States::kBody) {
+    service->AsyncRead(client->IoServiceSlot());
+    return;
+  }
+  if (reader.State() == States::kFlushing) {
+    // Answered once the body is written to disk
+    reader.Flush([service, client, start] { Answer(service, client, start); });
+    return;
+  }
+  Answer(service, client, start);
 }
 
 auto toyws::RequestHandler::OnWrite(IoService<RequestHandler>* service,
                                     Client* client) -> void {
-  // TODO: Handle multiple writes
+  if (auto* socket = client->WebSocket(); socket != nullptr) {
+    // The handshake is done
+    auto& session = static_cast<Session&>(*socket);
+    session.Open();
+    if (session.State() != Session::States::kClosed) {
+      service->AsyncRead(client->IoServiceSlot());
+    } else if (client->Outbox().empty()) {
+      service->Close(client);
+    }
+    // Otherwise closed by OnSent
+    return;
+  }
+
+  if (client->Subscribed()) {
+    // The head is written; events follow through the outbox, and the peer
+    // has nothing more to say
+    service->Instance()->Events().Subscribe(client->Reader().Route(),
+                                            client->IoServiceSlot());
+    service->AsyncWaitClose(client->IoServiceSlot());
+    return;
+  }
+
+  if (client->Stream()) {
+    // Each chunk is produced into a single segment
+    auto& buffer = client->Buffer();
+    buffer.Clear();
+    buffer.Reserve(kSegmentSize);
+    const auto space = buffer.Spare().front();
+    std::pair<bool, std::size_t> chunk;
+    try {
+      chunk = WriteChunk(client->Stream(), static_cast<char*>(space.iov_base),
+                         space.iov_len);
+    } catch (...) {
+      // Whatever the producer threw, the head is already sent: all we can do
+      // is to cut the response short
+      service->Close(client);
+      return;
+    }
+    buffer.Commit(chunk.second);
+    if (chunk.first) {
+      // Last chunk
+      client->SetStream(nullptr);
+      service->AsyncWrite(client->IoServiceSlot(), AfterWrite::kClose);
+      return;
+    }
+    service->AsyncWrite(client->IoServiceSlot());
+    return;
+  }
+
   service->Close(client);
 }
 
+auto toyws::RequestHandler::OnSent(IoService<RequestHandler>* service,
+                                   Client* client) -> void {
+  const auto* socket = static_cast<const Session*>(client->WebSocket());
+  if (socket != nullptr && socket->State() == Session::States::kClosed &&
+      client->Outbox().empty()) {
+    // No read in progress, see ReadWebSocket()
+    service->Close(client);
+  }
+}
+
+auto toyws::RequestHandler::Broadcast(IoService<RequestHandler>* service,
+                                      const Route* route,
+                                      const WebSocketFrame& frame) -> void {
+  for (std::size_t slot = 0; slot < service->SlotCount(); ++slot) {
+    auto* client = service->GetClient(static_cast<int>(slot));
+    if (client == nullptr || client->WebSocket() == nullptr) {
+      continue;
+    }
+    auto& session = static_cast<Session&>(*client->WebSocket());
+    if (session.Route() == route) {
+      session.Send(frame);
+    }
+  }
+}
+
+auto toyws::RequestHandler::Publish(IoService<RequestHandler>* service,
+                                    const Route* route,
+                                    const EventStreamFrame& frame) -> void {
+  service->Instance()->Events().Publish(route, [&](int slot) {
+    return Deliver(service, service->GetClient(slot), frame);
+  });
+}
+
+auto toyws::RequestHandler::Heartbeat(IoService<RequestHandler>* service,
+                                      const EventStreamFrame& frame) -> void {
+  service->Instance()->Events().PublishAll([&](int slot) {
+    auto* client = service->GetClient(slot);
+    // Those with events still queued need none
+    return !client->Outbox().empty() || Deliver(service, client, frame);
+  });
+}
+
 namespace toyws {
-template class IoService<RequestHandler>;
+// By name, as an alias template can't be explicitly instantiated
+#if defined(TOYWS_IO_EPOLL)
+template class EpollIoService<RequestHandler>;
+#else
+template class UringIoService<RequestHandler>;
+#endif
 }  // namespace toyws
@@ -0,0 +1,206 @@
+#include "toyws/request_reader.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <string_view>
+
+#include "toyws/error.hpp"
+#include "toyws/http_response.hpp"
+
+inline constexpr std::string_view kHeadEnd = "\r\n\r\n";
+
+// Whether the transfer codings are chunked alone, the only ones we decode.
+// Anything layered under chunked (e.g. "gzip, chunked") would reach handlers
+// still encoded.
+static auto IsChunked(std::string_view codings) -> bool {
+  while (!codings.empty() &&
+         (codings.front() == ' ' || codings.front() == '\t')) {
+    codings.remove_prefix(1);
+  }
+  while (!codings.empty() &&
+         (codings.back() == ' ' || codings.back() == '\t')) {
+    codings.remove_suffix(1);
+  }
+  return std::ranges::equal(codings, std::string_view{"chunked"},
+                            [](char a, char b) {
+                              return std::tolower(static_cast<unsigned char>(
+                                         a)) == b;
+                            });
+}
+
+auto toyws::RequestReader::ReadHead(std::string_view data) -> std::size_t {
+  // The terminator may straddle the previous read
+  const auto before = head.size();
+  const auto searchFrom =
+      before < kHeadEnd.size() ? 0 : before - (kHeadEnd.size() - 1);
+  head.append(data);
+
+  const auto pos = head.find(kHeadEnd, searchFrom);
+  if (pos == std::string::npos) {
+    if (head.size() > kMaxHeadSize) {
+      Fail(HttpStatus::kRequestHeaderFieldsTooLarge);
+    }
+    return data.size();
+  }
+
+  const auto end = pos + kHeadEnd.size();
+  if (end > kMaxHeadSize) {
+    Fail(HttpStatus::kRequestHeaderFieldsTooLarge);
+    return end - before;
+  }
+  head.resize(end);
+
+  if (const auto status = request.Parse(head); status != HttpStatus::kOk) {
+    Fail(status);
+    return end - before;
+  }
+
+  head = std::pmr::string{head.get_allocator()};
+  state = States::kBody;
+  return end - before;
+}
+
+auto toyws::RequestReader::BeginBody(const toyws::Route* requestRoute,
+                                     AsyncFileIo* io) -> void {
+  route = requestRoute;
+  if (route != nullptr) {
+    options = route->Options().body;
+  }
+
+  const auto& headers = request.Headers();
+  const auto transferEncoding = headers.find("Transfer-Encoding");
+  const auto contentLength = headers.find("Content-Length");
+  if (transferEncoding != headers.end()) {
+    // Both would make the framing ambiguous (request smuggling)
+    if (contentLength != headers.end()) {
+      Fail(HttpStatus::kBadRequest);
+      return;
+    }
+    if (!IsChunked(transferEncoding->second)) {
+      Fail(HttpStatus::kNotImplemented);
+      return;
+    }
+    chunked = true;
+  } else if (contentLength != headers.end()) {
+    const auto& value = contentLength->second;
+    const auto* last = value.data() + value.size();
+    auto [ptr, ec] = std::from_chars(value.data(), last, remaining);
+    if (value.empty() || ec != std::errc{} || ptr != last) {
+      Fail(HttpStatus::kBadRequest);
+      return;
+    }
+    if (remaining > options.maxBytes) {
+      Fail(HttpStatus::kPayloadTooLarge);
+      return;
+    }
+  }
+
+  if (!chunked && remaining == 0) {
+    Complete();
+    return;
+  }
+
+  if (options.mode == BodyMode::kStream && options.onChunk == nullptr) {
+    options.mode = BodyMode::kBuffer;
+  }
+  if (options.mode == BodyMode::kBuffer) {
+    buffer.emplace(options.spillThreshold, options.spillDirectory, io);
+  }
+  state = States::kBody;
+}
+
+auto toyws::RequestReader::ReadBody(std::string_view data) -> void {
+  if (chunked) {
+    while (!decoder.Done() && state == States::kBody) {
+      const auto piece = decoder.Next(data);
+      if (piece.empty()) {
+        break;
+      }
+      Deliver(piece);
+    }
+    if (decoder.Failed()) {
+      Fail(HttpStatus::kBadRequest);
+    } else if (decoder.Done() && state == States::kBody) {
+      Complete();
+    }
+    return;
+  }
+
+  const auto piece = data.substr(
+      0, static_cast<std::size_t>(std::min<std::uint64_t>(remaining,
+                                                          data.size())));
+  remaining -= piece.size();
+  if (!piece.empty()) {
+    Deliver(piece);
+  }
+  if (remaining == 0 && state == States::kBody) {
+    Complete();
+  }
+}
+
+auto toyws::RequestReader::Deliver(std::string_view piece) -> void {
+  received += piece.size();
+  if (received > options.maxBytes) {
+    Fail(HttpStatus::kPayloadTooLarge);
+    return;
+  }
+
+  if (!buffer) {
+    // Thrown on the ring's thread, where nothing else would catch it
+    try {
+      options.onChunk(request, context, piece);
+    } catch (HttpStatusError& err) {
+      Fail(err.Status());
+    } catch (...) {
+      Fail(HttpStatus::kInternalServerError);
+    }
+    return;
+  }
+
+  try {
+    buffer->Append(piece);
+  } catch (const Error&) {
+    // Spilling to disk failed, which is no fault of the peer's
+    Fail(HttpStatus::kInternalServerError);
+  }
+}
+
+auto toyws::RequestReader::Flush(std::function<void()> done) -> void {
+  buffer->Flush([this, done = std::move(done)] {
+    Complete();
+    done();
+  });
+}
+
+auto toyws::RequestReader::Complete() -> void {
+  if (buffer && !buffer->Flushed()) {
+    state = States::kFlushing;
+    return;
+  }
+  if (buffer && buffer->Failed()) {
+    // Spilling to disk failed, which is no fault of the peer's
+    Fail(HttpStatus::kInternalServerError);
+    return;
+  }
+  state = States::kComplete;
+  if (!buffer) {
+    return;
+  }
+
+  if (buffer->Spilled()) {
+    lseek(buffer->File(), 0, SEEK_SET);
+    request.SetBodyFile(buffer->File());
+  } else {
+    request.SetBody(buffer->TakeMemory());
+  }
+}
+
+auto toyws::RequestReader::Fail(HttpStatus status) -> void {
+  state = States::kError;
+  errorStatus = status;
+  head = std::pmr::string{head.get_allocator()};
+  buffer.reset();
+}
@@ -0,0 +1,170 @@
+#include "toyws/response_cache.hpp"
+
+#include <algorithm>
+
+auto toyws::ResponseCache::MakeKey(const HttpRequest& request,
+                                   const std::vector<std::string>& vary)
+    -> std::string {
+  std::string key = HttpMethodName(request.Method());
+  key += ' ';
+  key += NormalizeTarget(request.Resource());
+
+  for (const auto& name : vary) {
+    key += '\n';
+    key += name;
+    key += ':';
+    if (auto it = request.Headers().find(name); it != request.Headers().end()) {
+      key += it->second;
+    }
+  }
+
+  return key;
+}
+
+auto toyws::ResponseCache::NormalizeTarget(std::string_view target)
+    -> std::string {
+  target = target.substr(0, target.find('#'));
+  const auto question = target.find('?');
+  const auto path = target.substr(0, question);
+
+  std::string out;
+  out.reserve(target.size());
+  for (char c : path) {
+    if (c == '/' && out.ends_with('/')) {
+      continue;
+    }
+    out += c;
+  }
+
+  if (question == std::string_view::npos) {
+    return out;
+  }
+
+  std::vector<std::string_view> params;
+  auto query = target.substr(question + 1);
+  while (!query.empty()) {
+    const auto amp = query.find('&');
+    if (auto param = query.substr(0, amp); !param.empty()) {
+      params.push_back(param);
+    }
+    query = amp == std::string_view::npos ? "" : query.substr(amp + 1);
+  }
+  std::sort(params.begin(), params.end());
+
+  for (std::size_t i = 0; i < params.size(); ++i) {
+    out += i == 0 ? '?' : '&';
+    out += params[i];
+  }
+
+  return out;
+}
+
+auto toyws::ResponseCache::Lookup(const std::string& key,
+                                  std::uint64_t waiter, Clock::time_point now)
+    -> LookupResult {
+  auto it = index.find(key);
+  if (it == index.end()) {
+    const auto slot = Allocate();
+    entries[slot].key = key;
+    entries[slot].filling = true;
+    entries[slot].expires = now + options.fillTimeout;
+    index.emplace(key, slot);
+    return {LookupStatus::kMiss, nullptr};
+  }
+
+  auto& entry = entries[it->second];
+  if (entry.filling) {
+    if (entry.expires <= now) {
+      // Whoever was filling it is stuck; the caller fills it for the waiters
+      entry.expires = now + options.fillTimeout;
+      return {LookupStatus::kMiss, nullptr};
+    }
+    entry.waiters.push_back({waiter, now});
+    return {LookupStatus::kPending, nullptr};
+  }
+
+  if (entry.expires <= now) {
+    // Keep the entry as a placeholder so that the refill is coalesced too
+    bytes -= entry.response->size();
+    entry.response = nullptr;
+    entry.filling = true;
+    entry.expires = now + options.fillTimeout;
+    return {LookupStatus::kMiss, nullptr};
+  }
+
+  entry.referenced = true;
+  return {LookupStatus::kHit, entry.response};
+}
+
+auto toyws::ResponseCache::Complete(const std::string& key, Bytes response,
+                                    std::optional<Clock::time_point> expires)
+    -> std::vector<Waiter> {
+  auto it = index.find(key);
+  if (it == index.end() || !entries[it->second].filling) {
+    // Completed already, by whoever took the fill over
+    return {};
+  }
+
+  const auto slot = it->second;
+  auto waiters = std::move(entries[slot].waiters);
+  entries[slot].waiters.clear();
+
+  if (!expires || !response || !MakeRoom(response->size())) {
+    Remove(slot);
+    return waiters;
+  }
+
+  auto& entry = entries[slot];
+  bytes += response->size();
+  entry.response = std::move(response);
+  entry.expires = *expires;
+  entry.referenced = false;
+  entry.filling = false;
+
+  return waiters;
+}
+
+auto toyws::ResponseCache::Allocate() -> std::size_t {
+  if (!freeSlots.empty()) {
+    const auto slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+  }
+  entries.emplace_back();
+  return entries.size() - 1;
+}
+
+auto toyws::ResponseCache::Remove(std::size_t slot) -> void {
+  auto& entry = entries[slot];
+  if (entry.response) {
+    bytes -= entry.response->size();
+  }
+  index.erase(entry.key);
+  entry = Entry{};
+  freeSlots.push_back(slot);
+}
+
+auto toyws::ResponseCache::MakeRoom(std::size_t size) -> bool {
+  if (size > options.maxBytes) {
+    return false;
+  }
+
+  auto stored = [this] { return index.size() - 1; };  // Minus the new entry
+  // Two sweeps are enough to clear every reference bit and evict
+  std::size_t budget = entries.size() * 2;
+  while ((bytes + size > options.maxBytes || stored() >= options.maxEntries) &&
+         budget-- > 0) {
+    clockHand = (clockHand + 1) % entries.size();
+    auto& entry = entries[clockHand];
+    if (entry.key.empty() || entry.filling) {
+      continue;
+    }
+    if (entry.referenced) {
+      entry.referenced = false;
+      continue;
+    }
+    Remove(clockHand);
+  }
+
+  return bytes + size <= options.maxBytes && stored() < options.maxEntries;
+}
@@ -0,0 +1,122 @@
+#include "toyws/response_writer.hpp"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <string_view>
+
+#include "toyws/error.hpp"
+
+namespace {
+// kLengthDigits zeros, ending the head
+constexpr std::string_view kLengthPlaceholder = "0000000000\r\n\r\n";
+static_assert(kLengthPlaceholder.find('\r') ==
+              toyws::ResponseWriter::kLengthDigits);
+}  // namespace
+
+toyws::ResponseWriter::ResponseWriter()
+    : owned{std::make_unique<BufferChain>()}, out{owned.get()} {}
+
+toyws::ResponseWriter::ResponseWriter(BufferChain& buffer) : out{&buffer} {
+  out->Clear();
+}
+
+auto toyws::ResponseWriter::SetStatus(HttpStatus newStatus) -> void {
+  if (stage != Stages::kStatus) {
+    throw Error("ResponseWriter: Status set after the status line");
+  }
+  status = newStatus;
+}
+
+auto toyws::ResponseWriter::Header(std::string_view name,
+                                   std::string_view value) -> void {
+  if (stage > Stages::kHeaders) {
+    throw Error("ResponseWriter: Header after the body");
+  }
+  Advance(Stages::kHeaders);
+  out->Append(name);
+  out->Append(": ");
+  out->Append(value);
+  out->Append("\r\n");
+}
+
+auto toyws::ResponseWriter::Out() -> BufferChain::Inserter {
+  if (stage == Stages::kFinished) {
+    throw Error("ResponseWriter: Body written after Finish()");
+  }
+  Advance(Stages::kBody);
+  return out->Back();
+}
+
+auto toyws::ResponseWriter::Write(std::string_view data) -> void {
+  if (stage == Stages::kFinished) {
+    throw Error("ResponseWriter: Body written after Finish()");
+  }
+  Advance(Stages::kBody);
+  out->Append(data);
+}
+
+auto toyws::ResponseWriter::Finish() -> void {
+  if (stage == Stages::kFinished) {
+    return;
+  }
+  if (stage != Stages::kBody) {
+    Advance(Stages::kHeaders);
+    out->Append("Content-Length: 0\r\n\r\n");
+    bodyOffset = out->Size();
+    stage = Stages::kFinished;
+    return;
+  }
+
+  // Zero-padded to the width of the placeholder, which is valid (1*DIGIT)
+  std::array<char, kLengthDigits> digits;
+  const auto result = fmt::format_to_n(digits.data(), digits.size(), "{:0{}}",
+                                       BodySize(), kLengthDigits);
+  if (result.size != kLengthDigits) {
+    throw Error("ResponseWriter: Body too large for Content-Length");
+  }
+  out->Overwrite(lengthOffset, {digits.data(), digits.size()});
+  stage = Stages::kFinished;
+}
+
+auto toyws::ResponseWriter::Discard() -> void {
+  out->Clear();
+  status = HttpStatus::kOk;
+  stage = Stages::kStatus;
+}
+
+auto toyws::ResponseWriter::BodySize() const -> std::size_t {
+  return stage >= Stages::kBody ? out->Size() - bodyOffset : 0;
+}
+
+auto toyws::ResponseWriter::ToResponse() -> HttpResponse {
+  Finish();
+  const auto bytes = out->ToString();
+  HttpResponse response;
+  if (!response.Read(bytes.data(), bytes.size())) {
+    throw Error("ResponseWriter: Could not parse the response written");
+  }
+  return response;
+}
+
+auto toyws::ResponseWriter::Advance(Stages to) -> void {
+  if (stage == Stages::kStatus && to > Stages::kStatus) {
+    // Formatted on the stack & appended at once, as the head is short
+    std::array<char, 64> line;
+    const auto result =
+        fmt::format_to_n(line.data(), line.size(), "HTTP/1.1 {} {}\r\n",
+                         static_cast<int>(status), HttpStatusReason(status));
+    if (result.size > line.size()) {
+      throw Error("ResponseWriter: Status line too long");
+    }
+    out->Append({line.data(), result.size});
+    stage = Stages::kHeaders;
+  }
+  if (stage == Stages::kHeaders && to > Stages::kHeaders) {
+    out->Append("Content-Length: ");
+    lengthOffset = out->Size();
+    out->Append(kLengthPlaceholder);
+    bodyOffset = out->Size();
+    stage = Stages::kBody;
+  }
+}
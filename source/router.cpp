@@ -1,5 +1,8 @@
 #include "toyws/router.hpp"
 
+#include <algorithm>
+#include <format>
+
 #include "toyws/error.hpp"
 
 toyws::Route::Route(std::string path) : fullPath{std::move(path)} {
@@ -22,7 +25,7 @@ auto toyws::Route::Match(const std::string& uri) -> Route* {
 
   for (auto& route : subRoutes) {
     if (route.AppliesTo(rest)) {
-      auto match = route.Matches(rest);
+      auto match = route.Match(rest);
       if (match != nullptr) {
         return match;
       }
@@ -44,20 +47,78 @@ auto toyws::Route::PartialMatch(const std::string& uri) -> Route* {
 
   for (auto& route : subRoutes) {
     if (route.AppliesTo(rest)) {
-      return route.BestMatch(rest);
+      return route.PartialMatch(rest);
     }
   }
 
   return this;
 }
 
-auto toyws::Router::AddRoute(const std::string& uri, SyncHandler handler)
+auto toyws::Router::AddRoute(const std::string& uri, SyncHandler handler,
+                             RouteOptions options) -> void {
+  auto& route = Emplace(uri);
+  route.SetHandler(handler);
+  route.SetWriter(nullptr);
+  route.SetSocketHandlers(std::nullopt);
+  route.SetStreamHandlers(std::nullopt);
+  route.SetOptions(std::move(options));
+}
+
+auto toyws::Router::AddRoute(const std::string& uri, WriterHandler handler,
+                             RouteOptions options) -> void {
+  auto& route = Emplace(uri);
+  route.SetHandler(nullptr);
+  route.SetWriter(handler);
+  route.SetSocketHandlers(std::nullopt);
+  route.SetStreamHandlers(std::nullopt);
+  route.SetOptions(std::move(options));
+}
+
+auto toyws::Router::AddRoute(const std::string& uri, WebSocketHandlers handlers,
+                             RouteOptions options) -> void {
+  auto& route = Emplace(uri);
+  route.SetHandler(nullptr);
+  route.SetWriter(nullptr);
+  route.SetSocketHandlers(handlers);
+  route.SetStreamHandlers(std::nullopt);
+  route.SetOptions(std::move(options));
+}
+
+auto toyws::Router::AddRoute(const std::string& uri,
+                             EventStreamHandlers handlers, RouteOptions options)
     -> void {
-  ids = SplitUri(uri);
-  if (auto route = FindPartialMatchingRoute(uri); route) {
-  } else {
-    Route newRoute{};
+  auto& route = Emplace(uri);
+  route.SetHandler(nullptr);
+  route.SetWriter(nullptr);
+  route.SetSocketHandlers(std::nullopt);
+  route.SetStreamHandlers(handlers);
+  route.SetOptions(std::move(options));
+}
+
+auto toyws::Router::Emplace(const std::string& uri) -> Route& {
+  auto ids = SplitUri(uri);
+  if (ids.empty()) {
+    throw Error(std::format("Path {} must start with '/'", uri));
   }
+
+  // Walk (and create where missing) the chain of routes down to uri
+  std::string path;
+  auto* level = &routes;
+  Route* route = nullptr;
+  for (const auto& id : ids) {
+    path += id;
+    auto it = std::find_if(level->begin(), level->end(), [&](const Route& r) {
+      return r.Identifier() == id;
+    });
+    if (it == level->end()) {
+      level->emplace_back(path);
+      it = std::prev(level->end());
+    }
+    route = &*it;
+    level = &route->SubRoutes();
+  }
+
+  return *route;
 }
 
 auto toyws::Router::FindRoute(const std::string& uri) -> Route* {
@@ -65,8 +126,8 @@ auto toyws::Router::FindRoute(const std::string& uri) -> Route* {
     if (!route.AppliesTo(uri)) {
       continue;
     }
-    auto ptr = route.Matches(uri);
-    if (ptr != null) {
+    auto ptr = route.Match(uri);
+    if (ptr != nullptr) {
       return ptr;
     }
   }
@@ -76,7 +137,7 @@ auto toyws::Router::FindRoute(const std::string& uri) -> Route* {
 auto toyws::Router::FindPartialMatchingRoute(const std::string& uri) -> Route* {
   for (auto& route : routes) {
     if (route.AppliesTo(uri)) {
-      return route.BestMatch(uri);
+      return route.PartialMatch(uri);
     }
   }
   return nullptr;
@@ -85,6 +146,19 @@ auto toyws::Router::FindPartialMatchingRoute(const std::string& uri) -> Route* {
 auto toyws::Router::SplitUri(const std::string& uri)
     -> std::vector<std::string> {
   std::vector<std::string> out;
+  if (!uri.starts_with('/')) {
+    return out;
+  }
+
+  std::size_t start = 0;
+  while (start < uri.size()) {
+    auto next = uri.find('/', start + 1);
+    if (next == std::string::npos) {
+      next = uri.size();
+    }
+    out.push_back(uri.substr(start, next - start));
+    start = next;
+  }
 
   return out;
 }
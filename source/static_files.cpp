@@ -0,0 +1,781 @@
+#include "toyws/static_files.hpp"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <utility>
+
+#include "toyws/compression.hpp"
+#include "toyws/error.hpp"
+
+// Changes to entries of a watched directory that invalidate cached files
+inline constexpr std::uint32_t kWatchMask =
+    IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+    IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF;
+
+inline constexpr std::array<std::string_view, 7> kDayNames = {
+    "Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};  // 1970-01-01 was a Thu
+inline constexpr std::array<std::string_view, 12> kMonthNames = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+inline constexpr std::int64_t kSecondsPerDay = 24 * 60 * 60;
+
+static auto Trim(std::string_view str) -> std::string_view {
+  while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+    str.remove_prefix(1);
+  }
+  while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+    str.remove_suffix(1);
+  }
+  return str;
+}
+
+static auto ParseNumber(std::string_view str) -> std::optional<std::uint64_t> {
+  std::uint64_t value = 0;
+  const auto* end = str.data() + str.size();
+  auto [ptr, ec] = std::from_chars(str.data(), end, value);
+  if (str.empty() || ec != std::errc{} || ptr != end) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+// Open path below dirFd, without following it (e.g. through symlinks) out of
+// the directory where the kernel supports that.
+static auto OpenBeneath(int dirFd, const char* path) -> int {
+  // O_NONBLOCK keeps a FIFO from blocking the ring; it has no effect on
+  // regular files
+  const int flags = O_RDONLY | O_CLOEXEC | O_NONBLOCK;
+#if defined(RESOLVE_BENEATH) && defined(SYS_openat2)
+  open_how how{};
+  how.flags = static_cast<std::uint64_t>(flags);
+  how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+  const auto fd =
+      static_cast<int>(syscall(SYS_openat2, dirFd, path, &how, sizeof(how)));
+  if (fd >= 0 || errno != ENOSYS) {
+    return fd;
+  }
+#endif
+  return openat(dirFd, path, flags);
+}
+
+// Fill in the metadata of file at path, from what stat() says about it
+static auto Describe(toyws::OpenFile& file, const std::string& path,
+                     std::uint64_t inode, std::uint64_t size,
+                     std::int64_t seconds, std::uint32_t nanoseconds)
+    -> void {
+  const auto mtime = static_cast<std::uint64_t>(seconds) * 1'000'000'000 +
+                     nanoseconds;
+  file.size = size;
+  file.modified = seconds;
+  file.etag = std::format("\"{:x}-{:x}-{:x}\"", inode, size, mtime);
+  file.lastModified = toyws::FormatHttpDate(seconds);
+  file.contentType = toyws::ContentTypeFor(path);
+}
+
+// Percent-decode path & split it into segments, joined by '/' without leading
+// or trailing '/'. Returns std::nullopt for paths that must not be served.
+static auto NormalizePath(std::string_view path, bool serveHidden)
+    -> std::optional<std::string> {
+  std::string decoded;
+  decoded.reserve(path.size());
+  for (std::size_t i = 0; i < path.size(); ++i) {
+    if (path[i] != '%') {
+      decoded += path[i];
+      continue;
+    }
+    std::uint8_t value = 0;
+    const auto* begin = path.data() + i + 1;
+    if (i + 2 >= path.size() ||
+        std::from_chars(begin, begin + 2, value, 16).ptr != begin + 2) {
+      throw toyws::HttpStatusError(toyws::HttpStatus::kBadRequest,
+                                   "Invalid percent-encoding in path");
+    }
+    decoded += static_cast<char>(value);
+    i += 2;
+  }
+  if (decoded.find('\0') != std::string::npos) {
+    throw toyws::HttpStatusError(toyws::HttpStatus::kBadRequest,
+                                 "NUL in path");
+  }
+
+  std::string out;
+  std::string_view rest = decoded;
+  while (!rest.empty()) {
+    const auto slash = rest.find('/');
+    const auto segment = rest.substr(0, slash);
+    rest = slash == std::string_view::npos ? std::string_view{}
+                                           : rest.substr(slash + 1);
+    if (segment.empty() || segment == ".") {
+      continue;
+    }
+    if (segment == ".." || (!serveHidden && segment.starts_with('.'))) {
+      return std::nullopt;
+    }
+    if (!out.empty()) {
+      out += '/';
+    }
+    out += segment;
+  }
+  return out;
+}
+
+// FileCache:
+
+toyws::FileCache::FileCache(const std::string& root, std::size_t maxOpenFiles,
+                            std::chrono::milliseconds invalidationInterval)
+    : rootPath{root},
+      capacity{maxOpenFiles},
+      interval{invalidationInterval},
+      lastCheck{Clock::now()} {
+  rootFd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (rootFd < 0) {
+    throw Error(std::format("FileCache: Could not open {}: {}", root,
+                            std::strerror(errno)));
+  }
+  // Without inotify there is no way to notice changes, so nothing is cached
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+toyws::FileCache::~FileCache() {
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
+  }
+  close(rootFd);
+}
+
+auto toyws::FileCache::Open(const std::string& path)
+    -> std::shared_ptr<const OpenFile> {
+  if (auto file = Find(path); file != nullptr) {
+    return file;
+  }
+
+  const bool watched = WatchDirectoryOf(path);
+  std::shared_ptr<const OpenFile> file = OpenUncached(path);
+  if (file != nullptr && watched) {
+    Insert(path, file);
+  }
+  return file;
+}
+
+auto toyws::FileCache::Open(AsyncFileIo& io, const std::string& path,
+                            OpenedCallback done) -> void {
+  const auto seen = events;
+  const bool watched = WatchDirectoryOf(path);
+  auto stat = [this, &io, path, seen, watched,
+               done = std::move(done)](int fd) mutable {
+    if (fd < 0) {
+      done(nullptr, fd);
+      return;
+    }
+    auto file = std::make_shared<OpenFile>(fd);
+    io.StatFile(fd, [this, path = std::move(path), seen, watched,
+                     done = std::move(done), file = std::move(file)](
+                        int res, const struct statx& info) {
+      if (res < 0 || !S_ISREG(info.stx_mode)) {
+        done(nullptr, res < 0 ? res
+                              : (S_ISDIR(info.stx_mode) ? -EISDIR : -ENOENT));
+        return;
+      }
+      Describe(*file, path, info.stx_ino, info.stx_size,
+               info.stx_mtime.tv_sec, info.stx_mtime.tv_nsec);
+      // Unless changed while it was opened, as far as events tell
+      if (watched && events == seen) {
+        Insert(path, file);
+      }
+      done(file, 0);
+    });
+  };
+  // O_NONBLOCK keeps a FIFO from blocking the ring, see OpenBeneath()
+  io.OpenBeneath(rootFd, path.empty() ? "." : path, O_RDONLY | O_NONBLOCK,
+                 std::move(stat));
+}
+
+auto toyws::FileCache::Find(const std::string& path)
+    -> std::shared_ptr<const OpenFile> {
+  if (inotifyFd >= 0 && Clock::now() - lastCheck >= interval) {
+    ProcessEvents();
+  }
+
+  if (auto it = entries.find(path); it != entries.end()) {
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return it->second.file;
+  }
+  return nullptr;
+}
+
+auto toyws::FileCache::IsDirectory(const std::string& path) const -> bool {
+  struct stat info {};
+  return fstatat(rootFd, path.empty() ? "." : path.c_str(), &info, 0) == 0 &&
+         S_ISDIR(info.st_mode);
+}
+
+auto toyws::FileCache::ProcessEvents() -> void {
+  lastCheck = Clock::now();
+
+  alignas(inotify_event) char buffer[4096];
+  while (true) {
+    const auto length = read(inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      return;  // EAGAIN: no more pending events
+    }
+
+    for (const char* p = buffer; p < buffer + length;) {
+      const auto* event = reinterpret_cast<const inotify_event*>(p);
+      p += sizeof(inotify_event) + event->len;
+      ++events;
+
+      if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        // Events were lost, anything may have changed
+        entries.clear();
+        lru.clear();
+        continue;
+      }
+      const auto watch = watches.find(event->wd);
+      if (watch == watches.end()) {
+        continue;
+      }
+      const auto& directory = watch->second;
+
+      if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) != 0) {
+        // The directory is gone from where we know it. It is watched anew
+        // once something in it is opened again.
+        InvalidateDirectory(directory);
+        if ((event->mask & IN_IGNORED) == 0) {
+          inotify_rm_watch(inotifyFd, event->wd);
+        }
+        watches.erase(watch);
+        continue;
+      }
+
+      if (event->len > 0) {
+        // The name is NUL-padded
+        const std::string name{event->name};
+        const auto path = directory.empty() ? name : directory + '/' + name;
+        if ((event->mask & IN_ISDIR) != 0) {
+          InvalidateDirectory(path);
+        } else {
+          Invalidate(path);
+        }
+      }
+    }
+  }
+}
+
+auto toyws::FileCache::OpenUncached(const std::string& path)
+    -> std::shared_ptr<OpenFile> {
+  const int fd = OpenBeneath(rootFd, path.empty() ? "." : path.c_str());
+  if (fd < 0) {
+    if (errno == EACCES || errno == EPERM) {
+      throw HttpStatusError(HttpStatus::kForbidden, "Permission denied");
+    }
+    if (errno == EMFILE || errno == ENFILE || errno == ENOMEM) {
+      throw HttpStatusError(HttpStatus::kInternalServerError,
+                            std::strerror(errno));
+    }
+    return nullptr;  // Missing, or resolves to outside of the root
+  }
+  auto file = std::make_shared<OpenFile>(fd);
+
+  struct stat info {};
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    return nullptr;
+  }
+  Describe(*file, path, info.st_ino, static_cast<std::uint64_t>(info.st_size),
+           info.st_mtim.tv_sec,
+           static_cast<std::uint32_t>(info.st_mtim.tv_nsec));
+  return file;
+}
+
+auto toyws::FileCache::WatchDirectoryOf(const std::string& path) -> bool {
+  const auto slash = path.rfind('/');
+  return inotifyFd >= 0 && capacity > 0 &&
+         Watch(slash == std::string::npos ? std::string{}
+                                          : path.substr(0, slash));
+}
+
+auto toyws::FileCache::Watch(const std::string& directory) -> bool {
+  const auto path = directory.empty() ? rootPath : rootPath + '/' + directory;
+  const int wd = inotify_add_watch(inotifyFd, path.c_str(), kWatchMask);
+  if (wd < 0) {
+    return false;
+  }
+  // Watching the same directory again yields the same descriptor
+  watches[wd] = directory;
+  return true;
+}
+
+auto toyws::FileCache::Insert(const std::string& path,
+                              std::shared_ptr<const OpenFile> file) -> void {
+  if (auto it = entries.find(path); it != entries.end()) {
+    // Opened twice meanwhile, e.g. by two requests on a ring
+    it->second.file = std::move(file);
+    lru.splice(lru.begin(), lru, it->second.lru);
+    return;
+  }
+  if (entries.size() >= capacity) {
+    entries.erase(lru.back());
+    lru.pop_back();
+  }
+  lru.push_front(path);
+  entries.emplace(path, Entry{std::move(file), lru.begin()});
+}
+
+auto toyws::FileCache::Invalidate(const std::string& path) -> void {
+  if (auto it = entries.find(path); it != entries.end()) {
+    lru.erase(it->second.lru);
+    entries.erase(it);
+  }
+}
+
+auto toyws::FileCache::InvalidateDirectory(const std::string& directory)
+    -> void {
+  const auto prefix = directory.empty() ? std::string{} : directory + '/';
+  std::erase_if(entries, [&](const auto& entry) {
+    if (!entry.first.starts_with(prefix)) {
+      return false;
+    }
+    lru.erase(entry.second.lru);
+    return true;
+  });
+}
+
+// Free functions:
+
+auto toyws::ParseRange(std::string_view header, std::uint64_t size)
+    -> std::optional<ByteRange> {
+  header = Trim(header);
+  if (!header.starts_with("bytes=") ||
+      header.find(',') != std::string_view::npos) {
+    return std::nullopt;
+  }
+  header.remove_prefix(6);
+
+  const auto dash = header.find('-');
+  if (dash == std::string_view::npos) {
+    return std::nullopt;
+  }
+  const auto first = Trim(header.substr(0, dash));
+  const auto last = Trim(header.substr(dash + 1));
+
+  if (first.empty()) {
+    // Suffix range: the last n bytes
+    const auto suffix = ParseNumber(last);
+    if (!suffix) {
+      return std::nullopt;
+    }
+    if (*suffix == 0 || size == 0) {
+      return ByteRange{};
+    }
+    const auto length = std::min(*suffix, size);
+    return ByteRange{size - length, length};
+  }
+
+  const auto begin = ParseNumber(first);
+  if (!begin) {
+    return std::nullopt;
+  }
+  auto end = size - 1;
+  if (!last.empty()) {
+    const auto requestedEnd = ParseNumber(last);
+    if (!requestedEnd || *requestedEnd < *begin) {
+      return std::nullopt;
+    }
+    end = std::min(end, *requestedEnd);
+  }
+  if (*begin >= size) {
+    return ByteRange{};
+  }
+  return ByteRange{*begin, end - *begin + 1};
+}
+
+auto toyws::MatchEtag(std::string_view header, std::string_view etag)
+    -> std::optional<std::string_view> {
+  auto opaque = [](std::string_view tag) {
+    if (tag.starts_with("W/")) {
+      tag.remove_prefix(2);
+    }
+    return tag;
+  };
+  const auto target = opaque(etag);
+
+  while (!header.empty()) {
+    const auto comma = header.find(',');
+    const auto item = Trim(header.substr(0, comma));
+    header = comma == std::string_view::npos ? std::string_view{}
+                                             : header.substr(comma + 1);
+
+    if (item == "*") {
+      return etag;
+    }
+    const auto tag = opaque(item);
+    if (tag == target) {
+      return item;
+    }
+    // Compressed variants carry the tag with the encoding appended inside the
+    // quotes (see ToyWs::Compress)
+    if (target.size() < 2 || !tag.ends_with('"') ||
+        !tag.starts_with(target.substr(0, target.size() - 1))) {
+      continue;
+    }
+    const auto suffix =
+        tag.substr(target.size() - 1, tag.size() - target.size());
+    for (auto encoding : {ContentEncoding::kGzip, ContentEncoding::kDeflate}) {
+      if (suffix.size() > 1 && suffix.front() == '-' &&
+          suffix.substr(1) == ContentEncodingName(encoding)) {
+        return item;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+auto toyws::FormatHttpDate(std::int64_t seconds) -> std::string {
+  auto days = seconds / kSecondsPerDay;
+  auto time = seconds % kSecondsPerDay;
+  if (time < 0) {
+    time += kSecondsPerDay;
+    --days;
+  }
+  const std::chrono::year_month_day date{
+      std::chrono::sys_days{std::chrono::days{days}}};
+  const auto weekday = ((days % 7) + 7) % 7;
+
+  return std::format("{}, {:02} {} {:04} {:02}:{:02}:{:02} GMT",
+                     kDayNames[static_cast<std::size_t>(weekday)],
+                     static_cast<unsigned>(date.day()),
+                     kMonthNames[static_cast<unsigned>(date.month()) - 1],
+                     static_cast<int>(date.year()), time / 3600,
+                     time / 60 % 60, time % 60);
+}
+
+auto toyws::ParseHttpDate(std::string_view date)
+    -> std::optional<std::int64_t> {
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  date = Trim(date);
+  if (date.size() != 29 || date.substr(3, 2) != ", " || date[7] != ' ' ||
+      date[11] != ' ' || date[16] != ' ' || date[19] != ':' ||
+      date[22] != ':' || date.substr(25) != " GMT") {
+    return std::nullopt;
+  }
+
+  const auto month =
+      std::find(kMonthNames.begin(), kMonthNames.end(), date.substr(8, 3));
+  const auto day = ParseNumber(date.substr(5, 2));
+  const auto year = ParseNumber(date.substr(12, 4));
+  const auto hours = ParseNumber(date.substr(17, 2));
+  const auto minutes = ParseNumber(date.substr(20, 2));
+  const auto secs = ParseNumber(date.substr(23, 2));
+  if (month == kMonthNames.end() || !day || !year || !hours || !minutes ||
+      !secs) {
+    return std::nullopt;
+  }
+
+  const std::chrono::year_month_day ymd{
+      std::chrono::year{static_cast<int>(*year)},
+      std::chrono::month{
+          static_cast<unsigned>(month - kMonthNames.begin() + 1)},
+      std::chrono::day{static_cast<unsigned>(*day)}};
+  if (!ymd.ok() || *hours > 23 || *minutes > 59 || *secs > 60) {
+    return std::nullopt;
+  }
+  const auto days = std::chrono::sys_days{ymd}.time_since_epoch().count();
+  return days * kSecondsPerDay +
+         static_cast<std::int64_t>(*hours * 3600 + *minutes * 60 + *secs);
+}
+
+auto toyws::ContentTypeFor(std::string_view path) -> std::string_view {
+  static constexpr std::array<std::pair<std::string_view, std::string_view>,
+                              24>
+      kTypes = {{
+          {"css", "text/css; charset=utf-8"},
+          {"csv", "text/csv; charset=utf-8"},
+          {"gif", "image/gif"},
+          {"htm", "text/html; charset=utf-8"},
+          {"html", "text/html; charset=utf-8"},
+          {"ico", "image/x-icon"},
+          {"jpeg", "image/jpeg"},
+          {"jpg", "image/jpeg"},
+          {"js", "text/javascript; charset=utf-8"},
+          {"json", "application/json"},
+          {"map", "application/json"},
+          {"mjs", "text/javascript; charset=utf-8"},
+          {"mp4", "video/mp4"},
+          {"pdf", "application/pdf"},
+          {"png", "image/png"},
+          {"svg", "image/svg+xml"},
+          {"txt", "text/plain; charset=utf-8"},
+          {"wasm", "application/wasm"},
+          {"webm", "video/webm"},
+          {"webp", "image/webp"},
+          {"woff", "font/woff"},
+          {"woff2", "font/woff2"},
+          {"xml", "application/xml"},
+          {"zip", "application/zip"},
+      }};
+
+  const auto dot = path.rfind('.');
+  if (dot == std::string_view::npos ||
+      path.find('/', dot) != std::string_view::npos) {
+    return "application/octet-stream";
+  }
+  std::string extension{path.substr(dot + 1)};
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  const auto it = std::lower_bound(
+      kTypes.begin(), kTypes.end(), extension,
+      [](const auto& type, const std::string& ext) {
+        return type.first < ext;
+      });
+  if (it == kTypes.end() || it->first != extension) {
+    return "application/octet-stream";
+  }
+  return it->second;
+}
+
+auto toyws::ReadFileRange(const FileRange& range) -> std::string {
+  std::string out(range.length, '\0');
+  std::size_t done = 0;
+  while (done < out.size()) {
+    const auto res =
+        pread(range.file->fd, out.data() + done, out.size() - done,
+              static_cast<off_t>(range.offset + done));
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      // Truncated since it was opened, or an I/O error
+      throw HttpStatusError(HttpStatus::kInternalServerError,
+                            "Could not read file");
+    }
+    done += static_cast<std::size_t>(res);
+  }
+  return out;
+}
+
+// Read of a range in pieces, as a read may return less than asked for
+struct RangeRead {
+  toyws::FileRange range;
+  std::string data;
+  toyws::ReadRangeCallback done;
+};
+
+static auto ReadRest(toyws::AsyncFileIo& io, std::shared_ptr<RangeRead> read)
+    -> void {
+  const auto offset = read->range.offset + read->data.size();
+  const auto length = read->range.length - read->data.size();
+  io.Read(read->range.file->fd, offset, length,
+          [&io, read](int result, std::string_view data) {
+            if (result <= 0) {
+              // Truncated since it was opened, or an I/O error
+              read->done(result < 0 ? result : -EIO, {});
+              return;
+            }
+            read->data += data;
+            if (read->data.size() < read->range.length) {
+              ReadRest(io, read);
+              return;
+            }
+            read->done(0, std::move(read->data));
+          });
+}
+
+auto toyws::ReadFileRange(AsyncFileIo& io, FileRange range,
+                          ReadRangeCallback done) -> void {
+  auto read = std::make_shared<RangeRead>();
+  read->data.reserve(range.length);
+  read->range = std::move(range);
+  read->done = std::move(done);
+  if (read->range.length == 0) {
+    read->done(0, {});
+    return;
+  }
+  ReadRest(io, std::move(read));
+}
+
+// StaticFiles:
+
+toyws::StaticFiles::StaticFiles(StaticFilesOptions staticOptions)
+    : options{std::move(staticOptions)},
+      cache{options.root, options.maxOpenFiles,
+            options.invalidationInterval} {}
+
+auto toyws::StaticFiles::Serve(const HttpRequest& request,
+                               std::string_view path, HttpResponse& response)
+    -> void {
+  const auto relative = Resolve(request, path, response);
+  if (!relative) {
+    return;
+  }
+  const bool directory = path.empty() || path.ends_with('/');
+  auto file = cache.Open(*relative);
+  int error = 0;
+  if (file == nullptr) {
+    error = !directory && cache.IsDirectory(*relative) ? -EISDIR : -ENOENT;
+  }
+  Respond(request, directory, std::move(file), error, response);
+}
+
+auto toyws::StaticFiles::Serve(const HttpRequest& request,
+                               std::string_view path, HttpResponse& response,
+                               AsyncFileIo& io, ServeCallback done) -> bool {
+  const auto relative = Resolve(request, path, response);
+  if (!relative) {
+    return true;
+  }
+  const bool directory = path.empty() || path.ends_with('/');
+  if (auto file = cache.Find(*relative); file != nullptr) {
+    Respond(request, directory, std::move(file), 0, response);
+    return true;
+  }
+
+  cache.Open(io, *relative,
+             [this, &request, directory,
+              allocator = response.Headers().get_allocator(),
+              done = std::move(done)](std::shared_ptr<const OpenFile> file,
+                                      int error) {
+               HttpResponse opened{HttpStatus::kOk, allocator};
+               try {
+                 Respond(request, directory, std::move(file), error, opened);
+               } catch (HttpStatusError& err) {
+                 opened = HttpResponse{err.Status()};
+               } catch (...) {
+                 opened = HttpResponse{HttpStatus::kInternalServerError};
+               }
+               done(std::move(opened));
+             });
+  return false;
+}
+
+auto toyws::StaticFiles::Resolve(const HttpRequest& request,
+                                 std::string_view path,
+                                 HttpResponse& response) const
+    -> std::optional<std::string> {
+  if (request.Method() != HttpMethod::GET &&
+      request.Method() != HttpMethod::HEAD) {
+    response = HttpResponse{HttpStatus::kMethodNotAllowed,
+                            HeadersMap{{"Allow", "GET, HEAD"}}};
+    return std::nullopt;
+  }
+
+  auto relative = NormalizePath(path, options.serveHidden);
+  if (!relative) {
+    throw HttpStatusError(HttpStatus::kNotFound, "Path not served");
+  }
+  if (path.empty() || path.ends_with('/')) {
+    if (options.indexFile.empty()) {
+      throw HttpStatusError(HttpStatus::kNotFound, "No index file");
+    }
+    *relative += relative->empty() ? options.indexFile
+                                   : '/' + options.indexFile;
+  }
+  return relative;
+}
+
+auto toyws::StaticFiles::Respond(const HttpRequest& request, bool directory,
+                                 std::shared_ptr<const OpenFile> file,
+                                 int error, HttpResponse& response) const
+    -> void {
+  if (file == nullptr) {
+    if (error == -EISDIR && !directory) {
+      // Redirect to the index, so that its relative links resolve against the
+      // directory
+      const auto& resource = request.Resource();
+      const auto query = resource.find('?');
+      auto location = resource.substr(0, query) + '/';
+      if (query != std::string::npos) {
+        location += resource.substr(query);
+      }
+      response = HttpResponse{HttpStatus::kFound,
+                              HeadersMap{{"Location", location}}};
+      return;
+    }
+    if (error == -EACCES || error == -EPERM) {
+      throw HttpStatusError(HttpStatus::kForbidden, "Permission denied");
+    }
+    if (error == -EMFILE || error == -ENFILE || error == -ENOMEM) {
+      throw HttpStatusError(HttpStatus::kInternalServerError,
+                            std::strerror(-error));
+    }
+    // Missing, or resolves to outside of the root
+    throw HttpStatusError(HttpStatus::kNotFound, "No such file");
+  }
+
+  // Along with the response passed in, e.g. from the connection's Arena
+  HeadersMap headers{response.Headers().get_allocator()};
+  headers.emplace("ETag", file->etag);
+  headers.emplace("Last-Modified", file->lastModified);
+  if (options.maxAge.count() > 0) {
+    headers["Cache-Control"] =
+        std::format("max-age={}", options.maxAge.count());
+  }
+
+  // If-None-Match takes precedence over If-Modified-Since
+  const auto& requestHeaders = request.Headers();
+  std::optional<std::string_view> matched;
+  if (auto it = requestHeaders.find("If-None-Match");
+      it != requestHeaders.end()) {
+    matched = MatchEtag(it->second, file->etag);
+  } else if (auto since = requestHeaders.find("If-Modified-Since");
+             since != requestHeaders.end()) {
+    const auto date = ParseHttpDate(since->second);
+    if (date && file->modified <= *date) {
+      matched = file->etag;
+    }
+  }
+  if (matched) {
+    // Echo the tag the client has, which may be of a compressed variant
+    headers["ETag"] = *matched;
+    response = HttpResponse{HttpStatus::kNotModified, std::move(headers)};
+    return;
+  }
+
+  headers["Accept-Ranges"] = "bytes";
+  ByteRange range{0, file->size};
+  auto status = HttpStatus::kOk;
+  const auto rangeHeader = requestHeaders.find("Range");
+  const auto ifRange = requestHeaders.find("If-Range");
+  if (request.Method() == HttpMethod::GET &&
+      rangeHeader != requestHeaders.end() &&
+      (ifRange == requestHeaders.end() ||
+       std::string_view{ifRange->second} == file->etag ||
+       std::string_view{ifRange->second} == file->lastModified)) {
+    if (const auto requested = ParseRange(rangeHeader->second, file->size);
+        requested) {
+      if (requested->length == 0) {
+        headers["Content-Range"] = std::format("bytes */{}", file->size);
+        headers["Content-Length"] = "0";
+        response =
+            HttpResponse{HttpStatus::kRangeNotSatisfiable, std::move(headers)};
+        return;
+      }
+      range = *requested;
+      status = HttpStatus::kPartialContent;
+      headers["Content-Range"] =
+          std::format("bytes {}-{}/{}", range.offset,
+                      range.offset + range.length - 1, file->size);
+    }
+  }
+
+  headers["Content-Type"] = file->contentType;
+  headers["Content-Length"] = std::to_string(range.length);
+  response = HttpResponse{status, std::move(headers)};
+  if (request.Method() == HttpMethod::GET && range.length > 0) {
+    response.SetFile(FileRange{std::move(file), range.offset, range.length});
+  }
+}
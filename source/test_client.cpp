@@ -33,6 +33,9 @@ auto toyws::TestClient::Request(HttpMethod method, const std::string& route)
   do {
     auto sz = Recv(buf, bufSize);
     recvRes = response.Read(buf, sz);
+    if (!recvRes) {
+      throw Error("TestClient: Malformed response");
+    }
   } while (!recvRes);
 
   close(socketFd);
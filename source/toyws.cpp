@@ -1,28 +1,545 @@
 #include "toyws/toyws.hpp"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <format>
-#include <iostream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
 
 #include "toyws/http_request.hpp"
+#include "toyws/error.hpp"
+#include "toyws/event_stream.hpp"
 #include "toyws/http_response.hpp"
+#include "toyws/response_writer.hpp"
+#include "toyws/websocket.hpp"
+
+thread_local toyws::ToyWs::Ring* toyws::ToyWs::localRing = nullptr;
 
 toyws::ToyWs::ToyWs(std::string address, uint16_t port)
-    : listeningAddress{std::move(address)}, listeningPort{port} {}
+    : listeningAddress{std::move(address)}, listeningPort{port} {
+  SetRings(1);
+}
+
+auto toyws::ToyWs::SetRings(std::size_t count) -> void {
+  count = std::max<std::size_t>(count, 1);
+  while (rings.size() > count) {
+    metrics.Unregister(&rings.back()->service.Metrics());
+    rings.pop_back();
+  }
+  while (rings.size() < count) {
+    auto& ring = *rings.emplace_back(std::make_unique<Ring>());
+    ring.service.SetInstance(this);
+    metrics.Register(&ring.service.Metrics());
+  }
+}
+
+auto toyws::ToyWs::HandoffTarget(const IoService<RequestHandler>& from)
+    -> IoService<RequestHandler>* {
+  if (rings.size() < 2) {
+    return nullptr;
+  }
+  // Only ever called on the thread of from, whose scratch this is
+  auto& ring = CurrentRing();
+  ring.loads.clear();
+  std::size_t self = 0;
+  for (std::size_t i = 0; i < rings.size(); ++i) {
+    if (&rings[i]->service == &from) {
+      self = i;
+    }
+    ring.loads.push_back(rings[i]->service.Load());
+  }
+  const auto target = PickHandoffTarget(ring.loads, self, loadBalanceOptions);
+  return target ? &rings[*target]->service : nullptr;
+}
+
+auto toyws::ToyWs::SetAccessLogOptions(AccessLogOptions options) -> void {
+  accessLogOptions = std::move(options);
+}
+
+auto toyws::ToyWs::AddStaticRoute(const std::string& prefix,
+                                  StaticFilesOptions options,
+                                  RouteOptions routeOptions) -> void {
+  auto path = prefix;
+  while (path.ends_with('/')) {
+    path.pop_back();
+  }
+  if (!path.empty() && !path.starts_with('/')) {
+    throw Error(std::format("Path {} must start with '/'", prefix));
+  }
+
+  auto staticRoute = std::make_unique<StaticRoute>(path, std::move(options));
+  routeOptions.cache.enabled = false;
+  staticRoute->route.SetOptions(std::move(routeOptions));
+  staticRoutes.push_back(std::move(staticRoute));
+}
 
 auto toyws::ToyWs::Run() -> void {
-  auto socket = ioService.MakeListeningSocket(listeningAddress, listeningPort);
-  ioService.AsyncAccept(socket);
-  ioService.Run();
+  accessLog = std::make_unique<AccessLog>(accessLogOptions);
+  for (auto& ring : rings) {
+    ring->accessLog = accessLog->AddProducer();
+    ring->responseCache = ResponseCache{responseCacheOptions};
+    ring->compressor.SetLevel(compressionOptions.level);
+    ring->compressedVariants =
+        CompressedVariantCache{compressionOptions.variantCacheBytes};
+    ring->eventHub = EventHub{};
+    for (auto i = ring->staticFiles.size(); i < staticRoutes.size(); ++i) {
+      ring->staticFiles.push_back(
+          std::make_unique<StaticFiles>(staticRoutes[i]->files.Options()));
+    }
+  }
+  accessLog->Start();
+
+  // TCP rings listen on a socket each, among which the kernel spreads
+  // connections. A UNIX domain socket can't be bound twice, so rings share it.
+  const bool shared = listeningAddress.starts_with(kUnixAddressPrefix);
+  auto options = listenerOptions;
+  options.reusePort = options.reusePort || (rings.size() > 1 && !shared);
+  auto port = listeningPort;
+  for (auto& ring : rings) {
+    if (shared && ring != rings.front()) {
+      ring->listeningSocket = rings.front()->listeningSocket;
+      continue;
+    }
+    ring->listeningSocket =
+        ring->service.MakeListeningSocket(listeningAddress, port, options);
+    if (port == 0 && !shared) {
+      port = LocalPort(ring->listeningSocket);  // The others bind the same
+    }
+  }
+
+  // The first error stops all rings, and is rethrown once they are done
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto serve = [this, &error, &errorMutex](Ring& ring) {
+    try {
+      RunRing(ring);
+    } catch (...) {
+      {
+        std::lock_guard lock{errorMutex};
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      Stop();
+    }
+  };
+  for (std::size_t i = 1; i < rings.size(); ++i) {
+    rings[i]->thread = std::thread{serve, std::ref(*rings[i])};
+  }
+  if (hasEventStreams && eventStreamKeepAlive.count() > 0) {
+    heartbeat = std::thread{[this] { SendHeartbeats(); }};
+  }
+  serve(*rings.front());
+  for (auto& ring : rings) {
+    if (ring->thread.joinable()) {
+      ring->thread.join();
+    }
+  }
+  // Stopped along with the rings
+  if (heartbeat.joinable()) {
+    heartbeat.join();
+  }
+  {
+    std::lock_guard lock{heartbeatMutex};
+    heartbeatStop = false;
+  }
+
+  for (auto& ring : rings) {
+    if (!shared || ring == rings.front()) {
+      close(ring->listeningSocket);
+    }
+    ring->listeningSocket = -1;
+  }
+  // Offloaded handlers still running refer to connections of the rings. Their
+  // responses are never written though.
+  workers.reset();
+  accessLog->Stop();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+auto toyws::ToyWs::CurrentRing() -> Ring& {
+  auto* ring = LocalRing();
+  if (ring == nullptr) {
+    throw Error("Only a ring's thread has a ring of its own");
+  }
+  return *ring;
 }
 
-auto toyws::ToyWs::Stop() -> void { ioService.Stop(); }
+auto toyws::ToyWs::RunRing(Ring& ring) -> void {
+  localRing = &ring;
+  ring.service.AsyncAccept(ring.listeningSocket);
+  ring.service.Run();
+  localRing = nullptr;
+}
+
+auto toyws::ToyWs::Stop() -> void {
+  for (auto& ring : rings) {
+    ring->service.Stop();
+  }
+  {
+    std::lock_guard lock{heartbeatMutex};
+    heartbeatStop = true;
+  }
+  heartbeatWake.notify_all();
+}
+
+auto toyws::ToyWs::SendHeartbeats() -> void {
+  const auto frame = HeartbeatChunk();
+  std::unique_lock lock{heartbeatMutex};
+  while (!heartbeatWake.wait_for(lock, eventStreamKeepAlive,
+                                 [this] { return heartbeatStop; })) {
+    for (auto& ring : rings) {
+      auto* service = &ring->service;
+      service->Post([service, frame] {
+        RequestHandler::Heartbeat(service, frame);
+      });
+    }
+  }
+}
+
+auto toyws::ToyWs::Workers() -> WorkerPool& {
+  // Rings submit from threads of their own
+  std::lock_guard lock{workersMutex};
+  if (!workers) {
+    workers = std::make_unique<WorkerPool>(workerThreads);
+  }
+  return *workers;
+}
+
+auto toyws::ToyWs::Broadcast(const std::string& uri, WebSocketOpcode opcode,
+                             std::string_view payload) -> void {
+  const auto* route = router.FindRoute(uri);
+  if (route == nullptr || route->SocketHandlers() == nullptr) {
+    throw Error(std::format("Broadcast: {} is not a WebSocket route", uri));
+  }
+
+  const WebSocketFrame frame =
+      std::make_shared<const std::string>(EncodeFrame(opcode, payload));
+  for (auto& ring : rings) {
+    auto* service = &ring->service;
+    service->Post([service, route, frame] {
+      RequestHandler::Broadcast(service, route, frame);
+    });
+  }
+}
+
+auto toyws::ToyWs::Publish(const std::string& uri, std::string_view data,
+                           std::string_view event, std::string_view id)
+    -> void {
+  const auto* route = router.FindRoute(uri);
+  if (route == nullptr || route->StreamHandlers() == nullptr) {
+    throw Error(std::format("Publish: {} is not an event stream route", uri));
+  }
+
+  const auto frame = EncodeEventChunk(data, event, id);
+  for (auto& ring : rings) {
+    auto* service = &ring->service;
+    service->Post([service, route, frame] {
+      RequestHandler::Publish(service, route, frame);
+    });
+  }
+}
+
+auto toyws::ToyWs::FindRoute(const HttpRequest& request) -> const Route* {
+  const auto& resource = request.Resource();
+  const std::string path{std::string_view{resource}.substr(
+      0, resource.find('?'))};
+  const auto* route = router.FindRoute(path);
+  if (route != nullptr && route->HasHandler()) {
+    return route;
+  }
+
+  for (const auto& staticRoute : staticRoutes) {
+    const auto& prefix = staticRoute->prefix;
+    if (path.starts_with(prefix) &&
+        (path.size() == prefix.size() || path[prefix.size()] == '/')) {
+      return &staticRoute->route;
+    }
+  }
+  return nullptr;
+}
 
 auto toyws::ToyWs::HandleRequest(const HttpRequest& request)
     -> toyws::HttpResponse {
-  // TODO: Logging instead of cout
-  std::cout << std::format("[{}] {} {}\n", "TODO: client addr",
-                           HttpMethodName(request.Method()),
-                           request.Resource());
+  return HandleRequest(request, FindRoute(request));
+}
+
+auto toyws::ToyWs::HandleRequest(const HttpRequest& request,
+                                 const Route* route,
+                                 const HandlerContext& context)
+    -> toyws::HttpResponse {
+  const auto start = std::chrono::steady_clock::now();
+
   HttpResponse response{HttpStatus::kOk};
+  if (!metricsRoute.empty() &&
+      std::string_view{request.Resource()} == metricsRoute) {
+    response = HttpResponse{
+        HttpStatus::kOk,
+        {{"Content-Type", "text/plain; version=0.0.4; charset=utf-8"}},
+        metrics.RenderPrometheus()};
+  } else if (route == nullptr) {
+    response = HttpResponse{HttpStatus::kNotFound};
+  } else {
+    response = CallHandler(request, route, context);
+    if (context.IsDeferred()) {
+      return response;  // See FinishResponse()
+    }
+    Compress(request, route, response);
+  }
+
+  LogAccess(request, response, start);
+  return response;
+}
+
+auto toyws::ToyWs::CallHandler(const HttpRequest& request, const Route* route,
+                               const HandlerContext& context)
+    -> toyws::HttpResponse {
+  if (route->SocketHandlers() != nullptr) {
+    // Only connections served by a ring can be upgraded, see RequestHandler
+    return HttpResponse{HttpStatus::kUpgradeRequired};
+  }
+  if (route->StreamHandlers() != nullptr) {
+    // Only connections served by a ring can subscribe; others get what a
+    // subscriber is sent first
+    return CallSubscribe(request, route);
+  }
+  if (route->Writer() != nullptr) {
+    ResponseWriter writer;
+    CallWriter(request, route, context, writer);
+    return writer.ToResponse();
+  }
+
+  HttpResponse response{HttpStatus::kOk, context.Allocator()};
+  try {
+    if (route->Handler() != nullptr) {
+      route->Handler()(request, context, response);
+    } else {
+      ServeStatic(request, route, context, response);
+    }
+  } catch (HttpStatusError& err) {
+    response = HttpResponse{err.Status()};
+  } catch (...) {
+    response = HttpResponse{HttpStatus::kInternalServerError};
+  }
+  return response;
+}
+
+auto toyws::ToyWs::CallSubscribe(const HttpRequest& request,
+                                 const Route* route) -> toyws::HttpResponse {
+  if (request.Method() != HttpMethod::GET) {
+    return HttpResponse{HttpStatus::kMethodNotAllowed, {{"Allow", "GET"}}};
+  }
+
+  HttpResponse response{HttpStatus::kOk,
+                        {{"Content-Type", "text/event-stream"},
+                         {"Cache-Control", "no-cache"}}};
+  const auto* handlers = route->StreamHandlers();
+  if (handlers == nullptr) {
+    throw Error("CallSubscribe: Not an event stream route");
+  }
+  try {
+    if (const auto onSubscribe = handlers->onSubscribe) {
+      response.SetBody(onSubscribe(request));
+    }
+  } catch (HttpStatusError& err) {
+    response = HttpResponse{err.Status()};
+  } catch (...) {
+    response = HttpResponse{HttpStatus::kInternalServerError};
+  }
   return response;
 }
+
+auto toyws::ToyWs::CallWriter(const HttpRequest& request, const Route* route,
+                              const HandlerContext& context,
+                              ResponseWriter& writer) -> void {
+  try {
+    route->Writer()(request, context, writer);
+  } catch (HttpStatusError& err) {
+    writer.Discard();
+    writer.SetStatus(err.Status());
+  } catch (...) {
+    writer.Discard();
+    writer.SetStatus(HttpStatus::kInternalServerError);
+  }
+  writer.Finish();
+}
+
+auto toyws::ToyWs::FinishResponse(const HttpRequest& request,
+                                  const Route* route, HttpResponse& response,
+                                  std::chrono::steady_clock::time_point start)
+    -> void {
+  Compress(request, route, response);
+  LogAccess(request, response, start);
+}
+
+auto toyws::ToyWs::NegotiateEncoding(const HttpRequest& request,
+                                     const Route* route) const
+    -> ContentEncoding {
+  // What a WriterHandler writes is sent as is, wherever it runs
+  if (!compressionOptions.enabled || route == nullptr ||
+      !route->Options().compress || route->Writer() != nullptr) {
+    return ContentEncoding::kIdentity;
+  }
+  const auto it = request.Headers().find("Accept-Encoding");
+  if (it == request.Headers().end()) {
+    return ContentEncoding::kIdentity;
+  }
+  return toyws::NegotiateEncoding(it->second);
+}
+
+auto toyws::ToyWs::Compress(const HttpRequest& request, const Route* route,
+                            HttpResponse& response) -> void {
+  auto& headers = response.Headers();
+  const auto contentType = headers.find("Content-Type");
+  // Nothing varies on Accept-Encoding where compression is off
+  if (!compressionOptions.enabled || route == nullptr ||
+      !route->Options().compress || route->Writer() != nullptr ||
+      response.Status() != HttpStatus::kOk ||
+      response.Body().size() < compressionOptions.minSize ||
+      contentType == headers.end() ||
+      !IsCompressibleType(contentType->second) ||
+      headers.contains("Content-Encoding")) {
+    return;
+  }
+
+  // The representation depends on Accept-Encoding, whether we compress or not
+  auto& vary = headers["Vary"];
+  vary = vary.empty() ? "Accept-Encoding" : vary + ", Accept-Encoding";
+
+  const auto encoding = NegotiateEncoding(request, route);
+  if (encoding == ContentEncoding::kIdentity) {
+    return;
+  }
+
+  // A body with an ETag is identified by it (and the path), so its compressed
+  // form can be reused across requests. Off the rings' threads, there is
+  // neither a cache nor a compressor to reuse.
+  auto* ring = LocalRing();
+  CompressedVariantCache::Bytes compressed;
+  std::string identity;
+  const auto etag = headers.find("ETag");
+  if (etag != headers.end() && ring != nullptr) {
+    identity = route->FullPath() + ' ';
+    identity += etag->second;
+    compressed = ring->compressedVariants.Find(identity, encoding);
+  }
+  if (!compressed && ring != nullptr) {
+    compressed = std::make_shared<const std::string>(
+        ring->compressor.Compress(response.Body(), encoding));
+    if (!identity.empty()) {
+      ring->compressedVariants.Insert(identity, encoding, compressed);
+    }
+  } else if (!compressed) {
+    compressed = std::make_shared<const std::string>(
+        Compressor{compressionOptions.level}.Compress(response.Body(),
+                                                      encoding));
+  }
+
+  if (compressed->size() >= response.Body().size()) {
+    return;  // Not worth it
+  }
+
+  if (etag != headers.end()) {
+    // Each encoding is a different representation and needs its own ETag
+    auto& value = etag->second;
+    const auto suffix = std::string{"-"} + ContentEncodingName(encoding);
+    if (value.ends_with('"')) {
+      value.insert(value.size() - 1, suffix);
+    } else {
+      value += suffix;
+    }
+  }
+  headers["Content-Encoding"] = ContentEncodingName(encoding);
+  response.SetBody(*compressed);
+}
+
+auto toyws::ToyWs::ServeStatic(const HttpRequest& request, const Route* route,
+                               const HandlerContext& context,
+                               HttpResponse& response) -> void {
+  const auto it = std::find_if(staticRoutes.begin(), staticRoutes.end(),
+                               [route](const auto& staticRoute) {
+                                 return &staticRoute->route == route;
+                               });
+  if (it == staticRoutes.end()) {
+    throw HttpStatusError(HttpStatus::kNotFound, "No handler for route");
+  }
+  const auto& resource = request.Resource();
+  const auto path = std::string_view{resource}
+                        .substr(0, resource.find('?'))
+                        .substr((*it)->prefix.size());
+
+  // Compressible files are read into memory for Compress(), which keeps the
+  // compressed variant by ETag. Everything else is sent from the page cache.
+  auto readsBody = [this, &request, route](const StaticFiles& files,
+                                          HttpResponse& served) {
+    const auto& file = served.File();
+    if (!file || served.Status() != HttpStatus::kOk ||
+        !compressionOptions.enabled || !route->Options().compress ||
+        file.length < compressionOptions.minSize ||
+        file.length > files.Options().compressMaxBytes ||
+        !IsCompressibleType(file.file->contentType)) {
+      return false;
+    }
+    if (NegotiateEncoding(request, route) == ContentEncoding::kIdentity) {
+      // Other clients get it compressed
+      served.Headers()["Vary"] = "Accept-Encoding";
+      return false;
+    }
+    served.Headers().erase("Content-Length");
+    return true;
+  };
+
+  const auto index = static_cast<std::size_t>(it - staticRoutes.begin());
+  auto* ring = LocalRing();
+  auto* io = context.Io();
+  if (ring == nullptr || io == nullptr || index >= ring->staticFiles.size()) {
+    // Blocking, where there is no ring to wait on
+    std::lock_guard lock{(*it)->mutex};
+    (*it)->files.Serve(request, path, response);
+    if (readsBody((*it)->files, response)) {
+      response.SetBody(ReadFileRange(response.TakeFile()));
+    }
+    return;
+  }
+
+  // The ring's own files, which no other thread touches
+  auto& files = *ring->staticFiles[index];
+  // Known once deferred below, before any completion runs on the ring
+  auto respond = std::make_shared<Responder>();
+  auto read = [io, respond](HttpResponse served) {
+    auto range = served.TakeFile();
+    ReadFileRange(*io, std::move(range),
+                  [respond, served = std::move(served)](
+                      int result, std::string data) mutable {
+                    if (result < 0) {
+                      served = HttpResponse{HttpStatus::kInternalServerError};
+                    } else {
+                      served.SetBody(std::move(data));
+                    }
+                    (*respond)(std::move(served));
+                  });
+  };
+  const bool served = files.Serve(
+      request, path, response, *io,
+      [&files, respond, read, readsBody](HttpResponse opened) {
+        if (readsBody(files, opened)) {
+          read(std::move(opened));
+        } else {
+          (*respond)(std::move(opened));
+        }
+      });
+  if (served && !readsBody(files, response)) {
+    return;
+  }
+  *respond = context.Defer();
+  if (served) {
+    read(std::move(response));
+  }
+}
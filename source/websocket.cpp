@@ -0,0 +1,489 @@
+#include "toyws/websocket.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "toyws/http_headers_map.hpp"
+
+namespace {
+
+// Appended to Sec-WebSocket-Key before hashing (RFC 6455, section 4.2.2)
+constexpr std::string_view kAcceptGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+auto Sha1(std::string_view data) -> std::array<unsigned char, 20> {
+  std::array<std::uint32_t, 5> h = {0x67452301, 0xefcdab89, 0x98badcfe,
+                                    0x10325476, 0xc3d2e1f0};
+
+  // Message, 0x80, zeros & the length in bits, to a multiple of 64 bytes
+  std::string padded{data};
+  padded += '\x80';
+  padded.append((64 + 56 - padded.size() % 64) % 64, '\0');
+  const std::uint64_t bits = std::uint64_t{data.size()} * 8;
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    padded += static_cast<char>((bits >> shift) & 0xff);
+  }
+
+  std::array<std::uint32_t, 80> w{};
+  for (std::size_t block = 0; block < padded.size(); block += 64) {
+    for (std::size_t i = 0; i < 16; ++i) {
+      const auto* p =
+          reinterpret_cast<const unsigned char*>(padded.data() + block + 4 * i);
+      w[i] = (std::uint32_t{p[0]} << 24) | (std::uint32_t{p[1]} << 16) |
+             (std::uint32_t{p[2]} << 8) | std::uint32_t{p[3]};
+    }
+    for (std::size_t i = 16; i < 80; ++i) {
+      w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    auto [a, b, c, d, e] = h;
+    for (std::size_t i = 0; i < 80; ++i) {
+      std::uint32_t f = 0;
+      std::uint32_t k = 0;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      const auto temp = std::rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = std::rotl(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::array<unsigned char, 20> digest{};
+  for (std::size_t i = 0; i < digest.size(); ++i) {
+    digest[i] = static_cast<unsigned char>(h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+  return digest;
+}
+
+auto Base64(const unsigned char* data, std::size_t size) -> std::string {
+  static constexpr std::string_view kAlphabet =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((size + 2) / 3 * 4);
+  for (std::size_t i = 0; i < size; i += 3) {
+    const std::uint32_t n =
+        (std::uint32_t{data[i]} << 16) |
+        (i + 1 < size ? std::uint32_t{data[i + 1]} << 8 : 0) |
+        (i + 2 < size ? std::uint32_t{data[i + 2]} : 0);
+    out += kAlphabet[(n >> 18) & 0x3f];
+    out += kAlphabet[(n >> 12) & 0x3f];
+    out += i + 1 < size ? kAlphabet[(n >> 6) & 0x3f] : '=';
+    out += i + 2 < size ? kAlphabet[n & 0x3f] : '=';
+  }
+  return out;
+}
+
+auto EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) -> bool {
+  return std::ranges::equal(lhs, rhs, [](char a, char b) {
+    return (a | 0x20) == (b | 0x20);
+  });
+}
+
+// Whether the comma-separated list value has token (case-insensitively)
+auto HasToken(std::string_view value, std::string_view token) -> bool {
+  while (!value.empty()) {
+    const auto comma = value.find(',');
+    auto item = value.substr(0, comma);
+    value.remove_prefix(comma == std::string_view::npos ? value.size()
+                                                        : comma + 1);
+    while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+      item.remove_prefix(1);
+    }
+    while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+      item.remove_suffix(1);
+    }
+    if (EqualsIgnoreCase(item, token)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto Header(const toyws::HttpRequest& request, std::string_view name)
+    -> std::string_view {
+  const auto it = request.Headers().find(name);
+  return it == request.Headers().end() ? std::string_view{}
+                                       : std::string_view{it->second};
+}
+
+auto IsControl(toyws::WebSocketOpcode opcode) -> bool {
+  return (static_cast<std::uint8_t>(opcode) & 0x8) != 0;
+}
+
+// Codes a peer may send in a Close frame (RFC 6455, section 7.4)
+auto IsValidCloseCode(std::uint16_t code) -> bool {
+  return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) ||
+         (code >= 3000 && code <= 4999);
+}
+
+auto IsValidUtf8(std::string_view text) -> bool {
+  const auto* p = reinterpret_cast<const unsigned char*>(text.data());
+  const auto* end = p + text.size();
+  while (p < end) {
+    // ASCII 8 bytes at a time, as most text is
+    if (end - p >= 8) {
+      std::uint64_t word = 0;
+      std::memcpy(&word, p, sizeof(word));
+      if ((word & 0x8080808080808080) == 0) {
+        p += 8;
+        continue;
+      }
+    }
+    const unsigned char c = *p;
+    if (c < 0x80) {
+      ++p;
+      continue;
+    }
+    int length = 0;
+    // Bounds of the second byte, which rule out overlong forms, surrogates &
+    // code points beyond U+10FFFF
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      length = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      length = 3;
+      low = c == 0xe0 ? 0xa0 : 0x80;
+      high = c == 0xed ? 0x9f : 0xbf;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      length = 4;
+      low = c == 0xf0 ? 0x90 : 0x80;
+      high = c == 0xf4 ? 0x8f : 0xbf;
+    } else {
+      return false;
+    }
+    if (end - p < length || p[1] < low || p[1] > high) {
+      return false;
+    }
+    for (int i = 2; i < length; ++i) {
+      if ((p[i] & 0xc0) != 0x80) {
+        return false;
+      }
+    }
+    p += length;
+  }
+  return true;
+}
+
+// Append the head of a frame with payloadSize bytes to out
+auto AppendHead(std::string& out, toyws::WebSocketOpcode opcode,
+                std::size_t payloadSize, bool fin, bool masked) -> void {
+  out += static_cast<char>((fin ? 0x80U : 0U) |
+                           static_cast<std::uint8_t>(opcode));
+  const unsigned maskBit = masked ? 0x80 : 0;
+  if (payloadSize < 126) {
+    out += static_cast<char>(maskBit | static_cast<unsigned>(payloadSize));
+  } else if (payloadSize <= 0xffff) {
+    out += static_cast<char>(maskBit | 126U);
+    out += static_cast<char>(payloadSize >> 8);
+    out += static_cast<char>(payloadSize & 0xff);
+  } else {
+    out += static_cast<char>(maskBit | 127U);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      out += static_cast<char>((std::uint64_t{payloadSize} >> shift) & 0xff);
+    }
+  }
+}
+
+}  // namespace
+
+auto toyws::WebSocketAcceptKey(std::string_view key) -> std::string {
+  std::string input{key};
+  input += kAcceptGuid;
+  const auto digest = Sha1(input);
+  return Base64(digest.data(), digest.size());
+}
+
+auto toyws::IsWebSocketUpgrade(const HttpRequest& request) -> bool {
+  return request.Method() == HttpMethod::GET &&
+         HasToken(Header(request, "Upgrade"), "websocket");
+}
+
+auto toyws::AcceptWebSocket(const HttpRequest& request) -> HttpResponse {
+  if (!IsWebSocketUpgrade(request) ||
+      Header(request, "Sec-WebSocket-Version") != "13") {
+    return HttpResponse{HttpStatus::kUpgradeRequired,
+                        HeadersMap{{"Upgrade", "websocket"},
+                                   {"Connection", "Upgrade"},
+                                   {"Sec-WebSocket-Version", "13"}}};
+  }
+  // The key is 16 random bytes in base64
+  const auto key = Header(request, "Sec-WebSocket-Key");
+  if (key.size() != 24 || !HasToken(Header(request, "Connection"), "upgrade")) {
+    return HttpResponse{HttpStatus::kBadRequest};
+  }
+
+  HttpResponse response{HttpStatus::kSwitchingProtocols,
+                        HeadersMap{{"Upgrade", "websocket"},
+                                   {"Connection", "Upgrade"}}};
+  response.Headers().emplace("Sec-WebSocket-Accept", WebSocketAcceptKey(key));
+  return response;
+}
+
+auto toyws::UnmaskPayload(char* out, const char* in, std::size_t size,
+                          WebSocketMask mask, std::size_t offset) -> void {
+  // The key repeated, starting at offset into the payload
+  alignas(16) std::array<unsigned char, 16> pattern{};
+  for (std::size_t i = 0; i < pattern.size(); ++i) {
+    pattern[i] = mask[(offset + i) % mask.size()];
+  }
+
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const auto key =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(pattern.data()));
+  for (; i + 16 <= size; i += 16) {
+    const auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_xor_si128(data, key));
+  }
+#elif defined(__ARM_NEON)
+  const auto key = vld1q_u8(pattern.data());
+  for (; i + 16 <= size; i += 16) {
+    const auto data = vld1q_u8(reinterpret_cast<const std::uint8_t*>(in + i));
+    vst1q_u8(reinterpret_cast<std::uint8_t*>(out + i), veorq_u8(data, key));
+  }
+#endif
+  // A word at a time, as i is a multiple of the key's length so far
+  std::uint64_t word = 0;
+  std::memcpy(&word, pattern.data(), sizeof(word));
+  for (; i + 8 <= size; i += 8) {
+    std::uint64_t data = 0;
+    std::memcpy(&data, in + i, sizeof(data));
+    data ^= word;
+    std::memcpy(out + i, &data, sizeof(data));
+  }
+  for (; i < size; ++i) {
+    out[i] = static_cast<char>(in[i] ^ static_cast<char>(pattern[i % 4]));
+  }
+}
+
+auto toyws::EncodeFrame(WebSocketOpcode opcode, std::string_view payload,
+                        bool fin) -> std::string {
+  std::string frame;
+  frame.reserve(kMaxFrameHeadSize + payload.size());
+  AppendHead(frame, opcode, payload.size(), fin, false);
+  frame += payload;
+  return frame;
+}
+
+auto toyws::EncodeMaskedFrame(WebSocketOpcode opcode,
+                              std::string_view payload, WebSocketMask mask,
+                              bool fin) -> std::string {
+  std::string frame;
+  frame.reserve(kMaxFrameHeadSize + payload.size());
+  AppendHead(frame, opcode, payload.size(), fin, true);
+  frame.append(reinterpret_cast<const char*>(mask.data()), mask.size());
+  const auto head = frame.size();
+  frame.resize(head + payload.size());
+  UnmaskPayload(frame.data() + head, payload.data(), payload.size(), mask);
+  return frame;
+}
+
+auto toyws::CloseCodeOf(std::string_view payload) -> WebSocketCloseCode {
+  if (payload.size() < 2) {
+    return WebSocketCloseCode::kNoStatus;
+  }
+  return static_cast<WebSocketCloseCode>(
+      (static_cast<unsigned>(static_cast<unsigned char>(payload[0])) << 8) |
+      static_cast<unsigned char>(payload[1]));
+}
+
+auto toyws::EncodeCloseFrame(WebSocketCloseCode code, std::string_view reason)
+    -> std::string {
+  if (code == WebSocketCloseCode::kNoStatus) {
+    return EncodeFrame(WebSocketOpcode::kClose, {});
+  }
+  const auto value = static_cast<std::uint16_t>(code);
+  std::string payload;
+  payload += static_cast<char>(value >> 8);
+  payload += static_cast<char>(value & 0xff);
+  payload += reason.substr(0, kMaxControlPayload - 2);
+  return EncodeFrame(WebSocketOpcode::kClose, payload);
+}
+
+auto toyws::WebSocketReader::Next(std::string_view& input)
+    -> std::optional<Message> {
+  if (delivered != nullptr) {
+    delivered->clear();
+    delivered = nullptr;
+  }
+
+  while (state != State::kError) {
+    if (state == State::kHead) {
+      if (!ReadHead(input)) {
+        return std::nullopt;
+      }
+      if (remaining == 0) {
+        if (auto complete = CompleteFrame()) {
+          return complete;
+        }
+        continue;
+      }
+    }
+    if (input.empty()) {
+      return std::nullopt;
+    }
+
+    auto& target = IsControl(opcode) ? control : message;
+    const auto n = static_cast<std::size_t>(
+        std::min<std::uint64_t>(remaining, input.size()));
+    const auto old = target.size();
+    target.resize(old + n);
+    UnmaskPayload(target.data() + old, input.data(), n, mask, payloadRead);
+    input.remove_prefix(n);
+    payloadRead += n;
+    remaining -= n;
+    if (remaining == 0) {
+      if (auto complete = CompleteFrame()) {
+        return complete;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+auto toyws::WebSocketReader::ReadHead(std::string_view& input) -> bool {
+  // 2 bytes first, which tell the size of the rest
+  auto needed = [this] {
+    std::size_t size = 2;
+    if (headSize >= 2) {
+      const auto length = head[1] & 0x7f;
+      size += length == 126 ? 2 : length == 127 ? 8 : 0;
+      size += (head[1] & 0x80) != 0 ? mask.size() : 0;
+    }
+    return size;
+  };
+  while (headSize < needed()) {
+    if (input.empty()) {
+      return false;
+    }
+    head[headSize++] = static_cast<unsigned char>(input.front());
+    input.remove_prefix(1);
+  }
+
+  fin = (head[0] & 0x80) != 0;
+  opcode = static_cast<WebSocketOpcode>(head[0] & 0x0f);
+  std::size_t at = 2;
+  const auto length = head[1] & 0x7fU;
+  if (length < 126) {
+    remaining = length;
+  } else {
+    remaining = 0;
+    const std::size_t bytes = length == 126 ? 2 : 8;
+    for (std::size_t i = 0; i < bytes; ++i) {
+      remaining = (remaining << 8) | head[at++];
+    }
+  }
+
+  // No extensions are negotiated, and clients must mask
+  if ((head[0] & 0x70) != 0 || (head[1] & 0x80) == 0) {
+    Fail(WebSocketCloseCode::kProtocolError);
+    return false;
+  }
+  std::copy_n(head.begin() + static_cast<std::ptrdiff_t>(at), mask.size(),
+              mask.begin());
+  headSize = 0;
+  payloadRead = 0;
+
+  switch (opcode) {
+    case WebSocketOpcode::kText:
+    case WebSocketOpcode::kBinary:
+      if (inMessage) {
+        Fail(WebSocketCloseCode::kProtocolError);
+        return false;
+      }
+      inMessage = true;
+      messageOpcode = opcode;
+      break;
+    case WebSocketOpcode::kContinuation:
+      if (!inMessage) {
+        Fail(WebSocketCloseCode::kProtocolError);
+        return false;
+      }
+      break;
+    case WebSocketOpcode::kClose:
+    case WebSocketOpcode::kPing:
+    case WebSocketOpcode::kPong:
+      // May come between fragments, but not be fragmented themselves
+      if (!fin || remaining > kMaxControlPayload) {
+        Fail(WebSocketCloseCode::kProtocolError);
+        return false;
+      }
+      break;
+    default:
+      Fail(WebSocketCloseCode::kProtocolError);
+      return false;
+  }
+  if (!IsControl(opcode) && remaining > maxMessageSize - message.size()) {
+    Fail(WebSocketCloseCode::kMessageTooBig);
+    return false;
+  }
+
+  state = State::kPayload;
+  return true;
+}
+
+auto toyws::WebSocketReader::CompleteFrame() -> std::optional<Message> {
+  state = State::kHead;
+
+  if (IsControl(opcode)) {
+    if (opcode == WebSocketOpcode::kClose && !control.empty()) {
+      if (control.size() < 2 ||
+          !IsValidCloseCode(static_cast<std::uint16_t>(CloseCodeOf(control)))) {
+        return Fail(WebSocketCloseCode::kProtocolError);
+      }
+      if (!IsValidUtf8(std::string_view{control}.substr(2))) {
+        return Fail(WebSocketCloseCode::kInvalidPayload);
+      }
+    }
+    delivered = &control;
+    return Message{opcode, control};
+  }
+
+  if (!fin) {
+    return std::nullopt;  // More fragments to come
+  }
+  inMessage = false;
+  if (messageOpcode == WebSocketOpcode::kText && !IsValidUtf8(message)) {
+    return Fail(WebSocketCloseCode::kInvalidPayload);
+  }
+  delivered = &message;
+  return Message{messageOpcode, message};
+}
+
+auto toyws::WebSocketReader::Fail(WebSocketCloseCode code)
+    -> std::optional<Message> {
+  state = State::kError;
+  errorCode = code;
+  return std::nullopt;
+}
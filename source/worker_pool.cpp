@@ -0,0 +1,90 @@
+#include "toyws/worker_pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+// The pool & index of the worker running on this thread, if any
+thread_local const toyws::WorkerPool* currentPool = nullptr;
+thread_local std::size_t currentIndex = 0;
+}  // namespace
+
+toyws::WorkerPool::WorkerPool(std::size_t threads) {
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  // Only once all exist, as any worker may steal from any other
+  for (std::size_t i = 0; i < threads; ++i) {
+    workers[i]->thread = std::thread{[this, i] { WorkerLoop(i); }};
+  }
+}
+
+toyws::WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard lock{sleepMutex};
+    stopping = true;
+  }
+  wakeup.notify_all();
+  for (auto& worker : workers) {
+    worker->thread.join();
+  }
+}
+
+auto toyws::WorkerPool::Submit(Task task) -> void {
+  const auto index =
+      currentPool == this
+          ? currentIndex
+          : nextWorker.fetch_add(1, std::memory_order_relaxed) %
+                workers.size();
+  {
+    std::lock_guard lock{sleepMutex};
+    pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  {
+    auto& worker = *workers[index];
+    std::lock_guard lock{worker.mutex};
+    worker.tasks.push_back(std::move(task));
+  }
+  wakeup.notify_one();
+}
+
+auto toyws::WorkerPool::WorkerLoop(std::size_t index) -> void {
+  currentPool = this;
+  currentIndex = index;
+
+  Task task;
+  while (true) {
+    if (TakeTask(index, task)) {
+      pending.fetch_sub(1, std::memory_order_relaxed);
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock lock{sleepMutex};
+    // pending may count a task that is about to be pushed, in which case
+    // this returns right away and the task is found on the next attempt.
+    wakeup.wait(lock, [this] {
+      return stopping || pending.load(std::memory_order_relaxed) > 0;
+    });
+    if (stopping && pending.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+  }
+}
+
+auto toyws::WorkerPool::TakeTask(std::size_t index, Task& task) -> bool {
+  for (std::size_t i = 0; i < workers.size(); ++i) {
+    auto& worker = *workers[(index + i) % workers.size()];
+    std::lock_guard lock{worker.mutex};
+    if (!worker.tasks.empty()) {
+      task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
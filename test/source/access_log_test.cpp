@@ -0,0 +1,146 @@
+#include "toyws/access_log.hpp"
+
+#include <unistd.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "toyws/spsc_queue.hpp"
+
+/**
+ * @brief Create an empty temporary file and return its path.
+ */
+static auto TempLogPath() -> std::string {
+  std::string path = "/tmp/toyws_access_log_XXXXXX";
+  int fd = mkstemp(path.data());
+  REQUIRE(fd != -1);
+  close(fd);
+  return path;
+}
+
+static auto ReadFile(const std::string& path) -> std::string {
+  std::ifstream file{path};
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+TEST_CASE("SpscQueue push & pop", "[library]") {
+  toyws::SpscQueue<int, 4> queue;
+  int out = 0;
+
+  REQUIRE(queue.TryPop(out) == false);
+  for (int i = 0; i < 4; ++i) {
+    REQUIRE(queue.TryPush(i));
+  }
+  REQUIRE(queue.TryPush(4) == false);
+  REQUIRE(queue.Size() == 4);
+
+  REQUIRE(queue.TryPop(out));
+  REQUIRE(out == 0);
+  REQUIRE(queue.TryPush(4));
+
+  for (int i = 1; i <= 4; ++i) {
+    REQUIRE(queue.TryPop(out));
+    REQUIRE(out == i);
+  }
+  REQUIRE(queue.TryPop(out) == false);
+}
+
+TEST_CASE("AccessLog writes formatted records", "[library]") {
+  auto path = TempLogPath();
+  {
+    toyws::AccessLogOptions options;
+    options.path = path;
+    toyws::AccessLog log{options};
+    auto* producer = log.AddProducer();
+    log.Start();
+
+    toyws::HttpRequest request{toyws::HttpMethod::GET, "/index.html"};
+    toyws::HttpResponse response{toyws::HttpStatus::kOk};
+    producer->Record(request, response, std::chrono::microseconds{42});
+
+    log.Stop();
+  }
+
+  auto content = ReadFile(path);
+  std::remove(path.c_str());
+
+  REQUIRE(content.find("GET /index.html 200 0B 42us\n") != std::string::npos);
+}
+
+TEST_CASE("AccessLog level & sampling", "[library]") {
+  auto path = TempLogPath();
+  {
+    toyws::AccessLogOptions options;
+    options.path = path;
+    options.level = toyws::AccessLogLevel::kErrors;
+    toyws::AccessLog log{options};
+    auto* producer = log.AddProducer();
+    log.Start();
+
+    toyws::HttpRequest request{toyws::HttpMethod::POST, "/form"};
+    producer->Record(request, toyws::HttpResponse{toyws::HttpStatus::kOk},
+                     std::chrono::microseconds{1});
+    producer->Record(request,
+                     toyws::HttpResponse{toyws::HttpStatus::kNotFound},
+                     std::chrono::microseconds{1});
+
+    log.Stop();
+  }
+
+  auto content = ReadFile(path);
+  std::remove(path.c_str());
+
+  REQUIRE(content.find(" 200 ") == std::string::npos);
+  REQUIRE(content.find("POST /form 404") != std::string::npos);
+
+  // Every 4th success is kept; errors are all kept, and don't count towards
+  // the sampling
+  path = TempLogPath();
+  {
+    toyws::AccessLogOptions options;
+    options.path = path;
+    options.sampleRate = 4;
+    toyws::AccessLog log{options};
+    auto* producer = log.AddProducer();
+    log.Start();
+
+    for (int i = 0; i < 40; ++i) {
+      const auto resource = "/page/" + std::to_string(i);
+      producer->Record(toyws::HttpRequest{toyws::HttpMethod::GET, resource},
+                       toyws::HttpResponse{toyws::HttpStatus::kOk},
+                       std::chrono::microseconds{1});
+      if (i % 4 == 0) {
+        producer->Record(
+            toyws::HttpRequest{toyws::HttpMethod::GET, resource},
+            toyws::HttpResponse{toyws::HttpStatus::kInternalServerError},
+            std::chrono::microseconds{1});
+      }
+    }
+
+    log.Stop();
+  }
+
+  content = ReadFile(path);
+  std::remove(path.c_str());
+
+  const auto count = [&](const std::string& needle) {
+    std::size_t found = 0;
+    for (auto pos = content.find(needle); pos != std::string::npos;
+         pos = content.find(needle, pos + needle.size())) {
+      ++found;
+    }
+    return found;
+  };
+  REQUIRE(count(" 200 ") == 10);
+  REQUIRE(count(" 500 ") == 10);
+  REQUIRE(content.find("GET /page/3 200") != std::string::npos);
+  REQUIRE(content.find("GET /page/0 200") == std::string::npos);
+  REQUIRE(content.find("GET /page/36 500") != std::string::npos);
+}
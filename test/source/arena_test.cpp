@@ -0,0 +1,92 @@
+#include "toyws/arena.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "toyws/http_response.hpp"
+#include "toyws/request_reader.hpp"
+
+// Counts what is allocated from it, passing it on to the default resource
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  int allocations = 0;
+
+ private:
+  auto do_allocate(std::size_t bytes, std::size_t alignment)
+      -> void* override {
+    ++allocations;
+    return std::pmr::get_default_resource()->allocate(bytes, alignment);
+  }
+
+  auto do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment)
+      -> void override {
+    std::pmr::get_default_resource()->deallocate(ptr, bytes, alignment);
+  }
+
+  auto do_is_equal(const std::pmr::memory_resource& other) const noexcept
+      -> bool override {
+    return this == &other;
+  }
+};
+
+// Read the head of request with a reader allocating from arena
+static auto ReadRequest(toyws::Arena& arena, std::string_view request)
+    -> void {
+  toyws::RequestReader reader{arena.Resource()};
+  reader.ReadHead(request);
+  REQUIRE(reader.State() == toyws::RequestReader::States::kBody);
+  REQUIRE(reader.Request().Resource() == "/search?q=arena");
+  REQUIRE(reader.Request().Headers().at("Accept-Language") ==
+          "en-US,sv;q=0.7,en;q=0.3");
+}
+
+TEST_CASE("Arena holds a typical request without going upstream",
+          "[library]") {
+  const std::string request =
+      "GET /search?q=arena HTTP/1.1\r\n"
+      "Host: 127.0.0.1:5000\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 "
+      "Firefox/128.0\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;"
+      "q=0.8\r\n"
+      "Accept-Language: en-US,sv;q=0.7,en;q=0.3\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Connection: keep-alive\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "\r\n";
+
+  CountingResource upstream;
+  toyws::Arena arena{&upstream};
+  ReadRequest(arena, request);
+  REQUIRE(upstream.allocations == 0);
+
+  // Starts over at the inline storage
+  arena.Reset();
+  ReadRequest(arena, request);
+  REQUIRE(upstream.allocations == 0);
+
+  SECTION("Goes upstream once the inline storage is used up") {
+    std::pmr::string large{arena.Resource()};
+    large.resize(toyws::Arena::kInlineSize);
+    REQUIRE(upstream.allocations > 0);
+  }
+}
+
+TEST_CASE("HttpResponse takes its allocator along when moved", "[library]") {
+  toyws::Arena arena;
+  toyws::HttpResponse response{toyws::HttpStatus::kOk, arena.Resource()};
+  response.Headers()["Content-Type"] = "text/plain";
+  REQUIRE(response.Headers().get_allocator().resource() == arena.Resource());
+
+  // As handlers usually replace the response they are passed
+  response = toyws::HttpResponse{toyws::HttpStatus::kNotFound,
+                                 toyws::HeadersMap{{"Allow", "GET"}}};
+  REQUIRE(response.Status() == toyws::HttpStatus::kNotFound);
+  REQUIRE(response.Headers().at("Allow") == "GET");
+  REQUIRE(response.Headers().get_allocator().resource() ==
+          std::pmr::get_default_resource());
+}
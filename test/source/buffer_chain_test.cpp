@@ -0,0 +1,120 @@
+#include "toyws/buffer_chain.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <format>
+#include <string>
+
+#include "toyws/http_response.hpp"
+
+static auto Pattern(std::size_t size) -> std::string {
+  std::string out(size, '\0');
+  for (std::size_t i = 0; i < size; ++i) {
+    out[i] = static_cast<char>('a' + i % 26);
+  }
+  return out;
+}
+
+TEST_CASE("BufferChain append, pieces & consume", "[library]") {
+  toyws::SegmentPool pool;
+  toyws::BufferChain chain{&pool};
+
+  const auto data = Pattern(2 * toyws::kSegmentSize + 100);
+  chain.Append(data.substr(0, 10));
+  chain.Append(data.substr(10));
+  REQUIRE(chain.Size() == data.size());
+  REQUIRE(chain.PieceCount() == 3);
+  REQUIRE(chain.Piece(0).size() == toyws::kSegmentSize);
+  REQUIRE(chain.Piece(2).size() == 100);
+  REQUIRE(chain.ToString() == data);
+  REQUIRE(chain.Data().size() == 3);
+
+  // Consuming releases emptied segments to the pool
+  chain.Consume(toyws::kSegmentSize + 1);
+  REQUIRE(pool.FreeCount() == 1);
+  REQUIRE(chain.PieceCount() == 2);
+  REQUIRE(chain.Piece(0).size() == toyws::kSegmentSize - 1);
+  REQUIRE(chain.ToString() == data.substr(toyws::kSegmentSize + 1));
+
+  const auto iovecs = chain.Data();
+  REQUIRE(iovecs.size() == 2);
+  REQUIRE(iovecs[0].iov_len + iovecs[1].iov_len == chain.Size());
+
+  chain.Consume(chain.Size());
+  REQUIRE(chain.Empty());
+  REQUIRE(chain.PieceCount() == 0);
+  REQUIRE(pool.FreeCount() == 3);
+
+  // Segments are reused
+  chain.Append("x");
+  REQUIRE(pool.FreeCount() == 2);
+  chain.Clear();
+  REQUIRE(pool.FreeCount() == 3);
+}
+
+TEST_CASE("BufferChain reserve, spare & commit", "[library]") {
+  toyws::BufferChain chain;
+  chain.Append("head");
+  chain.Reserve(toyws::kSegmentSize);
+
+  auto spare = chain.Spare();
+  REQUIRE(spare.size() == 2);
+  REQUIRE(spare[0].iov_len == toyws::kSegmentSize - 4);
+  REQUIRE(spare[1].iov_len == toyws::kSegmentSize);
+
+  // Simulate a readv() filling the first iovec and part of the second
+  std::memset(spare[0].iov_base, 'a', spare[0].iov_len);
+  std::memset(spare[1].iov_base, 'b', 10);
+  chain.Commit(spare[0].iov_len + 10);
+
+  REQUIRE(chain.Size() == toyws::kSegmentSize + 10);
+  REQUIRE(chain.Piece(1) == std::string(10, 'b'));
+  REQUIRE(chain.ToString().starts_with("headaaa"));
+}
+
+TEST_CASE("HttpResponse written to BufferChain", "[library]") {
+  const auto body = Pattern(3 * toyws::kSegmentSize);
+  toyws::HttpResponse response{
+      toyws::HttpStatus::kOk, {{"Content-Type", "text/plain"}}, body};
+
+  toyws::BufferChain chain;
+  response.Write(chain);
+
+  const auto head =
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain\r\n"
+      "Content-Length: " +
+      std::to_string(body.size()) + "\r\n\r\n";
+  REQUIRE(chain.ToString() == head + body);
+  REQUIRE(chain.PieceCount() == 4);
+}
+
+TEST_CASE("BufferChain data from offset", "[library]") {
+  toyws::BufferChain chain;
+  chain.Append(Pattern(2 * toyws::kSegmentSize));
+  chain.Consume(10);
+
+  // Content starts 10 bytes into the first segment
+  const auto offset = toyws::kSegmentSize - 20;
+  auto data = chain.Data(offset);
+  REQUIRE(data.size() == 2);
+  REQUIRE(data[0].iov_len == 10);
+  REQUIRE(data[1].iov_len == toyws::kSegmentSize);
+  REQUIRE(std::string_view{static_cast<char*>(data[0].iov_base), 10} ==
+          Pattern(2 * toyws::kSegmentSize).substr(10 + offset, 10));
+
+  REQUIRE(chain.Data(chain.Size()).empty());
+}
+
+TEST_CASE("BufferChain inserter & overwrite", "[library]") {
+  toyws::BufferChain chain;
+  chain.Append(Pattern(toyws::kSegmentSize - 3));
+  std::format_to(chain.Back(), "{:06}|", 42);
+  REQUIRE(chain.PieceCount() == 2);
+  REQUIRE(chain.ToString().ends_with("000042|"));
+
+  // Across the boundary between the segments
+  chain.Overwrite(toyws::kSegmentSize - 3, "123456");
+  REQUIRE(chain.ToString().ends_with("123456|"));
+  REQUIRE(chain.Size() == toyws::kSegmentSize + 4);
+}
@@ -0,0 +1,77 @@
+#include "toyws/chunked_body.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+#include "toyws/http_response.hpp"
+
+// Drain producer through WriteChunk using a buffer of given size
+static auto Drain(const toyws::BodyProducer& producer, std::size_t bufferSize)
+    -> std::string {
+  std::vector<char> buffer(bufferSize);
+  std::string out;
+  for (int i = 0; i < 1000; ++i) {
+    auto [done, length] = toyws::WriteChunk(producer, buffer.data(),
+                                            buffer.size());
+    out.append(buffer.data(), length);
+    if (done) {
+      return out;
+    }
+  }
+  FAIL("Producer never finished");
+  return out;
+}
+
+TEST_CASE("Chunked body framing", "[library]") {
+  SECTION("Single piece") {
+    auto producer = [](toyws::ChunkSink& sink) {
+      sink.Write("hello");
+      return false;
+    };
+    REQUIRE(Drain(producer, 64) == "00000005\r\nhello\r\n0\r\n\r\n");
+  }
+
+  SECTION("Empty body") {
+    auto producer = [](toyws::ChunkSink& /*sink*/) { return false; };
+    REQUIRE(Drain(producer, 64) == "0\r\n\r\n");
+  }
+
+  SECTION("Split across chunks when the buffer is small") {
+    const std::string body(100, 'x');
+    toyws::BodyProducer producer = [&body, offset = std::size_t{0}](
+                                       toyws::ChunkSink& sink) mutable {
+      offset += sink.Write(std::string_view{body}.substr(offset));
+      return offset < body.size();
+    };
+    // 64 bytes of buffer leaves 64 - 8 - 4 - 5 = 47 bytes of payload
+    REQUIRE(Drain(producer, 64) ==
+            "0000002f\r\n" + body.substr(0, 47) + "\r\n" +
+                "0000002f\r\n" + body.substr(47, 47) + "\r\n" +
+                "00000006\r\n" + body.substr(94) + "\r\n0\r\n\r\n");
+  }
+
+  SECTION("Buffer too small") {
+    auto producer = [](toyws::ChunkSink& /*sink*/) { return false; };
+    std::vector<char> buffer(16);
+    REQUIRE_THROWS_AS(
+        toyws::WriteChunk(producer, buffer.data(), buffer.size()),
+        toyws::Error);
+  }
+}
+
+TEST_CASE("Streamed HttpResponse writes only the head", "[library]") {
+  toyws::HttpResponse response{toyws::HttpStatus::kOk,
+                               {{"Content-Type", "text/plain"}},
+                               "ignored"};
+  response.SetStream([](toyws::ChunkSink& /*sink*/) { return false; });
+  REQUIRE(response.IsStreaming());
+
+  std::vector<char> buffer(256);
+  auto [success, length] = response.Write(buffer.data(), buffer.size());
+  REQUIRE(success);
+  REQUIRE(std::string(buffer.data(), length) ==
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/plain\r\n"
+          "Transfer-Encoding: chunked\r\n\r\n");
+}
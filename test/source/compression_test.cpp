@@ -0,0 +1,98 @@
+#include "toyws/compression.hpp"
+
+#include <zlib.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <memory>
+#include <string>
+
+using toyws::ContentEncoding;
+
+static auto Inflate(const std::string& data, ContentEncoding encoding)
+    -> std::string {
+  z_stream stream{};
+  // +32 would auto-detect, but we want to verify the exact format
+  const int windowBits = encoding == ContentEncoding::kGzip ? 15 + 16 : 15;
+  REQUIRE(inflateInit2(&stream, windowBits) == Z_OK);
+
+  std::string out(64 * 1024, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef*>(out.data());
+  stream.avail_out = static_cast<uInt>(out.size());
+  const int res = inflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  inflateEnd(&stream);
+
+  REQUIRE(res == Z_STREAM_END);
+  return out;
+}
+
+TEST_CASE("Accept-Encoding negotiation", "[library]") {
+  using toyws::NegotiateEncoding;
+
+  REQUIRE(NegotiateEncoding("") == ContentEncoding::kIdentity);
+  REQUIRE(NegotiateEncoding("br") == ContentEncoding::kIdentity);
+  REQUIRE(NegotiateEncoding("gzip, deflate, br") == ContentEncoding::kGzip);
+  REQUIRE(NegotiateEncoding("deflate") == ContentEncoding::kDeflate);
+  REQUIRE(NegotiateEncoding("GZIP") == ContentEncoding::kGzip);
+  REQUIRE(NegotiateEncoding("gzip;q=0.5, deflate") ==
+          ContentEncoding::kDeflate);
+  REQUIRE(NegotiateEncoding("gzip;q=0, *") == ContentEncoding::kDeflate);
+  REQUIRE(NegotiateEncoding("*") == ContentEncoding::kGzip);
+  REQUIRE(NegotiateEncoding("*;q=0") == ContentEncoding::kIdentity);
+}
+
+TEST_CASE("Compressible content types", "[library]") {
+  REQUIRE(toyws::IsCompressibleType("text/html; charset=utf-8"));
+  REQUIRE(toyws::IsCompressibleType("application/json"));
+  REQUIRE(toyws::IsCompressibleType("application/problem+json"));
+  REQUIRE(toyws::IsCompressibleType("image/svg+xml"));
+  REQUIRE_FALSE(toyws::IsCompressibleType("image/png"));
+  REQUIRE_FALSE(toyws::IsCompressibleType("application/octet-stream"));
+}
+
+TEST_CASE("Compressor round trip with reused contexts", "[library]") {
+  toyws::Compressor compressor;
+
+  std::string body;
+  for (int i = 0; i < 2000; ++i) {
+    body += "<li>item " + std::to_string(i) + "</li>\n";
+  }
+
+  for (auto encoding : {ContentEncoding::kGzip, ContentEncoding::kDeflate}) {
+    // Compress more than once to exercise resetting the context
+    for (int i = 0; i < 3; ++i) {
+      const auto compressed = compressor.Compress(body, encoding);
+      REQUIRE(compressed.size() < body.size() / 2);
+      REQUIRE(Inflate(compressed, encoding) == body);
+    }
+    REQUIRE(Inflate(compressor.Compress("", encoding), encoding).empty());
+  }
+
+  compressor.SetLevel(1);
+  REQUIRE(Inflate(compressor.Compress(body, ContentEncoding::kGzip),
+                  ContentEncoding::kGzip) == body);
+}
+
+TEST_CASE("CompressedVariantCache eviction", "[library]") {
+  toyws::CompressedVariantCache cache{100};
+  auto bytes = [](std::size_t n) {
+    return std::make_shared<const std::string>(n, 'x');
+  };
+
+  cache.Insert("/a \"1\"", ContentEncoding::kGzip, bytes(40));
+  cache.Insert("/a \"1\"", ContentEncoding::kDeflate, bytes(40));
+  REQUIRE(cache.SizeBytes() == 80);
+  REQUIRE(cache.Find("/a \"1\"", ContentEncoding::kGzip) != nullptr);
+
+  // Evicts the least recently used (deflate) variant
+  cache.Insert("/b \"2\"", ContentEncoding::kGzip, bytes(40));
+  REQUIRE(cache.Find("/a \"1\"", ContentEncoding::kDeflate) == nullptr);
+  REQUIRE(cache.Find("/a \"1\"", ContentEncoding::kGzip) != nullptr);
+  REQUIRE(cache.SizeBytes() == 80);
+
+  // Too large to ever fit
+  cache.Insert("/c \"3\"", ContentEncoding::kGzip, bytes(101));
+  REQUIRE(cache.Find("/c \"3\"", ContentEncoding::kGzip) == nullptr);
+}
@@ -0,0 +1,60 @@
+#include "toyws/connection_table.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <set>
+
+using toyws::ConnectionTable;
+using toyws::OpKind;
+using toyws::OpTag;
+
+TEST_CASE("OpTag carries kind, slot & generation", "[library]") {
+  constexpr OpTag tag{OpKind::kSpliceOut, 1234, 42};
+  REQUIRE(tag.Kind() == OpKind::kSpliceOut);
+  REQUIRE(tag.Slot() == 1234);
+  REQUIRE(tag.Generation() == 42);
+  REQUIRE(OpTag{tag.Value()}.Slot() == 1234);
+
+  // Wraps around rather than spilling into the kind
+  constexpr OpTag wrapped{OpKind::kRead, 7, OpTag::kGenerationMask + 3};
+  REQUIRE(wrapped.Kind() == OpKind::kRead);
+  REQUIRE(wrapped.Generation() == 2);
+
+  constexpr std::uint64_t address = 0x7fff'1234'5678;
+  REQUIRE(OpTag{OpKind::kHandoff, address}.Payload() == address);
+  REQUIRE(OpTag{OpKind::kHandoff, address}.Kind() == OpKind::kHandoff);
+}
+
+TEST_CASE("ConnectionTable tells stale completions apart", "[library]") {
+  ConnectionTable table{2};
+
+  const auto slot = table.Acquire();
+  const auto tag = table.Tag(OpKind::kRead, slot);
+  REQUIRE(table.IsCurrent(tag));
+
+  // The next connection in the same slot has a new generation
+  table.Release(slot);
+  REQUIRE(!table.IsCurrent(tag));
+  REQUIRE(table.Acquire() == slot);
+  REQUIRE(!table.IsCurrent(tag));
+  REQUIRE(table.IsCurrent(table.Tag(OpKind::kRead, slot)));
+
+  REQUIRE(!table.IsCurrent(OpTag{OpKind::kRead, 99, 0}));
+}
+
+TEST_CASE("ConnectionTable grows once all slots are used", "[library]") {
+  ConnectionTable table{2};
+  std::set<std::uint32_t> slots;
+  for (int i = 0; i < 5; ++i) {
+    slots.insert(table.Acquire());
+  }
+
+  REQUIRE(slots.size() == 5);
+  REQUIRE(table.Size() == 5);
+  REQUIRE(table.Used() == 5);
+
+  table.Release(3);
+  REQUIRE(table.Used() == 4);
+  REQUIRE(table.Acquire() == 3);
+  REQUIRE(table.Size() == 5);
+}
@@ -0,0 +1,84 @@
+#include "toyws/event_stream.hpp"
+
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+#include "toyws/error.hpp"
+#include "toyws/router.hpp"
+
+TEST_CASE("Events are encoded a data line per line", "[library]") {
+  REQUIRE(toyws::EncodeEvent("hello") == "data: hello\n\n");
+  REQUIRE(toyws::EncodeEvent("") == "data: \n\n");
+  REQUIRE(toyws::EncodeEvent("a\nb\r\nc\rd", "update", "42") ==
+          "event: update\nid: 42\ndata: a\ndata: b\ndata: c\ndata: d\n\n");
+  // A trailing line break is an empty last line
+  REQUIRE(toyws::EncodeEvent("a\n") == "data: a\ndata: \n\n");
+
+  REQUIRE_THROWS_AS(toyws::EncodeEvent("x", "up\ndate"), toyws::Error);
+  REQUIRE_THROWS_AS(toyws::EncodeEvent("x", {}, "4\r2"), toyws::Error);
+}
+
+TEST_CASE("Events are framed as chunks", "[library]") {
+  REQUIRE(toyws::EncodeChunk("hello") == "5\r\nhello\r\n");
+  REQUIRE(toyws::EncodeChunk(std::string(300, 'x')).starts_with("12c\r\n"));
+  // Would end the body
+  REQUIRE(toyws::EncodeChunk("").empty());
+
+  const auto frame = toyws::EncodeEventChunk("hi");
+  REQUIRE(*frame == "a\r\ndata: hi\n\n\r\n");
+  REQUIRE(*toyws::HeartbeatChunk() == "3\r\n:\n\n\r\n");
+  REQUIRE(toyws::HeartbeatChunk() == toyws::HeartbeatChunk());
+}
+
+TEST_CASE("EventHub publishes to the subscribers of a topic", "[library]") {
+  const toyws::Route news{"/news"};
+  const toyws::Route sports{"/sports"};
+  toyws::EventHub hub;
+  for (int slot = 0; slot < 5; ++slot) {
+    hub.Subscribe(&news, slot);
+  }
+  hub.Subscribe(&sports, 7);
+  REQUIRE(hub.Subscribers() == 6);
+  REQUIRE(hub.Subscribers(&news) == 5);
+
+  SECTION("Each once") {
+    std::vector<int> delivered;
+    REQUIRE(hub.Publish(&news, [&](int slot) {
+      delivered.push_back(slot);
+      return true;
+    }) == 5);
+    std::sort(delivered.begin(), delivered.end());
+    REQUIRE(delivered == std::vector<int>{0, 1, 2, 3, 4});
+  }
+
+  SECTION("Dropping those not delivered to") {
+    std::vector<int> delivered;
+    REQUIRE(hub.Publish(&news, [&](int slot) {
+      delivered.push_back(slot);
+      return slot % 2 == 0;
+    }) == 3);
+    REQUIRE(delivered.size() == 5);
+    REQUIRE(hub.Subscribers() == 4);
+    REQUIRE_FALSE(hub.Unsubscribe(&news, 1));
+    REQUIRE(hub.Unsubscribe(&news, 2));
+    REQUIRE(hub.Subscribers(&news) == 2);
+  }
+
+  SECTION("To all topics") {
+    int delivered = 0;
+    REQUIRE(hub.PublishAll([&](int slot) {
+      ++delivered;
+      return slot != 7;
+    }) == 5);
+    REQUIRE(delivered == 6);
+    REQUIRE(hub.Subscribers(&sports) == 0);
+  }
+
+  SECTION("To a topic without subscribers") {
+    const toyws::Route other{"/other"};
+    REQUIRE(hub.Publish(&other, [](int /*slot*/) { return true; }) == 0);
+    REQUIRE_FALSE(hub.Unsubscribe(&other, 0));
+  }
+}
@@ -1,5 +1,6 @@
 #include <catch2/catch_test_macros.hpp>
 #include <string>
+#include <string_view>
 
 #include "toyws/http_headers_map.hpp"
 #include "toyws/http_request.hpp"
@@ -97,3 +98,54 @@ TEST_CASE("Response with Headers", "[library]") {
 
   REQUIRE(expected == buf);
 }
+
+TEST_CASE("Malformed requests are reported as status", "[library]") {
+  using toyws::HttpStatus;
+  auto parse = [](std::string_view head) {
+    toyws::HttpRequest req;
+    return req.Parse(head);
+  };
+
+  REQUIRE(parse("GET / HTTP/1.1\r\nHost: a\r\n\r\n") == HttpStatus::kOk);
+  REQUIRE(parse("BREW / HTTP/1.1\r\n\r\n") == HttpStatus::kBadRequest);
+  REQUIRE(parse("GET / HTTP/1.1\n\n") == HttpStatus::kBadRequest);
+  REQUIRE(parse("GET /\r\n\r\n") == HttpStatus::kBadRequest);
+  REQUIRE(parse("GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\n\r\n") ==
+          HttpStatus::kBadRequest);
+  // Names are case-insensitive
+  REQUIRE(parse("GET / HTTP/1.1\r\nContent-Length: 1\r\n"
+                "content-length: 2\r\n\r\n") == HttpStatus::kBadRequest);
+  REQUIRE(parse("GET / HTTP/1.1\r\nHost a\r\n\r\n") == HttpStatus::kBadRequest);
+  REQUIRE(parse("GET / HTTP/2.0\r\n\r\n") ==
+          HttpStatus::kHttpVersionNotSupported);
+
+  std::string many = "GET / HTTP/1.1\r\n";
+  for (int i = 0; i < 101; ++i) {
+    many += "X-Field-" + std::to_string(i) + ": 1\r\n";
+  }
+  many += "\r\n";
+  REQUIRE(parse(many) == HttpStatus::kRequestHeaderFieldsTooLarge);
+}
+
+TEST_CASE("Header names are looked up case-insensitively", "[library]") {
+  toyws::HttpRequest req;
+  REQUIRE(req.Parse("GET / HTTP/1.1\r\naccept-encoding: gzip\r\n"
+                    "CONTENT-type: text/plain\r\n\r\n") ==
+          toyws::HttpStatus::kOk);
+
+  REQUIRE(req.Headers().at("Accept-Encoding") == "gzip");
+  REQUIRE(req.Headers().at("content-type") == "text/plain");
+  REQUIRE(req.Headers().contains(std::string_view{"Content-Type"}));
+  REQUIRE(!req.Headers().contains(std::string_view{"Content-Typ"}));
+
+  const toyws::HeaderNameHash hash;
+  REQUIRE(hash("Sec-WebSocket-Key") == hash("sec-websocket-key"));
+}
+
+TEST_CASE("Unknown methods & statuses", "[library]") {
+  REQUIRE(toyws::ParseHttpMethod("GET") == toyws::HttpMethod::GET);
+  REQUIRE(!toyws::ParseHttpMethod("BREW"));
+  REQUIRE(toyws::ParseHttpStatus("404") == toyws::HttpStatus::kNotFound);
+  REQUIRE(!toyws::ParseHttpStatus("42x"));
+  REQUIRE(!toyws::ParseHttpStatus("299"));
+}
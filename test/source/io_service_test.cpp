@@ -1,18 +1,31 @@
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <random>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include "toyws/error.hpp"
 #include "toyws/io_service_impl.hpp"
 #include "toyws/test_client.hpp"
 
-// TODO: Figure out how to solve testing the different IoService
-// implementations. Which is made more difficult by them being platform
-// dependent.
-
 /**
  * @brief We randomize ports to facilitate running test in parallel.
  */
@@ -28,65 +41,323 @@ auto RandomPort() -> uint16_t {
  */
 class EchoHandler {
  public:
-  static auto OnAccept(toyws::IoService<EchoHandler>* service,
-                       toyws::Socket listeningFd, toyws::Client* client)
-      -> void {
+  template <typename Service>
+  static auto OnAccept(Service* service, toyws::Socket listeningFd,
+                       toyws::Client* client) -> void {
     service->AsyncAccept(listeningFd);
     service->AsyncRead(client->IoServiceSlot());
   }
 
-  static auto OnRead(toyws::IoService<EchoHandler>* service,
-                     toyws::Client* client) -> void {
+  template <typename Service>
+  static auto OnRead(Service* service, toyws::Client* client) -> void {
     service->AsyncWrite(client->IoServiceSlot());
   }
 
-  static auto OnWrite(toyws::IoService<EchoHandler>* service,
-                      toyws::Client* client) -> void {
+  template <typename Service>
+  static auto OnWrite(Service* service, toyws::Client* client) -> void {
     service->Close(client);
     service->Stop();
   }
+
+  template <typename Service>
+  static auto OnHandoff(Service* service, toyws::Client* client) -> void {
+    service->AsyncRead(client->IoServiceSlot());
+  }
+  template <typename Service>
+  static auto OnSent(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
 };
 namespace toyws {
-template class IoService<EchoHandler>;
-}
+template class UringIoService<EchoHandler>;
+template class EpollIoService<EchoHandler>;
+}  // namespace toyws
 
 /**
  * @brief Basic HTTP response handler using IoService
  */
 class HttpBasicHandler {
  public:
-  static auto OnAccept(toyws::IoService<HttpBasicHandler>* service,
-                       toyws::Socket listeningFd, toyws::Client* client)
-      -> void {
+  template <typename Service>
+  static auto OnAccept(Service* service, toyws::Socket listeningFd,
+                       toyws::Client* client) -> void {
     service->AsyncAccept(listeningFd);
     service->AsyncRead(client->IoServiceSlot());
   }
 
-  static auto OnRead(toyws::IoService<HttpBasicHandler>* service,
-                     toyws::Client* client) -> void {
+  template <typename Service>
+  static auto OnRead(Service* service, toyws::Client* client) -> void {
     toyws::HttpResponse response{toyws::HttpStatus::kOk, "All Good"};
-    auto res = response.Write(client->Buffer().data(), client->Buffer().size());
-    client->SetBufferContentSize(res.second);
+    client->Buffer().Clear();
+    response.Write(client->Buffer());
     service->AsyncWrite(client->IoServiceSlot());
   }
 
-  static auto OnWrite(toyws::IoService<HttpBasicHandler>* service,
-                      toyws::Client* client) -> void {
+  template <typename Service>
+  static auto OnWrite(Service* service, toyws::Client* client) -> void {
     service->Close(client);
     service->Stop();
   }
+
+  template <typename Service>
+  static auto OnHandoff(Service* service, toyws::Client* client) -> void {
+    service->AsyncRead(client->IoServiceSlot());
+  }
+  template <typename Service>
+  static auto OnSent(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
 };
 namespace toyws {
-template class IoService<HttpBasicHandler>;
+template class UringIoService<HttpBasicHandler>;
+template class EpollIoService<HttpBasicHandler>;
+}  // namespace toyws
+
+// Sent after the echo of "big", more than fits into the socket buffers
+inline constexpr std::size_t kBigOutputSize = 8 * 1024 * 1024;
+
+/**
+ * @brief Echoes, then closes or lingers as told by the data. "big" adds
+ * kBigOutputSize bytes to the echo, then closes. "stop" stops the service.
+ */
+class AfterWriteHandler {
+ public:
+  template <typename Service>
+  static auto OnAccept(Service* service, toyws::Socket listeningFd,
+                       toyws::Client* client) -> void {
+    service->AsyncAccept(listeningFd);
+    service->AsyncRead(client->IoServiceSlot());
+  }
+
+  template <typename Service>
+  static auto OnRead(Service* service, toyws::Client* client) -> void {
+    const auto data = client->Buffer().ToString();
+    auto after = toyws::AfterWrite::kOnWrite;
+    if (data.starts_with("close")) {
+      after = toyws::AfterWrite::kClose;
+    } else if (data.starts_with("linger")) {
+      after = toyws::AfterWrite::kLinger;
+    } else if (data.starts_with("big")) {
+      client->SetOutput(
+          std::make_shared<const std::string>(kBigOutputSize, 'x'));
+      after = toyws::AfterWrite::kClose;
+    }
+    service->AsyncWrite(client->IoServiceSlot(), after);
+  }
+
+  template <typename Service>
+  static auto OnWrite(Service* service, toyws::Client* client) -> void {
+    service->Close(client);
+    service->Stop();
+  }
+
+  template <typename Service>
+  static auto OnHandoff(Service* service, toyws::Client* client) -> void {
+    service->AsyncRead(client->IoServiceSlot());
+  }
+  template <typename Service>
+  static auto OnSent(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
+};
+namespace toyws {
+template class UringIoService<AfterWriteHandler>;
+template class EpollIoService<AfterWriteHandler>;
+}  // namespace toyws
+
+/**
+ * @brief Hands each connection over to target, which echoes once and stops.
+ * The service that accepted it stops as well.
+ */
+class HandoffHandler {
+ public:
+  static inline void* target = nullptr;  // Of the same Service type
+
+  template <typename Service>
+  static auto OnAccept(Service* service, toyws::Socket /*listeningFd*/,
+                       toyws::Client* client) -> void {
+    service->Handoff(*static_cast<Service*>(target),
+                     service->TakeClient(client->IoServiceSlot()));
+    service->Stop();
+  }
+
+  template <typename Service>
+  static auto OnRead(Service* service, toyws::Client* client) -> void {
+    service->AsyncWrite(client->IoServiceSlot());
+  }
+
+  template <typename Service>
+  static auto OnWrite(Service* service, toyws::Client* client) -> void {
+    service->Close(client);
+    service->Stop();
+  }
+
+  template <typename Service>
+  static auto OnHandoff(Service* service, toyws::Client* client) -> void {
+    service->AsyncRead(client->IoServiceSlot());
+  }
+  template <typename Service>
+  static auto OnSent(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
+};
+namespace toyws {
+template class UringIoService<HandoffHandler>;
+template class EpollIoService<HandoffHandler>;
+}  // namespace toyws
+
+// Messages queued for a connection by DuplexHandler as it is accepted, all
+// sharing one buffer
+inline constexpr std::size_t kDuplexMessages = 64;
+inline constexpr std::size_t kDuplexMessageSize = 64 * 1024;
+
+/**
+ * @brief Sends kDuplexMessages to each connection while reading from it, and
+ * echoes what it reads after them. Stops once the peer closes.
+ */
+class DuplexHandler {
+ public:
+  static inline int sent = 0;  // OnSent calls
+
+  template <typename Service>
+  static auto OnAccept(Service* service, toyws::Socket listeningFd,
+                       toyws::Client* client) -> void {
+    service->AsyncAccept(listeningFd);
+    const auto message =
+        std::make_shared<const std::string>(kDuplexMessageSize, 'm');
+    for (std::size_t i = 0; i < kDuplexMessages; ++i) {
+      client->Outbox().push_back(message);
+    }
+    service->AsyncSend(client->IoServiceSlot());
+    service->AsyncRead(client->IoServiceSlot());
+  }
+
+  template <typename Service>
+  static auto OnRead(Service* service, toyws::Client* client) -> void {
+    if (client->Buffer().Size() == 0) {
+      service->Close(client);
+      service->Stop();
+      return;
+    }
+    client->Outbox().push_back(
+        std::make_shared<const std::string>(client->Buffer().ToString()));
+    service->AsyncSend(client->IoServiceSlot());
+    service->AsyncRead(client->IoServiceSlot());
+  }
+
+  template <typename Service>
+  static auto OnWrite(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
+
+  template <typename Service>
+  static auto OnHandoff(Service* service, toyws::Client* client) -> void {
+    service->AsyncRead(client->IoServiceSlot());
+  }
+
+  template <typename Service>
+  static auto OnSent(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {
+    ++sent;
+  }
+};
+namespace toyws {
+template class UringIoService<DuplexHandler>;
+template class EpollIoService<DuplexHandler>;
+}  // namespace toyws
+
+/**
+ * @brief Sends a message to each connection & waits for the peer to close,
+ * ignoring what it sends. Stops once it did.
+ */
+class WaitCloseHandler {
+ public:
+  static inline bool closedEmpty = false;  // OnRead saw an empty buffer
+
+  template <typename Service>
+  static auto OnAccept(Service* service, toyws::Socket listeningFd,
+                       toyws::Client* client) -> void {
+    service->AsyncAccept(listeningFd);
+    client->Outbox().push_back(std::make_shared<const std::string>("hello"));
+    service->AsyncSend(client->IoServiceSlot());
+    service->AsyncWaitClose(client->IoServiceSlot());
+  }
+
+  template <typename Service>
+  static auto OnRead(Service* service, toyws::Client* client) -> void {
+    closedEmpty = client->Buffer().Size() == 0;
+    service->Close(client);
+    service->Stop();
+  }
+
+  template <typename Service>
+  static auto OnWrite(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
+
+  template <typename Service>
+  static auto OnHandoff(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
+
+  template <typename Service>
+  static auto OnSent(Service* /*service*/, toyws::Client* /*client*/)
+      -> void {}
+};
+namespace toyws {
+template class UringIoService<WaitCloseHandler>;
+template class EpollIoService<WaitCloseHandler>;
+}  // namespace toyws
+
+/**
+ * @brief Echo server that stops after a number of connections
+ */
+class CountingEchoHandler : public EchoHandler {
+ public:
+  static inline int remaining = 0;
+
+  template <typename Service>
+  static auto OnWrite(Service* service, toyws::Client* client) -> void {
+    service->Close(client);
+    if (--remaining == 0) {
+      service->Stop();
+    }
+  }
+};
+namespace toyws {
+template class UringIoService<CountingEchoHandler>;
+template class EpollIoService<CountingEchoHandler>;
+}  // namespace toyws
+
+/**
+ * @brief The backends that tests run against.
+ */
+struct Uring {
+  static constexpr const char* kName = "uring";
+  template <typename Handler>
+  using Service = toyws::UringIoService<Handler>;
+};
+
+struct Epoll {
+  static constexpr const char* kName = "epoll";
+  template <typename Handler>
+  using Service = toyws::EpollIoService<Handler>;
+};
+
+/**
+ * @brief Whether Backend can be used on this host. io_uring may be disabled,
+ * e.g. by seccomp in containers.
+ */
+template <typename Backend>
+auto BackendAvailable() -> bool {
+  try {
+    typename Backend::template Service<EchoHandler> service;
+    return true;
+  } catch (const toyws::Error&) {
+    return false;
+  }
 }
 
 /**
  * @brief Io service fixture. Runs IoService in seperate thread for easier
  * tests.
  */
-template <typename Handler>
+template <typename Backend, typename Handler>
 struct IoServiceFixture {
-  toyws::IoService<Handler> service;
+  typename Backend::template Service<Handler> service;
   std::thread thread;
   uint16_t port;
 
@@ -122,8 +393,11 @@ struct IoServiceFixture {
   }
 };
 
-TEST_CASE("IoService simple echo", "[library]") {
-  IoServiceFixture<EchoHandler> service;
+TEMPLATE_TEST_CASE("IoService simple echo", "[library]", Uring, Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  IoServiceFixture<TestType, EchoHandler> service;
 
   toyws::TestClient client{service.port};
   auto response = client.RawRequest("Hello There", 32);
@@ -131,8 +405,51 @@ TEST_CASE("IoService simple echo", "[library]") {
   REQUIRE(response == "Hello There");
 }
 
-TEST_CASE("IoService + TestClient HTTP exchange", "[library]") {
-  IoServiceFixture<HttpBasicHandler> service;
+TEMPLATE_TEST_CASE("IoService closes after write", "[library]", Uring,
+                   Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  IoServiceFixture<TestType, AfterWriteHandler> service;
+
+  SECTION("Close") {
+    toyws::TestClient client{service.port};
+    REQUIRE(client.RawRequest("close", 32) == "close");
+    // End of stream
+    REQUIRE(client.RawRequest("", 32).empty());
+  }
+
+  SECTION("Linger") {
+    toyws::TestClient client{service.port};
+    REQUIRE(client.RawRequest("linger", 32) == "linger");
+    REQUIRE(client.RawRequest("", 32).empty());
+    // Still read (and discarded) after the shutdown
+    REQUIRE(client.RawRequest("more", 32).empty());
+  }
+
+  SECTION("Write larger than the socket buffers") {
+    toyws::TestClient client{service.port};
+    std::size_t received = client.RawRequest("big", 64 * 1024).size();
+    while (true) {
+      const auto piece = client.RawRequest("", 64 * 1024);
+      if (piece.empty()) {
+        break;
+      }
+      received += piece.size();
+    }
+    REQUIRE(received == 3 + kBigOutputSize);
+  }
+
+  toyws::TestClient stop{service.port};
+  REQUIRE(stop.RawRequest("stop", 32) == "stop");
+}
+
+TEMPLATE_TEST_CASE("IoService + TestClient HTTP exchange", "[library]", Uring,
+                   Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  IoServiceFixture<TestType, HttpBasicHandler> service;
 
   toyws::TestClient client{service.port};
   auto response = client.Get("/");
@@ -140,3 +457,412 @@ TEST_CASE("IoService + TestClient HTTP exchange", "[library]") {
   REQUIRE(response.Status() == toyws::HttpStatus::kOk);
   REQUIRE(response.Reason() == "All Good");
 }
+
+TEMPLATE_TEST_CASE("IoService file I/O", "[library]", Uring, Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  // Per backend, as ctest may run both at once
+  const std::string path =
+      std::string{"io_service_test_file_"} + TestType::kName + ".txt";
+  {
+    std::ofstream file{path, std::ios::binary};
+    file << "Hello from disk";
+  }
+
+  typename TestType::template Service<EchoHandler> service;
+  toyws::AsyncFileIo& io = service;
+  int openResult = -1;
+  int statResult = -1;
+  std::uint64_t size = 0;
+  std::string data;
+  // The stat may complete before or after the open & read
+  int pending = 2;
+  const auto done = [&] {
+    if (--pending == 0) {
+      service.Stop();
+    }
+  };
+  io.Stat(path, [&](int result, const struct statx& info) {
+    statResult = result;
+    size = info.stx_size;
+    done();
+  });
+  io.Open(path, O_RDONLY, [&](int fd) {
+    openResult = fd;
+    if (fd < 0) {
+      done();
+      return;
+    }
+    io.Read(fd, 6, 64, [&, fd](int result, std::string_view read) {
+      if (result >= 0) {
+        data = read;
+      }
+      io.CloseFile(fd);
+      done();
+    });
+  });
+  service.Run();
+  std::remove(path.c_str());
+
+  REQUIRE(statResult == 0);
+  REQUIRE(size == 15);
+  REQUIRE(openResult >= 0);
+  REQUIRE(data == "from disk");
+}
+
+TEMPLATE_TEST_CASE("IoService opens files beneath a directory", "[library]",
+                   Uring, Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  std::string directory = "io_service_test_XXXXXX";
+  REQUIRE(mkdtemp(directory.data()) != nullptr);
+  const auto path = directory + "/file.txt";
+  {
+    std::ofstream file{path, std::ios::binary};
+    file << "Hello from disk";
+  }
+  const int dirFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  REQUIRE(dirFd >= 0);
+
+  typename TestType::template Service<EchoHandler> service;
+  toyws::AsyncFileIo& io = service;
+  int outsideResult = 0;
+  int statResult = -1;
+  std::uint64_t size = 0;
+  // The same file through the parent first, then as it is
+  io.OpenBeneath(dirFd, "../" + path, O_RDONLY, [&](int outside) {
+    outsideResult = outside;
+    if (outside >= 0) {
+      io.CloseFile(outside);
+    }
+    io.OpenBeneath(dirFd, "file.txt", O_RDONLY, [&](int fd) {
+      if (fd < 0) {
+        service.Stop();
+        return;
+      }
+      io.StatFile(fd, [&, fd](int result, const struct statx& info) {
+        statResult = result;
+        size = info.stx_size;
+        io.CloseFile(fd);
+        service.Stop();
+      });
+    });
+  });
+  service.Run();
+  close(dirFd);
+  std::remove(path.c_str());
+  std::remove(directory.c_str());
+
+  REQUIRE(outsideResult < 0);
+  REQUIRE(statResult == 0);
+  REQUIRE(size == 15);
+}
+
+TEMPLATE_TEST_CASE("IoService drops what file I/O completions throw",
+                   "[library]", Uring, Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  typename TestType::template Service<EchoHandler> service;
+  toyws::AsyncFileIo& io = service;
+  int stats = 0;
+  // Each throws, and the next is started from the one before
+  std::function<void(int, const struct statx&)> next =
+      [&](int /*result*/, const struct statx& /*info*/) {
+        if (++stats == 3) {
+          service.Stop();
+        } else {
+          io.Stat(".", next);
+        }
+        throw std::runtime_error("Completion failed");
+      };
+  io.Stat(".", next);
+  service.Run();
+
+  REQUIRE(stats == 3);
+}
+
+TEMPLATE_TEST_CASE("IoService hands connections over", "[library]", Uring,
+                   Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  typename TestType::template Service<HandoffHandler> target;
+  HandoffHandler::target = &target;
+  std::thread targetThread{[&] { target.Run(); }};
+  {
+    IoServiceFixture<TestType, HandoffHandler> service;
+    toyws::TestClient client{service.port};
+    REQUIRE(client.RawRequest("Hello There", 32) == "Hello There");
+  }
+  targetThread.join();
+
+  REQUIRE(target.Metrics().accepts.Value() == 0);
+  REQUIRE(target.Metrics().closes.Value() == 1);
+  REQUIRE(target.Load() == 0);
+}
+
+TEMPLATE_TEST_CASE("IoService wakes up for other threads", "[library]", Uring,
+                   Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  typename TestType::template Service<EchoHandler> service;
+
+  SECTION("Posted tasks run on the thread of Run()") {
+    constexpr int kTasks = 3;
+    int ran = 0;
+    bool onRunThread = true;
+    const auto runThread = std::this_thread::get_id();
+    std::thread poster{[&] {
+      for (int i = 0; i < kTasks; ++i) {
+        service.Post([&] {
+          onRunThread = onRunThread && std::this_thread::get_id() == runThread;
+          if (++ran == kTasks) {
+            service.Stop();
+          }
+        });
+      }
+    }};
+    service.Run();
+    poster.join();
+
+    REQUIRE(ran == kTasks);
+    REQUIRE(onRunThread);
+  }
+
+  SECTION("Stop()") {
+    std::thread stopper{[&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds{50});
+      service.Stop();
+    }};
+    service.Run();
+    stopper.join();
+  }
+}
+
+TEMPLATE_TEST_CASE("IoService sends while reading", "[library]", Uring,
+                   Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  DuplexHandler::sent = 0;
+  const std::string_view ping = "ping";
+  const auto expected = kDuplexMessages * kDuplexMessageSize + ping.size();
+  std::string received;
+  {
+    IoServiceFixture<TestType, DuplexHandler> service;
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(service.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(connect(sock, reinterpret_cast<const sockaddr*>(&address),
+                    sizeof(address)) == 0);
+
+    // Read by the server while what it sends fills the socket buffers
+    REQUIRE(send(sock, ping.data(), ping.size(), 0) ==
+            static_cast<ssize_t>(ping.size()));
+
+    std::vector<char> piece(64 * 1024);
+    while (received.size() < expected) {
+      const auto res = recv(sock, piece.data(), piece.size(), 0);
+      if (res <= 0) {
+        break;
+      }
+      received.append(piece.data(), static_cast<std::size_t>(res));
+    }
+    shutdown(sock, SHUT_WR);
+    REQUIRE(recv(sock, piece.data(), piece.size(), 0) == 0);
+    close(sock);
+  }
+
+  REQUIRE(received.size() == expected);
+  REQUIRE(received.ends_with(ping));
+  REQUIRE(received.find_first_not_of('m') == expected - ping.size());
+  REQUIRE(DuplexHandler::sent >= 1);
+}
+
+TEMPLATE_TEST_CASE("IoService waits for the peer to close", "[library]",
+                   Uring, Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  WaitCloseHandler::closedEmpty = false;
+  const std::string ignored(3 * toyws::kDiscardSize, 'x');
+  std::string received;
+  std::uint64_t bytesRead = 0;
+  {
+    IoServiceFixture<TestType, WaitCloseHandler> service;
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(service.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(connect(sock, reinterpret_cast<const sockaddr*>(&address),
+                    sizeof(address)) == 0);
+
+    // Discarded, rather than ending the wait
+    REQUIRE(send(sock, ignored.data(), ignored.size(), 0) ==
+            static_cast<ssize_t>(ignored.size()));
+    std::array<char, 16> piece{};
+    while (received.size() < 5) {
+      const auto res = recv(sock, piece.data(), piece.size(), 0);
+      if (res <= 0) {
+        break;
+      }
+      received.append(piece.data(), static_cast<std::size_t>(res));
+    }
+    close(sock);
+    service.thread.join();
+    bytesRead = service.service.Metrics().bytesRead.Value();
+  }
+
+  REQUIRE(received == "hello");
+  REQUIRE(WaitCloseHandler::closedEmpty);
+  REQUIRE(bytesRead == ignored.size());
+}
+
+TEST_CASE("IoService backs off accepting without descriptors",
+          "[library]") {
+  if (!BackendAvailable<Uring>()) {
+    SKIP("io_uring not available");
+  }
+  IoServiceFixture<Uring, EchoHandler> fixture;
+  const int sock = socket(AF_INET, SOCK_STREAM, 0);
+  REQUIRE(sock >= 0);
+
+  // Out of descriptors from the lowest free one on
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  const int lowest = dup(sock);
+  close(lowest);
+  rlimit lowered = limit;
+  lowered.rlim_cur = static_cast<rlim_t>(lowest);
+  REQUIRE(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(fixture.port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const int connected = connect(
+      sock, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+  std::this_thread::sleep_for(3 * toyws::kAcceptBackoff);
+  const auto errors = fixture.service.Metrics().cqeErrors.Value();
+  setrlimit(RLIMIT_NOFILE, &limit);
+  REQUIRE(connected == 0);
+
+  // Accepted once descriptors are available again, which stops the service
+  REQUIRE(send(sock, "hi", 2, MSG_NOSIGNAL) == 2);
+  std::array<char, 2> echo{};
+  REQUIRE(recv(sock, echo.data(), echo.size(), MSG_WAITALL) == 2);
+  REQUIRE(std::string_view{echo.data(), echo.size()} == "hi");
+  close(sock);
+
+  // An accept per backoff, rather than as many as the ring can spin through
+  REQUIRE(errors > 0);
+  REQUIRE(errors <= 5);
+}
+
+TEST_CASE("IoService submits more than fits into the SQ", "[library]") {
+  if (!BackendAvailable<Uring>()) {
+    SKIP("io_uring not available");
+  }
+  toyws::UringIoService<EchoHandler> service;
+  constexpr int kOps = 3 * toyws::kSqSize + 1;
+  int completed = 0;
+  // Started from a completion, when submissions are batched
+  service.Stat(".", [&](int /*result*/, const struct statx& /*info*/) {
+    for (int i = 0; i < kOps; ++i) {
+      service.Stat(".", [&](int result, const struct statx& /*info*/) {
+        REQUIRE(result == 0);
+        if (++completed == kOps) {
+          service.Stop();
+        }
+      });
+    }
+  });
+  service.Run();
+
+  REQUIRE(completed == kOps);
+  REQUIRE(service.Metrics().sqFull.Value() > 0);
+}
+
+TEST_CASE("IoService lets SQEs wait longer to be submitted when busier",
+          "[library]") {
+  if (!BackendAvailable<Uring>()) {
+    SKIP("io_uring not available");
+  }
+  toyws::UringIoService<EchoHandler> service;
+  REQUIRE(service.SubmitThreshold() == std::chrono::nanoseconds{0});
+
+  // A few large batches of completions, then one at a time
+  constexpr int kBusyOps = 3 * toyws::kCqSize;
+  constexpr int kIdleOps = 32;
+  int completed = 0;
+  int idle = 0;
+  auto busyThreshold = std::chrono::nanoseconds{0};
+  std::function<void(int, const struct statx&)> next =
+      [&](int /*result*/, const struct statx& /*info*/) {
+        if (++idle == kIdleOps) {
+          service.Stop();
+        } else {
+          service.Stat(".", next);
+        }
+      };
+  service.Stat(".", [&](int /*result*/, const struct statx& /*info*/) {
+    for (int i = 0; i < kBusyOps; ++i) {
+      service.Stat(".", [&](int /*result*/, const struct statx& /*info*/) {
+        if (++completed == kBusyOps) {
+          busyThreshold = service.SubmitThreshold();
+          service.Stat(".", next);
+        }
+      });
+    }
+  });
+  service.Run();
+
+  REQUIRE(busyThreshold > std::chrono::nanoseconds{0});
+  REQUIRE(busyThreshold <= service.SubmitLatency());
+  REQUIRE(service.SubmitThreshold() < busyThreshold);
+}
+
+TEMPLATE_TEST_CASE(
+    "IoService holds more connections than it starts with slots for",
+    "[library]", Uring, Epoll) {
+  if (!BackendAvailable<TestType>()) {
+    SKIP("Backend not available");
+  }
+  constexpr int kConnections = static_cast<int>(toyws::kClientSlots) + 20;
+  CountingEchoHandler::remaining = kConnections;
+  IoServiceFixture<TestType, CountingEchoHandler> service;
+
+  // All connected at once, before any is served
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(service.port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::vector<int> sockets;
+  for (int i = 0; i < kConnections; ++i) {
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(connect(sock, reinterpret_cast<const sockaddr*>(&address),
+                    sizeof(address)) == 0);
+    sockets.push_back(sock);
+  }
+
+  int echoed = 0;
+  for (const int sock : sockets) {
+    char byte = 'x';
+    if (send(sock, &byte, 1, 0) == 1 && recv(sock, &byte, 1, 0) == 1 &&
+        byte == 'x') {
+      ++echoed;
+    }
+    close(sock);
+  }
+
+  REQUIRE(echoed == kConnections);
+}
@@ -0,0 +1,167 @@
+#include "toyws/listener.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "toyws/error.hpp"
+
+static auto GetOption(int sock, int level, int name) -> int {
+  int value = 0;
+  socklen_t length = sizeof(value);
+  REQUIRE(getsockopt(sock, level, name, &value, &length) == 0);
+  return value;
+}
+
+static auto ConnectTcp(int family, const char* address, std::uint16_t port)
+    -> int {
+  sockaddr_storage name{};
+  socklen_t nameLen = 0;
+  if (family == AF_INET) {
+    auto* name4 = reinterpret_cast<sockaddr_in*>(&name);
+    name4->sin_family = AF_INET;
+    name4->sin_port = htons(port);
+    REQUIRE(inet_pton(AF_INET, address, &name4->sin_addr) == 1);
+    nameLen = sizeof(sockaddr_in);
+  } else {
+    auto* name6 = reinterpret_cast<sockaddr_in6*>(&name);
+    name6->sin6_family = AF_INET6;
+    name6->sin6_port = htons(port);
+    REQUIRE(inet_pton(AF_INET6, address, &name6->sin6_addr) == 1);
+    nameLen = sizeof(sockaddr_in6);
+  }
+  int sock = socket(family, SOCK_STREAM, 0);
+  REQUIRE(sock != -1);
+  REQUIRE(connect(sock, reinterpret_cast<const sockaddr*>(&name), nameLen) ==
+          0);
+  return sock;
+}
+
+TEST_CASE("Listener applies TCP options", "[library]") {
+  toyws::ListenerOptions options;
+  options.backlog = 128;
+  options.deferAccept = std::chrono::seconds{5};
+  options.receiveBufferSize = 256 * 1024;
+
+  auto sock = toyws::MakeListeningSocket("127.0.0.1", 0, options);
+  const auto port = toyws::LocalPort(sock);
+  REQUIRE(port != 0);
+  REQUIRE(GetOption(sock, SOL_SOCKET, SO_ACCEPTCONN) == 1);
+  REQUIRE(GetOption(sock, IPPROTO_TCP, TCP_NODELAY) != 0);
+  REQUIRE(GetOption(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT) > 0);
+  // The kernel doubles the requested size for bookkeeping
+  REQUIRE(GetOption(sock, SOL_SOCKET, SO_RCVBUF) >= 256 * 1024);
+
+  // Accepted sockets inherit the options. Deferred accepts wait for data.
+  auto client = ConnectTcp(AF_INET, "127.0.0.1", port);
+  REQUIRE(write(client, "x", 1) == 1);
+  auto accepted = accept(sock, nullptr, nullptr);
+  REQUIRE(accepted != -1);
+  REQUIRE(GetOption(accepted, IPPROTO_TCP, TCP_NODELAY) != 0);
+
+  close(accepted);
+  close(client);
+  close(sock);
+}
+
+TEST_CASE("Listeners share a port with SO_REUSEPORT", "[library]") {
+  toyws::ListenerOptions options;
+  options.reusePort = true;
+  auto first = toyws::MakeListeningSocket("127.0.0.1", 0, options);
+  const auto port = toyws::LocalPort(first);
+  auto second = toyws::MakeListeningSocket("127.0.0.1", port, options);
+  REQUIRE(GetOption(second, SOL_SOCKET, SO_REUSEPORT) == 1);
+  REQUIRE(toyws::LocalPort(second) == port);
+
+  // Not without the option
+  REQUIRE_THROWS_AS(toyws::MakeListeningSocket("127.0.0.1", port),
+                    toyws::Error);
+
+  close(second);
+  close(first);
+}
+
+TEST_CASE("Listener on IPv6", "[library]") {
+  toyws::Socket sock = -1;
+  try {
+    sock = toyws::MakeListeningSocket("::", 0);
+  } catch (const toyws::Error&) {
+    SKIP("IPv6 is not available");
+  }
+  const auto port = toyws::LocalPort(sock);
+
+  SECTION("Dual-stack accepts IPv4") {
+    auto client = ConnectTcp(AF_INET, "127.0.0.1", port);
+    auto accepted = accept(sock, nullptr, nullptr);
+    REQUIRE(accepted != -1);
+    close(accepted);
+    close(client);
+  }
+
+  SECTION("IPv6 only") {
+    close(sock);
+    toyws::ListenerOptions options;
+    options.dualStack = false;
+    sock = toyws::MakeListeningSocket("::1", 0, options);
+    REQUIRE(GetOption(sock, IPPROTO_IPV6, IPV6_V6ONLY) == 1);
+    auto client = ConnectTcp(AF_INET6, "::1", toyws::LocalPort(sock));
+    close(client);
+  }
+
+  close(sock);
+}
+
+TEST_CASE("Listener on UNIX domain socket", "[library]") {
+  const auto path =
+      (std::filesystem::temp_directory_path() / "toyws_listener_test.sock")
+          .string();
+  toyws::ListenerOptions options;
+  options.unixMode = 0600;
+
+  // A stale socket file is replaced
+  close(toyws::MakeListeningSocket("unix:" + path, 0, options));
+  auto sock = toyws::MakeListeningSocket("unix:" + path, 0, options);
+  REQUIRE((std::filesystem::status(path).permissions() &
+           std::filesystem::perms::all) ==
+          (std::filesystem::perms::owner_read |
+           std::filesystem::perms::owner_write));
+
+  sockaddr_un name{};
+  name.sun_family = AF_UNIX;
+  std::memcpy(name.sun_path, path.data(), path.size());
+  int client = socket(AF_UNIX, SOCK_STREAM, 0);
+  REQUIRE(connect(client, reinterpret_cast<const sockaddr*>(&name),
+                  sizeof(name)) == 0);
+  auto accepted = accept(sock, nullptr, nullptr);
+  REQUIRE(accepted != -1);
+
+  close(accepted);
+  close(client);
+  close(sock);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Listener rejects bad addresses", "[library]") {
+  REQUIRE_THROWS_AS(toyws::MakeListeningSocket("localhost", 0), toyws::Error);
+  REQUIRE_THROWS_AS(toyws::MakeListeningSocket("unix:", 0), toyws::Error);
+  // Other files than sockets are not replaced
+  const auto path =
+      (std::filesystem::temp_directory_path() / "toyws_listener_test.txt")
+          .string();
+  std::ofstream{path} << "Not a socket";
+  REQUIRE_THROWS_AS(toyws::MakeListeningSocket("unix:" + path, 0),
+                    toyws::Error);
+  REQUIRE(std::filesystem::exists(path));
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,34 @@
+#include "toyws/load_balance.hpp"
+
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <cstddef>
+
+TEST_CASE("Connections are handed to the least loaded ring", "[library]") {
+  toyws::LoadBalanceOptions options;
+  options.minImbalance = 4;
+
+  SECTION("Only once the imbalance is large enough") {
+    const std::array<std::size_t, 3> loads{10, 7, 8};
+    REQUIRE(!toyws::PickHandoffTarget(loads, 0, options));
+    const std::array<std::size_t, 3> more{11, 7, 8};
+    REQUIRE(toyws::PickHandoffTarget(more, 0, options) == 1);
+  }
+
+  SECTION("Never to itself") {
+    const std::array<std::size_t, 3> loads{0, 20, 20};
+    REQUIRE(!toyws::PickHandoffTarget(loads, 0, options));
+    REQUIRE(toyws::PickHandoffTarget(loads, 1, options) == 0);
+  }
+
+  SECTION("Ties go to the first") {
+    const std::array<std::size_t, 4> loads{9, 2, 5, 2};
+    REQUIRE(toyws::PickHandoffTarget(loads, 0, options) == 1);
+  }
+
+  SECTION("Disabled") {
+    options.enabled = false;
+    const std::array<std::size_t, 2> loads{100, 0};
+    REQUIRE(!toyws::PickHandoffTarget(loads, 0, options));
+  }
+}
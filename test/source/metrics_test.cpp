@@ -0,0 +1,54 @@
+#include "toyws/metrics.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <string>
+
+TEST_CASE("LogHistogram bucket bounds", "[library]") {
+  using toyws::LogHistogram;
+
+  for (std::uint64_t value :
+       {0U, 1U, 3U, 4U, 7U, 8U, 9U, 15U, 100U, 1000U, 123456U}) {
+    auto bucket = LogHistogram::BucketIndex(value);
+    REQUIRE(value <= LogHistogram::BucketUpperBound(bucket));
+    if (bucket > 0) {
+      REQUIRE(value > LogHistogram::BucketUpperBound(bucket - 1));
+    }
+  }
+
+  REQUIRE(LogHistogram::BucketIndex(UINT64_MAX) ==
+          LogHistogram::kBucketCount - 1);
+}
+
+TEST_CASE("MetricsRegistry aggregates rings", "[library]") {
+  toyws::RingMetrics first;
+  toyws::RingMetrics second;
+  toyws::MetricsRegistry registry;
+  registry.Register(&first);
+  registry.Register(&second);
+
+  first.accepts.Add();
+  second.accepts.Add(2);
+  first.requests.Add();
+  first.requestLatencyUs.Record(50);
+  second.requests.Add();
+  second.requestLatencyUs.Record(2000);
+
+  auto snapshot = registry.Snapshot();
+  REQUIRE(snapshot.accepts == 3);
+  REQUIRE(snapshot.requests == 2);
+  REQUIRE(snapshot.requestLatencySumUs == 2050);
+
+  auto text = registry.RenderPrometheus();
+  REQUIRE(text.find("toyws_accepts_total 3\n") != std::string::npos);
+  REQUIRE(text.find(
+              "toyws_request_duration_seconds_bucket{le=\"0.0001\"} 1\n") !=
+          std::string::npos);
+  REQUIRE(text.find("toyws_request_duration_seconds_bucket{le=\"+Inf\"} 2\n") !=
+          std::string::npos);
+  REQUIRE(text.find("toyws_request_duration_seconds_count 2\n") !=
+          std::string::npos);
+
+  registry.Unregister(&second);
+  REQUIRE(registry.Snapshot().accepts == 1);
+}
@@ -0,0 +1,203 @@
+#include "toyws/request_body.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <catch2/catch_test_macros.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "toyws/error.hpp"
+
+// Decode input fed in pieces of at most step bytes
+static auto Decode(toyws::ChunkedDecoder& decoder, std::string_view input,
+                   std::size_t step) -> std::string {
+  std::string out;
+  while (!input.empty()) {
+    auto piece = input.substr(0, step);
+    input.remove_prefix(piece.size());
+    while (true) {
+      auto data = decoder.Next(piece);
+      if (data.empty()) {
+        break;
+      }
+      out += data;
+    }
+  }
+  return out;
+}
+
+TEST_CASE("Chunked body decoding", "[library]") {
+  const std::string body =
+      "7\r\nMozilla\r\n"
+      "11;name=value\r\nDeveloper Network\r\n"
+      "0\r\n"
+      "Expires: never\r\n"
+      "\r\n";
+
+  // Every split of the input must decode the same
+  for (std::size_t step = 1; step <= body.size(); ++step) {
+    toyws::ChunkedDecoder decoder;
+    REQUIRE(Decode(decoder, body, step) == "MozillaDeveloper Network");
+    REQUIRE(decoder.Done());
+  }
+
+  SECTION("Data after the last chunk is left alone") {
+    toyws::ChunkedDecoder decoder;
+    std::string_view input = "3\r\nabc\r\n0\r\n\r\nGET /";
+    REQUIRE(decoder.Next(input) == "abc");
+    REQUIRE(decoder.Next(input).empty());
+    REQUIRE(decoder.Done());
+    REQUIRE(input == "GET /");
+  }
+
+  SECTION("Malformed input") {
+    for (std::string_view bad :
+         {"x\r\n", "3\r\nabcX\r\n", "10000000000000000\r\n"}) {
+      toyws::ChunkedDecoder decoder;
+      Decode(decoder, bad, bad.size());
+      REQUIRE(decoder.Failed());
+    }
+  }
+}
+
+TEST_CASE("BodyBuffer spills to disk past threshold", "[library]") {
+  toyws::BodyBuffer buffer{8, ""};
+  buffer.Append("1234");
+  REQUIRE_FALSE(buffer.Spilled());
+  buffer.Append("5678");
+  REQUIRE_FALSE(buffer.Spilled());
+
+  buffer.Append("9");
+  REQUIRE(buffer.Spilled());
+  REQUIRE(buffer.Size() == 9);
+  buffer.Append("abc");
+
+  std::string content(16, '\0');
+  const auto n = pread(buffer.File(), content.data(), content.size(), 0);
+  REQUIRE(n == 12);
+  content.resize(static_cast<std::size_t>(n));
+  REQUIRE(content == "123456789abc");
+  REQUIRE(buffer.TakeMemory().empty());
+}
+
+/**
+ * @brief File I/O done right away, with completions held back until Run(), as
+ * a ring would.
+ */
+class DeferredFileIo : public toyws::AsyncFileIo {
+ public:
+  auto Open(std::string path, int flags, toyws::OpenCallback done)
+      -> void override {
+    const int fd = open(path.c_str(), flags | O_CLOEXEC, toyws::kFileMode);
+    const int res = fd == -1 ? -errno : fd;
+    completions.emplace_back([done = std::move(done), res] { done(res); });
+  }
+
+  auto OpenBeneath(int /*dirFd*/, std::string /*path*/, int /*flags*/,
+                   toyws::OpenCallback /*done*/) -> void override {
+    throw std::logic_error("Not used");
+  }
+
+  auto Read(int /*fd*/, std::uint64_t /*offset*/, std::size_t /*length*/,
+            toyws::ReadCallback /*done*/) -> void override {
+    throw std::logic_error("Not used");
+  }
+
+  auto Write(int fd, std::uint64_t offset, std::string data,
+             toyws::WriteCallback done) -> void override {
+    const auto written =
+        failWrites ? -1
+                   : pwrite(fd, data.data(), data.size(),
+                            static_cast<off_t>(offset));
+    const int res = written == -1 ? -EIO : static_cast<int>(written);
+    completions.emplace_back([done = std::move(done), res] { done(res); });
+  }
+
+  auto Stat(std::string /*path*/, toyws::StatCallback /*done*/)
+      -> void override {
+    throw std::logic_error("Not used");
+  }
+
+  auto StatFile(int /*fd*/, toyws::StatCallback /*done*/) -> void override {
+    throw std::logic_error("Not used");
+  }
+
+  auto CloseFile(int fd) -> void override { close(fd); }
+
+  // Complete what is in flight, including what that starts
+  auto Run() -> void {
+    while (!completions.empty()) {
+      auto pending = std::move(completions);
+      completions.clear();
+      for (auto& complete : pending) {
+        complete();
+      }
+    }
+  }
+
+  auto InFlight() const -> std::size_t { return completions.size(); }
+
+  bool failWrites = false;
+
+ private:
+  std::vector<std::function<void()>> completions;
+};
+
+TEST_CASE("BodyBuffer spills to disk with file I/O", "[library]") {
+  DeferredFileIo io;
+  bool flushed = false;
+
+  SECTION("Written once flushed") {
+    toyws::BodyBuffer buffer{4, "", &io};
+    buffer.Append("1234");
+    buffer.Append("5678");
+    REQUIRE(buffer.Spilled());
+    // Still being created, with what is appended meanwhile waiting for it
+    REQUIRE(buffer.File() == -1);
+    buffer.Append("9");
+    REQUIRE_FALSE(buffer.Flushed());
+
+    buffer.Flush([&] { flushed = true; });
+    REQUIRE_FALSE(flushed);
+    io.Run();
+    REQUIRE(flushed);
+    REQUIRE(buffer.Flushed());
+    REQUIRE_FALSE(buffer.Failed());
+
+    std::string content(16, '\0');
+    const auto n = pread(buffer.File(), content.data(), content.size(), 0);
+    REQUIRE(n == 9);
+    content.resize(static_cast<std::size_t>(n));
+    REQUIRE(content == "123456789");
+  }
+
+  SECTION("Failed writes") {
+    toyws::BodyBuffer buffer{4, "", &io};
+    io.failWrites = true;
+    buffer.Append("12345");
+    io.Run();
+    REQUIRE(buffer.Failed());
+    REQUIRE_THROWS_AS(buffer.Append("6"), toyws::Error);
+    buffer.Flush([&] { flushed = true; });
+    REQUIRE(flushed);
+  }
+
+  SECTION("Destroyed while writing") {
+    {
+      toyws::BodyBuffer buffer{4, "", &io};
+      buffer.Append("12345");
+      buffer.Flush([&] { flushed = true; });
+    }
+    REQUIRE(io.InFlight() == 1);
+    io.Run();
+    REQUIRE_FALSE(flushed);
+  }
+}
@@ -0,0 +1,243 @@
+#include "toyws/request_reader.hpp"
+
+#include <unistd.h>
+
+#include <any>
+#include <catch2/catch_test_macros.hpp>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "toyws/http_response.hpp"
+#include "toyws/router.hpp"
+
+using States = toyws::RequestReader::States;
+
+// Feed all of input to reader, step bytes at a time, as reads would
+static auto Feed(toyws::RequestReader& reader, const toyws::Route* route,
+                 std::string_view input, std::size_t step) -> void {
+  while (!input.empty() && reader.State() != States::kComplete &&
+         reader.State() != States::kError) {
+    auto data = input.substr(0, step);
+    input.remove_prefix(data.size());
+    if (reader.State() == States::kHead) {
+      data.remove_prefix(reader.ReadHead(data));
+      if (reader.State() != States::kBody) {
+        continue;
+      }
+      reader.BeginBody(route);
+    }
+    if (reader.State() == States::kBody) {
+      reader.ReadBody(data);
+    }
+  }
+}
+
+static auto Status(const toyws::Route* route, std::string_view input)
+    -> toyws::HttpStatus {
+  toyws::RequestReader reader;
+  Feed(reader, route, input, input.size());
+  return reader.State() == States::kError ? reader.ErrorStatus()
+                                          : toyws::HttpStatus::kOk;
+}
+
+static auto Noop(const toyws::HttpRequest& /*request*/,
+                 const toyws::HandlerContext& /*context*/,
+                 toyws::HttpResponse& /*response*/) -> void {}
+
+static auto CountChunks(const toyws::HttpRequest& /*request*/,
+                        toyws::HandlerContext& context,
+                        std::string_view chunk) -> void {
+  if (!context.UserData().has_value()) {
+    context.UserData() = std::string{};
+  }
+  std::any_cast<std::string&>(context.UserData()) += chunk;
+}
+
+static auto RefuseChunks(const toyws::HttpRequest& /*request*/,
+                         toyws::HandlerContext& context,
+                         std::string_view /*chunk*/) -> void {
+  if (context.UserData().has_value()) {
+    throw std::runtime_error("Second chunk");
+  }
+  context.UserData() = true;
+  throw toyws::HttpStatusError(toyws::HttpStatus::kPayloadTooLarge,
+                               "First chunk");
+}
+
+TEST_CASE("RequestReader accumulates head & body", "[library]") {
+  toyws::Route route{"/upload"};
+  route.SetHandler(Noop);
+
+  const std::string request =
+      "POST /upload HTTP/1.1\r\n"
+      "Host: localhost\r\n"
+      "Content-Length: 11\r\n"
+      "\r\n"
+      "hello world";
+
+  for (std::size_t step = 1; step <= request.size(); ++step) {
+    toyws::RequestReader reader;
+    Feed(reader, &route, request, step);
+    REQUIRE(reader.State() == States::kComplete);
+    REQUIRE(reader.Route() == &route);
+    REQUIRE(reader.Request().Resource() == "/upload");
+    REQUIRE(reader.Request().Body() == "hello world");
+  }
+
+  SECTION("With framing headers in any case") {
+    for (const std::string_view name :
+         {"content-length", "CONTENT-LENGTH", "content-Length"}) {
+      toyws::RequestReader reader;
+      Feed(reader, &route,
+           "POST /upload HTTP/1.1\r\n" + std::string{name} +
+               ": 5\r\n\r\nhello",
+           4);
+      REQUIRE(reader.State() == States::kComplete);
+      REQUIRE(reader.Request().Body() == "hello");
+    }
+
+    toyws::RequestReader reader;
+    Feed(reader, &route,
+         "POST /upload HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n"
+         "5\r\nhello\r\n0\r\n\r\n",
+         4);
+    REQUIRE(reader.State() == States::kComplete);
+    REQUIRE(reader.Request().Body() == "hello");
+  }
+
+  SECTION("Without a body") {
+    toyws::RequestReader reader;
+    Feed(reader, &route, "GET /upload HTTP/1.1\r\n\r\n", 5);
+    REQUIRE(reader.State() == States::kComplete);
+    REQUIRE(reader.Request().Body().empty());
+  }
+}
+
+TEST_CASE("RequestReader chunked, streamed & spilled bodies", "[library]") {
+  const std::string chunked =
+      "POST /upload HTTP/1.1\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\n"
+      "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+
+  SECTION("Buffered in memory") {
+    toyws::Route route{"/upload"};
+    toyws::RequestReader reader;
+    Feed(reader, &route, chunked, 7);
+    REQUIRE(reader.State() == States::kComplete);
+    REQUIRE(reader.Request().Body() == "hello world");
+    REQUIRE(reader.Request().BodyFile() == -1);
+  }
+
+  SECTION("Spilled to a file") {
+    toyws::Route route{"/upload"};
+    toyws::RouteOptions options;
+    options.body.spillThreshold = 4;
+    route.SetOptions(options);
+
+    toyws::RequestReader reader;
+    Feed(reader, &route, chunked, 7);
+    REQUIRE(reader.State() == States::kComplete);
+    REQUIRE(reader.Request().Body().empty());
+    REQUIRE(reader.Request().BodyFile() >= 0);
+
+    std::string content(32, '\0');
+    const auto n =
+        read(reader.Request().BodyFile(), content.data(), content.size());
+    REQUIRE(n == 11);
+    content.resize(static_cast<std::size_t>(n));
+    REQUIRE(content == "hello world");
+  }
+
+  SECTION("Streamed to the route") {
+    toyws::Route route{"/upload"};
+    toyws::RouteOptions options;
+    options.body.mode = toyws::BodyMode::kStream;
+    options.body.onChunk = CountChunks;
+    route.SetOptions(options);
+
+    toyws::RequestReader reader;
+    Feed(reader, &route, chunked, 3);
+    REQUIRE(reader.State() == States::kComplete);
+    REQUIRE(reader.Request().Body().empty());
+    REQUIRE(std::any_cast<const std::string&>(reader.Context().UserData()) ==
+            "hello world");
+  }
+
+  SECTION("Refused by the route") {
+    toyws::Route route{"/upload"};
+    toyws::RouteOptions options;
+    options.body.mode = toyws::BodyMode::kStream;
+    options.body.onChunk = RefuseChunks;
+    route.SetOptions(options);
+
+    toyws::RequestReader reader;
+    Feed(reader, &route, chunked, 3);
+    REQUIRE(reader.State() == States::kError);
+    REQUIRE(reader.ErrorStatus() == toyws::HttpStatus::kPayloadTooLarge);
+
+    // Anything else thrown is a fault of the server's
+    toyws::RequestReader other;
+    other.Context().UserData() = true;
+    Feed(other, &route, chunked, 3);
+    REQUIRE(other.State() == States::kError);
+    REQUIRE(other.ErrorStatus() == toyws::HttpStatus::kInternalServerError);
+  }
+}
+
+TEST_CASE("RequestReader rejects bad requests", "[library]") {
+  toyws::Route route{"/upload"};
+  toyws::RouteOptions options;
+  options.body.maxBytes = 8;
+  route.SetOptions(options);
+
+  using toyws::HttpStatus;
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nContent-Length: 9\r\n\r\n") ==
+          HttpStatus::kPayloadTooLarge);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                 "9\r\n123456789\r\n0\r\n\r\n") ==
+          HttpStatus::kPayloadTooLarge);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nContent-Length: 2\r\n"
+                 "Transfer-Encoding: chunked\r\n\r\n") ==
+          HttpStatus::kBadRequest);
+  // Whatever the case of the names
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\ncontent-length: 3\r\n"
+                 "Transfer-Encoding: chunked\r\n\r\n") ==
+          HttpStatus::kBadRequest);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nContent-Length: 3\r\n"
+                 "TRANSFER-encoding: chunked\r\n\r\n") ==
+          HttpStatus::kBadRequest);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\ncontent-length: 9\r\n\r\n") ==
+          HttpStatus::kPayloadTooLarge);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nContent-Length: x\r\n\r\n") ==
+          HttpStatus::kBadRequest);
+  // Codings other than chunked alone, even under it, are not implemented
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n"
+                 "\r\n") == HttpStatus::kNotImplemented);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\n"
+                 "Transfer-Encoding: chunked, gzip\r\n\r\n") ==
+          HttpStatus::kNotImplemented);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\n"
+                 "Transfer-Encoding: gzip, chunked\r\n\r\n") ==
+          HttpStatus::kNotImplemented);
+  REQUIRE(Status(&route,
+                 "POST /upload HTTP/1.1\r\nTransfer-Encoding: Chunked \r\n"
+                 "\r\n2\r\nhi\r\n0\r\n\r\n") == HttpStatus::kOk);
+  REQUIRE(Status(&route, "NOPE /upload HTTP/1.1\r\n\r\n") ==
+          HttpStatus::kBadRequest);
+  REQUIRE(Status(&route, "GET / HTTP/1.1\r\nX: " +
+                             std::string(toyws::RequestReader::kMaxHeadSize,
+                                         'x')) ==
+          HttpStatus::kRequestHeaderFieldsTooLarge);
+}
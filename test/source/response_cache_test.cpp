@@ -0,0 +1,122 @@
+#include "toyws/response_cache.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using Cache = toyws::ResponseCache;
+using Status = toyws::ResponseCache::LookupStatus;
+using namespace std::chrono_literals;
+
+static auto MakeBytes(std::size_t size) -> Cache::Bytes {
+  return std::make_shared<const std::string>(size, 'x');
+}
+
+static auto Ids(const std::vector<Cache::Waiter>& waiters)
+    -> std::vector<std::uint64_t> {
+  std::vector<std::uint64_t> ids;
+  for (const auto& waiter : waiters) {
+    ids.push_back(waiter.id);
+  }
+  return ids;
+}
+
+TEST_CASE("ResponseCache key normalization", "[library]") {
+  REQUIRE(Cache::NormalizeTarget("//a///b") == "/a/b");
+  REQUIRE(Cache::NormalizeTarget("/a?b=2&a=1") == "/a?a=1&b=2");
+  REQUIRE(Cache::NormalizeTarget("/a?&b=2&&a=1#frag") == "/a?a=1&b=2");
+
+  toyws::HttpRequest english{toyws::HttpMethod::GET,
+                             "/page",
+                             {{"Accept-Language", "en"}}};
+  toyws::HttpRequest swedish{toyws::HttpMethod::GET,
+                             "/page",
+                             {{"Accept-Language", "sv"}}};
+  REQUIRE(Cache::MakeKey(english, {}) == Cache::MakeKey(swedish, {}));
+  REQUIRE(Cache::MakeKey(english, {"Accept-Language"}) !=
+          Cache::MakeKey(swedish, {"Accept-Language"}));
+}
+
+TEST_CASE("ResponseCache hit, expiry & coalescing", "[library]") {
+  Cache cache;
+  const auto now = Cache::Clock::now();
+
+  REQUIRE(cache.Lookup("GET /", 1, now).status == Status::kMiss);
+  // Concurrent misses are coalesced onto the first
+  REQUIRE(cache.Lookup("GET /", 2, now).status == Status::kPending);
+  REQUIRE(cache.Lookup("GET /", 3, now + 10ms).status == Status::kPending);
+
+  auto waiters = cache.Complete("GET /", MakeBytes(10), now + 1s);
+  REQUIRE(Ids(waiters) == std::vector<std::uint64_t>{2, 3});
+  // Each waited since its own lookup
+  REQUIRE(waiters[1].since == now + 10ms);
+
+  auto hit = cache.Lookup("GET /", 4, now + 500ms);
+  REQUIRE(hit.status == Status::kHit);
+  REQUIRE(hit.bytes->size() == 10);
+  REQUIRE(cache.SizeBytes() == 10);
+
+  // Expired: regenerated by exactly one request
+  REQUIRE(cache.Lookup("GET /", 5, now + 2s).status == Status::kMiss);
+  REQUIRE(cache.Lookup("GET /", 6, now + 2s).status == Status::kPending);
+  REQUIRE(cache.SizeBytes() == 0);
+
+  // Uncacheable result: waiters are still handed back, nothing is stored
+  REQUIRE(Ids(cache.Complete("GET /", MakeBytes(10), std::nullopt)) ==
+          std::vector<std::uint64_t>{6});
+  REQUIRE(cache.Entries() == 0);
+}
+
+TEST_CASE("ResponseCache gives up on a miss not completed in time",
+          "[library]") {
+  toyws::ResponseCacheOptions options;
+  options.fillTimeout = 5s;
+  Cache cache{options};
+  const auto now = Cache::Clock::now();
+
+  REQUIRE(cache.Lookup("GET /", 1, now).status == Status::kMiss);
+  REQUIRE(cache.Lookup("GET /", 2, now + 1s).status == Status::kPending);
+
+  // The first is stuck: the next takes over, and its waiters with it
+  REQUIRE(cache.Lookup("GET /", 3, now + 5s).status == Status::kMiss);
+  REQUIRE(cache.Lookup("GET /", 4, now + 6s).status == Status::kPending);
+  REQUIRE(Ids(cache.Complete("GET /", MakeBytes(10), now + 1min)) ==
+          std::vector<std::uint64_t>{2, 4});
+  REQUIRE(cache.Lookup("GET /", 5, now + 7s).status == Status::kHit);
+
+  // Should the first complete after all, it leaves the entry alone
+  REQUIRE(cache.Complete("GET /", MakeBytes(20), now + 1min).empty());
+  REQUIRE(cache.SizeBytes() == 10);
+}
+
+TEST_CASE("ResponseCache evicts to stay within bounds", "[library]") {
+  toyws::ResponseCacheOptions options;
+  options.maxBytes = 100;
+  options.maxEntries = 3;
+  Cache cache{options};
+  const auto now = Cache::Clock::now();
+
+  for (int i = 0; i < 3; ++i) {
+    auto key = "GET /" + std::to_string(i);
+    REQUIRE(cache.Lookup(key, 0, now).status == Status::kMiss);
+    cache.Complete(key, MakeBytes(30), now + 1s);
+  }
+  REQUIRE(cache.Entries() == 3);
+
+  // Recently used entry survives eviction
+  REQUIRE(cache.Lookup("GET /0", 0, now).status == Status::kHit);
+
+  REQUIRE(cache.Lookup("GET /3", 0, now).status == Status::kMiss);
+  cache.Complete("GET /3", MakeBytes(30), now + 1s);
+  REQUIRE(cache.Entries() == 3);
+  REQUIRE(cache.SizeBytes() == 90);
+  REQUIRE(cache.Lookup("GET /0", 0, now).status == Status::kHit);
+
+  // Larger than the whole cache: never stored
+  REQUIRE(cache.Lookup("GET /big", 0, now).status == Status::kMiss);
+  cache.Complete("GET /big", MakeBytes(101), now + 1s);
+  REQUIRE(cache.Lookup("GET /big", 0, now).status == Status::kMiss);
+}
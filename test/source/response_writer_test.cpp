@@ -0,0 +1,77 @@
+#include "toyws/response_writer.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <format>
+#include <string>
+
+#include "toyws/buffer_chain.hpp"
+#include "toyws/error.hpp"
+#include "toyws/http_response.hpp"
+
+TEST_CASE("ResponseWriter writes into the buffer & fills in the length",
+          "[library]") {
+  toyws::BufferChain buffer;
+  buffer.Append("left over");
+  toyws::ResponseWriter writer{buffer};
+
+  writer.Header("Content-Type", "text/plain");
+  std::format_to(writer.Out(), "Hello, {}!", "world");
+  writer.Write(" Bye.");
+  writer.Finish();
+
+  REQUIRE(buffer.ToString() ==
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/plain\r\n"
+          "Content-Length: 0000000018\r\n"
+          "\r\n"
+          "Hello, world! Bye.");
+  REQUIRE(writer.BodySize() == 18);
+
+  // Finished for good
+  const auto size = buffer.Size();
+  writer.Finish();
+  REQUIRE(buffer.Size() == size);
+  REQUIRE_THROWS_AS(writer.Write("more"), toyws::Error);
+}
+
+TEST_CASE("ResponseWriter produces an HttpResponse", "[library]") {
+  toyws::ResponseWriter writer;
+
+  SECTION("With a body spanning segments") {
+    writer.SetStatus(toyws::HttpStatus::kPartialContent);
+    writer.Header("ETag", "\"1-2-3\"");
+    const std::string body(3 * toyws::kSegmentSize, 'b');
+    writer.Write(body);
+    REQUIRE_THROWS_AS(writer.Header("Late", "header"), toyws::Error);
+
+    const auto response = writer.ToResponse();
+    REQUIRE(response.Status() == toyws::HttpStatus::kPartialContent);
+    REQUIRE(response.Reason() == "Partial Content");
+    REQUIRE(response.Headers().at("ETag") == "\"1-2-3\"");
+    REQUIRE(std::stoul(std::string{response.Headers().at("Content-Length")}) ==
+            body.size());
+    REQUIRE(response.Body() == body);
+  }
+
+  SECTION("Without a body") {
+    writer.Header("Location", "/elsewhere");
+    REQUIRE_THROWS_AS(writer.SetStatus(toyws::HttpStatus::kFound),
+                      toyws::Error);
+
+    const auto response = writer.ToResponse();
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+    REQUIRE(response.Headers().at("Content-Length") == "0");
+    REQUIRE(response.Body().empty());
+  }
+
+  SECTION("Discarded for an error") {
+    writer.Write("partial");
+    writer.Discard();
+    writer.SetStatus(toyws::HttpStatus::kNotFound);
+
+    const auto response = writer.ToResponse();
+    REQUIRE(response.Status() == toyws::HttpStatus::kNotFound);
+    REQUIRE(response.Body().empty());
+    REQUIRE(writer.BodySize() == 0);
+  }
+}
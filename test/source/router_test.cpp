@@ -0,0 +1,117 @@
+#include "toyws/router.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <vector>
+
+static auto HandlerA(const toyws::HttpRequest& /*request*/,
+                     const toyws::HandlerContext& /*context*/,
+                     toyws::HttpResponse& /*response*/) -> void {}
+
+static auto HandlerB(const toyws::HttpRequest& /*request*/,
+                     const toyws::HandlerContext& /*context*/,
+                     toyws::HttpResponse& /*response*/) -> void {}
+
+static auto Writer(const toyws::HttpRequest& /*request*/,
+                   const toyws::HandlerContext& /*context*/,
+                   toyws::ResponseWriter& /*writer*/) -> void {}
+
+TEST_CASE("Router splits uri", "[library]") {
+  using Parts = std::vector<std::string>;
+  REQUIRE(toyws::Router::SplitUri("/") == Parts{"/"});
+  REQUIRE(toyws::Router::SplitUri("/users/me") == Parts{"/users", "/me"});
+  REQUIRE(toyws::Router::SplitUri("/a/") == Parts{"/a", "/"});
+  REQUIRE(toyws::Router::SplitUri("relative").empty());
+}
+
+TEST_CASE("Router finds exact routes", "[library]") {
+  toyws::Router router;
+  router.AddRoute("/", HandlerA);
+  router.AddRoute("/users/me", HandlerB);
+
+  auto* root = router.FindRoute("/");
+  REQUIRE(root != nullptr);
+  REQUIRE(root->Handler() == HandlerA);
+
+  auto* me = router.FindRoute("/users/me");
+  REQUIRE(me != nullptr);
+  REQUIRE(me->Handler() == HandlerB);
+  REQUIRE(me->FullPath() == "/users/me");
+
+  // Intermediate route exists, but has no handler
+  auto* users = router.FindRoute("/users");
+  REQUIRE(users != nullptr);
+  REQUIRE(users->Handler() == nullptr);
+
+  REQUIRE(router.FindRoute("/users/you") == nullptr);
+  REQUIRE(router.FindRoute("/user") == nullptr);
+}
+
+TEST_CASE("Router replaces a handler with one of the other kind",
+          "[library]") {
+  toyws::Router router;
+  router.AddRoute("/page", HandlerA);
+  router.AddRoute("/page", Writer);
+
+  auto* route = router.FindRoute("/page");
+  REQUIRE(route != nullptr);
+  REQUIRE(route->HasHandler());
+  REQUIRE(route->Handler() == nullptr);
+  REQUIRE(route->Writer() == Writer);
+
+  router.AddRoute("/page", HandlerB);
+  REQUIRE(route->Handler() == HandlerB);
+  REQUIRE(route->Writer() == nullptr);
+
+  router.AddRoute("/page", toyws::WebSocketHandlers{});
+  REQUIRE(route->HasHandler());
+  REQUIRE(route->Handler() == nullptr);
+  REQUIRE(route->SocketHandlers() != nullptr);
+
+  router.AddRoute("/page", toyws::EventStreamHandlers{});
+  REQUIRE(route->HasHandler());
+  REQUIRE(route->SocketHandlers() == nullptr);
+  REQUIRE(route->StreamHandlers() != nullptr);
+
+  router.AddRoute("/page", Writer);
+  REQUIRE(route->SocketHandlers() == nullptr);
+  REQUIRE(route->StreamHandlers() == nullptr);
+}
+
+TEST_CASE("Router keeps route options", "[library]") {
+  toyws::Router router;
+  toyws::RouteOptions options;
+  options.cache.enabled = true;
+  options.cache.vary = {"Accept-Language"};
+  router.AddRoute("/cached", HandlerA, options);
+
+  auto* route = router.FindRoute("/cached");
+  REQUIRE(route != nullptr);
+  REQUIRE(route->Options().cache.enabled);
+  REQUIRE(route->Options().cache.vary.size() == 1);
+}
+
+TEST_CASE("HandlerContext defers responses", "[library]") {
+  toyws::HandlerContext context;
+
+  SECTION("Without a responder") {
+    REQUIRE_THROWS_AS(context.Defer(), toyws::Error);
+    REQUIRE_FALSE(context.IsDeferred());
+    REQUIRE(context.Io() == nullptr);
+  }
+
+  SECTION("With a responder") {
+    std::vector<toyws::HttpStatus> responses;
+    context.SetResponder([&](toyws::HttpResponse response) {
+      responses.push_back(response.Status());
+    });
+    REQUIRE_FALSE(context.IsDeferred());
+
+    auto respond = context.Defer();
+    REQUIRE(context.IsDeferred());
+    REQUIRE(responses.empty());
+
+    respond(toyws::HttpResponse{toyws::HttpStatus::kNotFound});
+    REQUIRE(responses == std::vector{toyws::HttpStatus::kNotFound});
+  }
+}
@@ -0,0 +1,281 @@
+#include "toyws/static_files.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include "toyws/buffer_chain.hpp"
+#include "toyws/http_request.hpp"
+#include "toyws/http_response.hpp"
+
+namespace fs = std::filesystem;
+
+// Temporary directory, removed with its content at end of scope
+class TempDirectory {
+ public:
+  TempDirectory() {
+    std::string path =
+        (fs::temp_directory_path() / "toyws_static_XXXXXX").string();
+    REQUIRE(mkdtemp(path.data()) != nullptr);
+    root = path;
+  }
+
+  ~TempDirectory() { fs::remove_all(root); }
+
+  auto Write(const std::string& name, const std::string& content) const
+      -> void {
+    fs::create_directories((root / name).parent_path());
+    std::ofstream{root / name, std::ios::binary | std::ios::trunc} << content;
+  }
+
+  auto Path() const -> std::string { return root.string(); }
+
+ private:
+  fs::path root;
+};
+
+static auto Serve(toyws::StaticFiles& files, const std::string& path,
+                  toyws::HeadersMap headers = {},
+                  toyws::HttpMethod method = toyws::HttpMethod::GET)
+    -> toyws::HttpResponse {
+  toyws::HttpRequest request{method, "/static" + path, std::move(headers)};
+  toyws::HttpResponse response;
+  files.Serve(request, path, response);
+  return response;
+}
+
+TEST_CASE("Range header parsing", "[library]") {
+  using toyws::ParseRange;
+
+  auto range = ParseRange("bytes=0-99", 1000);
+  REQUIRE(range);
+  REQUIRE(range->offset == 0);
+  REQUIRE(range->length == 100);
+
+  range = ParseRange("bytes=900-", 1000);
+  REQUIRE((range && range->offset == 900 && range->length == 100));
+
+  range = ParseRange("bytes=-100", 1000);
+  REQUIRE((range && range->offset == 900 && range->length == 100));
+
+  range = ParseRange("bytes=-5000", 1000);
+  REQUIRE((range && range->offset == 0 && range->length == 1000));
+
+  // Clamped to the end
+  range = ParseRange("bytes=990-5000", 1000);
+  REQUIRE((range && range->offset == 990 && range->length == 10));
+
+  // Not satisfiable
+  REQUIRE(ParseRange("bytes=1000-", 1000)->length == 0);
+  REQUIRE(ParseRange("bytes=-0", 1000)->length == 0);
+  REQUIRE(ParseRange("bytes=0-", 0)->length == 0);
+
+  // Ignored
+  REQUIRE_FALSE(ParseRange("items=0-1", 1000));
+  REQUIRE_FALSE(ParseRange("bytes=0-1,5-6", 1000));
+  REQUIRE_FALSE(ParseRange("bytes=5-1", 1000));
+  REQUIRE_FALSE(ParseRange("bytes=x-1", 1000));
+  REQUIRE_FALSE(ParseRange("bytes=-", 1000));
+}
+
+TEST_CASE("If-None-Match matching", "[library]") {
+  using toyws::MatchEtag;
+  const std::string etag = "\"1-2-3\"";
+
+  REQUIRE(MatchEtag("\"1-2-3\"", etag) == "\"1-2-3\"");
+  REQUIRE(MatchEtag("\"x\", W/\"1-2-3\"", etag) == "W/\"1-2-3\"");
+  REQUIRE(MatchEtag("*", etag) == etag);
+  REQUIRE(MatchEtag("\"1-2-3-gzip\"", etag) == "\"1-2-3-gzip\"");
+  REQUIRE(MatchEtag("\"1-2-3-deflate\"", etag) == "\"1-2-3-deflate\"");
+  REQUIRE_FALSE(MatchEtag("\"1-2-3-br\"", etag));
+  REQUIRE_FALSE(MatchEtag("\"1-2-4\"", etag));
+  REQUIRE_FALSE(MatchEtag("", etag));
+}
+
+TEST_CASE("HTTP dates", "[library]") {
+  REQUIRE(toyws::FormatHttpDate(0) == "Thu, 01 Jan 1970 00:00:00 GMT");
+  REQUIRE(toyws::FormatHttpDate(784111777) ==
+          "Sun, 06 Nov 1994 08:49:37 GMT");
+  REQUIRE(toyws::ParseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+  REQUIRE(toyws::ParseHttpDate("Tue, 29 Feb 2000 12:00:00 GMT") == 951825600);
+  REQUIRE_FALSE(toyws::ParseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT"));
+  REQUIRE_FALSE(toyws::ParseHttpDate("Sun, 31 Nov 1994 08:49:37 GMT"));
+}
+
+TEST_CASE("Content types by extension", "[library]") {
+  REQUIRE(toyws::ContentTypeFor("index.html") == "text/html; charset=utf-8");
+  REQUIRE(toyws::ContentTypeFor("img/logo.PNG") == "image/png");
+  REQUIRE(toyws::ContentTypeFor("archive.tar.zst") ==
+          "application/octet-stream");
+  REQUIRE(toyws::ContentTypeFor("v1.2/README") == "application/octet-stream");
+}
+
+TEST_CASE("FileCache invalidation", "[library]") {
+  TempDirectory dir;
+  dir.Write("a.txt", "one");
+  dir.Write("sub/b.txt", "two");
+  toyws::FileCache cache{dir.Path(), 2, std::chrono::milliseconds{0}};
+
+  auto a = cache.Open("a.txt");
+  REQUIRE(a != nullptr);
+  REQUIRE(a->size == 3);
+  REQUIRE(cache.Open("a.txt") == a);
+  REQUIRE(cache.Open("missing.txt") == nullptr);
+  REQUIRE(cache.Open("sub") == nullptr);
+  REQUIRE(cache.IsDirectory("sub"));
+
+  SECTION("Changed file is reopened") {
+    dir.Write("a.txt", "three");
+    cache.ProcessEvents();
+    auto changed = cache.Open("a.txt");
+    REQUIRE(changed != a);
+    REQUIRE(changed->size == 5);
+    REQUIRE(changed->etag != a->etag);
+  }
+
+  SECTION("Replaced file is reopened") {
+    dir.Write("a.tmp", "three");
+    fs::rename(fs::path{dir.Path()} / "a.tmp", fs::path{dir.Path()} / "a.txt");
+    cache.ProcessEvents();
+    REQUIRE(cache.Open("a.txt")->size == 5);
+    // The old file stays open for whoever still uses it
+    REQUIRE(toyws::ReadFileRange({a, 0, 3}) == "one");
+  }
+
+  SECTION("Removed directory") {
+    REQUIRE(cache.Open("sub/b.txt") != nullptr);
+    fs::remove_all(fs::path{dir.Path()} / "sub");
+    cache.ProcessEvents();
+    REQUIRE(cache.Open("sub/b.txt") == nullptr);
+  }
+
+  SECTION("Least recently used file is evicted") {
+    dir.Write("c.txt", "four");
+    REQUIRE(cache.Open("sub/b.txt") != nullptr);
+    REQUIRE(cache.Open("c.txt") != nullptr);
+    REQUIRE(cache.Size() == 2);
+    REQUIRE(cache.Open("a.txt") != a);
+  }
+}
+
+TEST_CASE("Serving static files", "[library]") {
+  TempDirectory dir;
+  std::string content;
+  for (int i = 0; i < 100; ++i) {
+    content += "line " + std::to_string(i) + "\n";
+  }
+  dir.Write("page.html", content);
+  dir.Write("docs/index.html", "<h1>docs</h1>");
+  dir.Write(".secret", "hidden");
+  toyws::StaticFiles files{toyws::StaticFilesOptions{.root = dir.Path()}};
+
+  auto response = Serve(files, "/page.html");
+  REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+  REQUIRE(response.Body().empty());
+  REQUIRE(response.HasFile());
+  REQUIRE(response.File().length == content.size());
+  REQUIRE(toyws::ReadFileRange(response.File()) == content);
+  auto headers = response.Headers();
+  REQUIRE(headers["Content-Type"] == "text/html; charset=utf-8");
+  REQUIRE(std::string_view{headers["Content-Length"]} ==
+          std::to_string(content.size()));
+  REQUIRE(headers["Accept-Ranges"] == "bytes");
+  const auto etag = headers["ETag"];
+  const auto lastModified = headers["Last-Modified"];
+  REQUIRE(etag.starts_with('"'));
+  REQUIRE(toyws::ParseHttpDate(lastModified));
+
+  SECTION("Only the head is written") {
+    toyws::BufferChain out;
+    response.Write(out);
+    const auto text = out.ToString();
+    REQUIRE(text.ends_with("\r\n\r\n"));
+    REQUIRE(text.find("line 0") == std::string::npos);
+  }
+
+  SECTION("Conditional requests") {
+    response = Serve(files, "/page.html", {{"If-None-Match", etag}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kNotModified);
+    REQUIRE_FALSE(response.HasFile());
+
+    auto gzipEtag = etag;
+    gzipEtag.insert(gzipEtag.size() - 1, "-gzip");
+    response = Serve(files, "/page.html", {{"If-None-Match", gzipEtag}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kNotModified);
+    REQUIRE(std::string_view{response.Headers().at("ETag")} == gzipEtag);
+
+    response =
+        Serve(files, "/page.html", {{"If-Modified-Since", lastModified}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kNotModified);
+
+    response = Serve(files, "/page.html",
+                     {{"If-Modified-Since", "Thu, 01 Jan 1970 00:00:00 GMT"}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+
+    // If-None-Match takes precedence
+    response = Serve(files, "/page.html",
+                     {{"If-None-Match", "\"other\""},
+                      {"If-Modified-Since", lastModified}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+  }
+
+  SECTION("Range requests") {
+    response = Serve(files, "/page.html", {{"Range", "bytes=5-9"}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kPartialContent);
+    REQUIRE(std::string_view{response.Headers().at("Content-Range")} ==
+            "bytes 5-9/" + std::to_string(content.size()));
+    REQUIRE(response.Headers().at("Content-Length") == "5");
+    REQUIRE(toyws::ReadFileRange(response.File()) == content.substr(5, 5));
+
+    response = Serve(files, "/page.html", {{"Range", "bytes=100000-"}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kRangeNotSatisfiable);
+    REQUIRE(std::string_view{response.Headers().at("Content-Range")} ==
+            "bytes */" + std::to_string(content.size()));
+    REQUIRE_FALSE(response.HasFile());
+
+    // Stale If-Range means the full representation
+    response = Serve(files, "/page.html",
+                     {{"Range", "bytes=5-9"}, {"If-Range", "\"stale\""}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+    response = Serve(files, "/page.html",
+                     {{"Range", "bytes=5-9"}, {"If-Range", etag}});
+    REQUIRE(response.Status() == toyws::HttpStatus::kPartialContent);
+  }
+
+  SECTION("HEAD has no body") {
+    response = Serve(files, "/page.html", {}, toyws::HttpMethod::HEAD);
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+    REQUIRE(std::string_view{response.Headers().at("Content-Length")} ==
+            std::to_string(content.size()));
+    REQUIRE_FALSE(response.HasFile());
+  }
+
+  SECTION("Directories & index files") {
+    response = Serve(files, "/docs/");
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+    REQUIRE(toyws::ReadFileRange(response.File()) == "<h1>docs</h1>");
+
+    response = Serve(files, "/docs");
+    REQUIRE(response.Status() == toyws::HttpStatus::kFound);
+    REQUIRE(response.Headers().at("Location") == "/static/docs/");
+
+    response = Serve(files, "/do%63s/./index.html");
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+  }
+
+  SECTION("Paths that are not served") {
+    REQUIRE_THROWS_AS(Serve(files, "/missing"), toyws::HttpStatusError);
+    REQUIRE_THROWS_AS(Serve(files, "/../etc/passwd"), toyws::HttpStatusError);
+    REQUIRE_THROWS_AS(Serve(files, "/docs/%2e%2e/page.html"),
+                      toyws::HttpStatusError);
+    REQUIRE_THROWS_AS(Serve(files, "/.secret"), toyws::HttpStatusError);
+    REQUIRE_THROWS_AS(Serve(files, "/bad%zz"), toyws::HttpStatusError);
+    REQUIRE_THROWS_AS(Serve(files, "/nul%00"), toyws::HttpStatusError);
+
+    response = Serve(files, "/page.html", {}, toyws::HttpMethod::POST);
+    REQUIRE(response.Status() == toyws::HttpStatus::kMethodNotAllowed);
+  }
+}
@@ -1,9 +1,737 @@
 #include "toyws/toyws.hpp"
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <catch2/catch_test_macros.hpp>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <latch>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#include "toyws/chunked_body.hpp"
+#include "toyws/error.hpp"
+#include "toyws/event_stream.hpp"
+#include "toyws/test_client.hpp"
+#include "toyws/websocket.hpp"
+
+/**
+ * @brief Random port, so that tests can run in parallel.
+ */
+static auto RandomServerPort() -> uint16_t {
+  static std::random_device randDevice;
+  static std::mt19937 mt(randDevice());
+  static std::uniform_int_distribution<uint16_t> distribution(1024, 65535);
+  return distribution(mt);
+}
+
+/**
+ * @brief ToyWs on a random port. Routes are added to server, and then Start()
+ * runs it on a separate thread until the fixture is destroyed.
+ */
+struct ServerFixture {
+  uint16_t port = RandomServerPort();
+  toyws::ToyWs server{"127.0.0.1", port};
+  std::thread thread;
+
+  auto Start() -> void {
+    thread = std::thread{[this] {
+      try {
+        server.Run();
+      } catch (const toyws::Error&) {
+        // E.g. the port is taken, which the wait below finds out
+      }
+    }};
+
+    // Until it answers
+    for (int tries = 0; tries < 100; ++tries) {
+      try {
+        toyws::TestClient{port}.Get("/");
+        return;
+      } catch (const toyws::Error&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      }
+    }
+    throw std::runtime_error("Test server did not start");
+  }
+
+  ~ServerFixture() {
+    if (thread.joinable()) {
+      server.Stop();
+      thread.join();
+    }
+  }
+};
+
+/**
+ * @brief Connection to the server on port, for exchanges TestClient can't do.
+ * Reads time out rather than hang the test.
+ */
+static auto Connect(uint16_t port) -> int {
+  const int sock = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout{};
+  timeout.tv_sec = 5;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(sock, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(sock);
+    throw std::runtime_error("Test failed connecting to the server");
+  }
+  return sock;
+}
+
+static auto SendAll(int sock, std::string_view data) -> void {
+  while (!data.empty()) {
+    const auto sent = send(sock, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent <= 0) {
+      throw std::runtime_error("Test failed sending to the server");
+    }
+    data.remove_prefix(static_cast<std::size_t>(sent));
+  }
+}
+
+// Exactly count bytes, or fewer if the server closes (or is too slow)
+static auto ReceiveExactly(int sock, std::size_t count) -> std::string {
+  std::string data(count, '\0');
+  std::size_t received = 0;
+  while (received < count) {
+    const auto res = recv(sock, data.data() + received, count - received, 0);
+    if (res <= 0) {
+      break;
+    }
+    received += static_cast<std::size_t>(res);
+  }
+  data.resize(received);
+  return data;
+}
+
+// Up to & including the given delimiter
+static auto ReceiveUntil(int sock, std::string_view delimiter)
+    -> std::string {
+  std::string data;
+  while (!data.ends_with(delimiter)) {
+    char byte = 0;
+    if (recv(sock, &byte, 1, 0) != 1) {
+      break;
+    }
+    data += byte;
+  }
+  return data;
+}
+
+static auto Throw(const toyws::HttpRequest& /*request*/,
+                  const toyws::HandlerContext& /*context*/,
+                  toyws::HttpResponse& /*response*/) -> void {
+  throw std::runtime_error("Handler failed");
+}
+
+static auto ThrowWriter(const toyws::HttpRequest& /*request*/,
+                        const toyws::HandlerContext& /*context*/,
+                        toyws::ResponseWriter& writer) -> void {
+  writer.Write("partial");
+  throw std::runtime_error("Handler failed");
+}
+
+TEST_CASE("ToyWs answers handlers that throw with 500", "[library]") {
+  ServerFixture fixture;
+  toyws::RouteOptions offloaded;
+  offloaded.offload = true;
+  fixture.server.SetWorkerThreads(1);
+  fixture.server.AddRoute("/inline", Throw);
+  fixture.server.AddRoute("/offloaded", Throw, offloaded);
+  fixture.server.AddRoute("/writer", ThrowWriter);
+  fixture.server.AddRoute("/offloaded-writer", ThrowWriter, offloaded);
+  fixture.Start();
+
+  for (const auto* const path :
+       {"/inline", "/offloaded", "/writer", "/offloaded-writer"}) {
+    const auto response = toyws::TestClient{fixture.port}.Get(path);
+    REQUIRE(response.Status() == toyws::HttpStatus::kInternalServerError);
+    REQUIRE(response.Body().empty());
+  }
+  // And the rings are still serving
+  REQUIRE(toyws::TestClient{fixture.port}.Get("/").Status() ==
+          toyws::HttpStatus::kNotFound);
+}
+
+static auto Text(const toyws::HttpRequest& /*request*/,
+                 const toyws::HandlerContext& /*context*/,
+                 toyws::HttpResponse& response) -> void {
+  response = toyws::HttpResponse{toyws::HttpStatus::kOk,
+                                 {{"Content-Type", "text/plain"}},
+                                 std::string(4096, 'a')};
+}
+
+TEST_CASE("ToyWs handles requests off the rings' threads", "[library]") {
+  ServerFixture fixture;
+  fixture.server.AddRoute("/text", Text);
+  fixture.Start();
+
+  // While the rings serve, with what they keep to themselves left alone
+  const toyws::HttpRequest request{
+      toyws::HttpMethod::GET, "/text", {{"Accept-Encoding", "gzip"}}};
+  for (int i = 0; i < 2; ++i) {
+    auto response = fixture.server.HandleRequest(request);
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+    REQUIRE(response.Headers()["Content-Encoding"] == "gzip");
+    REQUIRE(response.Body().size() < 4096);
+    auto served = toyws::TestClient{fixture.port}.Get("/text");
+    REQUIRE(served.Status() == toyws::HttpStatus::kOk);
+    REQUIRE_FALSE(served.Headers().contains("Content-Encoding"));
+  }
+}
+
+static auto WriteText(const toyws::HttpRequest& /*request*/,
+                      const toyws::HandlerContext& /*context*/,
+                      toyws::ResponseWriter& writer) -> void {
+  writer.Header("Content-Type", "text/plain");
+  writer.Write(std::string(4096, 'a'));
+}
+
+TEST_CASE("ToyWs sends what writer routes write uncompressed", "[library]") {
+  toyws::ToyWs server{"127.0.0.1", 0};
+  toyws::RouteOptions offloaded;
+  offloaded.offload = true;
+  server.AddRoute("/inline", WriteText);
+  server.AddRoute("/offloaded", WriteText, offloaded);
+
+  for (const auto* const path : {"/inline", "/offloaded"}) {
+    const toyws::HttpRequest request{
+        toyws::HttpMethod::GET, path, {{"Accept-Encoding", "gzip"}}};
+    REQUIRE(server.NegotiateEncoding(request, server.FindRoute(request)) ==
+            toyws::ContentEncoding::kIdentity);
+    const auto response = server.HandleRequest(request);
+    REQUIRE(response.Body().size() == 4096);
+    REQUIRE_FALSE(response.Headers().contains("Content-Encoding"));
+    REQUIRE_FALSE(response.Headers().contains("Vary"));
+  }
+}
+
+TEST_CASE("ToyWs varies on Accept-Encoding only where it compresses",
+          "[library]") {
+  toyws::ToyWs server{"127.0.0.1", 0};
+  toyws::RouteOptions uncompressed;
+  uncompressed.compress = false;
+  server.AddRoute("/text", Text);
+  server.AddRoute("/uncompressed", Text, uncompressed);
+
+  const auto get = [&](const char* path) {
+    const toyws::HttpRequest request{
+        toyws::HttpMethod::GET, path, {{"Accept-Encoding", "gzip"}}};
+    return server.HandleRequest(request);
+  };
+  REQUIRE(get("/text").Headers().contains("Vary"));
+  REQUIRE_FALSE(get("/uncompressed").Headers().contains("Vary"));
+
+  toyws::CompressionOptions disabled;
+  disabled.enabled = false;
+  server.SetCompressionOptions(disabled);
+  const auto response = get("/text");
+  REQUIRE(response.Body().size() == 4096);
+  REQUIRE_FALSE(response.Headers().contains("Vary"));
+}
+
+// Response to a GET of path with the given extra header lines, split into the
+// head & the body (of Content-Length)
+static auto Fetch(uint16_t port, const std::string& path,
+                  const std::string& headers = {})
+    -> std::pair<std::string, std::string> {
+  const int sock = Connect(port);
+  SendAll(sock, "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" +
+                    headers + "Connection: close\r\n\r\n");
+  auto head = ReceiveUntil(sock, "\r\n\r\n");
+  std::size_t length = 0;
+  if (const auto at = head.find("Content-Length: ");
+      at != std::string::npos) {
+    length = std::stoul(head.substr(at + 16));
+  }
+  auto body = ReceiveExactly(sock, length);
+  close(sock);
+  return {std::move(head), std::move(body)};
+}
+
+TEST_CASE("ToyWs serves static files with the rings' file I/O", "[library]") {
+  std::string root =
+      (std::filesystem::temp_directory_path() / "toyws_served_XXXXXX")
+          .string();
+  REQUIRE(mkdtemp(root.data()) != nullptr);
+  std::string content;
+  for (int i = 0; i < 500; ++i) {
+    content += "line " + std::to_string(i) + "\n";
+  }
+  std::ofstream{root + "/page.txt"} << content;
+  std::filesystem::create_directory(root + "/docs");
+
+  {
+    ServerFixture fixture;
+    fixture.server.SetRings(2);
+    fixture.server.AddStaticRoute("/static",
+                                  toyws::StaticFilesOptions{.root = root});
+    fixture.Start();
+
+    // Opened on the first request, and cached for the second
+    for (int i = 0; i < 2; ++i) {
+      auto [head, body] = Fetch(fixture.port, "/static/page.txt");
+      REQUIRE(head.starts_with("HTTP/1.1 200"));
+      REQUIRE(body == content);
+
+      std::tie(head, body) = Fetch(fixture.port, "/static/page.txt",
+                                   "Accept-Encoding: gzip\r\n");
+      REQUIRE(head.starts_with("HTTP/1.1 200"));
+      REQUIRE(head.find("Content-Encoding: gzip") != std::string::npos);
+      REQUIRE(!body.empty());
+      REQUIRE(body.size() < content.size());
+    }
+    REQUIRE(Fetch(fixture.port, "/static/missing.txt")
+                .first.starts_with("HTTP/1.1 404"));
+    const auto redirect = Fetch(fixture.port, "/static/docs").first;
+    REQUIRE(redirect.starts_with("HTTP/1.1 302"));
+    REQUIRE(redirect.find("Location: /static/docs/") != std::string::npos);
+
+    // Off the rings' threads, without their file I/O
+    const toyws::HttpRequest request{
+        toyws::HttpMethod::GET, "/static/page.txt",
+        {{"Accept-Encoding", "gzip"}}};
+    auto response = fixture.server.HandleRequest(request);
+    REQUIRE(response.Status() == toyws::HttpStatus::kOk);
+    REQUIRE(response.Headers()["Content-Encoding"] == "gzip");
+  }
+  std::filesystem::remove_all(root);
+}
+
+// Answers with the body it was sent, whether kept in memory or spilled
+static auto EchoBody(const toyws::HttpRequest& request,
+                     const toyws::HandlerContext& /*context*/,
+                     toyws::HttpResponse& response) -> void {
+  std::string body = request.Body();
+  if (request.BodyFile() >= 0) {
+    body.resize(1024 * 1024);
+    const auto n = pread(request.BodyFile(), body.data(), body.size(), 0);
+    body.resize(static_cast<std::size_t>(std::max<ssize_t>(n, 0)));
+  }
+  response.SetBody(std::move(body));
+}
+
+TEST_CASE("ToyWs hands spilled bodies over once written", "[library]") {
+  ServerFixture fixture;
+  toyws::RouteOptions options;
+  options.body.spillThreshold = 1024;
+  options.compress = false;
+  fixture.server.AddRoute("/upload", EchoBody, options);
+  fixture.Start();
+
+  std::string body;
+  for (int i = 0; body.size() < 200 * 1024; ++i) {
+    body += std::to_string(i) + ' ';
+  }
+  const int sock = Connect(fixture.port);
+  SendAll(sock, "POST /upload HTTP/1.1\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\n\r\n" + body);
+  const auto head = ReceiveUntil(sock, "\r\n\r\n");
+  REQUIRE(head.starts_with("HTTP/1.1 200"));
+  REQUIRE(ReceiveExactly(sock, body.size()) == body);
+  close(sock);
+}
+
+static auto StreamThenThrow(const toyws::HttpRequest& /*request*/,
+                            const toyws::HandlerContext& /*context*/,
+                            toyws::HttpResponse& response) -> void {
+  response.SetStream([calls = 0](toyws::ChunkSink& sink) mutable {
+    if (calls++ > 0) {
+      throw std::runtime_error("Producer failed");
+    }
+    sink.Write("first");
+    return true;
+  });
+}
+
+TEST_CASE("ToyWs cuts streamed responses short if the producer throws",
+          "[library]") {
+  ServerFixture fixture;
+  fixture.server.AddRoute("/stream", StreamThenThrow);
+  fixture.Start();
+
+  const int sock = Connect(fixture.port);
+  SendAll(sock, "GET /stream HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  const auto head = ReceiveUntil(sock, "\r\n\r\n");
+  REQUIRE(head.starts_with("HTTP/1.1 200"));
+  REQUIRE(head.find("Transfer-Encoding: chunked") != std::string::npos);
+  REQUIRE(ReceiveUntil(sock, "\r\nfirst\r\n").ends_with("first\r\n"));
+  // Closed without the last chunk
+  REQUIRE(ReceiveExactly(sock, 1).empty());
+  close(sock);
+
+  // Never streamed (chunked) to HTTP/1.0, which can't take it
+  const int old = Connect(fixture.port);
+  SendAll(old, "GET /stream HTTP/1.0\r\n\r\n");
+  REQUIRE(ReceiveUntil(old, "\r\n\r\n").starts_with("HTTP/1.1 505"));
+  close(old);
+
+  // And the rings are still serving
+  REQUIRE(toyws::TestClient{fixture.port}.Get("/").Status() ==
+          toyws::HttpStatus::kNotFound);
+}
+
+static auto Echo(toyws::WebSocket& socket, toyws::WebSocketOpcode opcode,
+                 std::string_view payload) -> void {
+  socket.Send(opcode, std::string{payload});
+}
+
+static std::atomic<toyws::WebSocketCloseCode> closedWith;
+
+static auto RecordClose(toyws::WebSocket& /*socket*/,
+                        toyws::WebSocketCloseCode code) -> void {
+  closedWith = code;
+}
+
+// A frame the server sent, which is never masked
+static auto ReceiveFrame(int sock, toyws::WebSocketOpcode& opcode)
+    -> std::string {
+  const auto head = ReceiveExactly(sock, 2);
+  REQUIRE(head.size() == 2);
+  REQUIRE((head[1] & 0x80) == 0);
+  opcode = static_cast<toyws::WebSocketOpcode>(head[0] & 0x0f);
+  const auto length = static_cast<std::size_t>(head[1] & 0x7f);
+  REQUIRE(length < 126);  // All that these tests send back
+  return ReceiveExactly(sock, length);
+}
+
+TEST_CASE("ToyWs echoes on a WebSocket & closes it with a handshake",
+          "[library]") {
+  ServerFixture fixture;
+  toyws::WebSocketHandlers handlers;
+  handlers.onMessage = Echo;
+  handlers.onClose = RecordClose;
+  fixture.server.AddRoute("/ws", handlers);
+  fixture.Start();
+  closedWith = toyws::WebSocketCloseCode::kNoStatus;
+
+  const int sock = Connect(fixture.port);
+  // The example of RFC 6455, section 1.3
+  SendAll(sock,
+          "GET /ws HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+          "Connection: Upgrade\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+          "Sec-WebSocket-Version: 13\r\n\r\n");
+  const auto head = ReceiveUntil(sock, "\r\n\r\n");
+  REQUIRE(head.starts_with("HTTP/1.1 101"));
+  REQUIRE(head.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") !=
+          std::string::npos);
+
+  const toyws::WebSocketMask mask{1, 2, 3, 4};
+  auto opcode = toyws::WebSocketOpcode::kContinuation;
+  SendAll(sock, toyws::EncodeMaskedFrame(toyws::WebSocketOpcode::kText,
+                                         "hello", mask));
+  REQUIRE(ReceiveFrame(sock, opcode) == "hello");
+  REQUIRE(opcode == toyws::WebSocketOpcode::kText);
+
+  // The server answers the Close frame with its own, then closes
+  SendAll(sock, toyws::EncodeMaskedFrame(toyws::WebSocketOpcode::kClose,
+                                         std::string{"\x03\xe8" "done", 6},
+                                         mask));
+  const auto payload = ReceiveFrame(sock, opcode);
+  REQUIRE(opcode == toyws::WebSocketOpcode::kClose);
+  REQUIRE(toyws::CloseCodeOf(payload) == toyws::WebSocketCloseCode::kNormal);
+  REQUIRE(ReceiveExactly(sock, 1).empty());
+  close(sock);
+
+  // Called as the Close frame arrives, before the reply is even sent
+  REQUIRE(closedWith == toyws::WebSocketCloseCode::kNormal);
+}
+
+static auto ThrowOnMessage(toyws::WebSocket& /*socket*/,
+                           toyws::WebSocketOpcode /*opcode*/,
+                           std::string_view /*payload*/) -> void {
+  throw std::runtime_error("Handler failed");
+}
+
+static auto ThrowOnOpen(toyws::WebSocket& /*socket*/) -> void {
+  throw std::runtime_error("Handler failed");
+}
+
+// Open a WebSocket on path, and return what the server sent first after the
+// handshake, which must be a Close frame
+static auto CloseCodeAfterOpen(uint16_t port, const char* path,
+                               bool sendMessage) -> toyws::WebSocketCloseCode {
+  const int sock = Connect(port);
+  SendAll(sock, std::string{"GET "} + path +
+                    " HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                    "Sec-WebSocket-Version: 13\r\n\r\n");
+  REQUIRE(ReceiveUntil(sock, "\r\n\r\n").starts_with("HTTP/1.1 101"));
+  if (sendMessage) {
+    SendAll(sock, toyws::EncodeMaskedFrame(toyws::WebSocketOpcode::kText,
+                                           "hello", {1, 2, 3, 4}));
+  }
+  auto opcode = toyws::WebSocketOpcode::kContinuation;
+  const auto payload = ReceiveFrame(sock, opcode);
+  REQUIRE(opcode == toyws::WebSocketOpcode::kClose);
+  REQUIRE(ReceiveExactly(sock, 1).empty());
+  close(sock);
+  return toyws::CloseCodeOf(payload);
+}
+
+TEST_CASE("ToyWs closes WebSockets whose handlers throw with 1011",
+          "[library]") {
+  ServerFixture fixture;
+  toyws::WebSocketHandlers onMessage;
+  onMessage.onMessage = ThrowOnMessage;
+  onMessage.onClose = RecordClose;
+  fixture.server.AddRoute("/message", onMessage);
+  toyws::WebSocketHandlers onOpen;
+  onOpen.onOpen = ThrowOnOpen;
+  fixture.server.AddRoute("/open", onOpen);
+  fixture.Start();
+  closedWith = toyws::WebSocketCloseCode::kNoStatus;
+
+  REQUIRE(CloseCodeAfterOpen(fixture.port, "/message", true) ==
+          toyws::WebSocketCloseCode::kInternalError);
+  REQUIRE(closedWith == toyws::WebSocketCloseCode::kInternalError);
+  REQUIRE(CloseCodeAfterOpen(fixture.port, "/open", false) ==
+          toyws::WebSocketCloseCode::kInternalError);
+  // And the rings are still serving
+  REQUIRE(toyws::TestClient{fixture.port}.Get("/").Status() ==
+          toyws::HttpStatus::kNotFound);
+}
+
+static auto Welcome(const toyws::HttpRequest& /*request*/) -> std::string {
+  return toyws::EncodeEvent("welcome", "hello");
+}
+
+// The payload of the next chunk of a chunked body
+static auto ReceiveChunk(int sock) -> std::string {
+  const auto size = ReceiveUntil(sock, "\r\n");
+  REQUIRE_FALSE(size.empty());
+  auto chunk = ReceiveExactly(sock, std::stoul(size, nullptr, 16) + 2);
+  REQUIRE(chunk.ends_with("\r\n"));
+  chunk.resize(chunk.size() - 2);
+  return chunk;
+}
+
+TEST_CASE("ToyWs sends what is published to event stream subscribers",
+          "[library]") {
+  ServerFixture fixture;
+  toyws::EventStreamHandlers handlers;
+  handlers.onSubscribe = Welcome;
+  fixture.server.AddRoute("/events", handlers);
+  fixture.Start();
+
+  const int sock = Connect(fixture.port);
+  SendAll(sock, "GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  const auto head = ReceiveUntil(sock, "\r\n\r\n");
+  REQUIRE(head.starts_with("HTTP/1.1 200"));
+  REQUIRE(head.find("Content-Type: text/event-stream") != std::string::npos);
+  REQUIRE(head.find("Transfer-Encoding: chunked") != std::string::npos);
+  REQUIRE(ReceiveChunk(sock) == "event: hello\ndata: welcome\n\n");
+
+  // The subscription takes effect once the head is written, which the client
+  // can't tell. Published until one arrives.
+  bool published = false;
+  for (int tries = 0; tries < 100 && !published; ++tries) {
+    fixture.server.Publish("/events", "news", "update", "1");
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    char byte = 0;
+    published = recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 1;
+  }
+  REQUIRE(published);
+  REQUIRE(ReceiveChunk(sock) == "event: update\nid: 1\ndata: news\n\n");
+  close(sock);
+}
+
+/**
+ * @brief Header carrying the address of what the handlers of a test share
+ * with it, as handlers are plain functions. See StateOf().
+ */
+template <typename State>
+static auto StateHeader(State& state) -> std::string {
+  return "X-Test-State: " +
+         std::to_string(reinterpret_cast<std::uintptr_t>(&state)) + "\r\n";
+}
+
+template <typename State>
+static auto StateOf(const toyws::HttpRequest& request) -> State& {
+  const auto& value = request.Headers().at("X-Test-State");
+  std::uintptr_t address = 0;
+  std::from_chars(value.data(), value.data() + value.size(), address);
+  return *reinterpret_cast<State*>(address);
+}
+
+struct HeldResponse {
+  explicit HeldResponse(bool streamed) : stream{streamed} {}
+
+  bool stream;
+  std::latch held{1};        // Once the first request is held back
+  toyws::Responder respond;  // Touched on the ring's thread only
+  std::atomic<int> calls = 0;
+};
+
+static auto Respond(const HeldResponse& state,
+                    const toyws::Responder& respond) -> void {
+  toyws::HttpResponse response{toyws::HttpStatus::kOk,
+                               {{"Content-Type", "text/plain"}}};
+  if (state.stream) {
+    response.SetStream([](toyws::ChunkSink& sink) {
+      sink.Write("streamed");
+      return false;
+    });
+  } else {
+    response.SetBody("shared");
+  }
+  respond(std::move(response));
+}
+
+// Held back the first time, until /release
+static auto HoldFirst(const toyws::HttpRequest& request,
+                      const toyws::HandlerContext& context,
+                      toyws::HttpResponse& /*response*/) -> void {
+  auto& state = StateOf<HeldResponse>(request);
+  if (state.calls++ == 0) {
+    state.respond = context.Defer();
+    state.held.count_down();
+  } else {
+    Respond(state, context.Defer());
+  }
+}
+
+static auto Release(const toyws::HttpRequest& request,
+                    const toyws::HandlerContext& /*context*/,
+                    toyws::HttpResponse& response) -> void {
+  auto& state = StateOf<HeldResponse>(request);
+  Respond(state, std::exchange(state.respond, nullptr));
+  response = toyws::HttpResponse{toyws::HttpStatus::kOk, "released"};
+}
+
+TEST_CASE("ToyWs answers requests waiting for the same cached response",
+          "[library]") {
+  ServerFixture fixture;
+  toyws::RouteOptions cached;
+  cached.cache.enabled = true;
+  fixture.server.AddRoute("/cached", HoldFirst, cached);
+  fixture.server.AddRoute("/release", Release);
+  fixture.Start();
+
+  bool stream = false;
+  SECTION("With the response of the first") {
+    stream = false;
+  }
+  SECTION("Calling the handler again for a streamed response") {
+    stream = true;
+  }
+  HeldResponse state{stream};
+  const auto request = "GET /cached HTTP/1.1\r\nHost: localhost\r\n" +
+                       StateHeader(state) + "\r\n";
+
+  // The second arrives while the first waits for its response
+  const int first = Connect(fixture.port);
+  SendAll(first, request);
+  state.held.wait();
+  const int second = Connect(fixture.port);
+  SendAll(second, request);
+  for (int tries = 0; tries < 1000; ++tries) {
+    if (fixture.server.Metrics().Snapshot().cacheWaits == 1) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  REQUIRE(fixture.server.Metrics().Snapshot().cacheWaits == 1);
+
+  const int release = Connect(fixture.port);
+  SendAll(release, "GET /release HTTP/1.1\r\nHost: localhost\r\n" +
+                       StateHeader(state) + "\r\n");
+  REQUIRE(ReceiveUntil(release, "\r\n\r\n").starts_with("HTTP/1.1 200"));
+  close(release);
+
+  for (const int sock : {first, second}) {
+    const auto head = ReceiveUntil(sock, "\r\n\r\n");
+    REQUIRE(head.starts_with("HTTP/1.1 200"));
+    if (stream) {
+      REQUIRE(ReceiveChunk(sock) == "streamed");
+      REQUIRE(ReceiveChunk(sock).empty());
+    } else {
+      REQUIRE(ReceiveExactly(sock, 6) == "shared");
+    }
+    close(sock);
+  }
+  REQUIRE(state.calls == (stream ? 2 : 1));
+}
+
+struct GatedResponse {
+  std::latch entered{1};
+  std::latch release{1};
+  std::atomic<int> calls = 0;
+};
+
+// On a worker, until the test lets it respond
+static auto Gated(const toyws::HttpRequest& request,
+                  const toyws::HandlerContext& /*context*/,
+                  toyws::HttpResponse& response) -> void {
+  auto& state = StateOf<GatedResponse>(request);
+  if (state.calls++ == 0) {
+    state.entered.count_down();
+    state.release.wait();
+  }
+  response = toyws::HttpResponse{toyws::HttpStatus::kOk};
+  response.SetBody("gated");
+}
+
+TEST_CASE("ToyWs answers a request once whatever follows it", "[library]") {
+  ServerFixture fixture;
+  toyws::RouteOptions offloaded;
+  offloaded.offload = true;
+  fixture.server.AddRoute("/gated", Gated, offloaded);
+  fixture.Start();
+
+  GatedResponse state;
+  const int sock = Connect(fixture.port);
+  SendAll(sock, "GET /gated HTTP/1.1\r\nHost: localhost\r\n" +
+                    StateHeader(state) + "\r\n");
+  state.entered.wait();
+
+  // Sent while the response is on its way. Nothing reads it until the
+  // request is answered, by which time the connection is closed.
+  SECTION("Half-closed") {
+    shutdown(sock, SHUT_WR);
+  }
+  SECTION("Followed by another request") {
+    SendAll(sock, "GET /gated HTTP/1.1\r\nHost: localhost\r\n" +
+                      StateHeader(state) + "\r\n");
+  }
+  // Time for a ring that reads it anyway to do so, bounded as one that
+  // doesn't never does
+  const auto reads = fixture.server.Metrics().Snapshot().reads;
+  for (int tries = 0; tries < 100; ++tries) {
+    if (fixture.server.Metrics().Snapshot().reads > reads) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+  state.release.count_down();
 
-/*TEST_CASE("Name is toyws", "[library]") {
-  auto const exported = ExportedClass{};
-  REQUIRE(std::string("toyws") == exported.Name());
-}*/
+  const auto head = ReceiveUntil(sock, "\r\n\r\n");
+  REQUIRE(head.starts_with("HTTP/1.1 200"));
+  REQUIRE(ReceiveExactly(sock, 5) == "gated");
+  // Then closed, with nothing else sent
+  REQUIRE(ReceiveExactly(sock, 1).empty());
+  close(sock);
+  REQUIRE(state.calls == 1);
+}
@@ -0,0 +1,203 @@
+#include "toyws/websocket.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "toyws/http_headers_map.hpp"
+#include "toyws/http_request.hpp"
+#include "toyws/http_response.hpp"
+
+using Opcode = toyws::WebSocketOpcode;
+using CloseCode = toyws::WebSocketCloseCode;
+
+static constexpr toyws::WebSocketMask kMask{0x37, 0xfa, 0x21, 0x3d};
+
+// Everything reader yields from input, fed in pieces of at most step bytes
+static auto ReadAll(toyws::WebSocketReader& reader, std::string_view input,
+                    std::size_t step)
+    -> std::vector<std::pair<Opcode, std::string>> {
+  std::vector<std::pair<Opcode, std::string>> out;
+  while (!input.empty() && !reader.Failed()) {
+    auto piece = input.substr(0, step);
+    input.remove_prefix(piece.size());
+    while (auto message = reader.Next(piece)) {
+      out.emplace_back(message->opcode, std::string{message->payload});
+    }
+  }
+  return out;
+}
+
+TEST_CASE("WebSocket opening handshake", "[library]") {
+  // The example of RFC 6455, section 1.3
+  REQUIRE(toyws::WebSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ==") ==
+          "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+  toyws::HeadersMap headers{{"Host", "example.com"},
+                            {"Upgrade", "WebSocket"},
+                            {"Connection", "keep-alive, Upgrade"},
+                            {"Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ=="},
+                            {"Sec-WebSocket-Version", "13"}};
+
+  SECTION("Accepted") {
+    const toyws::HttpRequest request{toyws::HttpMethod::GET, "/chat",
+                                     headers};
+    REQUIRE(toyws::IsWebSocketUpgrade(request));
+    const auto response = toyws::AcceptWebSocket(request);
+    REQUIRE(response.Status() == toyws::HttpStatus::kSwitchingProtocols);
+    REQUIRE(response.Headers().at("Sec-WebSocket-Accept") ==
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+  }
+
+  SECTION("Another version") {
+    headers.erase("Sec-WebSocket-Version");
+    headers.emplace("Sec-WebSocket-Version", "8");
+    const toyws::HttpRequest request{toyws::HttpMethod::GET, "/chat",
+                                     headers};
+    const auto response = toyws::AcceptWebSocket(request);
+    REQUIRE(response.Status() == toyws::HttpStatus::kUpgradeRequired);
+    REQUIRE(response.Headers().at("Sec-WebSocket-Version") == "13");
+  }
+
+  SECTION("Not an upgrade") {
+    const toyws::HttpRequest request{toyws::HttpMethod::GET, "/chat"};
+    REQUIRE_FALSE(toyws::IsWebSocketUpgrade(request));
+    REQUIRE(toyws::AcceptWebSocket(request).Status() ==
+            toyws::HttpStatus::kUpgradeRequired);
+  }
+
+  SECTION("Without a key") {
+    headers.erase("Sec-WebSocket-Key");
+    const toyws::HttpRequest request{toyws::HttpMethod::GET, "/chat",
+                                     headers};
+    REQUIRE(toyws::AcceptWebSocket(request).Status() ==
+            toyws::HttpStatus::kBadRequest);
+  }
+}
+
+TEST_CASE("WebSocket payloads are unmasked at any size & offset",
+          "[library]") {
+  std::string payload;
+  for (std::size_t i = 0; i < 300; ++i) {
+    payload += static_cast<char>(i * 7);
+  }
+
+  for (std::size_t offset = 0; offset < 4; ++offset) {
+    for (std::size_t size : {0U, 1U, 3U, 15U, 16U, 17U, 31U, 64U, 100U, 300U}) {
+      std::string expected(size, '\0');
+      for (std::size_t i = 0; i < size; ++i) {
+        expected[i] = static_cast<char>(
+            static_cast<unsigned char>(payload[i]) ^ kMask[(offset + i) % 4]);
+      }
+      std::string out(size, '\0');
+      toyws::UnmaskPayload(out.data(), payload.data(), size, kMask, offset);
+      REQUIRE(out == expected);
+
+      // In place, & back again
+      toyws::UnmaskPayload(out.data(), out.data(), size, kMask, offset);
+      REQUIRE(out == payload.substr(0, size));
+    }
+  }
+}
+
+TEST_CASE("WebSocket frames are encoded with the shortest length",
+          "[library]") {
+  const auto small = toyws::EncodeFrame(Opcode::kText, std::string(125, 'a'));
+  REQUIRE(small.size() == 2 + 125);
+  REQUIRE(static_cast<unsigned char>(small[0]) == 0x81);
+  REQUIRE(small[1] == 125);
+
+  const auto medium = toyws::EncodeFrame(Opcode::kBinary,
+                                         std::string(126, 'b'), false);
+  REQUIRE(medium.size() == 4 + 126);
+  REQUIRE(medium[0] == 0x02);
+  REQUIRE(medium[1] == 126);
+
+  const auto large = toyws::EncodeFrame(Opcode::kBinary,
+                                        std::string(65536, 'c'));
+  REQUIRE(large.size() == 10 + 65536);
+  REQUIRE(large[1] == 127);
+  REQUIRE(large.substr(2, 8) == std::string_view{"\0\0\0\0\0\1\0\0", 8});
+
+  const auto close = toyws::EncodeCloseFrame(CloseCode::kGoingAway, "bye");
+  REQUIRE(toyws::CloseCodeOf(std::string_view{close}.substr(2)) ==
+          CloseCode::kGoingAway);
+  REQUIRE(toyws::EncodeCloseFrame(CloseCode::kNoStatus).size() == 2);
+}
+
+TEST_CASE("WebSocketReader reassembles fragmented messages", "[library]") {
+  // A text message in three fragments, with a ping in between
+  std::string input;
+  input += toyws::EncodeMaskedFrame(Opcode::kText, "Hello, ", kMask, false);
+  input += toyws::EncodeMaskedFrame(Opcode::kPing, "are you there?", kMask);
+  input += toyws::EncodeMaskedFrame(Opcode::kContinuation,
+                                    std::string(70000, 'w'), kMask, false);
+  input += toyws::EncodeMaskedFrame(Opcode::kContinuation, "!", kMask);
+  input += toyws::EncodeMaskedFrame(Opcode::kBinary, "", kMask);
+
+  // Whole, & a byte at a time
+  for (std::size_t step : {input.size(), std::size_t{7}, std::size_t{1}}) {
+    toyws::WebSocketReader reader;
+    const auto messages = ReadAll(reader, input, step);
+    REQUIRE_FALSE(reader.Failed());
+    REQUIRE(messages.size() == 3);
+    REQUIRE(messages[0].first == Opcode::kPing);
+    REQUIRE(messages[0].second == "are you there?");
+    REQUIRE(messages[1].first == Opcode::kText);
+    REQUIRE(messages[1].second == "Hello, " + std::string(70000, 'w') + "!");
+    REQUIRE(messages[2].first == Opcode::kBinary);
+    REQUIRE(messages[2].second.empty());
+  }
+}
+
+TEST_CASE("WebSocketReader fails on protocol errors", "[library]") {
+  toyws::WebSocketReader reader{1024};
+
+  SECTION("Unmasked frame") {
+    ReadAll(reader, toyws::EncodeFrame(Opcode::kText, "hi"), 64);
+    REQUIRE(reader.ErrorCode() == CloseCode::kProtocolError);
+  }
+
+  SECTION("Continuation without a message") {
+    ReadAll(reader,
+            toyws::EncodeMaskedFrame(Opcode::kContinuation, "hi", kMask), 64);
+    REQUIRE(reader.ErrorCode() == CloseCode::kProtocolError);
+  }
+
+  SECTION("Fragmented control frame") {
+    ReadAll(reader,
+            toyws::EncodeMaskedFrame(Opcode::kPing, "hi", kMask, false), 64);
+    REQUIRE(reader.ErrorCode() == CloseCode::kProtocolError);
+  }
+
+  SECTION("Text that is not UTF-8") {
+    ReadAll(reader, toyws::EncodeMaskedFrame(Opcode::kText, "\xc3(", kMask),
+            64);
+    REQUIRE(reader.ErrorCode() == CloseCode::kInvalidPayload);
+  }
+
+  SECTION("Message too big, across fragments") {
+    std::string input;
+    input += toyws::EncodeMaskedFrame(Opcode::kBinary, std::string(1000, 'x'),
+                                      kMask, false);
+    input += toyws::EncodeMaskedFrame(Opcode::kContinuation,
+                                      std::string(1000, 'x'), kMask);
+    ReadAll(reader, input, 64);
+    REQUIRE(reader.ErrorCode() == CloseCode::kMessageTooBig);
+  }
+
+  SECTION("Close with an invalid code") {
+    ReadAll(reader,
+            toyws::EncodeMaskedFrame(Opcode::kClose, "\x03\xed", kMask), 64);
+    REQUIRE(reader.ErrorCode() == CloseCode::kProtocolError);
+  }
+
+  REQUIRE(reader.Failed());
+  // Consumes nothing further
+  std::string_view more = "more";
+  REQUIRE_FALSE(reader.Next(more));
+  REQUIRE(more == "more");
+}
@@ -0,0 +1,41 @@
+#include "toyws/worker_pool.hpp"
+
+#include <atomic>
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <thread>
+
+TEST_CASE("WorkerPool runs every task before it is gone", "[library]") {
+  constexpr int kTasks = 1000;
+  std::atomic<int> ran = 0;
+  {
+    toyws::WorkerPool pool{4};
+    REQUIRE(pool.Size() == 4);
+    for (int i = 0; i < kTasks; ++i) {
+      pool.Submit([&] { ran.fetch_add(1); });
+    }
+  }
+
+  REQUIRE(ran.load() == kTasks);
+}
+
+TEST_CASE("WorkerPool steals from a busy worker", "[library]") {
+  std::atomic<bool> stolen = false;
+  bool waited = false;
+  {
+    toyws::WorkerPool pool{2};
+    pool.Submit([&] {
+      // Queued behind this task, on the same worker, so only another worker
+      // can run it while this one waits
+      pool.Submit([&] { stolen = true; });
+      const auto deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds{5};
+      while (!stolen && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      }
+      waited = stolen;
+    });
+  }
+
+  REQUIRE(waited);
+}